@@ -0,0 +1,198 @@
+#! /bin/sh
+# Run the GNU M4 benchmarks.
+# Copyright (C) 2010 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Usage: bench.sh M4 [NAME]...
+#
+# Run each benchmark NAME, or all of them, with the program M4, and
+# print one tab-separated line of results per benchmark, after a
+# header line starting with `#':
+#
+#   name  wall_s  max_rss_kb  units  unit  units_per_s
+#
+# The workloads are synthetic: most are the .m4 files next to this
+# script, sized with -D, and the others are generated in a scratch
+# directory.  Set BENCH_SCALE to a positive integer to multiply the
+# amount of work done by each benchmark.  The peak resident set size
+# is measured with GNU time, found as BENCH_TIME or /usr/bin/time, and
+# is shown as `-' if that is not available.  The exit status is 1 if
+# any benchmark failed.
+
+benchmarks='m4sugar recursion forloop regex translit divert include
+frozen esyscmd'
+
+me=`echo "$0" | sed 's,.*/,,'`
+case $0 in
+  */*) srcdir=`echo "$0" | sed 's,/[^/]*$,,'` ;;
+  *) srcdir=. ;;
+esac
+
+if test $# -lt 1; then
+  echo "usage: $me M4 [NAME]..." >&2
+  exit 1
+fi
+M4=$1
+shift
+test $# -gt 0 && benchmarks=$*
+
+scale=${BENCH_SCALE-1}
+case $scale in
+  '' | *[!0-9]* | 0) echo "$me: bad BENCH_SCALE: $scale" >&2; exit 1 ;;
+esac
+
+gnu_time=false
+: ${BENCH_TIME=/usr/bin/time}
+if "$BENCH_TIME" -f %M -o /dev/null true >/dev/null 2>&1; then
+  gnu_time=:
+fi
+
+work=${TMPDIR-/tmp}/m4-bench.$$
+trap 'rm -rf "$work"' 0
+trap 'exit 1' 1 2 13 15
+mkdir "$work" || exit 1
+status=0
+
+# now
+# Print the current time in seconds, with a fraction if date has %N.
+now ()
+{
+  date +%s.%N | sed 's/\.N$/.0/'
+}
+
+# run NAME UNITS UNIT COMMAND...
+# Run COMMAND, with its output discarded, as the benchmark NAME that
+# does UNITS units of work, and print its line of results.
+run ()
+{
+  name=$1 units=$2 unit=$3
+  shift 3
+  if $gnu_time; then
+    "$BENCH_TIME" -f '%e %M' -o "$work/time" "$@" >/dev/null 2>"$work/err"
+    result=$?
+    times=`tail -n 1 "$work/time"`
+  else
+    start=`now`
+    "$@" >/dev/null 2>"$work/err"
+    result=$?
+    times="`now` $start -"
+    times=`echo "$times" | awk '{ printf "%.3f %s", $1 - $2, $3 }'`
+  fi
+  if test $result != 0; then
+    echo "$me: $name failed:" >&2
+    cat "$work/err" >&2
+    status=1
+    return
+  fi
+  echo "$name $times $units $unit" | awk '{
+    rate = $2 > 0 ? sprintf ("%.0f", $4 / $2) : "-"
+    printf "%s\t%s\t%s\t%s\t%s\t%s\n", $1, $2, $3, $4, $5, rate }'
+}
+
+# m4bench NAME UNITS UNIT OPTION...
+# Run the workload NAME.m4 of the source directory as benchmark NAME.
+m4bench ()
+{
+  name=$1 units=$2 unit=$3
+  shift 3
+  run $name $units $unit "$M4" -I "$srcdir" "$@" "$srcdir/$name.m4"
+}
+
+# gen_include FANOUT DEPTH
+# Write a tree of include files to $work/inc, where each file defines a
+# macro, produces some text, and includes FANOUT files one level deeper,
+# down to DEPTH levels below the root file n0.m4.  Print the number of
+# files.
+gen_include ()
+{
+  mkdir "$work/inc" || exit 1
+  awk -v fanout=$1 -v depth=$2 -v dir="$work/inc" -v q="'" 'BEGIN {
+    files = 1
+    for (i = 0; i < depth; i++)
+      files = files * fanout + 1
+    for (k = 0; k < files; k++) {
+      f = dir "/n" k ".m4"
+      print "define(`n" k q ", `node " k q ")dnl" > f
+      for (j = 0; j < 20; j++)
+        print "text line " j " of n" k > f
+      for (c = k * fanout + 1; c <= k * fanout + fanout && c < files; c++)
+        print "include(`n" c ".m4" q ")dnl" > f
+      close (f)
+    }
+    print files
+  }'
+}
+
+echo "# name	wall_s	max_rss_kb	units	unit	units_per_s"
+for bench in $benchmarks; do
+  case $bench in
+    m4sugar)
+      n=`expr 5000 \* $scale`
+      m4bench $bench $n macros -DN=$n ;;
+    recursion)
+      reps=`expr 100 \* $scale`
+      m4bench $bench `expr $reps \* 2000` levels -L0 -DDEPTH=2000 \
+        -DREPS=$reps ;;
+    forloop)
+      n=`expr 1000 \* $scale`
+      m4bench $bench `expr $n \* 50` items -DN=$n ;;
+    regex)
+      passes=`expr 2 \* $scale`
+      m4bench $bench `expr $passes \* 4096` lines -DDOUBLE=12 \
+        -DPASSES=$passes ;;
+    translit)
+      passes=`expr 16 \* $scale`
+      m4bench $bench `expr $passes \* 2 \* 37 \* 32768` bytes \
+        -DDOUBLE=15 -DPASSES=$passes ;;
+    divert)
+      rounds=`expr 10 \* $scale`
+      m4bench $bench `expr $rounds \* 500 \* 4096` bytes -DDIVS=500 \
+        -DROUNDS=$rounds ;;
+    include)
+      files=`gen_include 4 5`
+      reps=`expr 5 \* $scale`
+      i=0
+      while test $i -lt $reps; do
+        echo "include(\`n0.m4')dnl"
+        i=`expr $i + 1`
+      done >"$work/include.m4"
+      run $bench `expr $files \* $reps` files \
+        "$M4" -I "$work/inc" "$work/include.m4" ;;
+    frozen)
+      if "$M4" -I "$srcdir" -DDEFS=5000 -F "$work/frozen.m4f" \
+          "$srcdir/frozen.m4" >/dev/null; then
+        reps=`expr 100 \* $scale`
+        run $bench $reps reloads ${SHELL-/bin/sh} -c '
+          i=0
+          while test $i -lt $2; do
+            "$0" -R "$1" </dev/null || exit 1
+            i=`expr $i + 1`
+          done' "$M4" "$work/frozen.m4f" $reps
+      else
+        echo "$me: $bench failed to freeze" >&2
+        status=1
+      fi ;;
+    esyscmd)
+      n=`expr 200 \* $scale`
+      m4bench $bench $n commands -DN=$n ;;
+    *)
+      echo "$me: unknown benchmark: $bench" >&2
+      status=1 ;;
+  esac
+done
+
+exit $status
@@ -0,0 +1,24 @@
+divert(`-1')
+# Helpers shared by the benchmark workloads, taken from the examples
+# of the manual.  Each workload is sized by macros defined with -D.
+
+# forloop(var, from, to, stmt) - expand STMT with VAR set to each
+#   value from FROM to TO
+define(`forloop', `ifelse(eval(`($2) <= ($3)'), `1',
+  `pushdef(`$1')_$0(`$1', eval(`$2'), eval(`$3'), `$4')popdef(`$1')')')
+define(`_forloop',
+  `define(`$1', `$2')$4`'ifelse(`$2', `$3', `',
+    `$0(`$1', incr(`$2'), `$3', `$4')')')
+
+# foreach(var, `(item_1, ..., item_n)', stmt) - expand STMT with VAR
+#   set to each item of the parenthesized list
+define(`foreach', `pushdef(`$1')_$0(`$1', `$2', `$3')popdef(`$1')')
+define(`_arg1', `$1')
+define(`_foreach', `ifelse(`$2', `()', `',
+  `define(`$1', _arg1$2)$3`'$0(`$1', (shift$2), `$3')')')
+
+# double(name, count) - append NAME to itself COUNT times, so that it
+#   grows by a factor of 2**COUNT without quadratic copying
+define(`double', `ifelse(`$2', `0', `',
+  `define(`$1', defn(`$1')defn(`$1'))$0(`$1', decr(`$2'))')')
+divert`'dnl
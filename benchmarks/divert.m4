@@ -0,0 +1,11 @@
+include(`common.m4')dnl
+divert(`-1')
+# Diversions: ROUNDS rounds writing a 4 KiB chunk to each of DIVS
+# diversions, which is more than fits in memory, so that most of them
+# spill to temporary files before being undiverted at the end.
+define(`chunk', `0123456789abcdefghijklmnopqrstu
+')
+double(`chunk', `7')
+forloop(`round', `1', ROUNDS,
+  `forloop(`div', `1', DIVS, `divert(div)defn(`chunk')')')
+divert`'dnl
@@ -0,0 +1,5 @@
+include(`common.m4')dnl
+divert(`-1')
+# Shell commands: N calls to esyscmd, each starting a shell.
+divert`'dnl
+forloop(`i', `1', N, `esyscmd(`echo 'i)')dnl
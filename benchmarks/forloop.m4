@@ -0,0 +1,10 @@
+include(`common.m4')dnl
+divert(`-1')
+# Iteration: a forloop of N rounds, each walking a list of 50 items
+# with foreach.
+define(`list', `(1')
+forloop(`i', `2', `50', `define(`list', defn(`list')`,'i)')
+define(`list', defn(`list')`)')
+divert`'dnl
+forloop(`round', `1', N, `foreach(`item', defn(`list'), `item ')
+')dnl
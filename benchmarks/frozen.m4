@@ -0,0 +1,6 @@
+include(`common.m4')dnl
+divert(`-1')
+# Frozen state: DEFS definitions to freeze, then reload many times.
+forloop(`i', `1', DEFS,
+  `define(`def'i, `the value of definition 'i` with $1 and $2')')
+divert`'dnl
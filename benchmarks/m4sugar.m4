@@ -0,0 +1,45 @@
+include(`common.m4')dnl
+divert(`-1')
+# Autoconf-like expansion: a cut-down m4sugar with [ ] quotes, N
+# macros defined through AC_DEFUN, and calls to each of them that
+# require shared macros into a diversion, join lists, and loop with
+# m4_foreach, much as configure scripts are produced.  The helpers of
+# common.m4 rely on the default quotes, so m4_for replaces forloop.
+changequote([, ])
+
+define([m4_define], [define([$1], [$2])])
+define([m4_for],
+  [pushdef([$1], [$2])_$0([$1], [$3], [$4])popdef([$1])])
+define([_m4_for],
+  [$3[]ifelse($1, [$2], [], [define([$1], incr($1))$0([$1], [$2], [$3])])])
+define([m4_shift2], [shift(shift($@))])
+define([m4_shift3], [shift(shift(shift($@)))])
+define([m4_ifval], [ifelse([$1], [], [$3], [$2])])
+define([m4_default], [m4_ifval([$1], [$1], [$2])])
+define([m4_divert_push], [pushdef([_m4_divert], divnum)divert([$1])])
+define([m4_divert_pop], [divert(_m4_divert)popdef([_m4_divert])])
+define([m4_join],
+  [ifelse([$#], [1], [], [$#], [2], [[$2]],
+    [[$2][$1]$0([$1], m4_shift2($@))])])
+define([m4_foreach], [pushdef([$1])_$0([$1], [$3], $2)popdef([$1])])
+define([_m4_foreach],
+  [ifelse([$#], [2], [], [$#], [3], [define([$1], [$3])$2],
+    [define([$1], [$3])$2[]$0([$1], [$2], m4_shift3($@))])])
+
+define([AC_DEFUN], [m4_define([$1], [$2])])
+define([AC_REQUIRE],
+  [ifdef([_ac_done_$1], [],
+    [define([_ac_done_$1])m4_divert_push([1])$1[]m4_divert_pop()])])
+
+m4_for([i], [0], [15], [AC_DEFUN([COMMON_]i, [common check ]i[
+])])
+define([_bench_defun], [AC_DEFUN([MAC_$1],
+[AC_REQUIRE([COMMON_]]eval([$1 % 16])[)dnl
+if test "x$[]ac_cv_mac_$1" = xyes; then
+  echo m4_join([, ], [one], [two], m4_default([], [three]))
+m4_foreach([opt], [[a], [b], [c], [d]], [  opt_$1=opt
+])fi
+])])
+m4_for([i], [1], N, [_bench_defun(i)])
+divert[]dnl
+m4_for([i], [1], N, [indir([MAC_]i)])dnl
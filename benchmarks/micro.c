@@ -0,0 +1,514 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Microbenchmarks of the components of libm4, each measured in
+   isolation within a single process, so that changes to a data
+   structure can be judged without the noise of whole runs of m4.
+
+   Usage: m4-micro [-I DIR]... [GROUP]...
+
+   Run each GROUP of benchmarks, or all of them, and print one
+   tab-separated line of results per benchmark, after a header line
+   starting with `#'.  The groups are:
+
+   hash    insert, lookup and iterate m4_hash tables of several sizes,
+           with sequential, random and long common-prefix keys
+   token   read fixed corpora with m4__next_token, under the default
+           quotes, bracket quotes, and multi-character delimiters
+   output  write through m4_output_text to diversion 0 and to a
+           diversion in memory, and switch between diversions
+   regex   call regexp with a working set of patterns below and above
+           the size of the cache of compiled expressions
+   args    collect the arguments of macro calls of several widths,
+           directly and through $@
+
+   The regex and args groups expand text with m4_expand_string, since
+   regexp_compile and its cache, kept in the module data of each
+   context, are private to the gnu module, and argument collection is
+   internal to macro.c.  They need the m4 and gnu modules, which are
+   found in the directories given with -I when they are not
+   preloaded.  */
+
+#include <config.h>
+
+#include "m4private.h"
+
+#include "gethrxtime.h"
+#include "xvasprintf.h"
+
+/* A benchmark group.  */
+typedef struct
+{
+  const char *name;             /* Name on the command line.  */
+  void (*func) (m4 *);          /* Run the benchmarks of the group.  */
+} micro_group;
+
+static void     micro_hash      (m4 *);
+static void     micro_token     (m4 *);
+static void     micro_output    (m4 *);
+static void     micro_regex     (m4 *);
+static void     micro_args      (m4 *);
+
+static const micro_group groups[] =
+{
+  { "hash", micro_hash },
+  { "token", micro_token },
+  { "output", micro_output },
+  { "regex", micro_regex },
+  { "args", micro_args },
+  { NULL, NULL }
+};
+
+/* Print the results of benchmark NAME, which did UNITS units of work
+   of kind UNIT since START.  */
+static void
+report (const char *name, xtime_t start, size_t units, const char *unit)
+{
+  double seconds = (gethrxtime () - start) / 1e9;
+
+  printf ("%s\t%.6f\t%zu\t%s\t%.0f\n", name, seconds, units, unit,
+          seconds > 0 ? units / seconds : 0.0);
+  fflush (stdout);
+}
+
+/* Return the next number of a cheap pseudo-random sequence kept in
+   *STATE, which is good enough to scatter hash keys.  */
+static size_t
+next_random (size_t *state)
+{
+  *state = *state * 1103515245 + 12345;
+  return *state >> 8;
+}
+
+/* Expand the NUL-terminated TEXT in CONTEXT, discarding the output,
+   and exit if that fails.  */
+static void
+expand (m4 *context, const char *text)
+{
+  char *out;
+  size_t len;
+
+  if (!m4_expand_string (context, text, strlen (text), &out, &len))
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("expansion failed"));
+  free (out);
+}
+
+
+
+/* --- HASH TABLES --- */
+
+/* Key distributions for micro_hash, as formats of one number.  */
+static const char *const hash_formats[] = { "seq", "rand", "prefix" };
+
+/* Fill KEYS with COUNT distinct keys of the distribution DIST, using
+   SALT to make a different set for each value.  */
+static void
+hash_keys (m4_string *keys, size_t count, int dist, size_t salt)
+{
+  size_t state = salt;
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    {
+      switch (dist)
+        {
+        case 0:
+          keys[i].str = xasprintf ("name%zu_%zu", salt, i);
+          break;
+        case 1:
+          keys[i].str = xasprintf ("%zx_%zu", next_random (&state), i);
+          break;
+        default:
+          keys[i].str = xasprintf ("m4_a_rather_long_common_prefix_%zu_%zu",
+                                   salt, i);
+          break;
+        }
+      keys[i].len = strlen (keys[i].str);
+    }
+}
+
+/* Time inserting, looking up, and iterating hash tables of several
+   sizes and key distributions.  */
+static void
+micro_hash (m4 *context M4_GNUC_UNUSED)
+{
+  static const size_t sizes[] = { 1000, 10000, 100000 };
+  size_t s;
+  int dist;
+
+  for (s = 0; s < sizeof sizes / sizeof *sizes; s++)
+    for (dist = 0; dist < 3; dist++)
+      {
+        size_t count = sizes[s];
+        size_t rounds = 1000000 / count;
+        m4_string *keys = (m4_string *) xnmalloc (count, sizeof *keys);
+        m4_string *misses = (m4_string *) xnmalloc (count, sizeof *misses);
+        m4_hash_iterator *place = NULL;
+        m4_hash *hash;
+        char name[64];
+        xtime_t start;
+        size_t found = 0;
+        size_t i;
+        size_t r;
+
+        hash_keys (keys, count, dist, 1);
+        hash_keys (misses, count, dist, 2);
+
+        start = gethrxtime ();
+        hash = m4_hash_new (0, m4_hash_string_hash, m4_hash_string_cmp);
+        for (i = 0; i < count; i++)
+          m4_hash_insert (hash, &keys[i], &keys[i]);
+        sprintf (name, "hash.insert.%s.%zu", hash_formats[dist], count);
+        report (name, start, count, "keys");
+
+        start = gethrxtime ();
+        for (r = 0; r < rounds; r++)
+          for (i = 0; i < count; i++)
+            found += m4_hash_lookup (hash, &keys[i]) != NULL;
+        sprintf (name, "hash.hit.%s.%zu", hash_formats[dist], count);
+        report (name, start, rounds * count, "lookups");
+
+        start = gethrxtime ();
+        for (r = 0; r < rounds; r++)
+          for (i = 0; i < count; i++)
+            found += m4_hash_lookup (hash, &misses[i]) != NULL;
+        sprintf (name, "hash.miss.%s.%zu", hash_formats[dist], count);
+        report (name, start, rounds * count, "lookups");
+        assert (found == rounds * count);
+
+        start = gethrxtime ();
+        for (r = 0; r < rounds; r++)
+          while ((place = m4_get_hash_iterator_next (hash, place)))
+            found++;
+        sprintf (name, "hash.iterate.%s.%zu", hash_formats[dist], count);
+        report (name, start, rounds * count, "entries");
+
+        m4_hash_delete (hash);
+        for (i = 0; i < count; i++)
+          {
+            free (keys[i].str);
+            free (misses[i].str);
+          }
+        free (keys);
+        free (misses);
+      }
+}
+
+
+
+/* --- TOKENIZER --- */
+
+/* Lines of the corpora for micro_token, where \1 and \2 stand for the
+   quotes, and \3 and \4 for the comment delimiters.  */
+static const struct
+{
+  const char *name;
+  const char *line;
+} token_corpora[] =
+{
+  { "prose", "The quick brown fox jumps over the lazy dog, 42 times.\n" },
+  { "quoted", "\1quoted text\2 and \1nested \1inner\2 quotes\2 here\n" },
+  { "calls", "foo(bar, \1baz\2, 12)dnl(x, y)\n" },
+  { "comments", "\3 a comment with words, \1quotes\2 and (parens)\4\n" },
+};
+
+/* Syntax tables for micro_token, as the delimiters that replace \1,
+   \2, \3 and \4 in the corpora.  */
+static const struct
+{
+  const char *name;
+  const char *delims[4];
+} token_syntaxes[] =
+{
+  { "default", { "`", "'", "#", "\n" } },
+  { "brackets", { "[", "]", "#", "\n" } },
+  { "multi", { "<<", ">>", "/*", "*/" } },
+};
+
+/* Time reading about 4 MiB of each corpus with each syntax table.  */
+static void
+micro_token (m4 *context)
+{
+  m4_syntax_table *syntax = m4_get_syntax_table (context);
+  size_t c;
+  size_t s;
+
+  m4__input_reset (context);
+  for (s = 0; s < sizeof token_syntaxes / sizeof *token_syntaxes; s++)
+    {
+      const char *const *delims = token_syntaxes[s].delims;
+
+      m4_set_quotes (syntax, delims[0], strlen (delims[0]),
+                     delims[1], strlen (delims[1]));
+      m4_set_comment (syntax, delims[2], strlen (delims[2]),
+                      delims[3], strlen (delims[3]));
+      for (c = 0; c < sizeof token_corpora / sizeof *token_corpora; c++)
+        {
+          m4_obstack corpus;
+          m4_obstack *obs;
+          m4_symbol_value token;
+          const char *p;
+          char *text;
+          size_t len;
+          char name[64];
+          xtime_t start;
+
+          obstack_init (&corpus);
+          for (p = token_corpora[c].line; *p; p++)
+            if ('\1' <= *p && *p <= '\4')
+              obstack_grow (&corpus, delims[*p - '\1'],
+                            strlen (delims[*p - '\1']));
+            else
+              obstack_1grow (&corpus, *p);
+          len = obstack_object_size (&corpus);
+          text = (char *) obstack_finish (&corpus);
+
+          obs = m4_push_string_init (context, "", 0);
+          while (obstack_object_size (obs) < 4 * 1024 * 1024)
+            obstack_grow (obs, text, len);
+          len = obstack_object_size (obs);
+          m4_push_string_finish (context);
+
+          start = gethrxtime ();
+          while (m4__next_token (context, &token, NULL, NULL, false, NULL)
+                 != M4_TOKEN_EOF)
+            continue;
+          sprintf (name, "token.%s.%s", token_syntaxes[s].name,
+                   token_corpora[c].name);
+          report (name, start, len, "bytes");
+          obstack_free (&corpus, NULL);
+        }
+    }
+  m4_set_quotes (syntax, "`", 1, "'", 1);
+  m4_set_comment (syntax, "#", 1, "\n", 1);
+}
+
+
+
+/* --- OUTPUT --- */
+
+/* Time writing text to diversion 0, to a diversion held in memory,
+   and while switching between diversions.  */
+static void
+micro_output (m4 *context)
+{
+  static const char chunk[] =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-\n";
+  static const size_t widths[] = { 2, 16, 256 };
+  size_t len = sizeof chunk - 1;
+  size_t count;
+  size_t i;
+  size_t w;
+  FILE *null = fopen ("/dev/null", "w");
+  FILE *previous;
+  xtime_t start;
+  char name[64];
+
+  if (!null)
+    m4_error (context, EXIT_FAILURE, errno, NULL, _("cannot open %s"),
+              quotearg_style (locale_quoting_style, "/dev/null"));
+  previous = m4_output_redirect (context, null);
+
+  m4_make_diversion (context, 0);
+  count = 64 * 1024 * 1024 / len;
+  start = gethrxtime ();
+  for (i = 0; i < count; i++)
+    m4_output_text (context, chunk, len);
+  report ("output.div0", start, count * len, "bytes");
+
+  /* Stay within the memory allowed to diversions, to measure the
+     buffers rather than the temporary files.  */
+  count = 256 * 1024 / len;
+  start = gethrxtime ();
+  for (w = 0; w < 64; w++)
+    {
+      m4_make_diversion (context, 1);
+      for (i = 0; i < count; i++)
+        m4_output_text (context, chunk, len);
+      m4_make_diversion (context, 0);
+      m4_insert_diversion (context, 1);
+    }
+  report ("output.memory", start, 64 * count * len, "bytes");
+
+  for (w = 0; w < sizeof widths / sizeof *widths; w++)
+    {
+      count = 1000000;
+      start = gethrxtime ();
+      for (i = 0; i < count; i++)
+        {
+          m4_make_diversion (context, 1 + i % widths[w]);
+          m4_divert_text (context, NULL, chunk, 8, 0);
+        }
+      m4_make_diversion (context, 0);
+      m4_undivert_all (context);
+      sprintf (name, "output.switch.%zu", widths[w]);
+      report (name, start, count, "switches");
+    }
+
+  m4_output_redirect (context, previous);
+  fclose (null);
+}
+
+
+
+/* --- REGULAR EXPRESSIONS --- */
+
+/* Time regexp calls cycling through working sets of patterns of
+   several sizes, around the size of the cache of compiled
+   expressions.  */
+static void
+micro_regex (m4 *context)
+{
+  static const size_t sets[] = { 1, 8, 16, 17, 64 };
+  size_t count = 20000;
+  size_t s;
+  size_t i;
+
+  for (s = 0; s < sizeof sets / sizeof *sets; s++)
+    {
+      m4_obstack text;
+      xtime_t start;
+      char name[64];
+
+      obstack_init (&text);
+      for (i = 0; i < count; i++)
+        {
+          char buf[128];
+          sprintf (buf, "regexp(`abc123def', `[a-z]+\\([0-9]+\\)\\|q%zu')",
+                   i % sets[s]);
+          obstack_grow (&text, buf, strlen (buf));
+        }
+      obstack_1grow (&text, '\0');
+
+      start = gethrxtime ();
+      expand (context, (char *) obstack_finish (&text));
+      sprintf (name, "regex.patterns.%zu", sets[s]);
+      report (name, start, count, "calls");
+      obstack_free (&text, NULL);
+    }
+}
+
+
+
+/* --- ARGUMENT COLLECTION --- */
+
+/* Time collecting the arguments of calls to a macro with several
+   numbers of arguments, both directly and when passed on through $@,
+   which the engine forwards by reference.  */
+static void
+micro_args (m4 *context)
+{
+  static const size_t widths[] = { 1, 8, 64 };
+  size_t w;
+  size_t i;
+  size_t j;
+
+  expand (context, "define(`f', `')define(`g', `f($@)')");
+  for (w = 0; w < sizeof widths / sizeof *widths; w++)
+    {
+      const char *macro;
+      size_t count = 1000000 / widths[w];
+
+      for (macro = "f"; macro; macro = *macro == 'f' ? "g" : NULL)
+        {
+          m4_obstack text;
+          xtime_t start;
+          char name[64];
+
+          obstack_init (&text);
+          for (i = 0; i < count; i++)
+            {
+              obstack_grow (&text, macro, 1);
+              obstack_1grow (&text, '(');
+              for (j = 0; j < widths[w]; j++)
+                obstack_grow (&text, j ? ", arg" : "arg", j ? 5 : 3);
+              obstack_grow (&text, ")\n", 2);
+            }
+          obstack_1grow (&text, '\0');
+
+          start = gethrxtime ();
+          expand (context, (char *) obstack_finish (&text));
+          sprintf (name, "args.%s.%zu", *macro == 'f' ? "direct" : "ref",
+                   widths[w]);
+          report (name, start, count * widths[w], "args");
+          obstack_free (&text, NULL);
+        }
+    }
+}
+
+
+
+int
+main (int argc, char *const *argv)
+{
+  m4 *context;
+  bool expands = false;
+  int first;
+  int i;
+  const micro_group *group;
+
+  m4_set_program_name (argv[0]);
+  LTDL_SET_PRELOADED_SYMBOLS ();
+  context = m4_create ();
+  m4__module_init (context);
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] == 'I'; i++)
+    {
+      if (argv[i][2])
+        m4_add_include_directory (context, argv[i] + 2, false);
+      else if (++i < argc)
+        m4_add_include_directory (context, argv[i], false);
+    }
+  first = i;
+  for (; i < argc; i++)
+    {
+      for (group = groups; group->name; group++)
+        if (STREQ (argv[i], group->name))
+          break;
+      if (!group->name)
+        m4_error (context, EXIT_FAILURE, 0, NULL,
+                  _("unknown benchmark group: %s"),
+                  quotearg_style (locale_quoting_style, argv[i]));
+    }
+
+  m4_input_init (context);
+  m4_output_init (context);
+  fputs ("# name\twall_s\tunits\tunit\tunits_per_s\n", stdout);
+  for (group = groups; group->name; group++)
+    {
+      bool selected = first == argc;
+
+      for (i = first; i < argc && !selected; i++)
+        selected = STREQ (argv[i], group->name);
+      if (!selected)
+        continue;
+      if (group->func == micro_regex || group->func == micro_args)
+        {
+          if (!expands)
+            {
+              m4_module_load (context, "m4", NULL);
+              m4_module_load (context, "gnu", NULL);
+              expands = true;
+            }
+        }
+      group->func (context);
+    }
+
+  return m4_get_exit_status (context);
+}
@@ -0,0 +1,8 @@
+include(`common.m4')dnl
+divert(`-1')
+# Deep recursion: each call of nest happens while collecting the
+# arguments of incr, so the expansion level reaches DEPTH, REPS times.
+define(`nest', `ifelse(`$1', `0', `0', `incr(nest(decr(`$1')))')')
+divert`'dnl
+forloop(`rep', `1', REPS, `nest(DEPTH)
+')dnl
@@ -0,0 +1,15 @@
+include(`common.m4')dnl
+divert(`-1')
+# Regular expressions: PASSES rounds of patsubst over a text of
+# 2**DOUBLE lines, followed by one regexp call per line of the text.
+define(`text', `key_12=value 345 some more words=here
+')
+double(`text', DOUBLE)
+define(`lines', eval(`2 ** 'DOUBLE))
+divert`'dnl
+forloop(`pass', `1', PASSES,
+  `patsubst(defn(`text'), `\([a-z_0-9]+\)=\([a-z]+\)', `\2=\1')dnl
+patsubst(defn(`text'), `[0-9]+', `<\&>')dnl
+forloop(`i', `1', lines,
+  `regexp(`key_'i`=value', `\([a-z]+\)_\([0-9]+\)=\(.*\)', `\3\2')
+')')dnl
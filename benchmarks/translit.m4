@@ -0,0 +1,11 @@
+include(`common.m4')dnl
+divert(`-1')
+# Big translit: PASSES rounds of case mapping and deletion over a text
+# of 2**DOUBLE copies of a 37 byte line.
+define(`text', `abcdefghijklmnopqrstuvwxyz0123456789
+')
+double(`text', DOUBLE)
+divert`'dnl
+forloop(`pass', `1', PASSES,
+  `translit(defn(`text'), `a-z', `A-Z')dnl
+translit(defn(`text'), `0-9a-f')')dnl
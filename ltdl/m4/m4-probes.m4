@@ -0,0 +1,41 @@
+#                                                            -*- Autoconf -*-
+# m4-probes.m4 -- optional static probes for tracing tools.
+#
+# Copyright (C) 2010 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# serial 1
+
+# M4_PROBES
+# ---------
+# Compile in the static probes of m4/probes.h when asked to, which needs
+# the <sys/sdt.h> of SystemTap or a compatible implementation.
+AC_DEFUN([M4_PROBES],
+[AC_ARG_ENABLE([probes],
+  [AS_HELP_STRING([--enable-probes],
+    [compile in static probes for perf, SystemTap and bpftrace
+     [default=no]])],
+  [], [enable_probes=no])
+AC_MSG_CHECKING([[whether to compile in static probes]])
+AC_MSG_RESULT([$enable_probes])
+if test "x$enable_probes" != xno; then
+  AC_CHECK_HEADERS([sys/sdt.h], [],
+    [AC_MSG_ERROR([--enable-probes requires <sys/sdt.h>])])
+  AC_DEFINE([ENABLE_PROBES], [1],
+    [Define to 1 to compile in static probes for tracing tools.])
+fi
+])
@@ -19,7 +19,7 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-# serial 1
+# serial 2
 
 # M4_SYSCMD
 # ---------
@@ -56,4 +56,7 @@ fi
 AC_MSG_RESULT([$with_syscmd_shell])
 AC_DEFINE_UNQUOTED([M4_SYSCMD_SHELL], ["$with_syscmd_shell"],
   [Shell used by syscmd and esyscmd, must accept -c argument.])
+dnl Spawning avoids copying the page tables of a large m4 process.
+AC_CHECK_HEADERS_ONCE([spawn.h])
+AC_CHECK_FUNCS_ONCE([posix_spawn posix_spawnp])
 ])
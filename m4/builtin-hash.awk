@@ -0,0 +1,192 @@
+# Generate a perfect hash of the builtin names of the standard modules.
+# Copyright (C) 2010 Free Software Foundation, Inc.
+#
+# This file is part of GNU M4.
+#
+# GNU M4 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GNU M4 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Usage: LC_ALL=C awk -f builtin-hash.awk modules/m4.c modules/gnu.c ...
+#
+# Each file is scanned for the `BUILTIN (name, ...)' lines of its
+# builtin_functions table.  The output, included by m4/builtin.c,
+# maps each name to its index in the sorted builtin table of every
+# module that provides it, through a table of slots indexed by the
+# hash computed by builtin_hash in m4/builtin.c:
+#
+#   h = len; for each byte c: h = (h * MULTIPLIER + c) mod 2^20
+#   slot = h >> (20 - log2 (SIZE))
+#
+# MULTIPLIER and SIZE are searched for so that no two names share a
+# slot.
+
+BEGIN {
+  for (i = 1; i < 128; i++)
+    ord[sprintf ("%c", i)] = i
+  modules = 0
+  names = 0
+}
+
+FNR == 1 {
+  module = FILENAME
+  sub (/.*\//, "", module)
+  sub (/\.c$/, "", module)
+  module_name[modules] = module
+  module_count[modules] = 0
+  module_file[modules] = FILENAME
+  modules++
+}
+
+/^  BUILTIN \(/ {
+  name = $0
+  sub (/^  BUILTIN \( */, "", name)
+  sub (/ *,.*/, "", name)
+  m = modules - 1
+  module_builtin[m, module_count[m]++] = name
+  if (!(name in name_index))
+    {
+      name_index[name] = names
+      name_list[names++] = name
+    }
+}
+
+function hash (name, multiplier,   h, i)
+{
+  h = length (name)
+  for (i = 1; i <= length (name); i++)
+    h = (h * multiplier + ord[substr (name, i, 1)]) % 1048576
+  return h
+}
+
+# Try to place every name in a table of 2^BITS slots, and return true
+# if no two names collide.
+function place (multiplier, bits,   i, slot)
+{
+  split ("", slots)
+  for (i = 0; i < names; i++)
+    {
+      slot = int (hash (name_list[i], multiplier) / 2 ^ (20 - bits))
+      if (slot in slots)
+        return 0
+      slots[slot] = i
+    }
+  return 1
+}
+
+END {
+  if (!names)
+    {
+      print "builtin-hash.awk: no builtins found" > "/dev/stderr"
+      exit 1
+    }
+
+  # The index of a name in a module is its position once the builtins
+  # of that module are sorted, as m4__module_open does with strcmp.
+  for (m = 0; m < modules; m++)
+    {
+      for (i = 1; i < module_count[m]; i++)
+        for (j = i;
+             j > 0 && module_builtin[m, j - 1] > module_builtin[m, j]; j--)
+          {
+            tmp = module_builtin[m, j]
+            module_builtin[m, j] = module_builtin[m, j - 1]
+            module_builtin[m, j - 1] = tmp
+          }
+      for (i = 0; i < module_count[m]; i++)
+        index_of[m, module_builtin[m, i]] = i
+    }
+
+  for (bits = 1; 2 ^ bits < 2 * names; bits++)
+    continue
+  found = 0
+  for (; bits <= 12 && !found; bits++)
+    for (multiplier = 3; multiplier < 65536 && !found; multiplier += 2)
+      found = place (multiplier, bits)
+  bits--
+  multiplier -= 2
+  if (!found)
+    {
+      print "builtin-hash.awk: no perfect hash found" > "/dev/stderr"
+      exit 1
+    }
+
+  printf "/* DO NOT EDIT! GENERATED AUTOMATICALLY by builtin-hash.awk from\n"
+  line = "  "
+  for (m = 0; m < modules; m++)
+    {
+      file = module_file[m]
+      sub (/.*\/modules\//, "modules/", file)
+      if (length (line) + length (file) > 70)
+        {
+          print line
+          line = "  "
+        }
+      line = line " " file
+    }
+  print line ".  */"
+  print ""
+  printf "#define BUILTIN_HASH_MODULES    %d\n", modules
+  printf "#define BUILTIN_HASH_MULTIPLIER %d\n", multiplier
+  printf "#define BUILTIN_HASH_SHIFT      %d\n", 20 - bits
+  printf "#define BUILTIN_HASH_SIZE       %d\n", 2 ^ bits
+  print ""
+  print "/* A builtin name, and its index in each module, or -1.  */"
+  print "typedef struct"
+  print "{"
+  print "  const char *name;"
+  print "  size_t len;"
+  print "  short index[BUILTIN_HASH_MODULES];"
+  print "} builtin_hash_entry;"
+  print ""
+  print "static const char *const builtin_hash_modules[] ="
+  print "{"
+  for (m = 0; m < modules; m++)
+    printf "  \"%s\",\n", module_name[m]
+  print "};"
+  print ""
+  print "static const size_t builtin_hash_counts[] ="
+  print "{"
+  for (m = 0; m < modules; m++)
+    printf "  %d,\n", module_count[m]
+  print "};"
+  print ""
+  print "static const builtin_hash_entry builtin_hash_entries[] ="
+  print "{"
+  for (i = 0; i < names; i++)
+    {
+      name = name_list[i]
+      printf "  { \"%s\", %d, {", name, length (name)
+      for (m = 0; m < modules; m++)
+        printf " %d%s", ((m, name) in index_of) ? index_of[m, name] : -1, \
+          m + 1 < modules ? "," : ""
+      print " } },"
+    }
+  print "};"
+  print ""
+  print "/* Each slot holds 1 + the index of an entry, or 0.  */"
+  print "static const unsigned short builtin_hash_slots[] ="
+  print "{"
+  line = " "
+  for (slot = 0; slot < 2 ^ bits; slot++)
+    {
+      item = sprintf (" %d,", (slot in slots) ? slots[slot] + 1 : 0)
+      if (length (line) + length (item) > 76)
+        {
+          print line
+          line = " "
+        }
+      line = line item
+    }
+  print line
+  print "};"
+}
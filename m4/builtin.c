@@ -25,13 +25,103 @@
 
 #include "m4private.h"
 
-/* Comparison function, for use in bsearch, which compares NAME
-   against the name of BUILTIN.  */
-static int
-compare_builtin_name_CB (const void *name, const void *b)
+/* The builtins of the standard modules are found through a perfect
+   hash, generated from their sources by builtin-hash.awk.  Other
+   modules are searched by bisection.  */
+#include "builtin-hash.h"
+
+/* Return the slot of NAME of length LEN in builtin_hash_slots.  Since
+   the hash is computed modulo 2^20, it can wrap around in 32 bits.  */
+static size_t
+builtin_hash (const char *name, size_t len)
+{
+  uint32_t h = len;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    h = h * BUILTIN_HASH_MULTIPLIER + to_uchar (name[i]);
+  return (h & 0xfffff) >> BUILTIN_HASH_SHIFT;
+}
+
+/* Return the entry for NAME of length LEN among the builtins of the
+   standard modules, or NULL if none of them provides it.  */
+static const builtin_hash_entry *
+builtin_hash_lookup (const char *name, size_t len)
+{
+  unsigned short slot = builtin_hash_slots[builtin_hash (name, len)];
+  const builtin_hash_entry *entry;
+
+  if (!slot)
+    return NULL;
+  entry = &builtin_hash_entries[slot - 1];
+  if (entry->len != len || memcmp (entry->name, name, len) != 0)
+    return NULL;
+  return entry;
+}
+
+/* Set the hash index of MODULE to its position among the standard
+   modules, if it has exactly the builtins that the perfect hash was
+   generated from, or to -1 so that it is searched by bisection.  */
+void
+m4__builtin_hash_module (m4_module *module)
+{
+  const char *name = m4_get_module_name (module);
+  size_t i;
+  int index;
+
+  module->hash_index = -1;
+  if (!name)
+    return;
+  for (index = 0; index < BUILTIN_HASH_MODULES; index++)
+    if (STREQ (name, builtin_hash_modules[index]))
+      break;
+  if (index == BUILTIN_HASH_MODULES
+      || module->builtins_len != builtin_hash_counts[index])
+    return;
+  for (i = 0; i < module->builtins_len; i++)
+    {
+      const char *builtin = module->builtins[i].builtin.name;
+      const builtin_hash_entry *entry
+        = builtin_hash_lookup (builtin, strlen (builtin));
+
+      if (!entry || entry->index[index] != (short) i)
+        return;
+    }
+  module->hash_index = index;
+}
+
+/* Return the builtin of MODULE which has NAME of length LEN, which
+   need not be NUL terminated, or NULL.  */
+m4__builtin *
+m4__builtin_find (m4_module *module, const char *name, size_t len)
 {
-  const m4__builtin *builtin = (const m4__builtin *) b;
-  return strcmp ((const char *) name, builtin->builtin.name);
+  size_t lo = 0;
+  size_t hi = module->builtins_len;
+
+  if (module->hash_index >= 0)
+    {
+      const builtin_hash_entry *entry = builtin_hash_lookup (name, len);
+      short i = entry ? entry->index[module->hash_index] : -1;
+
+      return i < 0 ? NULL : &module->builtins[i];
+    }
+
+  while (lo < hi)
+    {
+      size_t i = (lo + hi) / 2;
+      const char *builtin = module->builtins[i].builtin.name;
+      int cmp = strncmp (builtin, name, len);
+
+      if (cmp == 0 && builtin[len] != '\0')
+        cmp = 1;
+      if (cmp == 0)
+        return &module->builtins[i];
+      if (cmp < 0)
+        lo = i + 1;
+      else
+        hi = i;
+    }
+  return NULL;
 }
 
 /* Find the builtin which has NAME.  If MODULE is not NULL, then
@@ -42,12 +132,12 @@ m4_symbol_value *
 m4_builtin_find_by_name (m4_module *module, const char *name)
 {
   m4_module *cur = module ? module : m4__module_next (NULL);
+  size_t len = strlen (name);
   m4__builtin *bp;
 
   do
     {
-      bp = (m4__builtin *) bsearch (name, cur->builtins, cur->builtins_len,
-                                    sizeof *bp, compare_builtin_name_CB);
+      bp = m4__builtin_find (cur, name, len);
       if (bp)
         {
           m4_symbol_value *token = (m4_symbol_value *) xzalloc (sizeof *token);
@@ -165,6 +165,7 @@ set_debug_file (m4 *context, const m4_call_info *caller, FILE *fp)
 
   debug_file = fp;
   m4_set_debug_file (context, fp);
+  m4__trace_restart (context);
 
   if (debug_file != NULL && debug_file != stdout)
     {
@@ -251,6 +252,19 @@ m4_debug_message (m4 *context, int mode, const char *format, ...)
     {
       va_list args;
 
+      if (m4_get_trace_binary_opt (context))
+        {
+          m4_obstack *obs = &context->trace_messages;
+          size_t start = obstack_object_size (obs);
+
+          va_start (args, format);
+          obstack_vprintf (obs, format, args);
+          va_end (args);
+          m4__trace_message (context, (char *) obstack_base (obs) + start,
+                             obstack_object_size (obs) - start);
+          obstack_blank (obs, start - obstack_object_size (obs));
+          return;
+        }
       m4_debug_message_prefix (context);
       va_start (args, format);
       xvfprintf (m4_get_debug_file (context), format, args);
@@ -41,6 +41,7 @@ struct m4_hash
   m4_hash_hash_func *hash_func;
   m4_hash_cmp_func *cmp_func;
   hash_node **buckets;
+  hash_node *free_list;         /* nodes available for reuse */
 #ifndef NDEBUG
   m4_hash_iterator *iter;       /* current iterator */
 #endif
@@ -71,6 +72,7 @@ struct m4_hash_iterator
 #define HASH_BUCKETS(hash)      ((hash)->buckets)
 #define HASH_HASH_FUNC(hash)    ((hash)->hash_func)
 #define HASH_CMP_FUNC(hash)     ((hash)->cmp_func)
+#define HASH_FREE_LIST(hash)    ((hash)->free_list)
 
 #define NODE_NEXT(node)         ((node)->next)
 #define NODE_KEY(node)          ((node)->key)
@@ -102,17 +104,14 @@ struct m4_hash_iterator
 
 static void             bucket_insert   (m4_hash *hash, hash_node *bucket);
 static void             bucket_delete   (m4_hash *hash, size_t i);
-static hash_node *      node_new        (const void *key, void *value);
+static hash_node *      node_new        (m4_hash *hash, const void *key,
+                                         void *value);
 static void             node_insert     (m4_hash *hash, hash_node *node);
 static hash_node *      node_lookup     (m4_hash *hash, const void *key);
 static void             node_delete     (m4_hash *hash, hash_node *node);
 static void             maybe_grow      (m4_hash *hash);
 
 
-
-static hash_node *free_list = NULL;
-
-
 
 /* Allocate and return a new, unpopulated but initialised m4_hash with
    SIZE buckets, where HASH_FUNC will be used to generate bucket numbers
@@ -136,6 +135,7 @@ m4_hash_new (size_t size, m4_hash_hash_func *hash_func,
                                                   sizeof *HASH_BUCKETS (hash));
   HASH_HASH_FUNC (hash) = hash_func;
   HASH_CMP_FUNC (hash)  = cmp_func;
+  HASH_FREE_LIST (hash) = NULL;
 #ifndef NDEBUG
   HASH_ITER (hash)      = NULL;
 #endif
@@ -159,11 +159,11 @@ m4_hash_dup (m4_hash *src, m4_hash_copy_func *copy)
   return dest;
 }
 
-/* Recycle each of the nodes in HASH onto the free list, and release
-   the rest of the memory used by the table.  Memory addressed by the
-   recycled nodes is _NOT_ freed: this needs to be done manually to
-   prevent memory leaks.  This is not safe to call while HASH is being
-   iterated.  */
+/* Release each of the nodes in HASH, including those on its free
+   list, and the rest of the memory used by the table.  Memory
+   addressed by the nodes is _NOT_ freed: this needs to be done
+   manually to prevent memory leaks.  This is not safe to call while
+   HASH is being iterated.  */
 void
 m4_hash_delete (m4_hash *hash)
 {
@@ -175,13 +175,19 @@ m4_hash_delete (m4_hash *hash)
   for (i = 0; i < HASH_SIZE (hash); ++i)
     if (BUCKET_NTH (hash, i))
       bucket_delete (hash, i);
+  while (HASH_FREE_LIST (hash))
+    {
+      hash_node *stale = HASH_FREE_LIST (hash);
+      HASH_FREE_LIST (hash) = NODE_NEXT (stale);
+      free (stale);
+    }
   free (HASH_BUCKETS (hash));
   free (hash);
 }
 
 /* Check that the nodes in bucket I have been cleared, and recycle
-   each of the nodes in the bucket to the free list.  Bucket I must
-   not be empty when this function is called.  */
+   each of the nodes in the bucket to the free list of HASH.  Bucket I
+   must not be empty when this function is called.  */
 static void
 bucket_delete (m4_hash *hash, size_t i)
 {
@@ -200,22 +206,22 @@ bucket_delete (m4_hash *hash, size_t i)
   assert (NODE_KEY (node) == NULL);
   --HASH_LENGTH (hash);
 
-  NODE_NEXT (node)      = free_list;
-  free_list             = BUCKET_NTH (hash, i);
+  NODE_NEXT (node)      = HASH_FREE_LIST (hash);
+  HASH_FREE_LIST (hash) = BUCKET_NTH (hash, i);
   BUCKET_NTH (hash, i)  = NULL;
 }
 
 /* Create and initialise a new node with KEY and VALUE, by reusing a
-   node from the free list if possible.  */
+   node from the free list of HASH if possible.  */
 static hash_node *
-node_new (const void *key, void *value)
+node_new (m4_hash *hash, const void *key, void *value)
 {
   hash_node *node = NULL;
 
-  if (free_list)
+  if (HASH_FREE_LIST (hash))
     {
-      node = free_list;
-      free_list = NODE_NEXT (free_list);
+      node = HASH_FREE_LIST (hash);
+      HASH_FREE_LIST (hash) = NODE_NEXT (node);
     }
   else
     node = (hash_node *) xmalloc (sizeof *node);
@@ -236,8 +242,8 @@ node_delete (m4_hash *hash, hash_node *node)
   assert (node);
   assert (NODE_KEY (node) == NULL);
 
-  NODE_NEXT (node)      = free_list;
-  free_list             = node;
+  NODE_NEXT (node)      = HASH_FREE_LIST (hash);
+  HASH_FREE_LIST (hash) = node;
 
   --HASH_LENGTH (hash);
 }
@@ -255,7 +261,7 @@ m4_hash_insert (m4_hash *hash, const void *key, void *value)
   assert (hash);
   assert (!HASH_ITER (hash));
 
-  node = node_new (key, value);
+  node = node_new (hash, key, value);
   node_insert (hash, node);
   maybe_grow (hash);
 
@@ -377,6 +383,38 @@ m4_get_hash_length (m4_hash *hash)
   return HASH_LENGTH (hash);
 }
 
+/* How many buckets are currently allocated by HASH.  */
+size_t
+m4_get_hash_size (m4_hash *hash)
+{
+  assert (hash);
+
+  return HASH_SIZE (hash);
+}
+
+/* Return the number of entries in the fullest bucket of HASH, which
+   bounds the number of comparisons done by a lookup.  */
+size_t
+m4_get_hash_longest_chain (m4_hash *hash)
+{
+  size_t longest = 0;
+  size_t i;
+
+  assert (hash);
+
+  for (i = 0; i < HASH_SIZE (hash); i++)
+    {
+      hash_node *node;
+      size_t length = 0;
+
+      for (node = BUCKET_NTH (hash, i); node; node = NODE_NEXT (node))
+        length++;
+      if (longest < length)
+        longest = length;
+    }
+  return longest;
+}
+
 #if 0
 /* Force the number of buckets to be the given value.  You probably ought
    not to be using this function once the table has been in use, since
@@ -468,20 +506,6 @@ bucket_insert (m4_hash *hash, hash_node *bucket)
   while (bucket);
 }
 
-/* Reclaim all memory used by free nodes.  Safe to call at any time,
-   although only worth calling at program shutdown to verify no
-   leaks.  */
-void
-m4_hash_exit (void)
-{
-  while (free_list)
-    {
-      hash_node *stale = free_list;
-      free_list = NODE_NEXT (stale);
-      free (stale);
-    }
-}
-
 
 
 /* Iterate over a given HASH.  Start with PLACE being NULL, then
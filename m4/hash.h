@@ -44,9 +44,10 @@ extern m4_hash *m4_hash_new     (size_t size, m4_hash_hash_func *hash_func,
                                  m4_hash_cmp_func *cmp_func);
 extern m4_hash *m4_hash_dup     (m4_hash *hash, m4_hash_copy_func *copy);
 extern void     m4_hash_delete  (m4_hash *hash);
-extern void     m4_hash_exit    (void);
 
 extern size_t   m4_get_hash_length      (m4_hash *hash);
+extern size_t   m4_get_hash_size        (m4_hash *hash);
+extern size_t   m4_get_hash_longest_chain (m4_hash *hash);
 
 extern void **          m4_hash_lookup  (m4_hash *hash, const void *key);
 extern void *           m4_hash_remove  (m4_hash *hash, const void *key);
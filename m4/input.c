@@ -103,17 +103,26 @@ typedef struct m4_input_block m4_input_block;
 static  int             file_peek       (m4_input_block *, m4 *, bool);
 static  int             file_read       (m4_input_block *, m4 *, bool, bool,
                                          bool);
-static  void            file_unget      (m4_input_block *, int);
+static  void            file_unget      (m4_input_block *, m4 *, int);
 static  bool            file_clean      (m4_input_block *, m4 *, bool);
+static  void            file_reverted   (m4_input_block *, m4 *);
 static  void            file_print      (m4_input_block *, m4 *, m4_obstack *,
                                          int);
 static  const char *    file_buffer     (m4_input_block *, m4 *, size_t *,
                                          bool);
 static  void            file_consume    (m4_input_block *, m4 *, size_t);
+static  int             cached_peek     (m4_input_block *, m4 *, bool);
+static  int             cached_read     (m4_input_block *, m4 *, bool, bool,
+                                         bool);
+static  void            cached_unget    (m4_input_block *, m4 *, int);
+static  bool            cached_clean    (m4_input_block *, m4 *, bool);
+static  const char *    cached_buffer   (m4_input_block *, m4 *, size_t *,
+                                         bool);
+static  void            cached_consume  (m4_input_block *, m4 *, size_t);
 static  int             string_peek     (m4_input_block *, m4 *, bool);
 static  int             string_read     (m4_input_block *, m4 *, bool, bool,
                                          bool);
-static  void            string_unget    (m4_input_block *, int);
+static  void            string_unget    (m4_input_block *, m4 *, int);
 static  void            string_print    (m4_input_block *, m4 *, m4_obstack *,
                                          int);
 static  const char *    string_buffer   (m4_input_block *, m4 *, size_t *,
@@ -122,7 +131,7 @@ static  void            string_consume  (m4_input_block *, m4 *, size_t);
 static  int             composite_peek  (m4_input_block *, m4 *, bool);
 static  int             composite_read  (m4_input_block *, m4 *, bool, bool,
                                          bool);
-static  void            composite_unget (m4_input_block *, int);
+static  void            composite_unget (m4_input_block *, m4 *, int);
 static  bool            composite_clean (m4_input_block *, m4 *, bool);
 static  void            composite_print (m4_input_block *, m4 *, m4_obstack *,
                                          int);
@@ -132,7 +141,7 @@ static  void            composite_consume (m4_input_block *, m4 *, size_t);
 static  int             eof_peek        (m4_input_block *, m4 *, bool);
 static  int             eof_read        (m4_input_block *, m4 *, bool, bool,
                                          bool);
-static  void            eof_unget       (m4_input_block *, int);
+static  void            eof_unget       (m4_input_block *, m4 *, int);
 static  const char *    eof_buffer      (m4_input_block *, m4 *, size_t *,
                                          bool);
 
@@ -144,7 +153,7 @@ static  bool    match_input             (m4 *, const char *, size_t, bool);
 static  int     next_char               (m4 *, bool, bool, bool);
 static  int     peek_char               (m4 *, bool);
 static  bool    pop_input               (m4 *, bool);
-static  void    unget_input             (int);
+static  void    unget_input             (m4 *, int);
 static  const char * next_buffer        (m4 *, size_t *, bool);
 static  void    consume_buffer          (m4 *, size_t);
 static  bool    consume_syntax          (m4 *, m4_obstack *, unsigned int);
@@ -174,7 +183,7 @@ struct input_funcs
 
   /* Unread a single unsigned character or CHAR_BUILTIN, must be the
      same character previously read by read_func.  */
-  void  (*unget_func)   (m4_input_block *, int);
+  void  (*unget_func)   (m4_input_block *, m4 *, int);
 
   /* Optional function to perform cleanup at end of input.  If
      CLEANUP, it is safe to perform non-recoverable cleanup actions.
@@ -224,6 +233,14 @@ struct m4_input_block
           bool_bitfield line_start : 1; /* Saved start_of_input_line state.  */
         }
       u_f;      /* See file_funcs.  */
+      struct
+        {
+          const char *str;              /* Remaining file contents.  */
+          size_t len;                   /* Remaining length.  */
+          void *data;                   /* Handle for m4__include_release.  */
+          bool_bitfield line_start : 1; /* Saved start_of_input_line state.  */
+        }
+      u_m;      /* See cached_funcs.  */
       struct
         {
           m4__symbol_chain *chain;      /* Current link in chain.  */
@@ -235,36 +252,43 @@ struct m4_input_block
 };
 
 
-/* Obstack for storing individual tokens.  */
-static m4_obstack token_stack;
+/* The state of the input engine, one per context.  */
+struct m4__input_state
+{
+  /* Obstack for storing individual tokens.  */
+  m4_obstack token_stack;
+
+  /* Obstack for storing input file names.  */
+  m4_obstack file_names;
 
-/* Obstack for storing input file names.  */
-static m4_obstack file_names;
+  /* Wrapup input stack.  */
+  m4_obstack *wrapup_stack;
 
-/* Wrapup input stack.  */
-static m4_obstack *wrapup_stack;
+  /* Current stack, from input or wrapup.  */
+  m4_obstack *current_input;
 
-/* Current stack, from input or wrapup.  */
-static m4_obstack *current_input;
+  /* Bottom of token_stack, for obstack_free.  */
+  void *token_bottom;
 
-/* Bottom of token_stack, for obstack_free.  */
-static void *token_bottom;
+  /* Pointer to top of current_input, never NULL.  */
+  m4_input_block *isp;
 
-/* Pointer to top of current_input, never NULL.  */
-static m4_input_block *isp;
+  /* Pointer to top of wrapup_stack, never NULL.  */
+  m4_input_block *wsp;
 
-/* Pointer to top of wrapup_stack, never NULL.  */
-static m4_input_block *wsp;
+  /* Auxiliary for handling split m4_push_string (), NULL when not
+     pushing text for rescanning.  */
+  m4_input_block *next;
 
-/* Auxiliary for handling split m4_push_string (), NULL when not
-   pushing text for rescanning.  */
-static m4_input_block *next;
+  /* Flag for next_char () to increment current_line.  */
+  bool start_of_input_line;
 
-/* Flag for next_char () to increment current_line.  */
-static bool start_of_input_line;
+  /* Flag for next_char () to recognize change in input block.  */
+  bool input_change;
 
-/* Flag for next_char () to recognize change in input block.  */
-static bool input_change;
+  /* Number of times input switched to the wrapup stack.  */
+  size_t wrapup_level;
+};
 
 /* Vtable for handling input from files.  */
 static struct input_funcs file_funcs = {
@@ -272,6 +296,12 @@ static struct input_funcs file_funcs = {
   file_consume
 };
 
+/* Vtable for handling input from files kept in memory.  */
+static struct input_funcs cached_funcs = {
+  cached_peek, cached_read, cached_unget, cached_clean, file_print,
+  cached_buffer, cached_consume
+};
+
 /* Vtable for handling input from strings.  */
 static struct input_funcs string_funcs = {
   string_peek, string_read, string_unget, NULL, string_print, string_buffer,
@@ -318,11 +348,12 @@ static int
 file_read (m4_input_block *me, m4 *context, bool allow_quote M4_GNUC_UNUSED,
            bool allow_argv M4_GNUC_UNUSED, bool allow_unget M4_GNUC_UNUSED)
 {
+  m4__input_state *input = context->input;
   int ch;
 
-  if (start_of_input_line)
+  if (input->start_of_input_line)
     {
-      start_of_input_line = false;
+      input->start_of_input_line = false;
       m4_set_current_line (context, ++me->line);
     }
 
@@ -336,13 +367,15 @@ file_read (m4_input_block *me, m4 *context, bool allow_quote M4_GNUC_UNUSED,
     }
 
   if (ch == '\n')
-    start_of_input_line = true;
+    input->start_of_input_line = true;
   return ch;
 }
 
 static void
-file_unget (m4_input_block *me, int ch)
+file_unget (m4_input_block *me, m4 *context, int ch)
 {
+  m4__input_state *input = context->input;
+
   assert (ch < CHAR_EOF);
   if (ungetc (ch, me->u.u_f.fp) < 0)
     {
@@ -351,20 +384,17 @@ file_unget (m4_input_block *me, int ch)
     }
   me->u.u_f.end = false;
   if (ch == '\n')
-    start_of_input_line = false;
+    input->start_of_input_line = false;
 }
 
 static bool
 file_clean (m4_input_block *me, m4 *context, bool cleanup)
 {
+  m4__input_state *input = context->input;
+
   if (!cleanup)
     return false;
-  if (me->prev != &input_eof)
-    m4_debug_message (context, M4_DEBUG_TRACE_INPUT,
-                      _("input reverted to %s, line %d"),
-                      me->prev->file, me->prev->line);
-  else
-    m4_debug_message (context, M4_DEBUG_TRACE_INPUT, _("input exhausted"));
+  file_reverted (me, context);
 
   if (ferror (me->u.u_f.fp))
     {
@@ -376,55 +406,71 @@ file_clean (m4_input_block *me, m4 *context, bool cleanup)
   else if (me->u.u_f.close && fclose (me->u.u_f.fp) == EOF)
     m4_error (context, 0, errno, NULL, _("error reading %s"),
               quotearg_style (locale_quoting_style, me->file));
-  start_of_input_line = me->u.u_f.line_start;
+  input->start_of_input_line = me->u.u_f.line_start;
   m4_set_output_line (context, -1);
   return true;
 }
 
+/* Print the input reverted message when the input file ME is
+   popped, on behalf of file_clean and cached_clean.  */
+static void
+file_reverted (m4_input_block *me, m4 *context)
+{
+  if (me->prev != &input_eof)
+    m4_debug_message (context, M4_DEBUG_TRACE_INPUT,
+                      _("input reverted to %s, line %d"),
+                      me->prev->file, me->prev->line);
+  else
+    m4_debug_message (context, M4_DEBUG_TRACE_INPUT, _("input exhausted"));
+}
+
 static void
 file_print (m4_input_block *me, m4 *context M4_GNUC_UNUSED, m4_obstack *obs,
             int debug_level M4_GNUC_UNUSED)
 {
   const char *text = me->file;
-  assert (obstack_object_size (current_input) == 0);
+  assert (obstack_object_size (context->input->current_input) == 0);
   obstack_grow (obs, "<file: ", strlen ("<file: "));
   obstack_grow (obs, text, strlen (text));
   obstack_1grow (obs, '>');
 }
 
 static const char *
-file_buffer (m4_input_block *me, m4 *context M4_GNUC_UNUSED, size_t *len,
+file_buffer (m4_input_block *me, m4 *context, size_t *len,
              bool allow_quote M4_GNUC_UNUSED)
 {
-  if (start_of_input_line)
+  m4__input_state *input = context->input;
+
+  if (input->start_of_input_line)
     {
-      start_of_input_line = false;
+      input->start_of_input_line = false;
       m4_set_current_line (context, ++me->line);
     }
   if (me->u.u_f.end)
     return buffer_retry;
-  return freadptr (isp->u.u_f.fp, len);
+  return freadptr (input->isp->u.u_f.fp, len);
 }
 
 static void
 file_consume (m4_input_block *me, m4 *context, size_t len)
 {
+  m4__input_state *input = context->input;
   const char *buf;
   const char *p;
   size_t buf_len;
-  assert (!start_of_input_line);
+  assert (!input->start_of_input_line);
   buf = freadptr (me->u.u_f.fp, &buf_len);
   assert (buf && len <= buf_len);
   buf_len = 0;
   while ((p = (char *) memchr (buf + buf_len, '\n', len - buf_len)))
     {
       if (p == buf + len - 1)
-        start_of_input_line = true;
+        input->start_of_input_line = true;
       else
         m4_set_current_line (context, ++me->line);
       buf_len = p - buf + 1;
     }
-  if (freadseek (isp->u.u_f.fp, len) != 0)
+  if (freadseek (input->isp->u.u_f.fp, len) != 0)
     assert (false);
 }
 
@@ -441,37 +487,173 @@ file_consume (m4_input_block *me, m4 *context, size_t len)
 void
 m4_push_file (m4 *context, FILE *fp, const char *title, bool close_file)
 {
+  m4__input_state *input = context->input;
   m4_input_block *i;
 
-  if (next != NULL)
+  if (input->next != NULL)
     {
-      obstack_free (current_input, next);
-      next = NULL;
+      obstack_free (input->current_input, input->next);
+      input->next = NULL;
     }
 
   m4_debug_message (context, M4_DEBUG_TRACE_INPUT, _("input read from %s"),
                     quotearg_style (locale_quoting_style, title));
 
-  i = (m4_input_block *) obstack_alloc (current_input, sizeof *i);
+  i = (m4_input_block *) obstack_alloc (input->current_input, sizeof *i);
   i->funcs = &file_funcs;
   /* Save title on a separate obstack, so that wrapped text can refer
      to it even after the file is popped.  */
-  i->file = obstack_copy0 (&file_names, title, strlen (title));
+  i->file = obstack_copy0 (&input->file_names, title, strlen (title));
   i->line = 1;
 
   i->u.u_f.fp = fp;
   i->u.u_f.end = false;
   i->u.u_f.close = close_file;
-  i->u.u_f.line_start = start_of_input_line;
+  i->u.u_f.line_start = input->start_of_input_line;
+  M4_PROBE3 (input__push, i->file, i->line, "file");
 
   m4_set_output_line (context, -1);
 
-  i->prev = isp;
-  isp = i;
-  input_change = true;
+  i->prev = input->isp;
+  input->isp = i;
+  input->input_change = true;
 }
 
 
+/* Input files whose contents are held by the include cache.  These
+   behave like file input for line numbers and tracing, but read from
+   memory like strings.  */
+static int
+cached_peek (m4_input_block *me, m4 *context M4_GNUC_UNUSED,
+             bool allow_argv M4_GNUC_UNUSED)
+{
+  return me->u.u_m.len ? to_uchar (*me->u.u_m.str) : CHAR_RETRY;
+}
+
+static int
+cached_read (m4_input_block *me, m4 *context, bool allow_quote M4_GNUC_UNUSED,
+             bool allow_argv M4_GNUC_UNUSED, bool allow_unget M4_GNUC_UNUSED)
+{
+  m4__input_state *input = context->input;
+  int ch;
+
+  if (input->start_of_input_line)
+    {
+      input->start_of_input_line = false;
+      m4_set_current_line (context, ++me->line);
+    }
+  if (!me->u.u_m.len)
+    return CHAR_RETRY;
+  me->u.u_m.len--;
+  ch = to_uchar (*me->u.u_m.str++);
+  if (ch == '\n')
+    input->start_of_input_line = true;
+  return ch;
+}
+
+static void
+cached_unget (m4_input_block *me, m4 *context, int ch)
+{
+  m4__input_state *input = context->input;
+
+  assert (ch < CHAR_EOF && to_uchar (me->u.u_m.str[-1]) == ch);
+  me->u.u_m.str--;
+  me->u.u_m.len++;
+  if (ch == '\n')
+    input->start_of_input_line = false;
+}
+
+static bool
+cached_clean (m4_input_block *me, m4 *context, bool cleanup)
+{
+  m4__input_state *input = context->input;
+
+  if (!cleanup)
+    return false;
+  file_reverted (me, context);
+  m4__include_release (context, me->u.u_m.data);
+  input->start_of_input_line = me->u.u_m.line_start;
+  m4_set_output_line (context, -1);
+  return true;
+}
+
+static const char *
+cached_buffer (m4_input_block *me, m4 *context, size_t *len,
+               bool allow_quote M4_GNUC_UNUSED)
+{
+  m4__input_state *input = context->input;
+
+  if (input->start_of_input_line)
+    {
+      input->start_of_input_line = false;
+      m4_set_current_line (context, ++me->line);
+    }
+  if (!me->u.u_m.len)
+    return buffer_retry;
+  *len = me->u.u_m.len;
+  return me->u.u_m.str;
+}
+
+static void
+cached_consume (m4_input_block *me, m4 *context, size_t len)
+{
+  m4__input_state *input = context->input;
+  const char *buf = me->u.u_m.str;
+  const char *p;
+  size_t buf_len = 0;
+
+  assert (!input->start_of_input_line && len <= me->u.u_m.len);
+  while ((p = (char *) memchr (buf + buf_len, '\n', len - buf_len)))
+    {
+      if (p == buf + len - 1)
+        input->start_of_input_line = true;
+      else
+        m4_set_current_line (context, ++me->line);
+      buf_len = p - buf + 1;
+    }
+  me->u.u_m.str += len;
+  me->u.u_m.len -= len;
+}
+
+/* Push the LEN bytes at STR, the contents of the file TITLE held by
+   the include cache, like m4_push_file does for an open file.  The
+   contents must stay valid until m4__include_release is called with
+   DATA, once the input block is popped.  */
+void
+m4__push_file_contents (m4 *context, const char *str, size_t len,
+                        const char *title, void *data)
+{
+  m4__input_state *input = context->input;
+  m4_input_block *i;
+
+  if (input->next != NULL)
+    {
+      obstack_free (input->current_input, input->next);
+      input->next = NULL;
+    }
+
+  m4_debug_message (context, M4_DEBUG_TRACE_INPUT, _("input read from %s"),
+                    quotearg_style (locale_quoting_style, title));
+
+  i = (m4_input_block *) obstack_alloc (input->current_input, sizeof *i);
+  i->funcs = &cached_funcs;
+  i->file = obstack_copy0 (&input->file_names, title, strlen (title));
+  i->line = 1;
+
+  i->u.u_m.str = str;
+  i->u.u_m.len = len;
+  i->u.u_m.data = data;
+  i->u.u_m.line_start = input->start_of_input_line;
+  M4_PROBE3 (input__push, i->file, i->line, "cached");
+
+  m4_set_output_line (context, -1);
+
+  i->prev = input->isp;
+  input->isp = i;
+  input->input_change = true;
+}
+
+
 /* Handle string expansion text.  */
 static int
 string_peek (m4_input_block *me, m4 *context M4_GNUC_UNUSED,
@@ -492,7 +674,7 @@ string_read (m4_input_block *me, m4 *context M4_GNUC_UNUSED,
 }
 
 static void
-string_unget (m4_input_block *me, int ch)
+string_unget (m4_input_block *me, m4 *context M4_GNUC_UNUSED, int ch)
 {
   assert (ch < CHAR_EOF && to_uchar (me->u.u_s.str[-1]) == ch);
   me->u.u_s.str--;
@@ -503,12 +685,13 @@ static void
 string_print (m4_input_block *me, m4 *context, m4_obstack *obs,
               int debug_level)
 {
+  m4__input_state *input = context->input;
   bool quote = (debug_level & M4_DEBUG_TRACE_QUOTE) != 0;
   size_t arg_length = m4_get_max_debug_arg_length_opt (context);
 
   assert (!me->u.u_s.len);
-  m4_shipout_string_trunc (obs, (char *) obstack_base (current_input),
-                           obstack_object_size (current_input),
+  m4_shipout_string_trunc (obs, (char *) obstack_base (input->current_input),
+                           obstack_object_size (input->current_input),
                            quote ? m4_get_syntax_quotes (M4SYNTAX) : NULL,
                            &arg_length);
 }
@@ -539,18 +722,21 @@ string_consume (m4_input_block *me, m4 *context M4_GNUC_UNUSED, size_t len)
 m4_obstack *
 m4_push_string_init (m4 *context, const char *file, int line)
 {
+  m4__input_state *input = context->input;
+
   /* Free any memory occupied by completely parsed input.  */
-  assert (!next);
+  assert (!input->next);
   while (pop_input (context, false));
 
   /* Reserve the next location on the obstack.  */
-  next = (m4_input_block *) obstack_alloc (current_input, sizeof *next);
-  next->funcs = &string_funcs;
-  next->file = file;
-  next->line = line;
-  next->u.u_s.len = 0;
-
-  return current_input;
+  input->next = (m4_input_block *) obstack_alloc (input->current_input,
+                                                  sizeof *input->next);
+  input->next->funcs = &string_funcs;
+  input->next->file = file;
+  input->next->line = line;
+  input->next->u.u_s.len = 0;
+
+  return input->current_input;
 }
 
 /* This function allows gathering input from multiple locations,
@@ -578,10 +764,11 @@ m4_push_string_init (m4 *context, const char *file, int line)
 bool
 m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
 {
+  m4__input_state *input = context->input;
   m4__symbol_chain *src_chain = NULL;
   m4__symbol_chain *chain;
 
-  assert (next);
+  assert (input->next);
 
   /* Speed consideration - for short enough symbols, the speed and
      memory overhead of parsing another INPUT_CHAIN link outweighs the
@@ -592,20 +779,20 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
       assert (level < SIZE_MAX);
       if (m4_get_symbol_value_len (value) <= INPUT_INLINE_THRESHOLD)
         {
-          obstack_grow (current_input, m4_get_symbol_value_text (value),
+          obstack_grow (input->current_input, m4_get_symbol_value_text (value),
                         m4_get_symbol_value_len (value));
           return false;
         }
     }
   else if (m4_is_symbol_value_func (value))
     {
-      if (next->funcs == &string_funcs)
+      if (input->next->funcs == &string_funcs)
         {
-          next->funcs = &composite_funcs;
-          next->u.u_c.chain = next->u.u_c.end = NULL;
+          input->next->funcs = &composite_funcs;
+          input->next->u.u_c.chain = input->next->u.u_c.end = NULL;
         }
-      m4__append_builtin (current_input, value->u.builtin, &next->u.u_c.chain,
-                          &next->u.u_c.end);
+      m4__append_builtin (input->current_input, value->u.builtin,
+                          &input->next->u.u_c.chain, &input->next->u.u_c.end);
       return false;
     }
   else
@@ -623,7 +810,7 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
              && (src_chain->u.u_s.len <= INPUT_INLINE_THRESHOLD
                  || (!inuse && src_chain->u.u_s.level == SIZE_MAX)))
         {
-          obstack_grow (current_input, src_chain->u.u_s.str,
+          obstack_grow (input->current_input, src_chain->u.u_s.str,
                         src_chain->u.u_s.len);
           src_chain = src_chain->next;
         }
@@ -631,21 +818,22 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
         return false;
     }
 
-  if (next->funcs == &string_funcs)
+  if (input->next->funcs == &string_funcs)
     {
-      next->funcs = &composite_funcs;
-      next->u.u_c.chain = next->u.u_c.end = NULL;
+      input->next->funcs = &composite_funcs;
+      input->next->u.u_c.chain = input->next->u.u_c.end = NULL;
     }
-  m4__make_text_link (current_input, &next->u.u_c.chain, &next->u.u_c.end);
+  m4__make_text_link (input->current_input, &input->next->u.u_c.chain,
+                      &input->next->u.u_c.end);
   if (m4_is_symbol_value_text (value))
     {
-      chain = (m4__symbol_chain *) obstack_alloc (current_input,
+      chain = (m4__symbol_chain *) obstack_alloc (input->current_input,
                                                   sizeof *chain);
-      if (next->u.u_c.end)
-        next->u.u_c.end->next = chain;
+      if (input->next->u.u_c.end)
+        input->next->u.u_c.end->next = chain;
       else
-        next->u.u_c.chain = chain;
-      next->u.u_c.end = chain;
+        input->next->u.u_c.chain = chain;
+      input->next->u.u_c.end = chain;
       chain->next = NULL;
       chain->type = M4__CHAIN_STR;
       chain->quote_age = m4_get_symbol_value_quote_age (value);
@@ -659,8 +847,9 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
     {
       if (src_chain->type == M4__CHAIN_FUNC)
         {
-          m4__append_builtin (current_input, src_chain->u.builtin,
-                              &next->u.u_c.chain, &next->u.u_c.end);
+          m4__append_builtin (input->current_input, src_chain->u.builtin,
+                              &input->next->u.u_c.chain,
+                              &input->next->u.u_c.end);
           src_chain = src_chain->next;
           continue;
         }
@@ -678,19 +867,19 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
               && (src_chain->u.u_s.len <= INPUT_INLINE_THRESHOLD
                   || (!inuse && src_chain->u.u_s.level == SIZE_MAX)))
             {
-              obstack_grow (current_input, src_chain->u.u_s.str,
+              obstack_grow (input->current_input, src_chain->u.u_s.str,
                             src_chain->u.u_s.len);
               break;
             }
           /* We must clone each link in the chain, since next_char
              destructively modifies the chain it is parsing.  */
-          chain = (m4__symbol_chain *) obstack_copy (current_input, src_chain,
-                                                     sizeof *chain);
+          chain = (m4__symbol_chain *) obstack_copy (input->current_input,
+                                                     src_chain, sizeof *chain);
           chain->next = NULL;
           if (chain->type == M4__CHAIN_STR && chain->u.u_s.level == SIZE_MAX)
             {
               if (chain->u.u_s.len <= INPUT_INLINE_THRESHOLD || !inuse)
-                chain->u.u_s.str = (char *) obstack_copy (current_input,
+                chain->u.u_s.str = (char *) obstack_copy (input->current_input,
                                                           chain->u.u_s.str,
                                                           chain->u.u_s.len);
               else
@@ -700,11 +889,11 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
                 }
             }
         }
-      if (next->u.u_c.end)
-        next->u.u_c.end->next = chain;
+      if (input->next->u.u_c.end)
+        input->next->u.u_c.end->next = chain;
       else
-        next->u.u_c.chain = chain;
-      next->u.u_c.end = chain;
+        input->next->u.u_c.chain = chain;
+      input->next->u.u_c.end = chain;
       if (chain->type == M4__CHAIN_ARGV)
         {
           assert (!chain->u.u_a.comma && !chain->u.u_a.skip_last);
@@ -723,33 +912,37 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
    from push_string_init is collected into the input stack.  If the
    new object is empty, we do not push it.  */
 void
-m4_push_string_finish (void)
+m4_push_string_finish (m4 *context)
 {
-  size_t len = obstack_object_size (current_input);
+  m4__input_state *input = context->input;
+  size_t len = obstack_object_size (input->current_input);
 
-  if (next == NULL)
+  if (input->next == NULL)
     {
       assert (!len);
       return;
     }
 
-  if (len || next->funcs == &composite_funcs)
+  if (len || input->next->funcs == &composite_funcs)
     {
-      if (next->funcs == &string_funcs)
+      if (input->next->funcs == &string_funcs)
         {
-          next->u.u_s.str = (char *) obstack_finish (current_input);
-          next->u.u_s.len = len;
+          input->next->u.u_s.str
+            = (char *) obstack_finish (input->current_input);
+          input->next->u.u_s.len = len;
         }
       else
-        m4__make_text_link (current_input, &next->u.u_c.chain,
-                            &next->u.u_c.end);
-      next->prev = isp;
-      isp = next;
-      input_change = true;
+        m4__make_text_link (input->current_input, &input->next->u.u_c.chain,
+                            &input->next->u.u_c.end);
+      input->next->prev = input->isp;
+      input->isp = input->next;
+      input->input_change = true;
+      M4_PROBE3 (input__push, input->next->file, input->next->line,
+                 "string");
     }
   else
-    obstack_free (current_input, next);
-  next = NULL;
+    obstack_free (input->current_input, input->next);
+  input->next = NULL;
 }
 
 
@@ -759,6 +952,7 @@ m4_push_string_finish (void)
 static int
 composite_peek (m4_input_block *me, m4 *context, bool allow_argv)
 {
+  m4__input_state *input = context->input;
   m4__symbol_chain *chain = me->u.u_c.chain;
   size_t argc;
 
@@ -789,14 +983,14 @@ composite_peek (m4_input_block *me, m4 *context, bool allow_argv)
              input block containing the next unparsed argument from
              argv.  */
           m4_push_string_init (context, me->file, me->line);
-          m4__push_arg_quote (context, current_input, chain->u.u_a.argv,
+          m4__push_arg_quote (context, input->current_input, chain->u.u_a.argv,
                               chain->u.u_a.index,
                               m4__quote_cache (M4SYNTAX, NULL,
                                                chain->quote_age,
                                                chain->u.u_a.quotes));
           chain->u.u_a.index++;
           chain->u.u_a.comma = true;
-          m4_push_string_finish ();
+          m4_push_string_finish (context);
           return peek_char (context, allow_argv);
         case M4__CHAIN_LOC:
           break;
@@ -813,6 +1007,7 @@ static int
 composite_read (m4_input_block *me, m4 *context, bool allow_quote,
                 bool allow_argv, bool allow_unget)
 {
+  m4__input_state *input = context->input;
   m4__symbol_chain *chain = me->u.u_c.chain;
   size_t argc;
   while (chain)
@@ -857,19 +1052,19 @@ composite_read (m4_input_block *me, m4 *context, bool allow_quote,
              input block containing the next unparsed argument from
              argv.  */
           m4_push_string_init (context, me->file, me->line);
-          m4__push_arg_quote (context, current_input, chain->u.u_a.argv,
+          m4__push_arg_quote (context, input->current_input, chain->u.u_a.argv,
                               chain->u.u_a.index,
                               m4__quote_cache (M4SYNTAX, NULL,
                                                chain->quote_age,
                                                chain->u.u_a.quotes));
           chain->u.u_a.index++;
           chain->u.u_a.comma = true;
-          m4_push_string_finish ();
+          m4_push_string_finish (context);
           return next_char (context, allow_quote, allow_argv, allow_unget);
         case M4__CHAIN_LOC:
           me->file = chain->u.u_l.file;
           me->line = chain->u.u_l.line;
-          input_change = true;
+          input->input_change = true;
           me->u.u_c.chain = chain->next;
           return next_char (context, allow_quote, allow_argv, allow_unget);
         default:
@@ -882,7 +1077,8 @@ composite_read (m4_input_block *me, m4 *context, bool allow_quote,
 }
 
 static void
-composite_unget (m4_input_block *me, int ch)
+composite_unget (m4_input_block *me, m4 *context M4_GNUC_UNUSED,
+                 int ch)
 {
   m4__symbol_chain *chain = me->u.u_c.chain;
   switch (chain->type)
@@ -951,13 +1147,14 @@ static void
 composite_print (m4_input_block *me, m4 *context, m4_obstack *obs,
                  int debug_level)
 {
+  m4__input_state *input = context->input;
   bool quote = (debug_level & M4_DEBUG_TRACE_QUOTE) != 0;
   size_t maxlen = m4_get_max_debug_arg_length_opt (context);
   m4__symbol_chain *chain = me->u.u_c.chain;
   const m4_string_pair *quotes = m4_get_syntax_quotes (M4SYNTAX);
   bool module = (debug_level & M4_DEBUG_TRACE_MODULE) != 0;
   bool done = false;
-  size_t len = obstack_object_size (current_input);
+  size_t len = obstack_object_size (input->current_input);
 
   if (quote)
     m4_shipout_string (context, obs, quotes->str1, quotes->len1, false);
@@ -990,8 +1187,8 @@ composite_print (m4_input_block *me, m4 *context, m4_obstack *obs,
       chain = chain->next;
     }
   if (len)
-    m4_shipout_string_trunc (obs, (char *) obstack_base (current_input), len,
-                             NULL, &maxlen);
+    m4_shipout_string_trunc (obs, (char *) obstack_base (input->current_input),
+                             len, NULL, &maxlen);
   if (quote)
     m4_shipout_string (context, obs, quotes->str2, quotes->len2, false);
 }
@@ -1000,6 +1197,7 @@ static const char *
 composite_buffer (m4_input_block *me, m4 *context, size_t *len,
                   bool allow_quote)
 {
+  m4__input_state *input = context->input;
   m4__symbol_chain *chain = me->u.u_c.chain;
   while (chain)
     {
@@ -1030,7 +1228,7 @@ composite_buffer (m4_input_block *me, m4 *context, size_t *len,
         case M4__CHAIN_LOC:
           me->file = chain->u.u_l.file;
           me->line = chain->u.u_l.line;
-          input_change = true;
+          input->input_change = true;
           me->u.u_c.chain = chain->next;
           return next_buffer (context, len, allow_quote);
         default:
@@ -1111,7 +1309,8 @@ m4__append_builtin (m4_obstack *obs, const m4__builtin *func,
 void
 m4_push_builtin (m4 *context, m4_obstack *obs, m4_symbol_value *token)
 {
-  m4_input_block *i = (obs == current_input ? next : wsp);
+  m4__input_state *input = context->input;
+  m4_input_block *i = (obs == input->current_input ? input->next : input->wsp);
   assert (i);
   if (i->funcs == &string_funcs)
     {
@@ -1145,7 +1344,8 @@ eof_read (m4_input_block *me, m4 *context M4_GNUC_UNUSED,
 }
 
 static void
-eof_unget (m4_input_block *me M4_GNUC_UNUSED, int ch)
+eof_unget (m4_input_block *me M4_GNUC_UNUSED, m4 *context M4_GNUC_UNUSED,
+           int ch)
 {
   assert (ch == CHAR_EOF);
 }
@@ -1165,7 +1365,8 @@ eof_buffer (m4_input_block *me M4_GNUC_UNUSED, m4 *context M4_GNUC_UNUSED,
 void
 m4_input_print (m4 *context, m4_obstack *obs, int debug_level)
 {
-  m4_input_block *block = next ? next : isp;
+  m4__input_state *input = context->input;
+  m4_input_block *block = input->next ? input->next : input->isp;
   assert (context && obs && (debug_level & M4_DEBUG_TRACE_EXPANSION));
   assert (block->funcs->print_func);
   block->funcs->print_func (block, context, obs, debug_level);
@@ -1179,27 +1380,29 @@ m4_obstack *
 m4__push_wrapup_init (m4 *context, const m4_call_info *caller,
                       m4__symbol_chain ***end)
 {
+  m4__input_state *input = context->input;
   m4_input_block *i;
   m4__symbol_chain *chain;
 
-  assert (obstack_object_size (wrapup_stack) == 0);
-  if (wsp != &input_eof)
+  assert (obstack_object_size (input->wrapup_stack) == 0);
+  if (input->wsp != &input_eof)
     {
-      i = wsp;
+      i = input->wsp;
       assert (i->funcs == &composite_funcs && i->u.u_c.end
               && i->u.u_c.end->type != M4__CHAIN_LOC);
     }
   else
     {
-      i = (m4_input_block *) obstack_alloc (wrapup_stack, sizeof *i);
-      i->prev = wsp;
+      i = (m4_input_block *) obstack_alloc (input->wrapup_stack, sizeof *i);
+      i->prev = input->wsp;
       i->funcs = &composite_funcs;
       i->file = caller->file;
       i->line = caller->line;
       i->u.u_c.chain = i->u.u_c.end = NULL;
-      wsp = i;
+      input->wsp = i;
     }
-  chain = (m4__symbol_chain *) obstack_alloc (wrapup_stack, sizeof *chain);
+  chain = (m4__symbol_chain *) obstack_alloc (input->wrapup_stack,
+                                              sizeof *chain);
   if (i->u.u_c.end)
     i->u.u_c.end->next = chain;
   else
@@ -1211,15 +1414,18 @@ m4__push_wrapup_init (m4 *context, const m4_call_info *caller,
   chain->u.u_l.file = caller->file;
   chain->u.u_l.line = caller->line;
   *end = &i->u.u_c.end;
-  return wrapup_stack;
+  return input->wrapup_stack;
 }
 
 /* After pushing wrapup text, this completes the bookkeeping.  */
 void
-m4__push_wrapup_finish (void)
+m4__push_wrapup_finish (m4 *context)
 {
-  m4__make_text_link (wrapup_stack, &wsp->u.u_c.chain, &wsp->u.u_c.end);
-  assert (wsp->u.u_c.end->type != M4__CHAIN_LOC);
+  m4__input_state *input = context->input;
+
+  m4__make_text_link (input->wrapup_stack, &input->wsp->u.u_c.chain,
+                      &input->wsp->u.u_c.end);
+  assert (input->wsp->u.u_c.end->type != M4__CHAIN_LOC);
 }
 
 
@@ -1230,57 +1436,70 @@ m4__push_wrapup_finish (void)
 static bool
 pop_input (m4 *context, bool cleanup)
 {
-  m4_input_block *tmp = isp->prev;
-
-  assert (isp);
-  if (isp->funcs->clean_func
-      ? !isp->funcs->clean_func (isp, context, cleanup)
-      : (isp->funcs->peek_func (isp, context, true) != CHAR_RETRY))
+  m4__input_state *input = context->input;
+  m4_input_block *tmp = input->isp->prev;
+
+  assert (input->isp);
+  if (input->isp->funcs->clean_func
+      ? !input->isp->funcs->clean_func (input->isp, context, cleanup)
+      : (input->isp->funcs->peek_func (input->isp, context, true)
+         != CHAR_RETRY))
     return false;
 
-  obstack_free (current_input, isp);
+  M4_PROBE2 (input__pop, input->isp->file, input->isp->line);
+  obstack_free (input->current_input, input->isp);
   m4__quote_uncache (M4SYNTAX);
-  next = NULL; /* might be set in m4_push_string_init () */
+  input->next = NULL; /* might be set in m4_push_string_init () */
 
-  isp = tmp;
-  input_change = true;
+  input->isp = tmp;
+  input->input_change = true;
   return true;
 }
 
+/* Return true if wrapup text is waiting for the end of input.  */
+bool
+m4__wrapup_pending (m4 *context)
+{
+  m4__input_state *input = context->input;
+
+  return input->wsp != &input_eof;
+}
+
 /* To switch input over to the wrapup stack, main () calls pop_wrapup.
    Since wrapup text can install new wrapup text, pop_wrapup ()
    returns true if there is more wrapped text to parse.  */
 bool
 m4_pop_wrapup (m4 *context)
 {
-  static size_t level = 0;
+  m4__input_state *input = context->input;
 
-  next = NULL;
-  obstack_free (current_input, NULL);
-  free (current_input);
+  input->next = NULL;
+  obstack_free (input->current_input, NULL);
+  free (input->current_input);
 
-  if (wsp == &input_eof)
+  if (input->wsp == &input_eof)
     {
-      obstack_free (wrapup_stack, NULL);
+      obstack_free (input->wrapup_stack, NULL);
       m4_set_current_file (context, NULL);
       m4_set_current_line (context, 0);
       m4_debug_message (context, M4_DEBUG_TRACE_INPUT,
                        _("input from m4wrap exhausted"));
-      current_input = NULL;
-      DELETE (wrapup_stack);
+      input->current_input = NULL;
+      DELETE (input->wrapup_stack);
       return false;
     }
 
   m4_debug_message (context, M4_DEBUG_TRACE_INPUT,
-                    _("input from m4wrap recursion level %zu"), ++level);
+                    _("input from m4wrap recursion level %zu"),
+                    ++input->wrapup_level);
 
-  current_input = wrapup_stack;
-  wrapup_stack = (m4_obstack *) xmalloc (sizeof *wrapup_stack);
-  obstack_init (wrapup_stack);
+  input->current_input = input->wrapup_stack;
+  input->wrapup_stack = (m4_obstack *) xmalloc (sizeof *input->wrapup_stack);
+  obstack_init (input->wrapup_stack);
 
-  isp = wsp;
-  wsp = &input_eof;
-  input_change = true;
+  input->isp = input->wsp;
+  input->wsp = &input_eof;
+  input->input_change = true;
 
   return true;
 }
@@ -1292,9 +1511,10 @@ m4_pop_wrapup (m4 *context)
 static void
 init_builtin_token (m4 *context, m4_obstack *obs, m4_symbol_value *token)
 {
+  m4__input_state *input = context->input;
   m4__symbol_chain *chain;
-  assert (isp->funcs == &composite_funcs);
-  chain = isp->u.u_c.chain;
+  assert (input->isp->funcs == &composite_funcs);
+  chain = input->isp->u.u_c.chain;
   assert (!chain->quote_age && chain->type == M4__CHAIN_FUNC
           && chain->u.builtin);
   if (obs)
@@ -1326,10 +1546,12 @@ init_builtin_token (m4 *context, m4_obstack *obs, m4_symbol_value *token)
 static void
 append_quote_token (m4 *context, m4_obstack *obs, m4_symbol_value *value)
 {
-  m4__symbol_chain *src_chain = isp->u.u_c.chain;
+  m4__input_state *input = context->input;
+  m4__symbol_chain *src_chain = input->isp->u.u_c.chain;
   m4__symbol_chain *chain;
-  assert (isp->funcs == &composite_funcs && obs && m4__quote_age (M4SYNTAX));
-  isp->u.u_c.chain = src_chain->next;
+  assert (input->isp->funcs == &composite_funcs && obs
+          && m4__quote_age (M4SYNTAX));
+  input->isp->u.u_c.chain = src_chain->next;
 
   /* Speed consideration - for short enough symbols, the speed and
      memory overhead of parsing another INPUT_CHAIN link outweighs the
@@ -1368,17 +1590,19 @@ append_quote_token (m4 *context, m4_obstack *obs, m4_symbol_value *value)
 static void
 init_argv_symbol (m4 *context, m4_obstack *obs, m4_symbol_value *value)
 {
+  m4__input_state *input = context->input;
   m4__symbol_chain *src_chain;
   m4__symbol_chain *chain;
   int ch;
   const m4_string_pair *comments = m4_get_syntax_comments (M4SYNTAX);
 
-  assert (value->type == M4_SYMBOL_VOID && isp->funcs == &composite_funcs
-          && isp->u.u_c.chain->type == M4__CHAIN_ARGV
+  assert (value->type == M4_SYMBOL_VOID
+          && input->isp->funcs == &composite_funcs
+          && input->isp->u.u_c.chain->type == M4__CHAIN_ARGV
           && obs && obstack_object_size (obs) == 0);
 
-  src_chain = isp->u.u_c.chain;
-  isp->u.u_c.chain = src_chain->next;
+  src_chain = input->isp->u.u_c.chain;
+  input->isp->u.u_c.chain = src_chain->next;
   value->type = M4_SYMBOL_COMP;
   /* Clone the link, since the input will be discarded soon.  */
   chain = (m4__symbol_chain *) obstack_copy (obs, src_chain, sizeof *chain);
@@ -1414,7 +1638,7 @@ init_argv_symbol (m4 *context, m4_obstack *obs, m4_symbol_value *value)
   ch = peek_char (context, true);
   if (!m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_COMMA | M4_SYNTAX_CLOSE))
     {
-      isp->u.u_c.chain = src_chain;
+      input->isp->u.u_c.chain = src_chain;
       src_chain->u.u_a.index = m4_arg_argc (chain->u.u_a.argv) - 1;
       src_chain->u.u_a.comma = true;
       chain->u.u_a.skip_last = true;
@@ -1435,20 +1659,22 @@ init_argv_symbol (m4 *context, m4_obstack *obs, m4_symbol_value *value)
 static int
 next_char (m4 *context, bool allow_quote, bool allow_argv, bool allow_unget)
 {
+  m4__input_state *input = context->input;
   int ch;
 
   while (1)
     {
-      if (input_change)
+      if (input->input_change)
         {
-          m4_set_current_file (context, isp->file);
-          m4_set_current_line (context, isp->line);
-          input_change = false;
+          m4_set_current_file (context, input->isp->file);
+          m4_set_current_line (context, input->isp->line);
+          input->input_change = false;
         }
 
-      assert (isp->funcs->read_func);
-      while (((ch = isp->funcs->read_func (isp, context, allow_quote,
-                                           allow_argv, allow_unget))
+      assert (input->isp->funcs->read_func);
+      while (((ch = input->isp->funcs->read_func (input->isp, context,
+                                                  allow_quote, allow_argv,
+                                                  allow_unget))
               != CHAR_RETRY)
              || allow_unget)
         {
@@ -1468,8 +1694,9 @@ next_char (m4 *context, bool allow_quote, bool allow_argv, bool allow_unget)
 static int
 peek_char (m4 *context, bool allow_argv)
 {
+  m4__input_state *input = context->input;
   int ch;
-  m4_input_block *block = isp;
+  m4_input_block *block = input->isp;
 
   while (1)
     {
@@ -1490,10 +1717,12 @@ peek_char (m4 *context, bool allow_argv)
    stack, using an existing input_block if possible.  This is not safe
    to call except immediately after next_char(context, aq, aa, true).  */
 static void
-unget_input (int ch)
+unget_input (m4 *context, int ch)
 {
-  assert (isp->funcs->unget_func != NULL);
-  isp->funcs->unget_func (isp, ch);
+  m4__input_state *input = context->input;
+
+  assert (input->isp->funcs->unget_func != NULL);
+  input->isp->funcs->unget_func (input->isp, context, ch);
 }
 
 /* Return a pointer to the available bytes of the current input block,
@@ -1506,19 +1735,21 @@ unget_input (int ch)
 static const char *
 next_buffer (m4 *context, size_t *len, bool allow_quote)
 {
+  m4__input_state *input = context->input;
   const char *buf;
   while (1)
     {
-      assert (isp);
-      if (input_change)
+      assert (input->isp);
+      if (input->input_change)
         {
-          m4_set_current_file (context, isp->file);
-          m4_set_current_line (context, isp->line);
-          input_change = false;
+          m4_set_current_file (context, input->isp->file);
+          m4_set_current_line (context, input->isp->line);
+          input->input_change = false;
         }
 
-      assert (isp->funcs->buffer_func);
-      buf = isp->funcs->buffer_func (isp, context, len, allow_quote);
+      assert (input->isp->funcs->buffer_func);
+      buf = input->isp->funcs->buffer_func (input->isp, context, len,
+                                            allow_quote);
       if (buf != buffer_retry)
         return buf;
       /* End of input source --- pop one level.  */
@@ -1532,11 +1763,13 @@ next_buffer (m4 *context, size_t *len, bool allow_quote)
 static void
 consume_buffer (m4 *context, size_t len)
 {
-  assert (isp && !input_change);
+  m4__input_state *input = context->input;
+
+  assert (input->isp && !input->input_change);
   if (len)
     {
-      assert (isp->funcs->consume_func);
-      isp->funcs->consume_func (isp, context, len);
+      assert (input->isp->funcs->consume_func);
+      input->isp->funcs->consume_func (input->isp, context, len);
     }
 }
 
@@ -1642,7 +1875,7 @@ match_input (m4 *context, const char *s, size_t len, bool consume)
   st = m4_push_string_init (context, m4_get_current_file (context),
                             m4_get_current_line (context));
   obstack_grow (st, t, n);
-  m4_push_string_finish ();
+  m4_push_string_finish (context);
   return result;
 }
 
@@ -1714,7 +1947,7 @@ consume_syntax (m4 *context, m4_obstack *obs, unsigned int syntax)
             }
           return ch == CHAR_EOF;
         }
-      unget_input (ch);
+      unget_input (context, ch);
       return false;
     }
 }
@@ -1724,36 +1957,78 @@ consume_syntax (m4 *context, m4_obstack *obs, unsigned int syntax)
 void
 m4_input_init (m4 *context)
 {
-  obstack_init (&file_names);
+  m4__input_state *input;
+
+  input = (m4__input_state *) xzalloc (sizeof *input);
+  context->input = input;
+  obstack_init (&input->file_names);
   m4_set_current_file (context, NULL);
   m4_set_current_line (context, 0);
 
-  current_input = (m4_obstack *) xmalloc (sizeof *current_input);
-  obstack_init (current_input);
-  wrapup_stack = (m4_obstack *) xmalloc (sizeof *wrapup_stack);
-  obstack_init (wrapup_stack);
+  m4__input_reset (context);
 
   /* Allocate an object in the current chunk, so that obstack_free
      will always work even if the first token parsed spills to a new
      chunk.  */
-  obstack_init (&token_stack);
-  token_bottom = obstack_finish (&token_stack);
-
-  isp = &input_eof;
-  wsp = &input_eof;
-  next = NULL;
+  obstack_init (&input->token_stack);
+  input->token_bottom = obstack_finish (&input->token_stack);
+}
 
-  start_of_input_line = false;
+/* Make the input engine ready for new input again, once m4_pop_wrapup
+   has consumed all input and wrapup text.  Do nothing if it is still
+   ready.  */
+void
+m4__input_reset (m4 *context)
+{
+  m4__input_state *input = context->input;
+
+  if (input->current_input)
+    return;
+  assert (!input->wrapup_stack);
+  input->current_input = (m4_obstack *) xmalloc (sizeof *input->current_input);
+  obstack_init (input->current_input);
+  input->wrapup_stack = (m4_obstack *) xmalloc (sizeof *input->wrapup_stack);
+  obstack_init (input->wrapup_stack);
+
+  input->isp = &input_eof;
+  input->wsp = &input_eof;
+  input->next = NULL;
+  input->wrapup_level = 0;
+
+  input->start_of_input_line = false;
 }
 
 /* Free memory used by the input engine.  */
 void
-m4_input_exit (void)
+m4_input_exit (m4 *context)
 {
-  assert (!current_input && isp == &input_eof);
-  assert (!wrapup_stack && wsp == &input_eof);
-  obstack_free (&file_names, NULL);
-  obstack_free (&token_stack, NULL);
+  m4__input_state *input = context->input;
+
+  assert (!input->current_input && input->isp == &input_eof);
+  assert (!input->wrapup_stack && input->wsp == &input_eof);
+  obstack_free (&input->file_names, NULL);
+  obstack_free (&input->token_stack, NULL);
+  free (input);
+  context->input = NULL;
+}
+
+/* Raise the high water marks of STATS to the memory currently used by
+   the token and input stacks.  */
+void
+m4__input_stats (m4 *context, m4__stats *stats)
+{
+  m4__input_state *input = context->input;
+  size_t used;
+
+  used = obstack_memory_used (&input->token_stack);
+  if (stats->token_stack_max < used)
+    stats->token_stack_max = used;
+  if (input->current_input)
+    {
+      used = obstack_memory_used (input->current_input);
+      if (stats->input_stack_max < used)
+        stats->input_stack_max = used;
+    }
 }
 
 
@@ -1776,6 +2051,7 @@ m4__token_type
 m4__next_token (m4 *context, m4_symbol_value *token, int *line,
                 m4_obstack *obs, bool allow_argv, const m4_call_info *caller)
 {
+  m4__input_state *input = context->input;
   int ch;
   int quote_level;
   m4__token_type type;
@@ -1785,12 +2061,12 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
      for tokens where argument collection might not use the literal
      token.  But for comments and strings, we can output directly into
      the argument collection obstack OBS, if provided.  */
-  m4_obstack *obs_safe = &token_stack;
+  m4_obstack *obs_safe = &input->token_stack;
 
-  assert (next == NULL);
+  assert (input->next == NULL);
   memset (token, '\0', sizeof *token);
   do {
-    obstack_free (&token_stack, token_bottom);
+    obstack_free (&input->token_stack, input->token_bottom);
 
     /* Must consume an input character.  */
     ch = next_char (context, false, allow_argv && m4__quote_age (M4SYNTAX),
@@ -1805,6 +2081,7 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
 #ifdef DEBUG_INPUT
         xfprintf (stderr, "next_token -> EOF\n");
 #endif
+        m4__stats_add (context, tokens[M4_TOKEN_EOF], 1);
         return M4_TOKEN_EOF;
       }
 
@@ -1814,6 +2091,7 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
 #ifdef DEBUG_INPUT
         m4_print_token (context, "next_token", M4_TOKEN_MACDEF, token);
 #endif
+        m4__stats_add (context, tokens[M4_TOKEN_MACDEF], 1);
         return M4_TOKEN_MACDEF;
       }
     if (ch == CHAR_ARGV)
@@ -1822,17 +2100,18 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
 #ifdef DEBUG_INPUT
         m4_print_token (context, "next_token", M4_TOKEN_ARGV, token);
 #endif
+        m4__stats_add (context, tokens[M4_TOKEN_ARGV], 1);
         return M4_TOKEN_ARGV;
       }
 
     if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_ESCAPE))
       { /* ESCAPED WORD */
-        obstack_1grow (&token_stack, ch);
+        obstack_1grow (&input->token_stack, ch);
         if ((ch = next_char (context, false, false, false)) < CHAR_EOF)
           {
-            obstack_1grow (&token_stack, ch);
+            obstack_1grow (&input->token_stack, ch);
             if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_ALPHA))
-              consume_syntax (context, &token_stack,
+              consume_syntax (context, &input->token_stack,
                               M4_SYNTAX_ALPHA | M4_SYNTAX_NUM);
             type = M4_TOKEN_WORD;
           }
@@ -2045,28 +2324,28 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
       }
     else if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_ACTIVE))
       { /* ACTIVE CHARACTER */
-        obstack_1grow (&token_stack, ch);
+        obstack_1grow (&input->token_stack, ch);
         type = M4_TOKEN_WORD;
       }
     else if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_OPEN))
       { /* OPEN PARENTHESIS */
-        obstack_1grow (&token_stack, ch);
+        obstack_1grow (&input->token_stack, ch);
         type = M4_TOKEN_OPEN;
       }
     else if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_COMMA))
       { /* COMMA */
-        obstack_1grow (&token_stack, ch);
+        obstack_1grow (&input->token_stack, ch);
         type = M4_TOKEN_COMMA;
       }
     else if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_CLOSE))
       { /* CLOSE PARENTHESIS */
-        obstack_1grow (&token_stack, ch);
+        obstack_1grow (&input->token_stack, ch);
         type = M4_TOKEN_CLOSE;
       }
     else
       { /* EVERYTHING ELSE */
         assert (ch < CHAR_EOF);
-        obstack_1grow (&token_stack, ch);
+        obstack_1grow (&input->token_stack, ch);
         if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_OTHER | M4_SYNTAX_NUM))
           {
             if (obs)
@@ -2086,7 +2365,7 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
             if (!m4_get_interactive_opt (context)
                 && !m4_get_syncoutput_opt (context)
                 && m4__safe_quotes (M4SYNTAX))
-              consume_syntax (context, &token_stack, M4_SYNTAX_SPACE);
+              consume_syntax (context, &input->token_stack, M4_SYNTAX_SPACE);
             type = M4_TOKEN_SPACE;
           }
         else
@@ -2098,11 +2377,12 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
     {
       if (obs_safe != obs)
         {
-          len = obstack_object_size (&token_stack);
-          obstack_1grow (&token_stack, '\0');
+          len = obstack_object_size (&input->token_stack);
+          obstack_1grow (&input->token_stack, '\0');
 
-          m4_set_symbol_value_text (token, obstack_finish (&token_stack), len,
-                                    m4__quote_age (M4SYNTAX));
+          m4_set_symbol_value_text (token,
+                                    obstack_finish (&input->token_stack),
+                                    len, m4__quote_age (M4SYNTAX));
         }
       else
         assert (type == M4_TOKEN_STRING || type == M4_TOKEN_COMMENT);
@@ -2115,16 +2395,17 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
 #ifdef DEBUG_INPUT
   if (token->type == M4_SYMBOL_VOID)
     {
-      len = obstack_object_size (&token_stack);
-      obstack_1grow (&token_stack, '\0');
+      len = obstack_object_size (&input->token_stack);
+      obstack_1grow (&input->token_stack, '\0');
 
-      m4_set_symbol_value_text (token, obstack_finish (&token_stack), len,
-                                m4__quote_age (M4SYNTAX));
+      m4_set_symbol_value_text (token, obstack_finish (&input->token_stack),
+                                len, m4__quote_age (M4SYNTAX));
     }
 
   m4_print_token (context, "next_token", type, token);
 #endif
 
+  m4__stats_add (context, tokens[type], 1);
   return type;
 }
 
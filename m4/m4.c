@@ -23,6 +23,7 @@
 #include "m4private.h"
 
 #define DEFAULT_NESTING_LIMIT	1024
+#define DEFAULT_ESYSCMD_CACHE_SIZE (16 * 1024 * 1024)
 
 
 m4 *
@@ -39,6 +40,7 @@ m4_create (void)
   context->nesting_limit = DEFAULT_NESTING_LIMIT;
   context->debug_level = M4_DEBUG_TRACE_INITIAL;
   context->max_debug_arg_length = SIZE_MAX;
+  context->esyscmd_cache_size = DEFAULT_ESYSCMD_CACHE_SIZE;
 
   context->search_path =
     (m4__search_path_info *) xzalloc (sizeof *context->search_path);
@@ -53,6 +55,11 @@ m4_delete (m4 *context)
   size_t i;
   assert (context);
 
+  /* Write any profile or statistics that the caller has not already
+     finished.  */
+  m4_profile_finish (context);
+  m4_stats_finish (context);
+
   if (context->symtab)
     m4_symtab_delete (context->symtab);
 
@@ -63,20 +70,12 @@ m4_delete (m4 *context)
      which are closed later.  */
   assert (context->debug_file == stderr || context->debug_file == stdout);
 
+  m4__trace_exit (context);
   obstack_free (&context->trace_messages, NULL);
 
   if (context->search_path)
     {
-      m4__search_path *path = context->search_path->list;
-
-      while (path)
-        {
-          m4__search_path *stale = path;
-          path = path->next;
-
-          DELETE (stale->dir); /* Cast away const.  */
-          free (stale);
-        }
+      m4__include_exit (context);
       free (context->search_path);
     }
 
@@ -94,6 +93,13 @@ m4_delete (m4 *context)
     }
   free (context->arg_stacks);
 
+  while (context->frame_pool)
+    {
+      m4__macro_frame *stale = context->frame_pool;
+      context->frame_pool = stale->prev;
+      free (stale);
+    }
+
   free (context);
 }
 
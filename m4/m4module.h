@@ -210,6 +210,9 @@ extern void             m4_delete       (m4 *);
         M4FIELD(int,    debug_level_opt,           debug_level)         \
         M4FIELD(size_t, max_debug_arg_length_opt,  max_debug_arg_length)\
         M4FIELD(int,    regexp_syntax_opt,         regexp_syntax)       \
+        M4FIELD(size_t, include_cache_opt,         include_cache)       \
+        M4FIELD(const char *, esyscmd_cache_opt,   esyscmd_cache)       \
+        M4FIELD(size_t, esyscmd_cache_size_opt,    esyscmd_cache_size)  \
 
 
 #define m4_context_opt_bit_table                                        \
@@ -222,6 +225,10 @@ extern void             m4_delete       (m4 *);
         M4OPT_BIT(M4_OPT_FATAL_WARN_BIT,        fatal_warnings_opt)     \
         M4OPT_BIT(M4_OPT_WARN_EXIT_BIT,         warnings_exit_opt)      \
         M4OPT_BIT(M4_OPT_SAFER_BIT,             safer_opt)              \
+        M4OPT_BIT(M4_OPT_TRACE_BINARY_BIT,      trace_binary_opt)       \
+        M4OPT_BIT(M4_OPT_INCLUDE_SNAPSHOT_BIT,  include_snapshot_opt)   \
+        M4OPT_BIT(M4_OPT_SYSCMD_DIRECT_BIT,     syscmd_direct_opt)      \
+        M4OPT_BIT(M4_OPT_SHELL_COPROCESS_BIT,   shell_coprocess_opt)    \
 
 
 #define M4FIELD(type, base, field)                                      \
@@ -245,6 +252,7 @@ m4_context_opt_bit_table
 
 typedef void m4_module_init_func   (m4 *, m4_module *, m4_obstack *);
 typedef void m4_module_finish_func (m4 *, m4_module *, m4_obstack *);
+typedef void m4_module_data_free_func (void *);
 
 extern m4_module *  m4_module_load     (m4 *, const char *, m4_obstack *);
 extern const char * m4_module_makeresident (m4_module *);
@@ -254,6 +262,12 @@ extern void *       m4_module_import   (m4 *, const char *, const char *,
                                         m4_obstack *);
 
 extern const char * m4_get_module_name (const m4_module *);
+extern void *       m4_get_module_data (m4 *, const char *);
+extern void         m4_set_module_data (m4 *, const char *, void *,
+                                        m4_module_data_free_func *);
+extern void         m4_set_module_fork_func (m4 *, const char *,
+                                        m4_module_data_free_func *);
+extern void         m4__module_forked  (m4 *);
 extern void         m4__module_exit    (m4 *);
 
 
@@ -263,11 +277,15 @@ extern void         m4__module_exit    (m4 *);
 
 typedef void *m4_symtab_apply_func (m4_symbol_table *, const char *, size_t,
                                     m4_symbol *, void *);
+typedef void m4_symtab_lazy_func (m4_symbol_table *, const char *, size_t,
+                                  void *);
 
 extern m4_symbol_table *m4_symtab_create  (size_t);
 extern void       m4_symtab_delete  (m4_symbol_table *);
 extern void *     m4_symtab_apply   (m4_symbol_table *, bool,
                                      m4_symtab_apply_func *, void *);
+extern void       m4_symtab_set_lazy (m4_symbol_table *,
+                                      m4_symtab_lazy_func *, void *);
 
 extern m4_symbol *m4_symbol_lookup  (m4_symbol_table *, const char *, size_t);
 extern m4_symbol *m4_symbol_pushdef (m4_symbol_table *, const char *, size_t,
@@ -352,6 +370,8 @@ extern m4_symbol_value  *m4_builtin_find_by_func (m4_module *,
 /* --- MACRO MANAGEMENT --- */
 
 extern void     m4_macro_expand_input   (m4 *);
+extern bool     m4_expand_string        (m4 *, const char *, size_t, char **,
+                                         size_t *);
 extern void     m4_macro_call           (m4 *, m4_symbol_value *, m4_obstack *,
                                          m4_macro_args *);
 extern size_t   m4_arg_argc             (m4_macro_args *);
@@ -433,6 +453,65 @@ extern void     m4_debug_message        (m4 *, int, const char *, ...)
 extern void     m4_trace_prepare        (m4 *, const m4_call_info *,
                                          m4_symbol_value *);
 
+/* When trace_binary_opt is set, trace and debug messages are written
+   to the debug file as a series of m4_trace_record structures in host
+   byte order, each followed by SIZE bytes of text.  Every file starts
+   with an M4_TRACE_HEADER record, and a new header restarts the
+   numbering of strings.  */
+#define M4_TRACE_VERSION        1
+
+enum {
+  /* First record of a file: INDEX is M4_TRACE_VERSION, and LENGTH is
+     the size of a record.  The value reads as "M4TR" on big-endian
+     hosts, and is not recognized with the wrong byte order.  */
+  M4_TRACE_HEADER               = 0x4d345452,
+  /* The text is the string with id NAME.  */
+  M4_TRACE_STRING               = 1,
+  /* The text is the start quote, of length INDEX, followed by the end
+     quote, both in effect for later records with the q flag.  */
+  M4_TRACE_QUOTES,
+  /* A macro call seen before argument collection; the text is the
+     current definition.  */
+  M4_TRACE_PREPARE,
+  /* The start of a macro call with INDEX arguments; LENGTH is the
+     --debuglen limit.  */
+  M4_TRACE_CALL,
+  /* Argument INDEX of the last call, truncated to the --debuglen
+     limit; LENGTH is its full length.  */
+  M4_TRACE_ARG,
+  /* Argument INDEX of the last call is a builtin, printed as the
+     text.  */
+  M4_TRACE_FUNC,
+  /* The end of the macro call CALL_ID; the text is its expansion.  */
+  M4_TRACE_RESULT,
+  /* A debug message; the text is the message.  */
+  M4_TRACE_MESSAGE
+};
+
+typedef struct m4_trace_record m4_trace_record;
+struct m4_trace_record
+{
+  uint32_t type;        /* One of the M4_TRACE_* record kinds.  */
+  uint32_t flags;       /* Debug flags in effect for the call.  */
+  uint32_t depth;       /* Expansion level of the call.  */
+  uint32_t name;        /* String id of the macro name.  */
+  uint32_t file;        /* String id of the file of the call.  */
+  uint32_t line;        /* Line of the call.  */
+  uint32_t index;       /* Argument index or count, see above.  */
+  uint32_t size;        /* Bytes of text following the record.  */
+  uint64_t length;      /* Length limit or full length, see above.  */
+  uint64_t call_id;     /* Unique sequence id of the call.  */
+  uint64_t time;        /* Nanoseconds since tracing started.  */
+};
+
+extern bool     m4_profile_set_output   (m4 *, const char *);
+extern bool     m4_profile_set_stacks_output (m4 *, const char *);
+extern void     m4_profile_finish       (m4 *);
+
+extern bool     m4_stats_set_output     (m4 *, const char *);
+extern void     m4_stats_regex          (m4 *, bool);
+extern void     m4_stats_finish         (m4 *);
+
 
 /* --- REGEXP SYNTAX --- */
 
@@ -517,7 +596,7 @@ extern void     m4_reset_syntax (m4_syntax_table *);
 /* --- INPUT TOKENIZATION --- */
 
 extern  void    m4_input_init   (m4 *context);
-extern  void    m4_input_exit   (void);
+extern  void    m4_input_exit   (m4 *);
 extern  void    m4_skip_line    (m4 *context, const m4_call_info *);
 
 /* push back input */
@@ -525,7 +604,7 @@ extern  void    m4_skip_line    (m4 *context, const m4_call_info *);
 extern  void    m4_push_file    (m4 *, FILE *, const char *, bool);
 extern  void    m4_push_builtin (m4 *, m4_obstack *, m4_symbol_value *);
 extern  m4_obstack      *m4_push_string_init    (m4 *, const char *, int);
-extern  void    m4_push_string_finish   (void);
+extern  void    m4_push_string_finish   (m4 *);
 extern  bool    m4_pop_wrapup   (m4 *);
 extern  void    m4_input_print  (m4 *, m4_obstack *, int);
 
@@ -534,7 +613,7 @@ extern  void    m4_input_print  (m4 *, m4_obstack *, int);
 /* --- OUTPUT MANAGEMENT --- */
 
 extern void     m4_output_init          (m4 *);
-extern void     m4_output_exit          (void);
+extern void     m4_output_exit          (m4 *);
 extern void     m4_output_text          (m4 *, const char *, size_t);
 extern void     m4_divert_text          (m4 *, m4_obstack *, const char *,
                                          size_t, int);
@@ -547,18 +626,34 @@ extern bool     m4_shipout_string_trunc (m4_obstack *, const char *, size_t,
 extern void     m4_make_diversion    (m4 *, int);
 extern void     m4_insert_diversion  (m4 *, int);
 extern void     m4_insert_file       (m4 *, FILE *);
-extern void     m4_freeze_diversions (m4 *, FILE *);
+extern void     m4_freeze_diversions (m4 *, FILE *, bool);
 extern void     m4_undivert_all      (m4 *);
+extern FILE *   m4_output_redirect   (m4 *, FILE *);
 
 
 
 /* --- PATH MANAGEMENT --- */
 
+typedef void m4_open_func (m4 *, const char *, bool, void *);
+
+/* Usage of the include cache enabled by m4_set_include_cache_opt.  */
+typedef struct
+{
+  size_t hits;          /* Includes served from memory.  */
+  size_t misses;        /* Includes that read the file.  */
+  size_t evictions;     /* Files dropped to stay within the limit.  */
+  size_t bytes;         /* Bytes currently held.  */
+  size_t peak_bytes;    /* Most bytes held at once.  */
+} m4_include_cache_stats;
+
 extern void	m4_add_include_directory (m4 *, const char *, bool);
 extern bool	m4_load_filename	 (m4 *, const m4_call_info *,
 					  const char *, m4_obstack *, bool);
 extern char *   m4_path_search		 (m4 *, const char *, const char **);
+extern void	m4_path_cache_flush	 (m4 *);
+extern void	m4_get_include_cache_stats (m4 *, m4_include_cache_stats *);
 extern FILE *	m4_fopen		 (m4 *, const char *, const char *);
+extern void	m4_set_open_hook	 (m4 *, m4_open_func *, void *);
 
 
 
@@ -27,9 +27,13 @@
 #include "cloexec.h"
 #include "quotearg.h"
 #include "xmemdup0.h"
+#include "xtime.h"
+
+#include "probes.h"
 
 typedef struct m4__search_path_info m4__search_path_info;
 typedef struct m4__macro_arg_stacks m4__macro_arg_stacks;
+typedef struct m4__macro_frame m4__macro_frame;
 typedef struct m4__symbol_chain m4__symbol_chain;
 
 typedef enum {
@@ -56,6 +60,14 @@ typedef unsigned int bool_bitfield;
 
 /* --- CONTEXT MANAGEMENT --- */
 
+typedef struct m4__profile m4__profile;
+typedef struct m4__stats m4__stats;
+typedef struct m4__trace m4__trace;
+typedef struct m4__input_state m4__input_state;
+typedef struct m4__output_state m4__output_state;
+typedef struct m4__module_ref m4__module_ref;
+typedef struct m4__module_data m4__module_data;
+
 struct m4 {
   m4_symbol_table *     symtab;
   m4_syntax_table *     syntax;
@@ -74,6 +86,9 @@ struct m4 {
   int           debug_level;                    /* -d */
   size_t        max_debug_arg_length;           /* -l */
   int           regexp_syntax;                  /* -r */
+  size_t        include_cache;                  /* --include-cache */
+  const char *  esyscmd_cache;                  /* --esyscmd-cache */
+  size_t        esyscmd_cache_size;             /* --esyscmd-cache-size */
   int           opt_flags;
 
   /* __PRIVATE__: */
@@ -81,6 +96,16 @@ struct m4 {
   m4__macro_arg_stacks  *arg_stacks;    /* Array of current argv refs.  */
   size_t                stacks_count;   /* Size of arg_stacks.  */
   size_t                expansion_level;/* Macro call nesting level.  */
+  m4__macro_frame       *frame_pool;    /* Recycled expansion frames.  */
+  m4__profile           *profile;       /* Macro profile, or NULL.  */
+  m4__stats             *stats;         /* Run statistics, or NULL.  */
+  m4__trace             *trace;         /* Binary trace state, or NULL.  */
+  m4__input_state       *input;         /* Input stacks and tokens.  */
+  m4__output_state      *output;        /* Diversions.  */
+  m4__module_ref        *modules;       /* Modules loaded, in order.  */
+  size_t                pending_misses; /* Lookups missing deferred names.  */
+  m4__module_data       *module_data;   /* Data kept by modules.  */
+  size_t                macro_call_id;  /* Number of the last macro call.  */
 };
 
 #define M4_OPT_PREFIX_BUILTINS_BIT      (1 << 0) /* -P */
@@ -92,6 +117,10 @@ struct m4 {
 #define M4_OPT_FATAL_WARN_BIT           (1 << 6) /* -E once */
 #define M4_OPT_WARN_EXIT_BIT            (1 << 7) /* -E twice */
 #define M4_OPT_SAFER_BIT                (1 << 8) /* --safer */
+#define M4_OPT_TRACE_BINARY_BIT         (1 << 9) /* --trace-format=binary */
+#define M4_OPT_INCLUDE_SNAPSHOT_BIT     (1 << 10) /* --include-snapshot */
+#define M4_OPT_SYSCMD_DIRECT_BIT        (1 << 11) /* --syscmd-direct */
+#define M4_OPT_SHELL_COPROCESS_BIT      (1 << 12) /* --shell-coprocess */
 
 /* Fast macro versions of accessor functions for public fields of m4,
    that also have an identically named function exported in m4module.h.  */
@@ -122,6 +151,12 @@ struct m4 {
 #  define m4_set_max_debug_arg_length_opt(C, V) ((C)->max_debug_arg_length=(V))
 #  define m4_get_regexp_syntax_opt(C)           ((C)->regexp_syntax)
 #  define m4_set_regexp_syntax_opt(C, V)        ((C)->regexp_syntax = (V))
+#  define m4_get_include_cache_opt(C)           ((C)->include_cache)
+#  define m4_set_include_cache_opt(C, V)        ((C)->include_cache = (V))
+#  define m4_get_esyscmd_cache_opt(C)           ((C)->esyscmd_cache)
+#  define m4_set_esyscmd_cache_opt(C, V)        ((C)->esyscmd_cache = (V))
+#  define m4_get_esyscmd_cache_size_opt(C)      ((C)->esyscmd_cache_size)
+#  define m4_set_esyscmd_cache_size_opt(C, V)   ((C)->esyscmd_cache_size = (V))
 
 #  define m4_get_prefix_builtins_opt(C)                                 \
                 (BIT_TEST((C)->opt_flags, M4_OPT_PREFIX_BUILTINS_BIT))
@@ -141,6 +176,14 @@ struct m4 {
                 (BIT_TEST((C)->opt_flags, M4_OPT_WARN_EXIT_BIT))
 #  define m4_get_safer_opt(C)                                           \
                 (BIT_TEST((C)->opt_flags, M4_OPT_SAFER_BIT))
+#  define m4_get_trace_binary_opt(C)                                    \
+                (BIT_TEST((C)->opt_flags, M4_OPT_TRACE_BINARY_BIT))
+#  define m4_get_include_snapshot_opt(C)                                \
+                (BIT_TEST((C)->opt_flags, M4_OPT_INCLUDE_SNAPSHOT_BIT))
+#  define m4_get_syscmd_direct_opt(C)                                   \
+                (BIT_TEST((C)->opt_flags, M4_OPT_SYSCMD_DIRECT_BIT))
+#  define m4_get_shell_coprocess_opt(C)                                 \
+                (BIT_TEST((C)->opt_flags, M4_OPT_SHELL_COPROCESS_BIT))
 
 /* No fast opt bit set macros, as they would need to evaluate their
    arguments more than once, which would subtly change their semantics.  */
@@ -166,6 +209,8 @@ typedef struct m4__builtin m4__builtin;
 
 extern void m4__set_symbol_value_builtin (m4_symbol_value *,
                                           const m4__builtin *);
+extern m4__builtin *m4__builtin_find (m4_module *, const char *, size_t);
+extern void m4__builtin_hash_module (m4_module *);
 extern void m4__builtin_print (m4_obstack *, const m4__builtin *, bool,
                                m4__symbol_chain **, const m4_string_pair *,
                                bool);
@@ -183,14 +228,19 @@ extern void m4__builtin_print (m4_obstack *, const m4__builtin *, bool,
 struct m4_module
 {
   lt_dlhandle handle;           /* All ltdl module information.  */
-  int refcount;                 /* Count of loads not matched by unload.  */
+  int refcount;                 /* Count of loads not matched by unload,
+                                   by all contexts.  */
   m4__builtin *builtins;        /* Sorted array of builtins.  */
   size_t builtins_len;          /* Number of builtins.  */
+  int hash_index;               /* Index among standard modules, or -1.  */
+  const m4_macro *macros;       /* Table of macros, or NULL.  */
+  size_t macros_len;            /* Number of macros.  */
 };
 
 extern void         m4__module_init (m4 *context);
 extern m4_module *  m4__module_open (m4 *context, const char *name,
                                      m4_obstack *obs);
+extern void         m4__module_forked (m4 *context);
 extern void         m4__module_exit (m4 *context);
 extern m4_module *  m4__module_next (m4_module *);
 extern m4_module *  m4__module_find (const char *name);
@@ -207,6 +257,7 @@ extern m4_module *  m4__module_find (const char *name);
 struct m4_symbol
 {
   bool traced;                  /* True if this symbol is traced.  */
+  bool changed;                 /* True if modified since it was reloaded.  */
   m4_symbol_value *value;       /* Linked list of pushdef'd values.  */
 };
 
@@ -423,6 +474,7 @@ extern bool     m4__arg_print           (m4 *, m4_obstack *, m4_macro_args *,
 #define VALUE_BLIND_ARGS_BIT            (1 << 1)
 #define VALUE_SIDE_EFFECT_ARGS_BIT      (1 << 2)
 #define VALUE_DELETED_BIT               (1 << 3)
+#define VALUE_BORROWED_TEXT_BIT         (1 << 4)
 
 
 struct m4_symbol_arg {
@@ -442,6 +494,8 @@ struct m4_symbol_arg {
 
 extern void m4__symtab_remove_module_references (m4_symbol_table *,
                                                  m4_module *);
+extern m4_symbol *m4__symtab_peek (m4_symbol_table *, const char *, size_t);
+extern m4_symtab_lazy_func *m4__symtab_get_lazy (m4_symbol_table *);
 extern bool m4__symbol_value_print (m4 *, m4_symbol_value *, m4_obstack *,
                                     const m4_string_pair *, bool,
                                     m4__symbol_chain **, size_t *, bool);
@@ -562,6 +616,68 @@ typedef enum {
   M4_TOKEN_ARGV         /* A series of parameters, M4_SYMBOL_COMP.  */
 } m4__token_type;
 
+/* Counters gathered across the engine for m4_stats_set_output.  High
+   water marks are sampled at each macro call, see stats.c.  */
+struct m4__stats
+{
+  FILE *file;                   /* Where the report is written.  */
+  size_t tokens[M4_TOKEN_ARGV + 1]; /* Tokens read, by type.  */
+  size_t lookups;               /* Words looked up as macro names.  */
+  size_t hits;                  /* Lookups that found a macro.  */
+  size_t calls;                 /* Macro calls.  */
+  size_t max_level;             /* Deepest expansion level.  */
+  size_t token_stack_max;       /* Most bytes used by the token stack.  */
+  size_t input_stack_max;       /* Most bytes used by the input stack.  */
+  size_t arg_stack_max;         /* Most bytes used by one level of the
+                                   argument stacks.  */
+  size_t output_bytes;          /* Bytes of text sent to diversions.  */
+  size_t diversions;            /* Diversions created.  */
+  size_t spilled_bytes;         /* Bytes flushed to temporary files.  */
+  size_t tmpfiles;              /* Temporary files created.  */
+  size_t regex_lookups;         /* Regular expressions requested.  */
+  size_t regex_hits;            /* Requests served by the regex cache.  */
+  xtime_t load_start;           /* Start of the frozen state load.  */
+  xtime_t load_time;            /* Time spent loading frozen state.  */
+};
+
+/* Add N to the statistics counter FIELD of context C, if statistics
+   are being gathered.  */
+#define m4__stats_add(C, Field, N)                                      \
+  ((C)->stats ? (void) ((C)->stats->Field += (N)) : (void) 0)
+
+/* Internal structure holding the state of one macro call on the
+   explicit expansion stack.  See macro.c for details on usage.  */
+struct m4__macro_frame
+{
+  m4__macro_frame *prev;        /* Interrupted call, or next free frame.  */
+  m4_call_info info;            /* Context of this macro call.  */
+  m4_symbol_value *value;       /* Original value of this macro.  */
+  size_t level;                 /* Expansion level of this macro.  */
+  void *args_base;              /* Base of stack->args on entry.  */
+  void *argv_base;              /* Base of stack->argv on entry.  */
+
+  /* Summary of the arguments collected so far, copied into the
+     m4_macro_args header once the call is complete.  */
+  size_t argc;
+  size_t arraylen;
+  unsigned int quote_age;
+  bool_bitfield wrapper : 1;
+  bool_bitfield has_ref : 1;
+  bool_bitfield flatten : 1;
+  bool_bitfield has_func : 1;
+  bool_bitfield more_args : 1;  /* True while collecting arguments.  */
+
+  /* State of the argument currently being collected.  */
+  bool_bitfield nested : 1;     /* True if TOKEN started a nested call.  */
+  bool_bitfield first : 1;      /* True if no prior content in argument.  */
+  m4_symbol_value *argp;        /* Argument being collected, or NULL.  */
+  m4__token_type type;          /* Type of the current token.  */
+  m4_symbol_value token;        /* The current token.  */
+  int paren_level;              /* Unbalanced parentheses in argument.  */
+  int line;                     /* Line where the argument started.  */
+  unsigned int age;             /* Quote age of the argument.  */
+};
+
 extern  void            m4__make_text_link (m4_obstack *, m4__symbol_chain **,
                                             m4__symbol_chain **);
 extern  void            m4__append_builtin (m4_obstack *, const m4__builtin *,
@@ -571,7 +687,11 @@ extern  bool            m4__push_symbol (m4 *, m4_symbol_value *, size_t,
                                          bool);
 extern  m4_obstack      *m4__push_wrapup_init (m4 *, const m4_call_info *,
                                                m4__symbol_chain ***);
-extern  void            m4__push_wrapup_finish (void);
+extern  void            m4__push_wrapup_finish (m4 *);
+extern  void            m4__push_file_contents (m4 *, const char *, size_t,
+                                                const char *, void *);
+extern  bool            m4__wrapup_pending (m4 *);
+extern  void            m4__input_reset (m4 *);
 extern  m4__token_type  m4__next_token (m4 *, m4_symbol_value *, int *,
                                         m4_obstack *, bool,
                                         const m4_call_info *);
@@ -590,6 +710,7 @@ extern  bool            m4__next_token_is_open (m4 *);
 /* --- PATH MANAGEMENT --- */
 
 typedef struct m4__search_path m4__search_path;
+typedef struct m4__include_content m4__include_content;
 
 struct m4__search_path {
   m4__search_path *next;        /* next directory to search */
@@ -601,9 +722,52 @@ struct m4__search_path_info {
   m4__search_path *list;        /* the list of path directories */
   m4__search_path *list_end;    /* the end of same */
   int max_length;               /* length of longest directory name */
+  m4_open_func *open_func;      /* called for each file opened, or NULL */
+  void *open_data;              /* opaque data for open_func */
+  m4_hash *cache;               /* results of m4_path_search, or NULL */
+  m4_hash *listings;            /* snapshots of directories, or NULL */
+  m4_hash *contents;            /* include cache by file name, or NULL */
+  m4__include_content *lru;     /* most recently used cached file */
+  m4__include_content *lru_end; /* least recently used cached file */
+  m4_include_cache_stats stats; /* include cache usage */
 };
 
 extern void m4__include_init (m4 *);
+extern void m4__include_exit (m4 *);
+extern void m4__include_release (m4 *, void *);
+
+
+/* --- OUTPUT MANAGEMENT --- */
+
+extern bool m4__output_has_temp_dir (m4 *);
+extern void m4__output_capture (m4 *);
+extern char *m4__output_release (m4 *, size_t *);
+
+
+/* --- PROFILING --- */
+
+extern void m4__profile_enter (m4 *, const m4_call_info *, size_t);
+extern void m4__profile_leave (m4 *, size_t, size_t);
+
+
+/* --- STATISTICS --- */
+
+extern void m4__stats_call       (m4 *, size_t);
+extern void m4__stats_load_begin (m4 *);
+extern void m4__stats_load_end   (m4 *);
+extern void m4__stats_forked     (m4 *);
+extern void m4__input_stats      (m4 *, m4__stats *);
+extern m4_hash *m4__symtab_hash  (m4_symbol_table *);
+
+
+/* --- BINARY TRACING --- */
+
+extern void m4__trace_prepare (m4 *, const m4_call_info *, m4_symbol_value *);
+extern void m4__trace_call    (m4 *, m4_macro_args *);
+extern void m4__trace_result  (m4 *, const m4_call_info *);
+extern void m4__trace_message (m4 *, const char *, size_t);
+extern void m4__trace_restart (m4 *);
+extern void m4__trace_exit    (m4 *);
 
 
 /* Debugging the memory allocator.  */
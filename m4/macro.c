@@ -120,13 +120,25 @@
    memory left on the obstack while waiting for refcounts to drop.
 */
 
-static m4_macro_args *collect_arguments (m4 *, m4_call_info *, m4_symbol *,
-                                         m4_obstack *, m4_obstack *);
+/* Possible results of expand_argument.  */
+typedef enum {
+  ARG_LAST,     /* The argument was the last of the call.  */
+  ARG_MORE,     /* The argument was followed by a comma.  */
+  ARG_NESTED    /* A nested macro call interrupted the argument.  */
+} arg_state;
+
+static size_t  collected_bytes   (m4_macro_args *);
+static m4__macro_frame *push_frame (m4 *, m4__macro_frame *, const char *,
+                                    size_t, m4_symbol *);
+static void    collect_argument  (m4 *, m4__macro_frame *, arg_state);
+static m4__macro_frame *call_frame (m4 *, m4__macro_frame *);
 static void    expand_macro      (m4 *, const char *, size_t, m4_symbol *);
+static m4_symbol *lookup_macro   (m4 *, m4_symbol_value *, const char **,
+                                  size_t *);
 static bool    expand_token      (m4 *, m4_obstack *, m4__token_type,
                                   m4_symbol_value *, int, bool);
-static bool    expand_argument   (m4 *, m4_obstack *, m4_symbol_value *,
-                                  const m4_call_info *);
+static arg_state expand_argument (m4 *, m4__macro_frame *, m4_symbol **,
+                                  const char **, size_t *);
 static void    process_macro     (m4 *, m4_symbol_value *, m4_obstack *, int,
                                   m4_macro_args *);
 
@@ -136,12 +148,13 @@ static unsigned int trace_header (m4 *, const m4_call_info *);
 static void    trace_flush       (m4 *, unsigned int);
 
 
-/* The number of the current call of expand_macro ().  */
-static size_t macro_call_id = 0;
-
 /* A placeholder symbol value representing the empty string, used to
-   optimize checks for emptiness.  */
-static m4_symbol_value empty_symbol;
+   optimize checks for emptiness.  It is never modified, so it can be
+   shared by all contexts.  */
+static m4_symbol_value empty_symbol =
+  {
+    NULL, NULL, 0, NULL, 0, SIZE_MAX, 0, M4_SYMBOL_TEXT, { { 0, "", 0 } }
+  };
 
 #if DEBUG_MACRO
 /* True if significant changes to stacks should be printed to the
@@ -171,26 +184,100 @@ m4_macro_expand_input (m4 *context)
     debug_macro_level = strtol (s, NULL, 0);
 #endif /* DEBUG_MACRO */
 
-  m4_set_symbol_value_text (&empty_symbol, "", 0, 0);
-  VALUE_MAX_ARGS (&empty_symbol) = -1;
-
   while ((type = m4__next_token (context, &token, &line, NULL, false, NULL))
          != M4_TOKEN_EOF)
     expand_token (context, NULL, type, &token, line, true);
 }
+
+/* Expand the LEN bytes of IN as if they were the only input file of a
+   run with the current state of CONTEXT: text saved by m4wrap is
+   expanded at the end, and all diversions are undiverted.  Store the
+   output in *OUT, a malloc'd NUL-terminated string, and its length in
+   *OUTLEN.  Definitions and other changes of state made by IN are
+   kept for later calls, but the input engine and the diversions are
+   reset, so that the context can serve any number of calls.  Return
+   false if an error was reported during the call, without affecting
+   the exit status of CONTEXT.  This must not be called while other
+   input is being read.  */
+bool
+m4_expand_string (m4 *context, const char *in, size_t len, char **out,
+                  size_t *outlen)
+{
+  int status = m4_get_exit_status (context);
+  m4_obstack *obs;
+  bool result;
+
+  assert (!context->expansion_level);
+  m4__input_reset (context);
+  m4_set_exit_status (context, EXIT_SUCCESS);
+  m4_make_diversion (context, 0);
+  m4__output_capture (context);
+
+  obs = m4_push_string_init (context, "", 0);
+  obstack_grow (obs, in, len);
+  m4_push_string_finish (context);
+  m4_macro_expand_input (context);
+  while (m4_pop_wrapup (context))
+    m4_macro_expand_input (context);
+  m4_make_diversion (context, 0);
+  m4_undivert_all (context);
+
+  *out = m4__output_release (context, outlen);
+  result = m4_get_exit_status (context) == EXIT_SUCCESS;
+  m4_set_exit_status (context, status);
+  return result;
+}
 
 
+/* Look up the word TOKEN in the symbol table, and return the symbol
+   if it should be expanded as a macro, or NULL if the word is just
+   text.  On success, set *NAME and *LEN to the macro name, which
+   omits any leading escape character.  */
+static m4_symbol *
+lookup_macro (m4 *context, m4_symbol_value *token, const char **name,
+              size_t *len)
+{
+  m4_symbol *symbol;
+  const char *textp = m4_get_symbol_value_text (token);
+  size_t len2 = m4_get_symbol_value_len (token);
+
+  if (m4_has_syntax (M4SYNTAX, *textp, M4_SYNTAX_ESCAPE))
+    {
+      textp++;
+      len2--;
+    }
+
+  symbol = m4_symbol_lookup (M4SYMTAB, textp, len2);
+  assert (!symbol || !m4_is_symbol_void (symbol));
+  if (context->stats)
+    {
+      context->stats->lookups++;
+      if (symbol)
+        context->stats->hits++;
+    }
+  if (symbol == NULL
+      || (symbol->value->type == M4_SYMBOL_FUNC
+          && BIT_TEST (SYMBOL_FLAGS (symbol), VALUE_BLIND_ARGS_BIT)
+          && !m4__next_token_is_open (context)))
+    return NULL;
+  *name = textp;
+  *len = len2;
+  return symbol;
+}
+
 /* Expand one token onto OBS, according to its type.  If OBS is NULL,
    output the expansion to the current diversion.  TYPE determines the
    contents of TOKEN.  Potential macro names (a TYPE of M4_TOKEN_WORD)
    are looked up in the symbol table, to see if they have a macro
    definition.  If they have, they are expanded as macros, otherwise
-   the text are just copied to the output.  LINE determines where
-   TOKEN began.  FIRST is true if there is no prior content in the
-   current macro argument.  Return true if the result is guranteed to
-   give the same parse on rescan in a quoted context with the same
-   quote age.  Returning false is always safe, although it may lead to
-   slower performance.  */
+   the text are just copied to the output.  Macros are only expanded
+   here at the top level; expand_argument handles words found while
+   collecting arguments.  LINE determines where TOKEN began.  FIRST is
+   true if there is no prior content in the current macro argument.
+   Return true if the result is guranteed to give the same parse on
+   rescan in a quoted context with the same quote age.  Returning
+   false is always safe, although it may lead to slower
+   performance.  */
 static bool
 expand_token (m4 *context, m4_obstack *obs, m4__token_type type,
               m4_symbol_value *token, int line, bool first)
@@ -253,31 +340,22 @@ expand_token (m4 *context, m4_obstack *obs, m4__token_type type,
 
     case M4_TOKEN_WORD:
       {
-        const char *textp = text;
-        size_t len = m4_get_symbol_value_len (token);
-        size_t len2 = len;
+        const char *name;
+        size_t len;
 
-        if (m4_has_syntax (M4SYNTAX, *textp, M4_SYNTAX_ESCAPE))
+        symbol = lookup_macro (context, token, &name, &len);
+        if (symbol == NULL)
           {
-            textp++;
-            len2--;
-          }
-
-        symbol = m4_symbol_lookup (M4SYMTAB, textp, len2);
-        assert (!symbol || !m4_is_symbol_void (symbol));
-        if (symbol == NULL
-            || (symbol->value->type == M4_SYMBOL_FUNC
-                && BIT_TEST (SYMBOL_FLAGS (symbol), VALUE_BLIND_ARGS_BIT)
-                && !m4__next_token_is_open (context)))
-          {
-            m4_divert_text (context, obs, text, len, line);
+            m4_divert_text (context, obs, text,
+                            m4_get_symbol_value_len (token), line);
             /* If safe_quotes is true, then words do not overlap with
                quote delimiters.  If it is false, we give the
                conservative answer of false rather than prove that no
                multi-byte delimiters are formed.  */
             return m4__safe_quotes (M4SYNTAX);
           }
-        expand_macro (context, textp, len2, symbol);
+        assert (!obs);
+        expand_macro (context, name, len, symbol);
         /* Expanding a macro may create new tokens to scan, and those
            tokens may generate unsafe text, but we did not append any
            text now.  */
@@ -291,171 +369,252 @@ expand_token (m4 *context, m4_obstack *obs, m4__token_type type,
   m4_divert_text (context, obs, text, m4_get_symbol_value_len (token), line);
   return result;
 }
-
 
-/* This function parses one argument to a macro call.  It expects the
-   first left parenthesis or the separating comma to have been read by
-   the caller.  It skips leading whitespace, then reads and expands
-   tokens, until it finds a comma or a right parenthesis at the same
-   level of parentheses.  It returns a flag indicating whether the
-   argument read is the last for the active macro call.  The arguments
-   are built on the obstack OBS, indirectly through expand_token ().
-   Report errors on behalf of CALLER.  */
-static bool
-expand_argument (m4 *context, m4_obstack *obs, m4_symbol_value *argp,
-                 const m4_call_info *caller)
-{
-  m4__token_type type;
-  m4_symbol_value token;
-  int paren_level = 0;
-  int line = m4_get_current_line (context);
-  size_t len;
-  unsigned int age = m4__quote_age (M4SYNTAX);
-  bool first = true;
 
-  memset (argp, '\0', sizeof *argp);
-  VALUE_MAX_ARGS (argp) = -1;
+/* This function parses one argument to the macro call in FRAME.  It
+   expects the first left parenthesis or the separating comma to have
+   been read by the caller.  It skips leading whitespace, then reads
+   and expands tokens, until it finds a comma or a right parenthesis
+   at the same level of parentheses.  The argument is built on the
+   obstack of the frame's expansion level, indirectly through
+   expand_token ().
+
+   Rather than recursing when a word in the argument names a macro,
+   return ARG_NESTED with *SYMBOL, *NAME and *LEN describing the
+   nested call, leaving the partial argument in FRAME; calling this
+   function again on FRAME after the nested call completes resumes
+   the argument where it left off.  Otherwise, return ARG_MORE or
+   ARG_LAST according to whether the argument read is the last for
+   the active macro call.  */
+static arg_state
+expand_argument (m4 *context, m4__macro_frame *frame, m4_symbol **symbol,
+                 const char **name, size_t *len)
+{
+  m4_obstack *obs = context->arg_stacks[frame->level].args;
+  m4_symbol_value *argp = frame->argp;
+  m4_symbol_value *token = &frame->token;
+  size_t size;
 
-  /* Skip leading white space.  */
-  do
+  if (argp == NULL)
     {
-      type = m4__next_token (context, &token, NULL, obs, true, caller);
+      /* Start a new argument.  */
+      argp = (m4_symbol_value *) obstack_alloc (obs, sizeof *argp);
+      memset (argp, '\0', sizeof *argp);
+      VALUE_MAX_ARGS (argp) = -1;
+      frame->argp = argp;
+      frame->paren_level = 0;
+      frame->line = m4_get_current_line (context);
+      frame->age = m4__quote_age (M4SYNTAX);
+      frame->first = true;
+      frame->nested = false;
+
+      /* Skip leading white space.  */
+      do
+        {
+          frame->type = m4__next_token (context, token, NULL, obs, true,
+                                        &frame->info);
+        }
+      while (frame->type == M4_TOKEN_SPACE);
     }
-  while (type == M4_TOKEN_SPACE);
 
   while (1)
     {
-      if (VALUE_MIN_ARGS (argp) < VALUE_MIN_ARGS (&token))
-        VALUE_MIN_ARGS (argp) = VALUE_MIN_ARGS (&token);
-      if (VALUE_MAX_ARGS (&token) < VALUE_MAX_ARGS (argp))
-        VALUE_MAX_ARGS (argp) = VALUE_MAX_ARGS (&token);
-      switch (type)
-        { /* TOKSW */
-        case M4_TOKEN_COMMA:
-        case M4_TOKEN_CLOSE:
-          if (paren_level == 0)
-            {
-              assert (argp->type != M4_SYMBOL_FUNC);
-              if (argp->type != M4_SYMBOL_COMP)
+      if (frame->nested)
+        /* A nested call just finished expanding; it appended no text
+           of its own, so the argument age is unchanged.  */
+        frame->nested = false;
+      else
+        {
+          if (VALUE_MIN_ARGS (argp) < VALUE_MIN_ARGS (token))
+            VALUE_MIN_ARGS (argp) = VALUE_MIN_ARGS (token);
+          if (VALUE_MAX_ARGS (token) < VALUE_MAX_ARGS (argp))
+            VALUE_MAX_ARGS (argp) = VALUE_MAX_ARGS (token);
+          switch (frame->type)
+            { /* TOKSW */
+            case M4_TOKEN_COMMA:
+            case M4_TOKEN_CLOSE:
+              if (frame->paren_level == 0)
                 {
-                  len = obstack_object_size (obs);
-                  VALUE_MODULE (argp) = NULL;
-                  if (len)
+                  assert (argp->type != M4_SYMBOL_FUNC);
+                  if (argp->type != M4_SYMBOL_COMP)
                     {
-                      obstack_1grow (obs, '\0');
-                      m4_set_symbol_value_text (argp, obstack_finish (obs),
-                                                len, age);
+                      size = obstack_object_size (obs);
+                      VALUE_MODULE (argp) = NULL;
+                      if (size)
+                        {
+                          obstack_1grow (obs, '\0');
+                          m4_set_symbol_value_text (argp,
+                                                    obstack_finish (obs),
+                                                    size, frame->age);
+                        }
+                      else
+                        m4_set_symbol_value_text (argp, "", size, 0);
                     }
                   else
-                    m4_set_symbol_value_text (argp, "", len, 0);
-                }
-              else
-                {
-                  m4__make_text_link (obs, NULL, &argp->u.u_c.end);
-                  if (argp->u.u_c.chain == argp->u.u_c.end
-                      && argp->u.u_c.chain->type == M4__CHAIN_FUNC)
                     {
-                      const m4__builtin *func = argp->u.u_c.chain->u.builtin;
-                      argp->type = M4_SYMBOL_FUNC;
-                      argp->u.builtin = func;
+                      m4__make_text_link (obs, NULL, &argp->u.u_c.end);
+                      if (argp->u.u_c.chain == argp->u.u_c.end
+                          && argp->u.u_c.chain->type == M4__CHAIN_FUNC)
+                        {
+                          const m4__builtin *func
+                            = argp->u.u_c.chain->u.builtin;
+                          argp->type = M4_SYMBOL_FUNC;
+                          argp->u.builtin = func;
+                        }
                     }
+                  return frame->type == M4_TOKEN_COMMA ? ARG_MORE : ARG_LAST;
                 }
-              return type == M4_TOKEN_COMMA;
-            }
-          /* fallthru */
-        case M4_TOKEN_OPEN:
-        case M4_TOKEN_SIMPLE:
-          if (type == M4_TOKEN_OPEN)
-            paren_level++;
-          else if (type == M4_TOKEN_CLOSE)
-            paren_level--;
-          if (!expand_token (context, obs, type, &token, line, first))
-            age = 0;
-          break;
+              /* fallthru */
+            case M4_TOKEN_OPEN:
+            case M4_TOKEN_SIMPLE:
+              if (frame->type == M4_TOKEN_OPEN)
+                frame->paren_level++;
+              else if (frame->type == M4_TOKEN_CLOSE)
+                frame->paren_level--;
+              if (!expand_token (context, obs, frame->type, token,
+                                 frame->line, frame->first))
+                frame->age = 0;
+              break;
 
-        case M4_TOKEN_EOF:
-          m4_error (context, EXIT_FAILURE, 0, caller,
-                    _("end of file in argument list"));
-          break;
+            case M4_TOKEN_EOF:
+              m4_error (context, EXIT_FAILURE, 0, &frame->info,
+                        _("end of file in argument list"));
+              break;
 
-        case M4_TOKEN_WORD:
-        case M4_TOKEN_SPACE:
-        case M4_TOKEN_STRING:
-        case M4_TOKEN_COMMENT:
-        case M4_TOKEN_MACDEF:
-          if (!expand_token (context, obs, type, &token, line, first))
-            age = 0;
-          if (token.type == M4_SYMBOL_COMP)
-            {
-              if (argp->type != M4_SYMBOL_COMP)
+            case M4_TOKEN_WORD:
+              *symbol = lookup_macro (context, token, name, len);
+              if (*symbol)
                 {
-                  argp->type = M4_SYMBOL_COMP;
-                  argp->u.u_c.chain = token.u.u_c.chain;
-                  argp->u.u_c.wrapper = argp->u.u_c.has_func = false;
+                  frame->nested = true;
+                  return ARG_NESTED;
                 }
-              else
+              m4_divert_text (context, obs, m4_get_symbol_value_text (token),
+                              m4_get_symbol_value_len (token), frame->line);
+              /* See expand_token for why this is the answer for
+                 plain words.  */
+              if (!m4__safe_quotes (M4SYNTAX))
+                frame->age = 0;
+              break;
+
+            case M4_TOKEN_SPACE:
+            case M4_TOKEN_STRING:
+            case M4_TOKEN_COMMENT:
+            case M4_TOKEN_MACDEF:
+              if (!expand_token (context, obs, frame->type, token,
+                                 frame->line, frame->first))
+                frame->age = 0;
+              if (token->type == M4_SYMBOL_COMP)
                 {
-                  assert (argp->u.u_c.end);
-                  argp->u.u_c.end->next = token.u.u_c.chain;
+                  if (argp->type != M4_SYMBOL_COMP)
+                    {
+                      argp->type = M4_SYMBOL_COMP;
+                      argp->u.u_c.chain = token->u.u_c.chain;
+                      argp->u.u_c.wrapper = argp->u.u_c.has_func = false;
+                    }
+                  else
+                    {
+                      assert (argp->u.u_c.end);
+                      argp->u.u_c.end->next = token->u.u_c.chain;
+                    }
+                  argp->u.u_c.end = token->u.u_c.end;
+                  if (token->u.u_c.has_func)
+                    argp->u.u_c.has_func = true;
                 }
-              argp->u.u_c.end = token.u.u_c.end;
-              if (token.u.u_c.has_func)
-                argp->u.u_c.has_func = true;
-            }
-          break;
+              break;
 
-        case M4_TOKEN_ARGV:
-          assert (paren_level == 0 && argp->type == M4_SYMBOL_VOID
-                  && obstack_object_size (obs) == 0
-                  && token.u.u_c.chain == token.u.u_c.end
-                  && token.u.u_c.chain->quote_age == age
-                  && token.u.u_c.chain->type == M4__CHAIN_ARGV);
-          argp->type = M4_SYMBOL_COMP;
-          argp->u.u_c.chain = argp->u.u_c.end = token.u.u_c.chain;
-          argp->u.u_c.wrapper = true;
-          argp->u.u_c.has_func = token.u.u_c.has_func;
-          type = m4__next_token (context, &token, NULL, NULL, false, caller);
-          if (argp->u.u_c.chain->u.u_a.skip_last)
-            assert (type == M4_TOKEN_COMMA);
-          else
-            assert (type == M4_TOKEN_COMMA || type == M4_TOKEN_CLOSE);
-          return type == M4_TOKEN_COMMA;
+            case M4_TOKEN_ARGV:
+              assert (frame->paren_level == 0
+                      && argp->type == M4_SYMBOL_VOID
+                      && obstack_object_size (obs) == 0
+                      && token->u.u_c.chain == token->u.u_c.end
+                      && token->u.u_c.chain->quote_age == frame->age
+                      && token->u.u_c.chain->type == M4__CHAIN_ARGV);
+              argp->type = M4_SYMBOL_COMP;
+              argp->u.u_c.chain = argp->u.u_c.end = token->u.u_c.chain;
+              argp->u.u_c.wrapper = true;
+              argp->u.u_c.has_func = token->u.u_c.has_func;
+              frame->type = m4__next_token (context, token, NULL, NULL, false,
+                                            &frame->info);
+              if (argp->u.u_c.chain->u.u_a.skip_last)
+                assert (frame->type == M4_TOKEN_COMMA);
+              else
+                assert (frame->type == M4_TOKEN_COMMA
+                        || frame->type == M4_TOKEN_CLOSE);
+              return frame->type == M4_TOKEN_COMMA ? ARG_MORE : ARG_LAST;
 
-        default:
-          assert (!"expand_argument");
-          abort ();
+            default:
+              assert (!"expand_argument");
+              abort ();
+            }
         }
 
       if (argp->type != M4_SYMBOL_VOID || obstack_object_size (obs))
-        first = false;
-      type = m4__next_token (context, &token, NULL, obs, first, caller);
+        frame->first = false;
+      frame->type = m4__next_token (context, token, NULL, obs, frame->first,
+                                    &frame->info);
     }
 }
 
 
 /* The macro expansion is handled by expand_macro ().  It parses the
-   arguments, using collect_arguments (), and builds a table of pointers to
-   the arguments.  The arguments themselves are stored on a local obstack.
-   Expand_macro () uses m4_macro_call () to do the call of the macro.
-
-   Expand_macro () is potentially recursive, since it calls expand_argument
-   (), which might call expand_token (), which might call expand_macro ().
+   arguments, using expand_argument (), and builds a table of pointers
+   to the arguments.  The arguments themselves are stored on a local
+   obstack.  Expand_macro () uses m4_macro_call () to do the call of
+   the macro.
+
+   A macro call found while collecting the arguments of another call
+   must be expanded before the outer argument can continue.  Rather
+   than recursing on the C stack, each pending call is represented by
+   a heap-allocated m4__macro_frame, linked to the frame whose
+   argument it interrupted, and expand_macro () runs a loop over the
+   innermost frame until the outermost call completes.  This way, the
+   depth of nesting is bounded only by the nesting limit and available
+   memory.  Frames are recycled through context->frame_pool, so that
+   steady-state expansion does not hit the allocator.
 
    NAME points to storage on the token stack, so it is only valid
-   until a call to collect_arguments parses more tokens.  SYMBOL is
-   the result of the symbol table lookup on NAME.  */
+   until more tokens are parsed.  SYMBOL is the result of the symbol
+   table lookup on NAME.  */
 static void
 expand_macro (m4 *context, const char *name, size_t len, m4_symbol *symbol)
 {
-  void *args_base;              /* Base of stack->args on entry.  */
-  void *args_scratch;           /* Base of scratch space for m4_macro_call.  */
-  void *argv_base;              /* Base of stack->argv on entry.  */
-  m4_macro_args *argv;          /* Arguments to the called macro.  */
-  m4_obstack *expansion;        /* Collects the macro's expansion.  */
-  m4_symbol_value *value;       /* Original value of this macro.  */
+  m4__macro_frame *frame = push_frame (context, NULL, name, len, symbol);
+
+  while (frame)
+    {
+      if (frame->more_args)
+        {
+          arg_state state = expand_argument (context, frame, &symbol, &name,
+                                             &len);
+          if (state == ARG_NESTED)
+            frame = push_frame (context, frame, name, len, symbol);
+          else
+            collect_argument (context, frame, state);
+        }
+      else
+        frame = call_frame (context, frame);
+    }
+}
+
+/* Start a call to the macro SYMBOL, named by NAME and LEN, that
+   interrupts the argument collection of PREV (or NULL at the top
+   level), and return its frame.  If the macro has arguments, the
+   open parenthesis is consumed, ready for expand_argument.  */
+static m4__macro_frame *
+push_frame (m4 *context, m4__macro_frame *prev, const char *name, size_t len,
+            m4_symbol *symbol)
+{
+  m4__macro_frame *frame;       /* State of this macro call.  */
   size_t level;                 /* Expansion level of this macro.  */
   m4__macro_arg_stacks *stack;  /* Storage for this macro.  */
-  m4_call_info info;            /* Context of this macro call.  */
+  m4_macro_args args;           /* Initial header of argv.  */
+
+  frame = context->frame_pool;
+  if (frame)
+    context->frame_pool = frame->prev;
+  else
+    frame = (m4__macro_frame *) xmalloc (sizeof *frame);
+  frame->prev = prev;
 
   /* Obstack preparation.  */
   level = context->expansion_level;
@@ -482,43 +641,149 @@ expand_macro (m4 *context, const char *name, size_t len, m4_symbol *symbol)
     }
   assert (obstack_object_size (stack->args) == 0
           && obstack_object_size (stack->argv) == 0);
-  args_base = obstack_finish (stack->args);
-  argv_base = obstack_finish (stack->argv);
+  frame->args_base = obstack_finish (stack->args);
+  frame->argv_base = obstack_finish (stack->argv);
+  frame->level = level;
   m4__adjust_refcount (context, level, true);
   stack->argcount++;
 
   /* Grab the current value of this macro, because it may change while
      collecting arguments.  Likewise, grab any state needed during
      tracing.  */
-  value = m4_get_symbol_value (symbol);
-  info.file = m4_get_current_file (context);
-  info.line = m4_get_current_line (context);
-  info.call_id = ++macro_call_id;
-  info.trace = (m4_is_debug_bit (context, M4_DEBUG_TRACE_ALL)
-                || m4_get_symbol_traced (symbol));
-  info.debug_level = m4_get_debug_level_opt (context);
-  info.name = name;
-  info.name_len = len;
+  frame->value = m4_get_symbol_value (symbol);
+  frame->info.file = m4_get_current_file (context);
+  frame->info.line = m4_get_current_line (context);
+  frame->info.call_id = ++context->macro_call_id;
+  frame->info.trace = (m4_is_debug_bit (context, M4_DEBUG_TRACE_ALL)
+                       || m4_get_symbol_traced (symbol));
+  frame->info.debug_level = m4_get_debug_level_opt (context);
+  frame->info.name = name;
+  frame->info.name_len = len;
 
   /* Prepare for macro expansion.  */
-  VALUE_PENDING (value)++;
+  VALUE_PENDING (frame->value)++;
   if (m4_get_nesting_limit_opt (context) < ++context->expansion_level)
     m4_error (context, EXIT_FAILURE, 0, NULL, _("\
 recursion limit of %zu exceeded, use -L<N> to change it"),
               m4_get_nesting_limit_opt (context));
 
-  m4_trace_prepare (context, &info, value);
-  argv = collect_arguments (context, &info, symbol, stack->args, stack->argv);
-  /* Since collect_arguments can invalidate stack by reallocating
-     context->arg_stacks during a recursive expand_macro call, we must
-     reset it here.  */
-  stack = &context->arg_stacks[level];
+  M4_PROBE3 (macro__entry, name, len, context->expansion_level);
+  if (context->profile)
+    m4__profile_enter (context, &frame->info, context->expansion_level);
+  m4_trace_prepare (context, &frame->info, frame->value);
+
+  /* Begin collecting arguments.  Must copy the name here, since we
+     are consuming tokens, and since symbol table can be changed
+     during argument collection.  */
+  frame->info.name = (char *) obstack_copy0 (stack->args, name, len);
+  frame->argc = 1;
+  frame->arraylen = 0;
+  frame->quote_age = m4__quote_age (M4SYNTAX);
+  frame->wrapper = false;
+  frame->has_ref = false;
+  frame->flatten = m4_symbol_flatten_args (symbol);
+  frame->has_func = false;
+  frame->argp = NULL;
+  args.info = &frame->info;
+  args.level = level;
+  obstack_grow (stack->argv, &args, offsetof (m4_macro_args, array));
+
+  frame->more_args = m4__next_token_is_open (context);
+  if (frame->more_args)
+    /* Gobble parenthesis.  */
+    m4__next_token (context, &frame->token, NULL, NULL, false, &frame->info);
+  return frame;
+}
+
+/* Add the argument just parsed by expand_argument, with result STATE,
+   to the table of arguments of the call in FRAME.  */
+static void
+collect_argument (m4 *context, m4__macro_frame *frame, arg_state state)
+{
+  m4__macro_arg_stacks *stack = &context->arg_stacks[frame->level];
+  m4_symbol_value *tokenp = frame->argp;
+
+  if ((m4_is_symbol_value_text (tokenp) && !m4_get_symbol_value_len (tokenp))
+      || (frame->flatten && m4_is_symbol_value_func (tokenp)))
+    {
+      obstack_free (stack->args, tokenp);
+      tokenp = &empty_symbol;
+    }
+  obstack_ptr_grow (stack->argv, tokenp);
+  frame->arraylen++;
+  frame->argc++;
+  switch (tokenp->type)
+    {
+    case M4_SYMBOL_TEXT:
+      /* Be conservative - any change in quoting while collecting
+         arguments, or any unsafe argument, will require a rescan if
+         $@ is reused.  */
+      if (m4_get_symbol_value_len (tokenp)
+          && m4_get_symbol_value_quote_age (tokenp) != frame->quote_age)
+        frame->quote_age = 0;
+      break;
+    case M4_SYMBOL_FUNC:
+      frame->has_func = true;
+      break;
+    case M4_SYMBOL_COMP:
+      frame->has_ref = true;
+      if (tokenp->u.u_c.wrapper)
+        {
+          assert (tokenp->u.u_c.chain->type == M4__CHAIN_ARGV
+                  && !tokenp->u.u_c.chain->next);
+          frame->argc += (tokenp->u.u_c.chain->u.u_a.argv->argc
+                          - tokenp->u.u_c.chain->u.u_a.index
+                          - tokenp->u.u_c.chain->u.u_a.skip_last - 1);
+          frame->wrapper = true;
+        }
+      if (tokenp->u.u_c.has_func)
+        frame->has_func = true;
+      break;
+    default:
+      assert (!"expand_argument");
+      abort ();
+    }
+  frame->argp = NULL;
+  frame->more_args = state == ARG_MORE;
+}
+
+/* Perform the call in FRAME, now that all of its arguments have been
+   collected, then recycle FRAME and return the frame whose argument
+   collection it interrupted.  */
+static m4__macro_frame *
+call_frame (m4 *context, m4__macro_frame *frame)
+{
+  m4__macro_frame *prev = frame->prev;
+  m4__macro_arg_stacks *stack = &context->arg_stacks[frame->level];
+  m4_symbol_value *value = frame->value;
+  void *args_scratch;           /* Base of scratch space for m4_macro_call.  */
+  m4_macro_args *argv;          /* Arguments to the called macro.  */
+  m4_obstack *expansion;        /* Collects the macro's expansion.  */
+
+  argv = (m4_macro_args *) obstack_finish (stack->argv);
+  argv->argc = frame->argc;
+  argv->inuse = false;
+  argv->wrapper = frame->wrapper;
+  argv->has_ref = frame->has_ref;
+  argv->flatten = frame->flatten;
+  argv->has_func = frame->has_func;
+  argv->quote_age = (frame->quote_age != m4__quote_age (M4SYNTAX)
+                     ? 0 : frame->quote_age);
+  argv->arraylen = frame->arraylen;
   args_scratch = obstack_finish (stack->args);
 
   /* The actual macro call.  */
-  expansion = m4_push_string_init (context, info.file, info.line);
+  expansion = m4_push_string_init (context, frame->info.file,
+                                   frame->info.line);
   m4_macro_call (context, value, expansion, argv);
-  m4_push_string_finish ();
+  M4_PROBE4 (macro__return, frame->info.name, frame->info.name_len,
+             frame->level + 1, obstack_object_size (expansion));
+  if (context->profile)
+    m4__profile_leave (context, collected_bytes (argv),
+                       obstack_object_size (expansion));
+  if (context->stats)
+    m4__stats_call (context, frame->level);
+  m4_push_string_finish (context);
 
   /* Cleanup.  */
   argv->info = NULL;
@@ -541,111 +806,44 @@ recursion limit of %zu exceeded, use -L<N> to change it"),
           obstack_free (stack->args, args_scratch);
           if (debug_macro_level & PRINT_ARGCOUNT_CHANGES)
             xfprintf (stderr, "m4debug: -%zu- `%s' in use, level=%zu, "
-                      "refcount=%zu, argcount=%zu\n", info.call_id,
-                      argv->info->name, level, stack->refcount,
+                      "refcount=%zu, argcount=%zu\n", frame->info.call_id,
+                      frame->info.name, frame->level, stack->refcount,
                       stack->argcount);
         }
       else
         {
-          obstack_free (stack->args, args_base);
-          obstack_free (stack->argv, argv_base);
+          obstack_free (stack->args, frame->args_base);
+          obstack_free (stack->argv, frame->argv_base);
           stack->argcount--;
         }
     }
+
+  frame->prev = context->frame_pool;
+  context->frame_pool = frame;
+  return prev;
 }
 
-/* Collect all the arguments to a call of the macro SYMBOL, with call
-   context INFO.  The arguments are stored on the obstack ARGUMENTS
-   and a table of pointers to the arguments on ARGV_STACK.  Return the
-   object describing all of the macro arguments.  */
-static m4_macro_args *
-collect_arguments (m4 *context, m4_call_info *info, m4_symbol *symbol,
-                   m4_obstack *arguments, m4_obstack *argv_stack)
+/* Return the number of bytes of text collected as arguments in ARGV,
+   not counting text that is only referenced through $@.  */
+static size_t
+collected_bytes (m4_macro_args *argv)
 {
-  m4_symbol_value token;
-  m4_symbol_value *tokenp;
-  bool more_args;
-  m4_macro_args args;
-  m4_macro_args *argv;
-
-  args.argc = 1;
-  args.inuse = false;
-  args.wrapper = false;
-  args.has_ref = false;
-  args.flatten = m4_symbol_flatten_args (symbol);
-  args.has_func = false;
-  /* Must copy here, since we are consuming tokens, and since symbol
-     table can be changed during argument collection.  */
-  info->name = (char *) obstack_copy0 (arguments, info->name, info->name_len);
-  args.quote_age = m4__quote_age (M4SYNTAX);
-  args.info = info;
-  args.level = context->expansion_level - 1;
-  args.arraylen = 0;
-  obstack_grow (argv_stack, &args, offsetof (m4_macro_args, array));
-
-  if (m4__next_token_is_open (context))
+  size_t len = 0;
+  size_t i;
+
+  for (i = 0; i < argv->arraylen; i++)
     {
-      /* Gobble parenthesis, then collect arguments.  */
-      m4__next_token (context, &token, NULL, NULL, false, info);
-      do
-        {
-          tokenp = (m4_symbol_value *) obstack_alloc (arguments,
-                                                      sizeof *tokenp);
-          more_args = expand_argument (context, arguments, tokenp, info);
+      m4_symbol_value *value = argv->array[i];
+      m4__symbol_chain *chain;
 
-          if ((m4_is_symbol_value_text (tokenp)
-               && !m4_get_symbol_value_len (tokenp))
-              || (args.flatten && m4_is_symbol_value_func (tokenp)))
-            {
-              obstack_free (arguments, tokenp);
-              tokenp = &empty_symbol;
-            }
-          obstack_ptr_grow (argv_stack, tokenp);
-          args.arraylen++;
-          args.argc++;
-          switch (tokenp->type)
-            {
-            case M4_SYMBOL_TEXT:
-              /* Be conservative - any change in quoting while
-                 collecting arguments, or any unsafe argument, will
-                 require a rescan if $@ is reused.  */
-              if (m4_get_symbol_value_len (tokenp)
-                  && m4_get_symbol_value_quote_age (tokenp) != args.quote_age)
-                args.quote_age = 0;
-              break;
-            case M4_SYMBOL_FUNC:
-              args.has_func = true;
-              break;
-            case M4_SYMBOL_COMP:
-              args.has_ref = true;
-              if (tokenp->u.u_c.wrapper)
-                {
-                  assert (tokenp->u.u_c.chain->type == M4__CHAIN_ARGV
-                          && !tokenp->u.u_c.chain->next);
-                  args.argc += (tokenp->u.u_c.chain->u.u_a.argv->argc
-                                - tokenp->u.u_c.chain->u.u_a.index
-                                - tokenp->u.u_c.chain->u.u_a.skip_last - 1);
-                  args.wrapper = true;
-                }
-              if (tokenp->u.u_c.has_func)
-                args.has_func = true;
-              break;
-            default:
-              assert (!"expand_argument");
-              abort ();
-            }
-        }
-      while (more_args);
+      if (m4_is_symbol_value_text (value))
+        len += m4_get_symbol_value_len (value);
+      else if (value->type == M4_SYMBOL_COMP)
+        for (chain = value->u.u_c.chain; chain; chain = chain->next)
+          if (chain->type == M4__CHAIN_STR)
+            len += chain->u.u_s.len;
     }
-  argv = (m4_macro_args *) obstack_finish (argv_stack);
-  argv->argc = args.argc;
-  argv->wrapper = args.wrapper;
-  argv->has_ref = args.has_ref;
-  argv->has_func = args.has_func;
-  if (args.quote_age != m4__quote_age (M4SYNTAX))
-    argv->quote_age = 0;
-  argv->arraylen = args.arraylen;
-  return argv;
+  return len;
 }
 
 
@@ -883,7 +1081,14 @@ m4_trace_prepare (m4 *context, const m4_call_info *info,
     quotes = m4_get_syntax_quotes (M4SYNTAX);
   if (info->trace && (info->debug_level & M4_DEBUG_TRACE_CALL))
     {
-      unsigned int start = trace_header (context, info);
+      unsigned int start;
+
+      if (m4_get_trace_binary_opt (context))
+        {
+          m4__trace_prepare (context, info, value);
+          return;
+        }
+      start = trace_header (context, info);
       obstack_grow (&context->trace_messages, info->name, info->name_len);
       obstack_grow (&context->trace_messages, " ... = ", 7);
       m4__symbol_value_print (context, value, &context->trace_messages, quotes,
@@ -900,10 +1105,16 @@ static unsigned int
 trace_pre (m4 *context, m4_macro_args *argv)
 {
   int trace_level = argv->info->debug_level;
-  unsigned int start = trace_header (context, argv->info);
+  unsigned int start;
   m4_obstack *trace = &context->trace_messages;
 
   assert (argv->info->trace);
+  if (m4_get_trace_binary_opt (context))
+    {
+      m4__trace_call (context, argv);
+      return 0;
+    }
+  start = trace_header (context, argv->info);
   obstack_grow (trace, argv->info->name, argv->info->name_len);
 
   if (1 < m4_arg_argc (argv) && (trace_level & M4_DEBUG_TRACE_ARGS))
@@ -929,6 +1140,11 @@ static void
 trace_post (m4 *context, unsigned int start, const m4_call_info *info)
 {
   assert (info->trace);
+  if (m4_get_trace_binary_opt (context))
+    {
+      m4__trace_result (context, info);
+      return;
+    }
   if (info->debug_level & M4_DEBUG_TRACE_EXPANSION)
     {
       obstack_grow (&context->trace_messages, " -> ", 4);
@@ -958,7 +1174,7 @@ m4__adjust_refcount (m4 *context, size_t level, bool increase)
       obstack_free (stack->argv, stack->argv_base);
       if ((debug_macro_level & PRINT_ARGCOUNT_CHANGES) && 1 < stack->argcount)
         xfprintf (stderr, "m4debug: -%zu- freeing %zu args, level=%zu\n",
-                  macro_call_id, stack->argcount, level);
+                  context->macro_call_id, stack->argcount, level);
       stack->argcount = 0;
     }
   if (debug_macro_level
@@ -1745,7 +1961,7 @@ m4_wrap_args (m4 *context, m4_macro_args *argv)
           abort ();
         }
     }
-  m4__push_wrapup_finish ();
+  m4__push_wrapup_finish (context);
 }
 
 
@@ -63,6 +63,22 @@
  * names to the expansion text.  Any macros defined in `m4_macro_table'
  * are installed into the M4 symbol table with set_module_macro_table().
  *
+ * Most runs only ever call a handful of the builtins of the modules
+ * loaded at startup, so their definitions are not installed right
+ * away: the symbol table asks module_lazy_CB() for each name that it
+ * cannot find, which installs the pending definitions of that name in
+ * the order the modules were loaded.  Names that are already in the
+ * symbol table when a module is loaded are installed right away, so
+ * that they are shadowed as before.
+ *
+ * The libltdl handles, and the m4_module wrappers with their sorted
+ * builtin tables, are shared by every context in the process.  What
+ * each context has loaded, and which of those definitions it has not
+ * installed yet, is kept in the m4__module_ref list of that context,
+ * so that a module loaded by two contexts is installed into both of
+ * their symbol tables.  Modules that need per-context state keep it
+ * with m4_set_module_data().
+ *
  * Each time a module is loaded, the module function prototyped as
  * "M4INIT_HANDLER (<module name>)" is called, if defined.  Any value
  * stored in OBS by this function becomes the expansion of the macro
@@ -86,14 +102,49 @@ static const char*  module_dlerror (void);
 static int          module_remove  (m4 *context, m4_module *module,
                                     m4_obstack *obs);
 
-static void         install_builtin_table (m4*, m4_module *);
-static void         install_macro_table   (m4*, m4_module *);
+static void         install_builtin       (m4 *, m4_module *, size_t);
+static void         install_macro         (m4 *, m4_module *, size_t);
+static void         install_builtin_table (m4*, m4__module_ref *);
+static void         install_macro_table   (m4*, m4__module_ref *);
+static void         module_defer          (m4 *, m4__module_ref *);
+static void         module_undefer        (m4 *, m4__module_ref *);
+static void         module_lazy_CB        (m4_symbol_table *, const char *,
+                                           size_t, void *);
 
 static int          m4__module_interface        (lt_dlhandle handle,
                                                  const char *id_string);
 
+/* A module loaded by a context.  */
+struct m4__module_ref
+{
+  m4_module *module;            /* Module shared by all contexts.  */
+  int refcount;                 /* Loads by this context not unloaded.  */
+  bool *pending;                /* Builtins, then macros, not installed.  */
+  m4__module_ref *next;         /* Next module, in the order loaded.  */
+};
+
+/* Data kept by a module on behalf of a context.  */
+struct m4__module_data
+{
+  char *name;                   /* Key chosen by the module.  */
+  void *data;                   /* The data.  */
+  m4_module_data_free_func *free_func; /* Releases DATA, or NULL.  */
+  m4_module_data_free_func *fork_func; /* Forgets the parent, or NULL.  */
+  m4__module_data *next;
+};
+
 static lt_dlinterface_id iface_id = NULL;
 
+/* Number of contexts that initialized the module loader.  libltdl
+   keeps a single list of handles per process, so the loader is only
+   torn down once the last of them exits.  */
+static size_t iface_users = 0;
+
+/* Past this many misses, the input is large enough that installing
+   the remaining definitions is cheaper than searching for them on
+   every miss.  */
+#define PENDING_MISS_LIMIT      1024
+
 const char *
 m4_get_module_name (const m4_module *module)
 {
@@ -133,64 +184,205 @@ m4_module_import (m4 *context, const char *module_name,
   return symbol_address;
 }
 
+/* Install builtin number I of MODULE.  */
+static void
+install_builtin (m4 *context, m4_module *module, size_t i)
+{
+  m4_symbol_value *value = m4_symbol_value_create ();
+  const char *name = module->builtins[i].builtin.name;
+
+  m4__set_symbol_value_builtin (value, &module->builtins[i]);
+  if (m4_get_prefix_builtins_opt (context))
+    name = xasprintf ("m4_%s", name);
+
+  m4_symbol_pushdef (M4SYMTAB, name, strlen (name), value);
+
+  if (m4_get_prefix_builtins_opt (context))
+    DELETE (name);
+}
+
+/* Install macro number I of MODULE.  */
 static void
-install_builtin_table (m4 *context, m4_module *module)
+install_macro (m4 *context, m4_module *module, size_t i)
 {
+  const m4_macro *mp = &module->macros[i];
+  m4_symbol_value *value = m4_symbol_value_create ();
+  size_t len = strlen (mp->value);
+
+  /* Sanity check that builtins meet the required interface.  */
+  assert (mp->min_args <= mp->max_args);
+
+  m4_set_symbol_value_text (value, xmemdup0 (mp->value, len), len, 0);
+  VALUE_MODULE (value) = module;
+  VALUE_MIN_ARGS (value) = mp->min_args;
+  VALUE_MAX_ARGS (value) = mp->max_args;
+
+  m4_symbol_pushdef (M4SYMTAB, mp->name, strlen (mp->name), value);
+}
+
+static void
+install_builtin_table (m4 *context, m4__module_ref *ref)
+{
+  m4_module *module = ref->module;
   size_t i;
 
   assert (context);
   assert (module);
+  for (i = 0; i < module->builtins_len; i++)
+    if (!ref->pending || ref->pending[i])
+      install_builtin (context, module, i);
+}
+
+static void
+install_macro_table (m4 *context, m4__module_ref *ref)
+{
+  m4_module *module = ref->module;
+  size_t i;
+
+  assert (context);
+  assert (module);
+  for (i = 0; i < module->macros_len; i++)
+    if (!ref->pending || ref->pending[module->builtins_len + i])
+      install_macro (context, module, i);
+}
+
+/* Return the reference of CONTEXT to MODULE, or NULL if CONTEXT has
+   not loaded it.  */
+static m4__module_ref *
+module_ref (m4 *context, const m4_module *module)
+{
+  m4__module_ref *ref;
+
+  for (ref = context->modules; ref; ref = ref->next)
+    if (ref->module == module)
+      break;
+  return ref;
+}
+
+/* Return true if some module loaded by CONTEXT has definitions that
+   are not installed yet.  */
+static bool
+module_pending (m4 *context)
+{
+  m4__module_ref *ref;
+
+  for (ref = context->modules; ref; ref = ref->next)
+    if (ref->pending)
+      return true;
+  return false;
+}
+
+/* Arrange for the definitions of the module of REF to be installed
+   when their names are first looked up, except for the names that are
+   already in the symbol table of CONTEXT, which are installed now.  */
+static void
+module_defer (m4 *context, m4__module_ref *ref)
+{
+  m4_module *module = ref->module;
+  size_t len = module->builtins_len + module->macros_len;
+  size_t i;
+
+  if (!len)
+    return;
+  if (!module_pending (context))
+    context->pending_misses = 0;
+  ref->pending = (bool *) xnmalloc (len, sizeof *ref->pending);
   for (i = 0; i < module->builtins_len; i++)
     {
-      m4_symbol_value *value = m4_symbol_value_create ();
       const char *name = module->builtins[i].builtin.name;
+      char *prefixed = NULL;
 
-      m4__set_symbol_value_builtin (value, &module->builtins[i]);
       if (m4_get_prefix_builtins_opt (context))
-        name = xasprintf ("m4_%s", name);
-
-      m4_symbol_pushdef (M4SYMTAB, name, strlen (name), value);
+        name = prefixed = xasprintf ("m4_%s", name);
+      ref->pending[i] = !m4__symtab_peek (M4SYMTAB, name, strlen (name));
+      free (prefixed);
+      if (!ref->pending[i])
+        install_builtin (context, module, i);
+    }
+  for (i = 0; i < module->macros_len; i++)
+    {
+      const char *name = module->macros[i].name;
+      bool *pending = &ref->pending[module->builtins_len + i];
 
-      if (m4_get_prefix_builtins_opt (context))
-        DELETE (name);
+      *pending = !m4__symtab_peek (M4SYMTAB, name, strlen (name));
+      if (!*pending)
+        install_macro (context, module, i);
     }
-  if (i)
-    m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
-                      _("module %s: builtins loaded"),
-                      m4_get_module_name (module));
+
+  m4_symtab_set_lazy (M4SYMTAB, module_lazy_CB, context);
 }
 
+/* Forget the definitions of the module of REF that are not installed
+   yet.  */
 static void
-install_macro_table (m4 *context, m4_module *module)
+module_undefer (m4 *context, m4__module_ref *ref)
 {
-  const m4_macro *mp;
-
-  assert (context);
-  assert (module);
+  if (!ref->pending)
+    return;
+  free (ref->pending);
+  ref->pending = NULL;
+  if (!module_pending (context)
+      && m4__symtab_get_lazy (M4SYMTAB) == module_lazy_CB)
+    m4_symtab_set_lazy (M4SYMTAB, NULL, NULL);
+}
 
-  mp = (const m4_macro *) lt_dlsym (module->handle, MACRO_SYMBOL);
+/* Install the pending definitions of NAME of length LEN into SYMTAB,
+   on behalf of the context in USERDATA, or all of them if NAME is
+   NULL.  */
+static void
+module_lazy_CB (m4_symbol_table *symtab, const char *name, size_t len,
+                void *userdata)
+{
+  m4 *context = (m4 *) userdata;
+  m4__module_ref *ref;
+  size_t i;
 
-  if (mp)
+  if (!name || ++context->pending_misses > PENDING_MISS_LIMIT)
     {
-      for (; mp->name != NULL; mp++)
-        {
-          m4_symbol_value *value = m4_symbol_value_create ();
-          size_t len = strlen (mp->value);
+      for (ref = context->modules; ref; ref = ref->next)
+        if (ref->pending)
+          {
+            install_builtin_table (context, ref);
+            install_macro_table (context, ref);
+            module_undefer (context, ref);
+          }
+      m4_symtab_set_lazy (symtab, NULL, NULL);
+      return;
+    }
 
-          /* Sanity check that builtins meet the required interface.  */
-          assert (mp->min_args <= mp->max_args);
+  for (ref = context->modules; ref; ref = ref->next)
+    {
+      m4_module *module = ref->module;
+      m4__builtin *builtin = NULL;
 
-          m4_set_symbol_value_text (value, xmemdup0 (mp->value, len), len, 0);
-          VALUE_MODULE (value) = module;
-          VALUE_MIN_ARGS (value) = mp->min_args;
-          VALUE_MAX_ARGS (value) = mp->max_args;
+      if (!ref->pending)
+        continue;
 
-          m4_symbol_pushdef (M4SYMTAB, mp->name, strlen (mp->name), value);
+      if (!m4_get_prefix_builtins_opt (context))
+        builtin = m4__builtin_find (module, name, len);
+      else if (len > 3 && memcmp (name, "m4_", 3) == 0)
+        builtin = m4__builtin_find (module, name + 3, len - 3);
+      if (builtin)
+        {
+          i = builtin - module->builtins;
+          if (ref->pending[i])
+            {
+              ref->pending[i] = false;
+              install_builtin (context, module, i);
+            }
         }
 
-      m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
-                        _("module %s: macros loaded"),
-                        m4_get_module_name (module));
+      for (i = 0; i < module->macros_len; i++)
+        {
+          bool *pending = &ref->pending[module->builtins_len + i];
+
+          if (*pending && strlen (module->macros[i].name) == len
+              && memcmp (module->macros[i].name, name, len) == 0)
+            {
+              *pending = false;
+              install_macro (context, module, i);
+            }
+        }
     }
 }
 
@@ -198,11 +390,30 @@ m4_module *
 m4_module_load (m4 *context, const char *name, m4_obstack *obs)
 {
   m4_module *module = m4__module_open (context, name, obs);
+  m4__module_ref *ref = module ? module_ref (context, module) : NULL;
 
-  if (module && module->refcount == 1)
+  if (ref && ref->refcount == 1)
     {
-      install_builtin_table (context, module);
-      install_macro_table (context, module);
+      m4_symtab_lazy_func *lazy = m4__symtab_get_lazy (M4SYMTAB);
+
+      /* Another source of deferred symbols, such as a frozen file,
+         cannot be combined with this one.  */
+      if (!lazy || lazy == module_lazy_CB)
+        module_defer (context, ref);
+      else
+        {
+          install_builtin_table (context, ref);
+          install_macro_table (context, ref);
+        }
+
+      if (module->builtins_len)
+        m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
+                          _("module %s: builtins loaded"),
+                          m4_get_module_name (module));
+      if (module->macros)
+        m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
+                          _("module %s: macros loaded"),
+                          m4_get_module_name (module));
     }
 
   return module;
@@ -229,7 +440,7 @@ m4_module_unload (m4 *context, const char *name, m4_obstack *obs)
   if (name)
     module = m4__module_find (name);
 
-  if (!module)
+  if (!module || !module_ref (context, module))
     {
       const char *error_msg = _("module not loaded");
 
@@ -317,14 +528,11 @@ m4__module_init (m4 *context)
 {
   int errors = 0;
 
-  /* Do this only once!  If we already have an iface_id, then the
-     module system has already been initialized.  */
-  if (iface_id)
-    {
-      m4_error (context, 0, 0, NULL,
-                _("multiple module loader initializations"));
-      return;
-    }
+  /* Do this only once per process!  If we already have an iface_id,
+     then another context has already initialized the module
+     system.  */
+  if (iface_users++)
+    return;
 
   errors      = lt_dlinit ();
 
@@ -483,6 +691,13 @@ m4__module_open (m4 *context, const char *name, m4_obstack *obs)
             }
           qsort (module->builtins, module->builtins_len,
                  sizeof *module->builtins, compare_builtin_CB);
+          m4__builtin_hash_module (module);
+
+          module->macros = (const m4_macro *) lt_dlsym (module->handle,
+                                                        MACRO_SYMBOL);
+          if (module->macros)
+            while (module->macros[module->macros_len].name)
+              module->macros_len++;
 
           /* clear out any stale errors, since we have to use
              lt_dlerror to distinguish between success and
@@ -499,6 +714,19 @@ m4__module_open (m4 *context, const char *name, m4_obstack *obs)
       /* Find and run any initializing function in the opened module,
          each time the module is opened.  */
       module->refcount++;
+      {
+        m4__module_ref *ref = module_ref (context, module);
+        if (!ref)
+          {
+            m4__module_ref **tail = &context->modules;
+            while (*tail)
+              tail = &(*tail)->next;
+            ref = (m4__module_ref *) xzalloc (sizeof *ref);
+            ref->module = module;
+            *tail = ref;
+          }
+        ref->refcount++;
+      }
       init_func = (m4_module_init_func *) lt_dlsym (handle, INIT_SYMBOL);
       if (init_func)
         {
@@ -531,22 +759,34 @@ m4__module_open (m4 *context, const char *name, m4_obstack *obs)
 void
 m4__module_exit (m4 *context)
 {
-  m4_module *   module  = m4__module_next (NULL);
-  int           errors  = 0;
+  m4__module_ref *      ref;
+  int                   errors  = 0;
 
-  while (module && !errors)
-    {
-      m4_module *pending = module;
+  /* There is no point installing definitions just to remove them.  */
+  for (ref = context->modules; ref; ref = ref->next)
+    module_undefer (context, ref);
 
-      /* If we are about to unload the final reference, move on to the
-         next module before we unload the current one.  */
-      if (pending->refcount <= 1)
-        module = m4__module_next (module);
+  /* Once the final reference of this context to a module is gone,
+     module_remove frees REF, so look at the head of the list each
+     time.  */
+  while ((ref = context->modules) && !errors)
+    errors = module_remove (context, ref->module, NULL);
 
-      errors = module_remove (context, pending, NULL);
+  /* The finish hooks are done, so the data of the modules can go.  */
+  while (context->module_data)
+    {
+      m4__module_data *data = context->module_data;
+      context->module_data = data->next;
+      if (data->free_func)
+        data->free_func (data->data);
+      free (data->name);
+      free (data);
     }
 
   assert (iface_id);            /* need to have called m4__module_init */
+  assert (iface_users);
+  if (--iface_users)
+    return;
   lt_dlinterface_free (iface_id);
   iface_id = NULL;
 
@@ -588,8 +828,15 @@ module_remove (m4 *context, m4_module *module, m4_obstack *obs)
   bool                          last_reference = false;
   bool                          resident = false;
   m4_module_finish_func *       finish_func;
+  m4__module_ref *              ref;
+  m4__module_ref **             prev;
 
   assert (module && module->handle);
+  for (prev = &context->modules; *prev; prev = &(*prev)->next)
+    if ((*prev)->module == module)
+      break;
+  ref = *prev;
+  assert (ref);
 
   /* Be careful when closing myself.  */
   handle = module->handle;
@@ -609,18 +856,22 @@ module_remove (m4 *context, m4_module *module, m4_obstack *obs)
     }
 #endif /* DEBUG_MODULES */
 
-  if (module->refcount-- == 1)
+  if (ref->refcount-- == 1)
     {
-      /* Remove the table references only when ref_count is *exactly*
-         equal to 1.  If module_close is called again on a
-         resident module after the references have already been
-         removed, we needn't try to remove them again!  */
+      /* Remove the table references only when the count of this
+         context is *exactly* equal to 1.  If module_close is called
+         again on a resident module after the references have already
+         been removed, we needn't try to remove them again!  */
+      module_undefer (context, ref);
       m4__symtab_remove_module_references (M4SYMTAB, module);
+      *prev = ref->next;
+      free (ref);
 
       m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
                         _("module %s: symbols unloaded"), name);
-      last_reference = true;
     }
+  if (module->refcount-- == 1)
+    last_reference = true;
 
   finish_func = (m4_module_finish_func *) lt_dlsym (handle, FINISH_SYMBOL);
   if (finish_func)
@@ -680,6 +931,79 @@ module_remove (m4 *context, m4_module *module, m4_obstack *obs)
 }
 
 
+/* Return the data that a module kept on behalf of CONTEXT under NAME
+   with m4_set_module_data, or NULL.  */
+void *
+m4_get_module_data (m4 *context, const char *name)
+{
+  m4__module_data *data;
+
+  assert (context && name);
+  for (data = context->module_data; data; data = data->next)
+    if (strcmp (data->name, name) == 0)
+      return data->data;
+  return NULL;
+}
+
+/* Keep DATA on behalf of CONTEXT under NAME, which is usually the
+   name of the module, replacing any earlier data of that NAME without
+   releasing it.  Unless FREE_FUNC is NULL, it is called on DATA once
+   CONTEXT has unloaded all its modules.  This lets a module keep
+   state for each context instead of in file-scope variables.  */
+void
+m4_set_module_data (m4 *context, const char *name, void *data,
+                    m4_module_data_free_func *free_func)
+{
+  m4__module_data *entry;
+
+  assert (context && name);
+  for (entry = context->module_data; entry; entry = entry->next)
+    if (strcmp (entry->name, name) == 0)
+      break;
+  if (!entry)
+    {
+      entry = (m4__module_data *) xmalloc (sizeof *entry);
+      entry->name = xstrdup (name);
+      entry->fork_func = NULL;
+      entry->next = context->module_data;
+      context->module_data = entry;
+    }
+  entry->data = data;
+  entry->free_func = free_func;
+}
+
+/* Arrange for FORK_FUNC to be called on the data that a module keeps
+   on behalf of CONTEXT under NAME, in a child that m4 forks to carry
+   on from the state of CONTEXT, as batch and server modes do.  It must
+   let go of what only the parent may use, such as the processes that
+   the parent started, without waiting for them.  */
+void
+m4_set_module_fork_func (m4 *context, const char *name,
+                         m4_module_data_free_func *fork_func)
+{
+  m4__module_data *entry;
+
+  assert (context && name);
+  for (entry = context->module_data; entry; entry = entry->next)
+    if (strcmp (entry->name, name) == 0)
+      break;
+  assert (entry);
+  entry->fork_func = fork_func;
+}
+
+/* Call the fork hooks of the module data of CONTEXT, in a child that
+   was just forked.  */
+void
+m4__module_forked (m4 *context)
+{
+  m4__module_data *data;
+
+  for (data = context->module_data; data; data = data->next)
+    if (data->fork_func)
+      data->fork_func (data->data);
+}
+
+
 /* Below here are the accessor functions behind fast macros.  Declare
    them last, so the rest of the file can use the macros.  */
 
@@ -75,54 +75,86 @@ struct m4_diversion
     size_t used;                /* Used buffer length, or tmp file exists.  */
   };
 
-/* Sorted set of diversions 1 through INT_MAX.  */
-static gl_oset_t diversion_table;
+/* The state of the output engine, one per context.  */
+struct m4__output_state
+{
+  /* Sorted set of diversions 1 through INT_MAX.  */
+  gl_oset_t diversion_table;
+
+  /* Diversion 0 (not part of diversion_table).  */
+  m4_diversion div0;
+
+  /* Linked list of reclaimed diversion storage.  */
+  m4_diversion *free_list;
+
+  /* Obstack from which diversion storage is allocated.  */
+  m4_obstack diversion_storage;
+
+  /* Total size of all in-memory buffer sizes.  */
+  size_t total_buffer_size;
+
+  /* Current output diversion, NULL if output is being currently
+     discarded.  diversion->u is guaranteed non-NULL except when the
+     diversion has never been used; use size to determine if it is a
+     malloc'd buffer or a FILE.  diversion->used is 0 if u.file is
+     stdout, and non-zero if this is a malloc'd buffer or a temporary
+     diversion file.  */
+  m4_diversion *diversion;
+
+  /* Cache of diversion->u.file, only valid when diversion->size is
+     0.  */
+  FILE *file;
 
-/* Diversion 0 (not part of diversion_table).  */
-static m4_diversion div0;
+  /* Cache of diversion->u.buffer + diversion->used, only valid when
+     diversion->size is non-zero.  */
+  char *cursor;
 
-/* Linked list of reclaimed diversion storage.  */
-static m4_diversion *free_list;
+  /* Cache of diversion->size - diversion->used, only valid when
+     diversion->size is non-zero.  */
+  size_t unused;
 
-/* Obstack from which diversion storage is allocated.  */
-static m4_obstack diversion_storage;
+  /* Temporary directory holding all spilled diversion files.  */
+  m4_temp_dir *temp_dir;
 
-/* Total size of all in-memory buffer sizes.  */
-static size_t total_buffer_size;
+  /* Cache of most recently used spilled diversion files.  */
+  FILE *tmp_file1;
+  FILE *tmp_file2;
 
-/* Current output diversion, NULL if output is being currently
-   discarded.  output_diversion->u is guaranteed non-NULL except when
-   the diversion has never been used; use size to determine if it is a
-   malloc'd buffer or a FILE.  output_diversion->used is 0 if u.file
-   is stdout, and non-zero if this is a malloc'd buffer or a temporary
-   diversion file.  */
-static m4_diversion *output_diversion;
+  /* Diversions that own tmp_file, or 0.  */
+  int tmp_file1_owner;
+  int tmp_file2_owner;
 
-/* Cache of output_diversion->u.file, only valid when
-   output_diversion->size is 0.  */
-static FILE *output_file;
+  /* True if tmp_file2 is more recently used.  */
+  bool tmp_file2_recent;
 
-/* Cache of output_diversion->u.buffer + output_diversion->used, only
-   valid when output_diversion->size is non-zero.  */
-static char *output_cursor;
+  /* Buffer holding the name of the most recent temporary file, and
+     the offset of its diversion number.  */
+  char *tmpname_buffer;
+  size_t tmpname_offset;
 
-/* Cache of output_diversion->size - output_diversion->used, only
-   valid when output_diversion->size is non-zero.  */
-static size_t output_unused;
+  /* True if the next diverted text starts an output line, for
+     sync lines.  */
+  bool start_of_output_line;
 
-/* Temporary directory holding all spilled diversion files.  */
-static m4_temp_dir *output_temp_dir;
+  /* File of diversion 0 while m4_expand_string captures its output in
+     memory, or NULL.  */
+  FILE *captured_file;
 
-/* Cache of most recently used spilled diversion files.  */
-static FILE *tmp_file1;
-static FILE *tmp_file2;
+  /* Next state that owns a temporary directory, for cleanup_tmpfile.  */
+  m4__output_state *next_owner;
 
-/* Diversions that own tmp_file, or 0.  */
-static int tmp_file1_owner;
-static int tmp_file2_owner;
+  /* Buffer for copying files into the output.  */
+  char copy_buffer[COPY_BUFFER_SIZE];
+};
 
-/* True if tmp_file2 is more recently used.  */
-static bool tmp_file2_recent;
+/* Output states owning a temporary directory.  This list is
+   process-wide, like the signal handlers installed by clean-temp, so
+   contexts running on separate threads must not spill diversions
+   concurrently.  */
+static m4__output_state *temp_dir_owners;
+
+/* True once cleanup_tmpfile is registered with atexit.  */
+static bool cleanup_registered;
 
 
 /* Internal routines.  */
@@ -149,19 +181,18 @@ threshold_diversion_CB (const void *elt, const void *threshold)
   return diversion->divnum >= *(const int *) threshold;
 }
 
-/* Clean up any temporary directory.  Designed for use as an atexit
-   handler, where it is not safe to call exit() recursively; so this
-   calls _exit if a problem is encountered.  */
-static void
-cleanup_tmpfile (void)
+/* Close the open diversions of OUTPUT, and clean up its temporary
+   directory.  Return true on failure.  */
+static bool
+cleanup_output_tmpfile (m4__output_state *output)
 {
   /* Close any open diversions.  */
   bool fail = false;
 
-  if (diversion_table)
+  if (output->diversion_table)
     {
       const void *elt;
-      gl_oset_iterator_t iter = gl_oset_iterator (diversion_table);
+      gl_oset_iterator_t iter = gl_oset_iterator (output->diversion_table);
       while (gl_oset_iterator_next (&iter, &elt))
         {
           m4_diversion *diversion = (m4_diversion *) elt;
@@ -177,29 +208,48 @@ cleanup_tmpfile (void)
     }
 
   /* Clean up the temporary directory.  */
-  if (cleanup_temp_dir (output_temp_dir) != 0)
+  if (cleanup_temp_dir (output->temp_dir) != 0)
     fail = true;
+  return fail;
+}
+
+/* Clean up any temporary directory.  Designed for use as an atexit
+   handler, where it is not safe to call exit() recursively; so this
+   calls _exit if a problem is encountered.  */
+static void
+cleanup_tmpfile (void)
+{
+  bool fail = false;
+  m4__output_state *output;
+
+  for (output = temp_dir_owners; output; output = output->next_owner)
+    if (cleanup_output_tmpfile (output))
+      fail = true;
   if (fail)
     _exit (exit_failure);
 }
 
 /* Convert DIVNUM into a temporary file name for use in m4_tmp*.  */
 static const char *
-m4_tmpname (int divnum)
+m4_tmpname (m4 *context, int divnum)
 {
-  static char *buffer;
-  static size_t offset;
-  if (buffer == NULL)
+  m4__output_state *output = context->output;
+
+  if (output->tmpname_buffer == NULL)
     {
-      obstack_printf (&diversion_storage, "%s/m4-", output_temp_dir->dir_name);
-      offset = obstack_object_size (&diversion_storage);
-      buffer = (char *) obstack_alloc (&diversion_storage,
-                                       INT_BUFSIZE_BOUND (divnum));
+      obstack_printf (&output->diversion_storage, "%s/m4-",
+                      output->temp_dir->dir_name);
+      output->tmpname_offset
+        = obstack_object_size (&output->diversion_storage);
+      output->tmpname_buffer
+        = (char *) obstack_alloc (&output->diversion_storage,
+                                  INT_BUFSIZE_BOUND (divnum));
     }
   assert (0 < divnum);
-  if (snprintf (&buffer[offset], INT_BUFSIZE_BOUND (divnum), "%d", divnum) < 0)
+  if (snprintf (&output->tmpname_buffer[output->tmpname_offset],
+                INT_BUFSIZE_BOUND (divnum), "%d", divnum) < 0)
     abort ();
-  return buffer;
+  return output->tmpname_buffer;
 }
 
 /* Create a temporary file for diversion DIVNUM open for reading and
@@ -212,23 +262,31 @@ m4_tmpname (int divnum)
 static FILE *
 m4_tmpfile (m4 *context, int divnum)
 {
+  m4__output_state *output = context->output;
   const char *name;
   FILE *file;
 
-  if (output_temp_dir == NULL)
+  if (output->temp_dir == NULL)
     {
-      output_temp_dir = create_temp_dir ("m4-", NULL, true);
-      if (output_temp_dir == NULL)
+      output->temp_dir = create_temp_dir ("m4-", NULL, true);
+      if (output->temp_dir == NULL)
         m4_error (context, EXIT_FAILURE, errno, NULL,
                   _("cannot create temporary file for diversion"));
-      atexit (cleanup_tmpfile);
+      if (!cleanup_registered)
+        {
+          atexit (cleanup_tmpfile);
+          cleanup_registered = true;
+        }
+      output->next_owner = temp_dir_owners;
+      temp_dir_owners = output;
     }
-  name = m4_tmpname (divnum);
-  register_temp_file (output_temp_dir, name);
+  m4__stats_add (context, tmpfiles, 1);
+  name = m4_tmpname (context, divnum);
+  register_temp_file (output->temp_dir, name);
   file = fopen_temp (name, O_BINARY ? "wb+" : "w+");
   if (file == NULL)
     {
-      unregister_temp_file (output_temp_dir, name);
+      unregister_temp_file (output->temp_dir, name);
       m4_error (context, EXIT_FAILURE, errno, NULL,
                 _("cannot create temporary file for diversion"));
     }
@@ -245,26 +303,27 @@ m4_tmpfile (m4 *context, int divnum)
 static FILE *
 m4_tmpopen (m4 *context, int divnum, bool reread)
 {
+  m4__output_state *output = context->output;
   const char *name;
   FILE *file;
 
-  if (tmp_file1_owner == divnum)
+  if (output->tmp_file1_owner == divnum)
     {
-      if (reread && fseeko (tmp_file1, 0, SEEK_SET) != 0)
+      if (reread && fseeko (output->tmp_file1, 0, SEEK_SET) != 0)
         m4_error (context, EXIT_FAILURE, errno, NULL,
                   _("cannot seek within diversion"));
-      tmp_file2_recent = false;
-      return tmp_file1;
+      output->tmp_file2_recent = false;
+      return output->tmp_file1;
     }
-  else if (tmp_file2_owner == divnum)
+  else if (output->tmp_file2_owner == divnum)
     {
-      if (reread && fseeko (tmp_file2, 0, SEEK_SET) != 0)
+      if (reread && fseeko (output->tmp_file2, 0, SEEK_SET) != 0)
         m4_error (context, EXIT_FAILURE, errno, NULL,
                   _("cannot seek to beginning of diversion"));
-      tmp_file2_recent = true;
-      return tmp_file2;
+      output->tmp_file2_recent = true;
+      return output->tmp_file2;
     }
-  name = m4_tmpname (divnum);
+  name = m4_tmpname (context, divnum);
   /* We need update mode, to avoid truncation.  */
   file = fopen_temp (name, O_BINARY ? "rb+" : "r+");
   if (file == NULL)
@@ -286,24 +345,26 @@ m4_tmpopen (m4 *context, int divnum, bool reread)
    On the other hand, keeping every spilled diversion open would run
    into EMFILE limits.  */
 static int
-m4_tmpclose (FILE *file, int divnum)
+m4_tmpclose (m4 *context, FILE *file, int divnum)
 {
+  m4__output_state *output = context->output;
   int result = 0;
-  if (divnum != tmp_file1_owner && divnum != tmp_file2_owner)
+
+  if (divnum != output->tmp_file1_owner && divnum != output->tmp_file2_owner)
     {
-      if (tmp_file2_recent)
+      if (output->tmp_file2_recent)
         {
-          if (tmp_file1_owner)
-            result = close_stream_temp (tmp_file1);
-          tmp_file1 = file;
-          tmp_file1_owner = divnum;
+          if (output->tmp_file1_owner)
+            result = close_stream_temp (output->tmp_file1);
+          output->tmp_file1 = file;
+          output->tmp_file1_owner = divnum;
         }
       else
         {
-          if (tmp_file2_owner)
-            result = close_stream_temp (tmp_file2);
-          tmp_file2 = file;
-          tmp_file2_owner = divnum;
+          if (output->tmp_file2_owner)
+            result = close_stream_temp (output->tmp_file2);
+          output->tmp_file2 = file;
+          output->tmp_file2_owner = divnum;
         }
     }
   return result;
@@ -311,23 +372,26 @@ m4_tmpclose (FILE *file, int divnum)
 
 /* Delete a closed temporary FILE for diversion DIVNUM.  */
 static int
-m4_tmpremove (int divnum)
+m4_tmpremove (m4 *context, int divnum)
 {
-  if (divnum == tmp_file1_owner)
+  m4__output_state *output = context->output;
+
+  if (divnum == output->tmp_file1_owner)
     {
-      int result = close_stream_temp (tmp_file1);
+      int result = close_stream_temp (output->tmp_file1);
       if (result)
         return result;
-      tmp_file1_owner = 0;
+      output->tmp_file1_owner = 0;
     }
-  else if (divnum == tmp_file2_owner)
+  else if (divnum == output->tmp_file2_owner)
     {
-      int result = close_stream_temp (tmp_file2);
+      int result = close_stream_temp (output->tmp_file2);
       if (result)
         return result;
-      tmp_file2_owner = 0;
+      output->tmp_file2_owner = 0;
     }
-  return cleanup_temp_file (output_temp_dir, m4_tmpname (divnum));
+  return cleanup_temp_file (output->temp_dir,
+                            m4_tmpname (context, divnum));
 }
 
 /* Transfer the temporary file for diversion OLDNUM to the previously
@@ -336,34 +400,36 @@ m4_tmpremove (int divnum)
 static FILE*
 m4_tmprename (m4 *context, int oldnum, int newnum)
 {
+  m4__output_state *output = context->output;
+
   /* m4_tmpname reuses its return buffer.  */
-  char *oldname = xstrdup (m4_tmpname (oldnum));
-  const char *newname = m4_tmpname (newnum);
-  register_temp_file (output_temp_dir, newname);
-  if (oldnum == tmp_file1_owner)
+  char *oldname = xstrdup (m4_tmpname (context, oldnum));
+  const char *newname = m4_tmpname (context, newnum);
+  register_temp_file (output->temp_dir, newname);
+  if (oldnum == output->tmp_file1_owner)
     {
       /* Be careful of mingw, which can't rename an open file.  */
       if (RENAME_OPEN_FILE_WORKS)
-        tmp_file1_owner = newnum;
+        output->tmp_file1_owner = newnum;
       else
         {
-          if (close_stream_temp (tmp_file1))
+          if (close_stream_temp (output->tmp_file1))
             m4_error (context, EXIT_FAILURE, errno, NULL,
                       _("cannot close temporary file for diversion"));
-          tmp_file1_owner = 0;
+          output->tmp_file1_owner = 0;
         }
     }
-  else if (oldnum == tmp_file2_owner)
+  else if (oldnum == output->tmp_file2_owner)
     {
       /* Be careful of mingw, which can't rename an open file.  */
       if (RENAME_OPEN_FILE_WORKS)
-        tmp_file2_owner = newnum;
+        output->tmp_file2_owner = newnum;
       else
         {
-          if (close_stream_temp (tmp_file2))
+          if (close_stream_temp (output->tmp_file2))
             m4_error (context, EXIT_FAILURE, errno, NULL,
                       _("cannot close temporary file for diversion"));
-          tmp_file2_owner = 0;
+          output->tmp_file2_owner = 0;
         }
     }
   /* Either it is safe to rename an open file, or no one should have
@@ -371,7 +437,7 @@ m4_tmprename (m4 *context, int oldnum, int newnum)
   if (rename (oldname, newname))
     m4_error (context, EXIT_FAILURE, errno, NULL,
               _("cannot create temporary file for diversion"));
-  unregister_temp_file (output_temp_dir, oldname);
+  unregister_temp_file (output->temp_dir, oldname);
   free (oldname);
   return m4_tmpopen (context, newnum, false);
 }
@@ -383,30 +449,56 @@ m4_tmprename (m4 *context, int oldnum, int newnum)
 void
 m4_output_init (m4 *context)
 {
-  diversion_table = gl_oset_create_empty (GL_AVLTREE_OSET, cmp_diversion_CB,
-                                          NULL);
-  div0.u.file = stdout;
+  m4__output_state *output;
+
+  output = (m4__output_state *) xzalloc (sizeof *output);
+  context->output = output;
+  output->start_of_output_line = true;
+  output->diversion_table = gl_oset_create_empty (GL_AVLTREE_OSET,
+                                                  cmp_diversion_CB, NULL);
+  output->div0.u.file = stdout;
   m4_set_current_diversion (context, 0);
-  output_diversion = &div0;
-  output_file = stdout;
-  obstack_init (&diversion_storage);
+  output->diversion = &output->div0;
+  output->file = stdout;
+  obstack_init (&output->diversion_storage);
+}
+
+/* Return true if diversions of CONTEXT have spilled to a temporary
+   directory.  A forked copy of CONTEXT would share its file names.  */
+bool
+m4__output_has_temp_dir (m4 *context)
+{
+  return context->output->temp_dir != NULL;
 }
 
 /* Clean up memory allocated during use.  */
 void
-m4_output_exit (void)
+m4_output_exit (m4 *context)
 {
+  m4__output_state *output = context->output;
   /* Order is important, since we may have registered cleanup_tmpfile
      as an atexit handler, and it must not traverse stale memory.  */
-  gl_oset_t table = diversion_table;
-  assert (gl_oset_size (diversion_table) == 0);
-  if (tmp_file1_owner)
-    m4_tmpremove (tmp_file1_owner);
-  if (tmp_file2_owner)
-    m4_tmpremove (tmp_file2_owner);
-  diversion_table = NULL;
+  gl_oset_t table = output->diversion_table;
+  m4__output_state **owner;
+
+  assert (gl_oset_size (output->diversion_table) == 0);
+  if (output->tmp_file1_owner)
+    m4_tmpremove (context, output->tmp_file1_owner);
+  if (output->tmp_file2_owner)
+    m4_tmpremove (context, output->tmp_file2_owner);
+  output->diversion_table = NULL;
   gl_oset_free (table);
-  obstack_free (&diversion_storage, NULL);
+  /* The temporary directory, if any, is empty by now.  */
+  for (owner = &temp_dir_owners; *owner; owner = &(*owner)->next_owner)
+    if (*owner == output)
+      {
+        *owner = output->next_owner;
+        cleanup_temp_dir (output->temp_dir);
+        break;
+      }
+  obstack_free (&output->diversion_storage, NULL);
+  free (output);
+  context->output = NULL;
 }
 
 /* Reorganize in-memory diversion buffers so the current diversion can
@@ -418,28 +510,54 @@ m4_output_exit (void)
 static void
 make_room_for (m4 *context, size_t length)
 {
+  m4__output_state *output = context->output;
   size_t wanted_size;
   m4_diversion *selected_diversion = NULL;
 
-  assert (!output_file);
-  assert (output_diversion);
-  assert (output_diversion->size || !output_diversion->u.file);
+  assert (!output->file);
+  assert (output->diversion);
+  assert (output->diversion->size || !output->diversion->u.file);
+
+  /* Diversion 0 is only in memory while it is captured, and is never
+     spilled to disk, so that the whole result can be handed over.  */
+  if (output->diversion == &output->div0)
+    {
+      size_t used = output->div0.size - output->unused;
+
+      assert (output->captured_file);
+      wanted_size = output->div0.size;
+      if (!wanted_size)
+        wanted_size = INITIAL_BUFFER_SIZE;
+      while (wanted_size - used < length)
+        {
+          if (SIZE_MAX / 2 < wanted_size)
+            xalloc_die ();
+          wanted_size *= 2;
+        }
+      output->div0.u.buffer = (char *) xrealloc (output->div0.u.buffer,
+                                                 wanted_size);
+      output->div0.size = wanted_size;
+      output->div0.used = used;
+      output->cursor = output->div0.u.buffer + used;
+      output->unused = wanted_size - used;
+      return;
+    }
 
   /* Compute needed size for in-memory buffer.  Diversions in-memory
      buffers start at 0 bytes, then 512, then keep doubling until it is
      decided to flush them to disk.  */
 
-  output_diversion->used = output_diversion->size - output_unused;
+  output->diversion->used = output->diversion->size - output->unused;
 
-  for (wanted_size = output_diversion->size;
+  for (wanted_size = output->diversion->size;
        wanted_size <= MAXIMUM_TOTAL_SIZE
-         && wanted_size - output_diversion->used < length;
+         && wanted_size - output->diversion->used < length;
        wanted_size = wanted_size == 0 ? INITIAL_BUFFER_SIZE : wanted_size * 2)
     ;
 
   /* Check if we are exceeding the maximum amount of buffer memory.  */
 
-  if (total_buffer_size - output_diversion->size + wanted_size
+  if (output->total_buffer_size - output->diversion->size + wanted_size
       > MAXIMUM_TOTAL_SIZE)
     {
       size_t selected_used;
@@ -454,10 +572,10 @@ make_room_for (m4 *context, size_t length)
          projected data, while making the selection.  So, if it is
          selected indeed, we will flush it smaller, before it grows.  */
 
-      selected_diversion = output_diversion;
-      selected_used = output_diversion->used + length;
+      selected_diversion = output->diversion;
+      selected_used = output->diversion->used + length;
 
-      iter = gl_oset_iterator (diversion_table);
+      iter = gl_oset_iterator (output->diversion_table);
       while (gl_oset_iterator_next (&iter, &elt))
         {
           diversion = (m4_diversion *) elt;
@@ -476,12 +594,15 @@ make_room_for (m4 *context, size_t length)
          a garbage pointer as a file.  */
 
       selected_buffer = selected_diversion->u.buffer;
-      total_buffer_size -= selected_diversion->size;
+      output->total_buffer_size -= selected_diversion->size;
       selected_diversion->size = 0;
       selected_diversion->u.file = NULL;
       selected_diversion->u.file = m4_tmpfile (context,
                                                selected_diversion->divnum);
 
+      m4__stats_add (context, spilled_bytes, selected_diversion->used);
+      M4_PROBE2 (diversion__spill, selected_diversion->divnum,
+                 selected_diversion->used);
       if (selected_diversion->used > 0)
         {
           count = fwrite (selected_buffer, selected_diversion->used, 1,
@@ -497,15 +618,15 @@ make_room_for (m4 *context, size_t length)
       selected_diversion->used = 1;
     }
 
-  /* Reload output_file, just in case the flushed diversion was current.  */
+  /* Reload output->file, just in case the flushed diversion was current.  */
 
-  if (output_diversion == selected_diversion)
+  if (output->diversion == selected_diversion)
     {
       /* The flushed diversion was current indeed.  */
 
-      output_file = output_diversion->u.file;
-      output_cursor = NULL;
-      output_unused = 0;
+      output->file = output->diversion->u.file;
+      output->cursor = NULL;
+      output->unused = 0;
     }
   else
     {
@@ -514,7 +635,7 @@ make_room_for (m4 *context, size_t length)
         {
           FILE *file = selected_diversion->u.file;
           selected_diversion->u.file = NULL;
-          if (m4_tmpclose (file, selected_diversion->divnum) != 0)
+          if (m4_tmpclose (context, file, selected_diversion->divnum) != 0)
             m4_error (context, 0, errno, NULL,
                       _("cannot close temporary file for diversion"));
         }
@@ -522,42 +643,45 @@ make_room_for (m4 *context, size_t length)
       /* The current buffer may be safely reallocated.  */
       assert (wanted_size >= length);
       {
-        char *buffer = output_diversion->u.buffer;
-        output_diversion->u.buffer = xcharalloc ((size_t) wanted_size);
-        memcpy (output_diversion->u.buffer, buffer, output_diversion->used);
+        char *buffer = output->diversion->u.buffer;
+        output->diversion->u.buffer = xcharalloc ((size_t) wanted_size);
+        memcpy (output->diversion->u.buffer, buffer,
+                output->diversion->used);
         free (buffer);
       }
 
-      total_buffer_size += wanted_size - output_diversion->size;
-      output_diversion->size = wanted_size;
+      output->total_buffer_size += wanted_size - output->diversion->size;
+      output->diversion->size = wanted_size;
 
-      output_cursor = output_diversion->u.buffer + output_diversion->used;
-      output_unused = wanted_size - output_diversion->used;
+      output->cursor = output->diversion->u.buffer + output->diversion->used;
+      output->unused = wanted_size - output->diversion->used;
     }
 }
 
 /* Output one character CHAR, when it is known that it goes to a
-   diversion file or an in-memory diversion buffer.  A variable m4
-   *context must be in scope.  */
-#define OUTPUT_CHARACTER(Char)                   \
-  if (output_file)                               \
-    putc ((Char), output_file);                  \
-  else if (output_unused == 0)                   \
-    output_character_helper (context, (Char));   \
-  else                                           \
-    (output_unused--, *output_cursor++ = (Char))
+   diversion file or an in-memory diversion buffer.  Variables m4
+   *context and m4__output_state *output must be in scope.  */
+#define OUTPUT_CHARACTER(Char)                          \
+  if (output->file)                              \
+    putc ((Char), output->file);                 \
+  else if (output->unused == 0)                  \
+    output_character_helper (context, (Char));          \
+  else                                                  \
+    (output->unused--, *output->cursor++ = (Char))
 
 static void
 output_character_helper (m4 *context, int character)
 {
+  m4__output_state *output = context->output;
+
   make_room_for (context, 1);
 
-  if (output_file)
-    putc (character, output_file);
+  if (output->file)
+    putc (character, output->file);
   else
     {
-      *output_cursor++ = character;
-      output_unused--;
+      *output->cursor++ = character;
+      output->unused--;
     }
 }
 
@@ -566,26 +690,27 @@ output_character_helper (m4 *context, int character)
 void
 m4_output_text (m4 *context, const char *text, size_t length)
 {
+  m4__output_state *output = context->output;
   size_t count;
 
-  if (!output_diversion || !length)
+  if (!output->diversion || !length)
     return;
 
-  if (!output_file && length > output_unused)
+  if (!output->file && length > output->unused)
     make_room_for (context, length);
 
-  if (output_file)
+  if (output->file)
     {
-      count = fwrite (text, length, 1, output_file);
+      count = fwrite (text, length, 1, output->file);
       if (count != 1)
         m4_error (context, EXIT_FAILURE, errno, NULL,
                   _("copying inserted file"));
     }
   else
     {
-      memcpy (output_cursor, text, length);
-      output_cursor += length;
-      output_unused -= length;
+      memcpy (output->cursor, text, length);
+      output->cursor += length;
+      output->unused -= length;
     }
 }
 
@@ -605,7 +730,7 @@ void
 m4_divert_text (m4 *context, m4_obstack *obs, const char *text, size_t length,
                 int line)
 {
-  static bool start_of_output_line = true;
+  m4__output_state *output = context->output;
 
   /* If output goes to an obstack, merely add TEXT to it.  */
 
@@ -617,8 +742,9 @@ m4_divert_text (m4 *context, m4_obstack *obs, const char *text, size_t length,
 
   /* Do nothing if TEXT should be discarded.  */
 
-  if (!output_diversion || !length)
+  if (!output->diversion || !length)
     return;
+  m4__stats_add (context, output_bytes, length);
 
   /* Output TEXT to a file, or in-memory diversion buffer.  */
 
@@ -650,9 +776,9 @@ m4_divert_text (m4 *context, m4_obstack *obs, const char *text, size_t length,
          tokens, and tokens that are out of sync but in the middle of
          the line, must wait until the next raw newline triggers a
          syncline.  */
-      if (start_of_output_line)
+      if (output->start_of_output_line)
         {
-          start_of_output_line = false;
+          output->start_of_output_line = false;
           m4_set_output_line (context, m4_get_output_line (context) + 1);
 
 #ifdef DEBUG_OUTPUT
@@ -688,9 +814,9 @@ m4_divert_text (m4 *context, m4_obstack *obs, const char *text, size_t length,
       /* Output the token, and track embedded newlines.  */
       for (; length-- > 0; text++)
         {
-          if (start_of_output_line)
+          if (output->start_of_output_line)
             {
-              start_of_output_line = false;
+              output->start_of_output_line = false;
               m4_set_output_line (context, m4_get_output_line (context) + 1);
 
 #ifdef DEBUG_OUTPUT
@@ -701,7 +827,7 @@ m4_divert_text (m4 *context, m4_obstack *obs, const char *text, size_t length,
             }
           OUTPUT_CHARACTER (*text);
           if (*text == '\n')
-            start_of_output_line = true;
+            output->start_of_output_line = true;
         }
     }
 }
@@ -790,38 +916,41 @@ m4_shipout_string_trunc (m4_obstack *obs, const char *s, size_t len,
 void
 m4_make_diversion (m4 *context, int divnum)
 {
+  m4__output_state *output = context->output;
   m4_diversion *diversion = NULL;
 
   if (m4_get_current_diversion (context) == divnum)
     return;
+  M4_PROBE2 (diversion__switch, m4_get_current_diversion (context), divnum);
 
-  if (output_diversion)
+  if (output->diversion)
     {
-      assert (!output_file || output_diversion->u.file == output_file);
-      assert (output_diversion->divnum != divnum);
-      if (!output_diversion->size && !output_diversion->u.file)
+      assert (!output->file || output->diversion->u.file == output->file);
+      assert (output->diversion->divnum != divnum);
+      if (!output->diversion->size && !output->diversion->u.file
+          && output->diversion != &output->div0)
         {
-          assert (!output_diversion->used);
-          if (!gl_oset_remove (diversion_table, output_diversion))
+          assert (!output->diversion->used);
+          if (!gl_oset_remove (output->diversion_table, output->diversion))
             assert (false);
-          output_diversion->u.next = free_list;
-          free_list = output_diversion;
+          output->diversion->u.next = output->free_list;
+          output->free_list = output->diversion;
         }
-      else if (output_diversion->size)
-        output_diversion->used = output_diversion->size - output_unused;
-      else if (output_diversion->used)
+      else if (output->diversion->size)
+        output->diversion->used = output->diversion->size - output->unused;
+      else if (output->diversion->used)
         {
-          assert (output_diversion->divnum != 0);
-          FILE *file = output_diversion->u.file;
-          output_diversion->u.file = NULL;
-          if (m4_tmpclose (file, output_diversion->divnum) != 0)
+          assert (output->diversion->divnum != 0);
+          FILE *file = output->diversion->u.file;
+          output->diversion->u.file = NULL;
+          if (m4_tmpclose (context, file, output->diversion->divnum) != 0)
             m4_error (context, 0, errno, NULL,
                       _("cannot close temporary file for diversion"));
         }
-      output_diversion = NULL;
-      output_file = NULL;
-      output_cursor = NULL;
-      output_unused = 0;
+      output->diversion = NULL;
+      output->file = NULL;
+      output->cursor = NULL;
+      output->unused = 0;
     }
 
   m4_set_current_diversion (context, divnum);
@@ -830,12 +959,12 @@ m4_make_diversion (m4 *context, int divnum)
     return;
 
   if (divnum == 0)
-    diversion = &div0;
+    diversion = &output->div0;
   else
     {
       const void *elt;
-      if (gl_oset_search_atleast (diversion_table, threshold_diversion_CB,
-                                  &divnum, &elt))
+      if (gl_oset_search_atleast (output->diversion_table,
+                                  threshold_diversion_CB, &divnum, &elt))
         {
           m4_diversion *temp = (m4_diversion *) elt;
           if (temp->divnum == divnum)
@@ -845,38 +974,40 @@ m4_make_diversion (m4 *context, int divnum)
   if (diversion == NULL)
     {
       /* First time visiting this diversion.  */
-      if (free_list)
+      m4__stats_add (context, diversions, 1);
+      if (output->free_list)
         {
-          diversion = free_list;
-          free_list = diversion->u.next;
+          diversion = output->free_list;
+          output->free_list = diversion->u.next;
           assert (!diversion->size && !diversion->used);
         }
       else
         {
-          diversion = (m4_diversion *) obstack_alloc (&diversion_storage,
-                                                      sizeof *diversion);
+          diversion
+            = (m4_diversion *) obstack_alloc (&output->diversion_storage,
+                                              sizeof *diversion);
           diversion->size = 0;
           diversion->used = 0;
         }
       diversion->u.file = NULL;
       diversion->divnum = divnum;
-      if (!gl_oset_add (diversion_table, diversion))
+      if (!gl_oset_add (output->diversion_table, diversion))
         assert (false);
     }
 
-  output_diversion = diversion;
-  if (output_diversion->size)
+  output->diversion = diversion;
+  if (output->diversion->size)
     {
-      output_cursor = output_diversion->u.buffer + output_diversion->used;
-      output_unused = output_diversion->size - output_diversion->used;
+      output->cursor = output->diversion->u.buffer + output->diversion->used;
+      output->unused = output->diversion->size - output->diversion->used;
     }
   else
     {
-      if (!output_diversion->u.file && output_diversion->used)
-        output_diversion->u.file = m4_tmpopen (context,
-                                               output_diversion->divnum,
-                                               false);
-      output_file = output_diversion->u.file;
+      if (!output->diversion->u.file && output->diversion->used)
+        output->diversion->u.file = m4_tmpopen (context,
+                                                output->diversion->divnum,
+                                                false);
+      output->file = output->diversion->u.file;
     }
 
   m4_set_output_line (context, -1);
@@ -888,16 +1019,17 @@ m4_make_diversion (m4 *context, int divnum)
 static void
 insert_file (m4 *context, FILE *file, bool escaped)
 {
-  static char buffer[COPY_BUFFER_SIZE];
+  m4__output_state *output = context->output;
+  char *buffer = output->copy_buffer;
   size_t length;
   char *str = buffer;
   bool first = true;
 
-  assert (output_diversion);
+  assert (output->diversion);
   /* Insert output by big chunks.  */
   while (1)
     {
-      length = fread (buffer, 1, sizeof buffer, file);
+      length = fread (buffer, 1, sizeof output->copy_buffer, file);
       if (ferror (file))
         m4_error (context, EXIT_FAILURE, errno, NULL,
                   _("reading inserted file"));
@@ -921,8 +1053,10 @@ insert_file (m4 *context, FILE *file, bool escaped)
 void
 m4_insert_file (m4 *context, FILE *file)
 {
+  m4__output_state *output = context->output;
+
   /* Optimize out inserting into a sink.  */
-  if (output_diversion)
+  if (output->diversion)
     insert_file (context, file, false);
 }
 
@@ -933,23 +1067,27 @@ m4_insert_file (m4 *context, FILE *file)
 static void
 insert_diversion_helper (m4 *context, m4_diversion *diversion, bool escaped)
 {
+  m4__output_state *output = context->output;
+
   assert (diversion->divnum > 0
           && diversion->divnum != m4_get_current_diversion (context));
   /* Effectively undivert only if an output stream is active.  */
-  if (output_diversion)
+  if (output->diversion)
     {
       if (diversion->size)
         {
-          if (!output_diversion->u.file)
+          if (!output->diversion->u.file
+              && output->diversion != &output->div0)
             {
               /* Transferring diversion metadata is faster than
                  copying contents.  */
-              assert (!output_diversion->used && output_diversion != &div0
-                      && !output_file);
-              output_diversion->u.buffer = diversion->u.buffer;
-              output_diversion->size = diversion->size;
-              output_cursor = diversion->u.buffer + diversion->used;
-              output_unused = diversion->size - diversion->used;
+              assert (!output->diversion->used
+                      && output->diversion != &output->div0
+                      && !output->file);
+              output->diversion->u.buffer = diversion->u.buffer;
+              output->diversion->size = diversion->size;
+              output->cursor = diversion->u.buffer + diversion->used;
+              output->unused = diversion->size - diversion->used;
               diversion->u.buffer = NULL;
             }
           else
@@ -959,22 +1097,24 @@ insert_diversion_helper (m4 *context, m4_diversion *diversion, bool escaped)
               /* Avoid double-charging the total in-memory size when
                  transferring from one in-memory diversion to
                  another.  */
-              total_buffer_size -= diversion->size;
+              output->total_buffer_size -= diversion->size;
               if (escaped)
                 str = quotearg_style_mem (escape_quoting_style, str, len);
               m4_output_text (context, str, escaped ? strlen (str) : len);
             }
         }
-      else if (!output_diversion->u.file)
+      else if (!output->diversion->u.file
+               && output->diversion != &output->div0)
         {
           /* Transferring diversion metadata is faster than copying
              contents.  */
-          assert (!output_diversion->used && output_diversion != &div0
-                  && !output_file);
-          output_diversion->u.file = m4_tmprename (context, diversion->divnum,
-                                                   output_diversion->divnum);
-          output_diversion->used = 1;
-          output_file = output_diversion->u.file;
+          assert (!output->diversion->used
+                  && output->diversion != &output->div0 && !output->file);
+          output->diversion->u.file
+            = m4_tmprename (context, diversion->divnum,
+                            output->diversion->divnum);
+          output->diversion->used = 1;
+          output->file = output->diversion->u.file;
           diversion->u.file = NULL;
           diversion->size = 1;
         }
@@ -992,8 +1132,8 @@ insert_diversion_helper (m4 *context, m4_diversion *diversion, bool escaped)
   /* Return all space used by the diversion.  */
   if (diversion->size)
     {
-      if (!output_diversion)
-        total_buffer_size -= diversion->size;
+      if (!output->diversion)
+        output->total_buffer_size -= diversion->size;
       free (diversion->u.buffer);
       diversion->size = 0;
     }
@@ -1003,19 +1143,19 @@ insert_diversion_helper (m4 *context, m4_diversion *diversion, bool escaped)
         {
           FILE *file = diversion->u.file;
           diversion->u.file = NULL;
-          if (m4_tmpclose (file, diversion->divnum) != 0)
+          if (m4_tmpclose (context, file, diversion->divnum) != 0)
             m4_error (context, 0, errno, NULL,
                       _("cannot clean temporary file for diversion"));
         }
-      if (m4_tmpremove (diversion->divnum) != 0)
+      if (m4_tmpremove (context, diversion->divnum) != 0)
         m4_error (context, 0, errno, NULL,
                   _("cannot clean temporary file for diversion"));
     }
   diversion->used = 0;
-  if (!gl_oset_remove (diversion_table, diversion))
+  if (!gl_oset_remove (output->diversion_table, diversion))
     assert (false);
-  diversion->u.next = free_list;
-  free_list = diversion;
+  diversion->u.next = output->free_list;
+  output->free_list = diversion;
 }
 
 /* Insert diversion number DIVNUM into the current output file.  The
@@ -1024,14 +1164,15 @@ insert_diversion_helper (m4 *context, m4_diversion *diversion, bool escaped)
 void
 m4_insert_diversion (m4 *context, int divnum)
 {
+  m4__output_state *output = context->output;
   const void *elt;
 
   /* Do not care about nonexistent diversions, and undiverting stdout
      or self is a no-op.  */
   if (divnum <= 0 || m4_get_current_diversion (context) == divnum)
     return;
-  if (gl_oset_search_atleast (diversion_table, threshold_diversion_CB,
-                              &divnum, &elt))
+  if (gl_oset_search_atleast (output->diversion_table,
+                              threshold_diversion_CB, &divnum, &elt))
     {
       m4_diversion *diversion = (m4_diversion *) elt;
       if (diversion->divnum == divnum)
@@ -1044,9 +1185,10 @@ m4_insert_diversion (m4 *context, int divnum)
 void
 m4_undivert_all (m4 *context)
 {
+  m4__output_state *output = context->output;
   int divnum = m4_get_current_diversion (context);
   const void *elt;
-  gl_oset_iterator_t iter = gl_oset_iterator (diversion_table);
+  gl_oset_iterator_t iter = gl_oset_iterator (output->diversion_table);
   while (gl_oset_iterator_next (&iter, &elt))
     {
       m4_diversion *diversion = (m4_diversion *) elt;
@@ -1056,10 +1198,13 @@ m4_undivert_all (m4 *context)
   gl_oset_iterator_free (&iter);
 }
 
-/* Produce all diversion information in frozen format on FILE.  */
+/* Produce all diversion information in frozen format on FILE.  If
+   ESCAPED, the contents are escaped as in version 2 frozen files;
+   otherwise they are copied verbatim.  */
 void
-m4_freeze_diversions (m4 *context, FILE *file)
+m4_freeze_diversions (m4 *context, FILE *file, bool escaped)
 {
+  m4__output_state *output = context->output;
   int saved_number;
   int last_inserted;
   gl_oset_iterator_t iter;
@@ -1068,9 +1213,9 @@ m4_freeze_diversions (m4 *context, FILE *file)
   saved_number = m4_get_current_diversion (context);
   last_inserted = 0;
   m4_make_diversion (context, 0);
-  output_file = file; /* kludge in the frozen file */
+  output->file = file; /* kludge in the frozen file */
 
-  iter = gl_oset_iterator (diversion_table);
+  iter = gl_oset_iterator (output->diversion_table);
   while (gl_oset_iterator_next (&iter, &elt))
     {
       m4_diversion *diversion = (m4_diversion *) elt;
@@ -1102,7 +1247,7 @@ m4_freeze_diversions (m4 *context, FILE *file)
                         (unsigned long int) file_stat.st_size);
             }
 
-          insert_diversion_helper (context, diversion, true);
+          insert_diversion_helper (context, diversion, escaped);
           putc ('\n', file);
 
           last_inserted = diversion->divnum;
@@ -1114,4 +1259,65 @@ m4_freeze_diversions (m4 *context, FILE *file)
 
   if (saved_number != last_inserted)
     xfprintf (file, "D%d,0\n\n", saved_number);
+  output->file = output->div0.u.file;
+}
+
+/* Start collecting the output of diversion 0 in memory, until
+   m4__output_release.  */
+void
+m4__output_capture (m4 *context)
+{
+  m4__output_state *output = context->output;
+
+  assert (!output->captured_file && !output->div0.size);
+  output->captured_file = output->div0.u.file;
+  output->div0.u.buffer = NULL;
+  output->div0.used = 0;
+  if (output->diversion == &output->div0)
+    {
+      output->file = NULL;
+      output->cursor = NULL;
+      output->unused = 0;
+    }
+}
+
+/* Stop collecting the output of diversion 0, which must be current,
+   and return what was collected, as a malloc'd NUL-terminated string
+   whose length is stored in *LEN.  */
+char *
+m4__output_release (m4 *context, size_t *len)
+{
+  m4__output_state *output = context->output;
+  char *buffer;
+
+  assert (output->captured_file && output->diversion == &output->div0);
+  if (!output->unused)
+    make_room_for (context, 1);
+  *output->cursor = '\0';
+  buffer = output->div0.u.buffer;
+  *len = output->div0.size - output->unused;
+
+  output->div0.u.file = output->captured_file;
+  output->div0.size = 0;
+  output->div0.used = 0;
+  output->captured_file = NULL;
+  output->file = output->div0.u.file;
+  output->cursor = NULL;
+  output->unused = 0;
+  return buffer;
+}
+
+/* Send the output of diversion 0 to FILE instead, and return the file
+   that received it so far, which is initially stdout.  */
+FILE *
+m4_output_redirect (m4 *context, FILE *file)
+{
+  m4__output_state *output = context->output;
+  FILE *previous = output->div0.u.file;
+
+  assert (!output->captured_file);
+  output->div0.u.file = file;
+  if (output->diversion == &output->div0)
+    output->file = file;
+  return previous;
 }
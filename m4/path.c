@@ -19,10 +19,28 @@
 */
 
 /* Handling of path search of included files via the builtins "include"
-   and "sinclude".  */
+   and "sinclude".
+
+   Modular sources include the same files over and over, and each
+   search may try every directory with every suffix before it
+   succeeds, so the results of m4_path_search, including failures,
+   are cached by file name and suffixes.  The cache is flushed when
+   the search path changes, and by the builtins that run commands or
+   create files, since the result of a search may have changed.  With
+   the include snapshot option, each directory is also listed once,
+   and searches look up the listing instead of asking the system,
+   which is only correct as long as the directories do not change.
+
+   When the include cache limit is set, the contents of included files
+   are also kept in memory, keyed by file name and checked against the
+   device, inode, modification time and size of the file each time it
+   is included again.  The least recently used files are dropped to
+   keep the total below the limit; files that are being read are never
+   dropped, and files that do not fit are read from disk as usual.  */
 
 #include <config.h>
 
+#include <dirent.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -32,6 +50,8 @@
 
 #include "dirname.h"
 #include "filenamecat.h"
+#include "stat-time.h"
+#include "timespec.h"
 
 /* Define this to see runtime debug info.  Implied by DEBUG.  */
 /*#define DEBUG_INCL */
@@ -47,9 +67,53 @@ static const char *FILE_SUFFIXES[] = {
 
 static const char *NO_SUFFIXES[] = { "", NULL };
 
+/* A result of m4_path_search, cached by file name and suffixes.  */
+typedef struct
+{
+  m4_string key;                /* File name, then each suffix.  */
+  char *path;                   /* File found, or NULL.  */
+  int error;                    /* Value of errno if not found.  */
+  bool report;                  /* True if the search was traced.  */
+} path_cache_entry;
+
+/* The snapshot of the entries of a directory.  */
+typedef struct
+{
+  m4_string key;                /* Directory name, empty for `.'.  */
+  m4_hash *names;               /* Set of entries, or NULL if unreadable.  */
+  int error;                    /* Value of errno if unreadable.  */
+  m4_obstack storage;           /* Storage for the names.  */
+} path_listing;
+
+/* The contents of a file kept by the include cache.  */
+struct m4__include_content
+{
+  m4_string key;                /* File name.  */
+  dev_t dev;                    /* Device of the file when read.  */
+  ino_t ino;                    /* Inode of the file when read.  */
+  struct timespec mtime;        /* Modification time when read.  */
+  off_t size;                   /* Size when read.  */
+  char *text;                   /* Contents of the file.  */
+  size_t refs;                  /* Number of input blocks reading text.  */
+  m4__include_content *prev;    /* More recently used file, or NULL.  */
+  m4__include_content *next;    /* Less recently used file, or NULL.  */
+};
+
 static void search_path_add (m4__search_path_info *, const char *, bool);
 static void search_path_env_init (m4__search_path_info *, char *, bool);
 static void include_env_init (m4 *context);
+static int  path_access (m4 *, const char *);
+static int  path_probe (m4 *, const char *);
+static path_listing *path_listing_get (m4 *, const char *, size_t);
+static char *path_search (m4 *, const char *, const char **, bool *);
+static void *path_cache_delete_CB (m4_hash *, const void *, void *, void *);
+static void *path_listing_delete_CB (m4_hash *, const void *, void *,
+                                     void *);
+static m4__include_content *include_content (m4 *, const char *);
+static void include_content_unlink (m4__search_path_info *,
+                                    m4__include_content *);
+static void include_content_delete (m4__search_path_info *,
+                                    m4__include_content *);
 
 #ifdef DEBUG_INCL
 static void include_dump (m4 *context);
@@ -136,6 +200,7 @@ m4_add_include_directory (m4 *context, const char *dir, bool prepend)
     return;
 
   search_path_add (m4__get_search_path (context), dir, prepend);
+  m4_path_cache_flush (context);
 
 #ifdef DEBUG_INCL
   xfprintf (stderr, "add_include_directory (%s) %s;\n", dir,
@@ -144,19 +209,121 @@ m4_add_include_directory (m4 *context, const char *dir, bool prepend)
 }
 
 
+/* Like access (NAME, R_OK), except that with the include snapshot
+   option of CONTEXT, look NAME up in the snapshot of its directory.
+   A NAME that is not found is passed to the open hook, if any.  */
+static int
+path_access (m4 *context, const char *name)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+  int result = path_probe (context, name);
+
+  if (result != 0 && info->open_func)
+    {
+      int saved_errno = errno;
+
+      info->open_func (context, name, false, info->open_data);
+      errno = saved_errno;
+    }
+  return result;
+}
+
+/* Check whether NAME can be read on behalf of path_access.  */
+static int
+path_probe (m4 *context, const char *name)
+{
+  size_t len = dir_len (name);
+  const char *base = name + len;
+  path_listing *listing;
+  m4_string key;
+
+  if (!m4_get_include_snapshot_opt (context))
+    return access (name, R_OK);
+
+  while (ISSLASH (*base))
+    base++;
+  listing = path_listing_get (context, name, len);
+  if (!listing->names)
+    {
+      errno = listing->error;
+      return -1;
+    }
+  key.str = (char *) base;
+  key.len = strlen (base);
+  if (*base && m4_hash_lookup (listing->names, &key))
+    return 0;
+  errno = ENOENT;
+  return -1;
+}
+
+/* Return the snapshot of the directory named by the first LEN bytes
+   of NAME, listing it first if needed.  */
+static path_listing *
+path_listing_get (m4 *context, const char *name, size_t len)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+  path_listing *listing;
+  m4_string key;
+  void **place;
+  DIR *dir;
+
+  if (!info->listings)
+    info->listings = m4_hash_new (0, m4_hash_string_hash,
+                                  m4_hash_string_cmp);
+  key.str = (char *) name;
+  key.len = len;
+  place = m4_hash_lookup (info->listings, &key);
+  if (place)
+    return (path_listing *) *place;
+
+  listing = (path_listing *) xzalloc (sizeof *listing);
+  listing->key.str = xmemdup0 (name, len);
+  listing->key.len = len;
+  obstack_init (&listing->storage);
+  dir = opendir (len ? listing->key.str : ".");
+  if (dir)
+    {
+      struct dirent *entry;
+
+      listing->names = m4_hash_new (0, m4_hash_string_hash,
+                                    m4_hash_string_cmp);
+      while ((entry = readdir (dir)))
+        {
+          m4_string *entry_key
+            = (m4_string *) obstack_alloc (&listing->storage,
+                                           sizeof *entry_key);
+
+          entry_key->len = strlen (entry->d_name);
+          entry_key->str = (char *) obstack_copy0 (&listing->storage,
+                                                   entry->d_name,
+                                                   entry_key->len);
+          m4_hash_insert (listing->names, entry_key, entry_key);
+        }
+      closedir (dir);
+    }
+  else
+    listing->error = errno;
+  m4_hash_insert (info->listings, &listing->key, listing);
+  return listing;
+}
+
 /* Search for FILENAME according to -B options, `.', -I options, then
-   M4PATH environment.  If successful, return the open file, and if
-   RESULT is not NULL, set *RESULT to a malloc'd string that
+   M4PATH environment, trying each of SUFFIXES in turn, or no suffix
+   if SUFFIXES is NULL.  If successful, return a malloc'd string that
    represents the file found with respect to the current working
    directory.  Otherwise, return NULL, and errno reflects the failure
-   from searching `.' (regardless of what else was searched).  */
+   from searching `.' (regardless of what else was searched).  The
+   result comes from a cache when the same search was done before.  */
 char *
 m4_path_search (m4 *context, const char *filename, const char **suffixes)
 {
-  m4__search_path *incl;
-  char *filepath;		/* buffer for constructed name */
-  size_t max_suffix_len = 0;
-  int i, e = 0;
+  m4__search_path_info *info = m4__get_search_path (context);
+  path_cache_entry *entry;
+  m4_obstack obs;
+  m4_string key;
+  void **place;
+  char *result;
+  int i;
 
   /* Reject empty file.  */
   if (*filename == '\0')
@@ -169,6 +336,107 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
   if (suffixes == NULL)
     suffixes = NO_SUFFIXES;
 
+  obstack_init (&obs);
+  obstack_grow0 (&obs, filename, strlen (filename));
+  for (i = 0; suffixes[i]; ++i)
+    obstack_grow0 (&obs, suffixes[i], strlen (suffixes[i]));
+  key.len = obstack_object_size (&obs);
+  key.str = (char *) obstack_finish (&obs);
+
+  if (!info->cache)
+    info->cache = m4_hash_new (0, m4_hash_string_hash, m4_hash_string_cmp);
+  place = m4_hash_lookup (info->cache, &key);
+  if (place)
+    {
+      obstack_free (&obs, NULL);
+      entry = (path_cache_entry *) *place;
+      if (!entry->path)
+        {
+          errno = entry->error;
+          return NULL;
+        }
+    }
+  else
+    {
+      entry = (path_cache_entry *) xzalloc (sizeof *entry);
+      entry->key.str = xmemdup0 (key.str, key.len);
+      entry->key.len = key.len;
+      obstack_free (&obs, NULL);
+      entry->path = path_search (context, filename, suffixes, &entry->report);
+      entry->error = errno;
+      m4_hash_insert (info->cache, &entry->key, entry);
+      if (!entry->path)
+        return NULL;
+    }
+
+  result = xstrdup (entry->path);
+  if (entry->report)
+    m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                      _("path search for %s found %s"),
+                      quotearg_style (locale_quoting_style, filename),
+                      quotearg_n_style (1, locale_quoting_style, result));
+  return result;
+}
+
+/* Forget the results of earlier calls to m4_path_search in CONTEXT,
+   because the search path changed, or files may have been created
+   or removed.  */
+void
+m4_path_cache_flush (m4 *context)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+
+  if (info->cache)
+    {
+      m4_hash_apply (info->cache, path_cache_delete_CB, NULL);
+      m4_hash_delete (info->cache);
+      info->cache = NULL;
+    }
+}
+
+/* Free the cache entry VALUE, on behalf of m4_path_cache_flush.  */
+static void *
+path_cache_delete_CB (m4_hash *hash M4_GNUC_UNUSED,
+                      const void *key M4_GNUC_UNUSED, void *value,
+                      void *userdata M4_GNUC_UNUSED)
+{
+  path_cache_entry *entry = (path_cache_entry *) value;
+
+  free (entry->key.str);
+  free (entry->path);
+  free (entry);
+  return NULL;
+}
+
+/* Free the directory snapshot VALUE, on behalf of m4__include_exit.  */
+static void *
+path_listing_delete_CB (m4_hash *hash M4_GNUC_UNUSED,
+                        const void *key M4_GNUC_UNUSED, void *value,
+                        void *userdata M4_GNUC_UNUSED)
+{
+  path_listing *listing = (path_listing *) value;
+
+  if (listing->names)
+    m4_hash_delete (listing->names);
+  obstack_free (&listing->storage, NULL);
+  free (listing->key.str);
+  free (listing);
+  return NULL;
+}
+
+/* Search for FILENAME on behalf of m4_path_search, and set *REPORT to
+   whether the result should be traced.  */
+static char *
+path_search (m4 *context, const char *filename, const char **suffixes,
+             bool *report)
+{
+  m4__search_path *incl;
+  char *filepath;		/* buffer for constructed name */
+  size_t max_suffix_len = 0;
+  int i, e = 0;
+
+  *report = false;
+
   /* Find the longest suffix, so that we will always allocate enough
      memory for a filename with suffix.  */
   for (i = 0; suffixes && suffixes[i]; ++i)
@@ -189,7 +457,7 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
       for (i = 0; suffixes && suffixes[i]; ++i)
         {
           strcpy (filepath + mem, suffixes[i]);
-          if (access (filepath, R_OK) == 0)
+          if (path_access (context, filepath) == 0)
 	    return filepath;
 
           /* If search fails, we'll use the error we got from the first
@@ -214,12 +482,9 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
       xfprintf (stderr, "path_search (%s) -- trying %s\n", filename, pathname);
 #endif
 
-      if (access (pathname, R_OK) == 0)
+      if (path_access (context, pathname) == 0)
         {
-          m4_debug_message (context, M4_DEBUG_TRACE_PATH,
-                            _("path search for %s found %s"),
-                            quotearg_style (locale_quoting_style, filename),
-                            quotearg_n_style (1, locale_quoting_style, pathname));
+          *report = true;
           return pathname;
         }
       else if (!incl->len)
@@ -232,7 +497,7 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
       for (i = 0; suffixes && suffixes[i]; ++i)
         {
           strcpy (filepath + mem, suffixes[i]);
-          if (access (filepath, R_OK) == 0)
+          if (path_access (context, filepath) == 0)
             return filepath;
         }
       free (filepath);
@@ -267,10 +532,190 @@ m4_fopen (m4 *context, const char *file, const char *mode)
       if (set_cloexec_flag (fileno (fp), true) != 0)
         m4_error (context, 0, errno, NULL,
                   _("cannot protect input file across forks"));
+      if (m4__get_search_path (context)->open_func)
+        m4__get_search_path (context)->open_func
+          (context, file, true, m4__get_search_path (context)->open_data);
     }
   return fp;
 }
 
+/* Install FUNC to be called with the opaque parameter USERDATA and
+   the name of every file that m4_fopen opens from now on, with true,
+   and of every file that include searches looked for and did not
+   find, with false, so that a caller can tell which files its input
+   depended on, and which files would have changed it by appearing.
+   The results of earlier searches are forgotten, so that none are
+   missed.  A NULL FUNC removes the hook.  */
+void
+m4_set_open_hook (m4 *context, m4_open_func *func, void *userdata)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+
+  info->open_func = func;
+  info->open_data = userdata;
+  if (func)
+    m4_path_cache_flush (context);
+}
+
+
+/* Return the contents of the regular file FILE from the include
+   cache, reading it first if needed, with its reference count
+   incremented on behalf of the input block that will read it.  Return
+   NULL if FILE cannot be cached, and should be opened as usual.  */
+static m4__include_content *
+include_content (m4 *context, const char *file)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+  size_t limit = m4_get_include_cache_opt (context);
+  m4__include_content *content;
+  m4__include_content *victim;
+  struct stat st;
+  m4_string key;
+  void **place;
+  FILE *fp;
+
+  if (stat (file, &st) != 0 || !S_ISREG (st.st_mode))
+    return NULL;
+
+  if (!info->contents)
+    info->contents = m4_hash_new (0, m4_hash_string_hash,
+                                  m4_hash_string_cmp);
+  key.str = (char *) file;
+  key.len = strlen (file);
+  place = m4_hash_lookup (info->contents, &key);
+  if (place)
+    {
+      content = (m4__include_content *) *place;
+      if (content->dev == st.st_dev && content->ino == st.st_ino
+          && timespec_cmp (content->mtime, get_stat_mtime (&st)) == 0
+          && content->size == st.st_size)
+        {
+          info->stats.hits++;
+          include_content_unlink (info, content);
+        }
+      else if (content->refs)
+        /* The file changed while its old contents are still being
+           read; leave it to disk this time.  */
+        return NULL;
+      else
+        {
+          include_content_delete (info, content);
+          content = NULL;
+        }
+    }
+  else
+    content = NULL;
+
+  if (!content)
+    {
+      info->stats.misses++;
+      if ((uintmax_t) st.st_size > limit)
+        return NULL;
+
+      /* Make room by dropping the least recently used files that are
+         not being read.  */
+      victim = info->lru_end;
+      while (victim && info->stats.bytes + st.st_size > limit)
+        {
+          m4__include_content *prev = victim->prev;
+
+          if (!victim->refs)
+            {
+              include_content_delete (info, victim);
+              info->stats.evictions++;
+            }
+          victim = prev;
+        }
+      if (info->stats.bytes + st.st_size > limit)
+        return NULL;
+
+      fp = fopen (file, "r");
+      if (!fp)
+        return NULL;
+      content = (m4__include_content *) xzalloc (sizeof *content);
+      content->text = (char *) xmalloc (st.st_size + 1);
+      /* Read one byte more than expected, to notice a file that grew
+         since it was stat'ed.  */
+      if (fread (content->text, 1, st.st_size + 1, fp) != (size_t) st.st_size
+          || ferror (fp))
+        {
+          fclose (fp);
+          free (content->text);
+          free (content);
+          return NULL;
+        }
+      fclose (fp);
+      content->key.str = xmemdup0 (file, key.len);
+      content->key.len = key.len;
+      content->dev = st.st_dev;
+      content->ino = st.st_ino;
+      content->mtime = get_stat_mtime (&st);
+      content->size = st.st_size;
+      m4_hash_insert (info->contents, &content->key, content);
+      info->stats.bytes += st.st_size;
+      if (info->stats.peak_bytes < info->stats.bytes)
+        info->stats.peak_bytes = info->stats.bytes;
+    }
+
+  /* Move CONTENT to the front of the list of cached files.  */
+  content->prev = NULL;
+  content->next = info->lru;
+  if (info->lru)
+    info->lru->prev = content;
+  else
+    info->lru_end = content;
+  info->lru = content;
+  content->refs++;
+  return content;
+}
+
+/* Remove CONTENT from the list of cached files in INFO.  */
+static void
+include_content_unlink (m4__search_path_info *info,
+                        m4__include_content *content)
+{
+  if (content->prev)
+    content->prev->next = content->next;
+  else
+    info->lru = content->next;
+  if (content->next)
+    content->next->prev = content->prev;
+  else
+    info->lru_end = content->prev;
+  content->prev = content->next = NULL;
+}
+
+/* Drop CONTENT from the include cache in INFO and free it.  */
+static void
+include_content_delete (m4__search_path_info *info,
+                        m4__include_content *content)
+{
+  include_content_unlink (info, content);
+  m4_hash_remove (info->contents, &content->key);
+  info->stats.bytes -= content->size;
+  free (content->key.str);
+  free (content->text);
+  free (content);
+}
+
+/* Called when the input block reading the cached file DATA is popped,
+   after which the file may be dropped from the cache.  */
+void
+m4__include_release (m4 *context M4_GNUC_UNUSED, void *data)
+{
+  m4__include_content *content = (m4__include_content *) data;
+
+  assert (content->refs);
+  content->refs--;
+}
+
+/* Fill *STATS with the usage of the include cache of CONTEXT.  */
+void
+m4_get_include_cache_stats (m4 *context, m4_include_cache_stats *stats)
+{
+  *stats = m4__get_search_path (context)->stats;
+}
+
 
 /* Generic load function.  Push the input file or load the module named
    FILENAME, if it can be found in the search path.  Complain
@@ -285,8 +730,17 @@ m4_load_filename (m4 *context, const m4_call_info *caller,
 
   if (m4_get_posixly_correct_opt (context))
     {
+      m4__search_path_info *info = m4__get_search_path (context);
+
       if (access (filename, R_OK) == 0)
         filepath = xstrdup (filename);
+      else if (info->open_func)
+        {
+          int saved_errno = errno;
+
+          info->open_func (context, filename, false, info->open_data);
+          errno = saved_errno;
+        }
     }
   else
     filepath = m4_path_search (context, filename, FILE_SUFFIXES);
@@ -302,8 +756,23 @@ m4_load_filename (m4 *context, const m4_call_info *caller,
     }
   else
     {
+      m4__include_content *content = NULL;
       FILE *fp = NULL;
 
+      if (filepath && m4_get_include_cache_opt (context))
+        content = include_content (context, filepath);
+      if (content)
+        {
+          m4__search_path_info *info = m4__get_search_path (context);
+
+          if (info->open_func)
+            info->open_func (context, filepath, true, info->open_data);
+          m4__push_file_contents (context, content->text, content->size,
+                                  filepath, content);
+          free (filepath);
+          return true;
+        }
+
       if (filepath)
         fp = m4_fopen (context, filepath, "r");
 
@@ -346,6 +815,33 @@ m4__include_init (m4 *context)
 #endif
 }
 
+void
+m4__include_exit (m4 *context)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+  m4__search_path *path = info->list;
+
+  m4_path_cache_flush (context);
+  while (info->lru)
+    include_content_delete (info, info->lru);
+  if (info->contents)
+    m4_hash_delete (info->contents);
+  if (info->listings)
+    {
+      m4_hash_apply (info->listings, path_listing_delete_CB, NULL);
+      m4_hash_delete (info->listings);
+    }
+
+  while (path)
+    {
+      m4__search_path *stale = path;
+      path = path->next;
+
+      DELETE (stale->dir); /* Cast away const.  */
+      free (stale);
+    }
+}
+
 
 
 #ifdef DEBUG_INCL
@@ -0,0 +1,65 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef M4_PROBES_H
+#define M4_PROBES_H 1
+
+/* Static probes, for tracing an m4 binary with tools such as perf,
+   SystemTap or bpftrace without rebuilding it.  They are compiled in
+   only when configured with `--enable-probes', which needs
+   <sys/sdt.h>; a probe then costs a no-op instruction until a tracer
+   attaches to it.  Otherwise M4_PROBE expands to nothing.
+
+   All probes belong to the provider `m4', and the double underscores
+   in their names below read as dashes to the tracers:
+
+   macro-entry (name, len, level)     a macro call begins collecting
+                                      its arguments
+   macro-return (name, len, level, bytes)
+                                      a macro call has produced BYTES
+                                      of expansion
+   symbol-define (name, len, pushed)  define, or pushdef if PUSHED
+   symbol-undefine (name, len, removed)
+                                      popdef, which REMOVED the symbol
+                                      if it held the last definition
+   diversion-switch (from, to)        output moves to diversion TO
+   diversion-spill (divnum, bytes)    an in-memory diversion is
+                                      flushed to a temporary file
+   input-push (file, line, kind)      an input source of KIND "file",
+                                      "cached" or "string" is pushed
+   input-pop (file, line)             an input source is exhausted
+   regex-compile (regex, len, hit)    a compiled regular expression is
+                                      requested, and HIT is 1 if it was
+                                      found in the cache
+
+   NAME and REGEX are not NUL-terminated, so tracers must copy LEN
+   bytes of them.  */
+
+#if ENABLE_PROBES
+#  include <sys/sdt.h>
+#  define M4_PROBE2(Name, A, B)         DTRACE_PROBE2 (m4, Name, A, B)
+#  define M4_PROBE3(Name, A, B, C)      DTRACE_PROBE3 (m4, Name, A, B, C)
+#  define M4_PROBE4(Name, A, B, C, D)   DTRACE_PROBE4 (m4, Name, A, B, C, D)
+#else
+#  define M4_PROBE2(Name, A, B)         ((void) 0)
+#  define M4_PROBE3(Name, A, B, C)      ((void) 0)
+#  define M4_PROBE4(Name, A, B, C, D)   ((void) 0)
+#endif
+
+#endif /* !M4_PROBES_H */
@@ -0,0 +1,449 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include "m4private.h"
+#include "close-stream.h"
+#include "gethrxtime.h"
+
+/* This file collects per-macro statistics about macro expansion, for
+   use in finding out where the time of an m4 run is spent.  Profiling
+   is off unless m4_profile_set_output has been called, in which case
+   expand_macro reports every macro call to m4__profile_enter and
+   m4__profile_leave.  When profiling is off, the only cost to the
+   macro engine is a test of context->profile per call.
+
+   Every call pushes a frame on a stack that parallels the nesting of
+   expand_macro, which is also the chain of m4_call_info objects.
+   When a frame is popped, its elapsed time is charged to the macro as
+   inclusive time, and the elapsed time minus that of its children is
+   charged as self time.  Because argument collection happens inside
+   expand_macro, macros called while collecting the arguments of
+   another macro count as its children; the rescanning of an expansion
+   happens after expand_macro returns, so macros called from the
+   expansion text are siblings instead.
+
+   The profile can also record the self time of each distinct call
+   stack, for display as a flame graph.  Each frame then also points
+   into a tree of call paths, where the children of a node are the
+   distinct macros called while that node was the innermost frame.
+   The tree is written in the collapsed stack format understood by
+   flame graph tools: one line per path, with the macro names from
+   outermost to innermost separated by `;', followed by a space and
+   the self time of the path in microseconds.  */
+
+/* Statistics gathered for one macro name.  */
+typedef struct
+{
+  m4_string name;               /* Macro name, also the hash key.  */
+  size_t calls;                 /* Number of calls.  */
+  xtime_t inclusive;            /* Time spent in outermost calls.  */
+  xtime_t self;                 /* Time spent excluding children.  */
+  size_t arg_bytes;             /* Bytes of arguments collected.  */
+  size_t expansion_bytes;       /* Bytes of expansion pushed back.  */
+  size_t max_depth;             /* Deepest expansion level seen.  */
+  size_t active;                /* Number of frames for this macro.  */
+} profile_entry;
+
+/* One distinct call path, in the tree of call paths.  */
+typedef struct profile_node profile_node;
+struct profile_node
+{
+  profile_entry *entry;         /* Innermost macro, or NULL at the root.  */
+  profile_node *parent;         /* Path without the innermost macro.  */
+  profile_node *child;          /* First path that extends this one.  */
+  profile_node *sibling;        /* Next path with the same parent.  */
+  xtime_t self;                 /* Time spent with this path innermost.  */
+};
+
+/* One active macro call.  */
+typedef struct
+{
+  profile_entry *entry;         /* Statistics for the called macro.  */
+  profile_node *node;           /* Call path, or NULL without stacks.  */
+  xtime_t start;                /* Time when the call started.  */
+  xtime_t children;             /* Time spent in nested calls.  */
+} profile_frame;
+
+struct m4__profile
+{
+  FILE *file;                   /* Where the report is written, or NULL.  */
+  FILE *stacks_file;            /* Where call paths go, or NULL.  */
+  m4_hash *table;               /* Map of macro name to profile_entry.  */
+  profile_node root;            /* Root of the tree of call paths.  */
+  profile_frame *frames;        /* Stack of active calls.  */
+  size_t frames_len;            /* Number of active calls.  */
+  size_t frames_max;            /* Allocated size of frames.  */
+  xtime_t start;                /* Time when profiling started.  */
+};
+
+static FILE *   profile_open            (m4 *, const char *);
+static void *   profile_collect_CB      (m4_hash *, const void *, void *,
+                                         void *);
+static int      profile_compare_CB      (const void *, const void *);
+static void     profile_pop             (m4__profile *, xtime_t);
+static profile_node *profile_child      (profile_node *, profile_entry *);
+static void     profile_write_table     (m4 *, m4__profile *, xtime_t);
+static void     profile_write_stacks    (m4 *, m4__profile *);
+static void     profile_write_name      (FILE *, const profile_entry *);
+
+
+
+/* Open NAME for writing a profile, and make sure CONTEXT is ready to
+   profile macro calls.  Return NULL with errno set on failure.  */
+static FILE *
+profile_open (m4 *context, const char *name)
+{
+  m4__profile *profile;
+  FILE *fp;
+
+  assert (context);
+  assert (name);
+
+  fp = fopen (name, "w");
+  if (fp == NULL)
+    return NULL;
+  if (set_cloexec_flag (fileno (fp), true) != 0)
+    m4_warn (context, errno, NULL,
+             _("cannot protect profile file across forks"));
+
+  if (!context->profile)
+    {
+      profile = (m4__profile *) xzalloc (sizeof *profile);
+      profile->table = m4_hash_new (0, m4_hash_string_hash,
+                                    m4_hash_string_cmp);
+      profile->start = gethrxtime ();
+      context->profile = profile;
+    }
+  return fp;
+}
+
+/* Start profiling macro expansion in CONTEXT, writing a table of
+   per-macro statistics to the file NAME when m4_profile_finish is
+   called.  Return false with errno set if NAME cannot be opened.
+   Must not be called once macro expansion has started.  */
+bool
+m4_profile_set_output (m4 *context, const char *name)
+{
+  FILE *fp = profile_open (context, name);
+
+  if (fp == NULL)
+    return false;
+  assert (!context->profile->file);
+  context->profile->file = fp;
+  return true;
+}
+
+/* Start profiling macro expansion in CONTEXT, writing the self time
+   of each distinct call stack in collapsed stack format to the file
+   NAME when m4_profile_finish is called.  Return false with errno set
+   if NAME cannot be opened.  Must not be called once macro expansion
+   has started.  */
+bool
+m4_profile_set_stacks_output (m4 *context, const char *name)
+{
+  FILE *fp = profile_open (context, name);
+
+  if (fp == NULL)
+    return false;
+  assert (!context->profile->stacks_file);
+  context->profile->stacks_file = fp;
+  return true;
+}
+
+/* Record the start of the macro call described by INFO, at expansion
+   level LEVEL.  */
+void
+m4__profile_enter (m4 *context, const m4_call_info *info, size_t level)
+{
+  m4__profile *profile = context->profile;
+  profile_entry *entry;
+  profile_frame *frame;
+  m4_string key;
+  void **place;
+
+  key.str = (char *) info->name;
+  key.len = info->name_len;
+  place = m4_hash_lookup (profile->table, &key);
+  if (place)
+    entry = (profile_entry *) *place;
+  else
+    {
+      entry = (profile_entry *) xzalloc (sizeof *entry);
+      entry->name.str = xmemdup0 (info->name, info->name_len);
+      entry->name.len = info->name_len;
+      m4_hash_insert (profile->table, &entry->name, entry);
+    }
+  entry->calls++;
+  entry->active++;
+  if (entry->max_depth < level)
+    entry->max_depth = level;
+
+  if (profile->frames_len == profile->frames_max)
+    profile->frames = (profile_frame *) x2nrealloc (profile->frames,
+                                                    &profile->frames_max,
+                                                    sizeof *frame);
+  frame = &profile->frames[profile->frames_len++];
+  frame->entry = entry;
+  frame->node = NULL;
+  if (profile->stacks_file)
+    frame->node = profile_child (profile->frames_len > 1
+                                 ? frame[-1].node : &profile->root, entry);
+  frame->children = 0;
+  frame->start = gethrxtime ();
+}
+
+/* Record the end of the innermost macro call, which collected
+   ARG_BYTES bytes of arguments and pushed back EXPANSION_BYTES bytes
+   of expansion.  */
+void
+m4__profile_leave (m4 *context, size_t arg_bytes, size_t expansion_bytes)
+{
+  m4__profile *profile = context->profile;
+  profile_entry *entry;
+
+  assert (profile->frames_len);
+  entry = profile->frames[profile->frames_len - 1].entry;
+  entry->arg_bytes += arg_bytes;
+  entry->expansion_bytes += expansion_bytes;
+  profile_pop (profile, gethrxtime ());
+}
+
+/* Pop the innermost frame of PROFILE, which ended at time NOW.  */
+static void
+profile_pop (m4__profile *profile, xtime_t now)
+{
+  profile_frame *frame = &profile->frames[--profile->frames_len];
+  xtime_t elapsed = now - frame->start;
+
+  frame->entry->self += elapsed - frame->children;
+  if (frame->node)
+    frame->node->self += elapsed - frame->children;
+  /* Only the outermost of several recursive calls contributes to the
+     inclusive time, or recursion would count the same time twice.  */
+  if (--frame->entry->active == 0)
+    frame->entry->inclusive += elapsed;
+  if (profile->frames_len)
+    profile->frames[profile->frames_len - 1].children += elapsed;
+}
+
+/* Return the child of the call path PARENT for a call to ENTRY,
+   creating it if this is the first such call.  */
+static profile_node *
+profile_child (profile_node *parent, profile_entry *entry)
+{
+  profile_node **place = &parent->child;
+  profile_node *node;
+
+  while (*place && (*place)->entry != entry)
+    place = &(*place)->sibling;
+  node = *place;
+  if (!node)
+    {
+      node = (profile_node *) xzalloc (sizeof *node);
+      node->entry = entry;
+      node->parent = parent;
+    }
+  else
+    *place = node->sibling;
+
+  /* Keep the most recently used child first, since a macro tends to
+     call the same few macros over and over.  */
+  node->sibling = parent->child;
+  parent->child = node;
+  return node;
+}
+
+/* Stop profiling in CONTEXT, and write the report.  Calls that are
+   still active, such as the call to m4exit that ends the run, are
+   closed as of now.  Does nothing if profiling is not active.  */
+void
+m4_profile_finish (m4 *context)
+{
+  m4__profile *profile;
+  xtime_t now;
+
+  assert (context);
+  profile = context->profile;
+  if (!profile)
+    return;
+  context->profile = NULL;
+
+  now = gethrxtime ();
+  while (profile->frames_len)
+    profile_pop (profile, now);
+
+  if (profile->stacks_file)
+    profile_write_stacks (context, profile);
+  profile_write_table (context, profile, now);
+  m4_hash_delete (profile->table);
+  free (profile->frames);
+  free (profile);
+}
+
+/* Write the statistics table of PROFILE, which ended at time NOW, if
+   one was requested, then release all profile entries.  */
+static void
+profile_write_table (m4 *context, m4__profile *profile, xtime_t now)
+{
+  FILE *fp = profile->file;
+  profile_entry **entries;
+  profile_entry **next;
+  size_t count;
+  size_t calls = 0;
+  size_t i;
+
+  count = m4_get_hash_length (profile->table);
+  entries = (profile_entry **) xnmalloc (count + 1, sizeof *entries);
+  next = entries;
+  m4_hash_apply (profile->table, profile_collect_CB, &next);
+
+  if (fp)
+    {
+      qsort (entries, count, sizeof *entries, profile_compare_CB);
+      for (i = 0; i < count; i++)
+        calls += entries[i]->calls;
+
+      xfprintf (fp, "# m4 profile: %zu macros, %zu calls, %.6f s\n",
+                count, calls, (now - profile->start) / 1e9);
+      xfprintf (fp, "# %10s %12s %12s %12s %12s %6s  %s\n", "calls",
+                "self s", "inclusive s", "arg bytes", "exp bytes", "depth",
+                "name");
+      for (i = 0; i < count; i++)
+        {
+          profile_entry *entry = entries[i];
+          xfprintf (fp, "%12zu %12.6f %12.6f %12zu %12zu %6zu  ",
+                    entry->calls, entry->self / 1e9, entry->inclusive / 1e9,
+                    entry->arg_bytes, entry->expansion_bytes,
+                    entry->max_depth);
+          fwrite (entry->name.str, 1, entry->name.len, fp);
+          putc ('\n', fp);
+        }
+      if (close_stream (fp) != 0)
+        m4_error (context, 0, errno, NULL, _("error writing profile"));
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      free (entries[i]->name.str);
+      free (entries[i]);
+    }
+  free (entries);
+}
+
+/* Write every call path of PROFILE in collapsed stack format, then
+   release the tree of call paths.  The tree is walked without
+   recursion, since it is as deep as the deepest macro nesting.  */
+static void
+profile_write_stacks (m4 *context, m4__profile *profile)
+{
+  FILE *fp = profile->stacks_file;
+  profile_node *node = profile->root.child;
+  const profile_node **path = NULL;     /* Nodes of the current path.  */
+  size_t path_max = 0;                  /* Allocated size of path.  */
+  size_t depth;
+  const profile_node *tmp;
+
+  while (node)
+    {
+      /* Collect the path from the innermost macro out, then write it
+         from the outermost macro in.  */
+      depth = 0;
+      for (tmp = node; tmp != &profile->root; tmp = tmp->parent)
+        {
+          if (depth == path_max)
+            path = (const profile_node **) x2nrealloc (path, &path_max,
+                                                       sizeof *path);
+          path[depth++] = tmp;
+        }
+      while (depth--)
+        {
+          profile_write_name (fp, path[depth]->entry);
+          if (depth)
+            putc (';', fp);
+        }
+      xfprintf (fp, " %lld\n", (long long) (node->self / 1000));
+      if (node->child)
+        node = node->child;
+      else
+        {
+          /* Free this leaf, and every ancestor whose children are all
+             done, until reaching a node with a sibling left to visit.  */
+          while (node != &profile->root && !node->sibling)
+            {
+              profile_node *parent = node->parent;
+              parent->child = NULL;
+              free (node);
+              node = parent;
+            }
+          if (node != &profile->root)
+            {
+              profile_node *sibling = node->sibling;
+              node->parent->child = sibling;
+              free (node);
+              node = sibling;
+            }
+          else
+            node = NULL;
+        }
+    }
+
+  free (path);
+  if (close_stream (fp) != 0)
+    m4_error (context, 0, errno, NULL, _("error writing profile stacks"));
+}
+
+/* Write the name of ENTRY to FP, replacing characters that would
+   confuse the collapsed stack format by `_'.  */
+static void
+profile_write_name (FILE *fp, const profile_entry *entry)
+{
+  size_t i;
+
+  for (i = 0; i < entry->name.len; i++)
+    {
+      char ch = entry->name.str[i];
+      putc (ch == ';' || ch == ' ' || ch == '\n' ? '_' : ch, fp);
+    }
+}
+
+/* Append the profile_entry VALUE to the array tracked by USERDATA.  */
+static void *
+profile_collect_CB (m4_hash *hash M4_GNUC_UNUSED,
+                    const void *key M4_GNUC_UNUSED, void *value,
+                    void *userdata)
+{
+  profile_entry ***next = (profile_entry ***) userdata;
+  *(*next)++ = (profile_entry *) value;
+  return NULL;
+}
+
+/* qsort comparison routine, ordering entries by decreasing self time,
+   then by name.  */
+static int
+profile_compare_CB (const void *a, const void *b)
+{
+  const profile_entry *x = *(profile_entry *const *) a;
+  const profile_entry *y = *(profile_entry *const *) b;
+
+  if (x->self != y->self)
+    return x->self < y->self ? 1 : -1;
+  return m4_hash_string_cmp (&x->name, &y->name);
+}
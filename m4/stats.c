@@ -0,0 +1,232 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <fcntl.h>
+
+#include "m4private.h"
+#include "close-stream.h"
+#include "gethrxtime.h"
+
+/* This file reports counters gathered across the engine over a whole
+   run, for use in sizing the hash table, memory budgets and caches.
+   Statistics are off unless m4_stats_set_output has been called; the
+   engine then bumps the counters of context->stats with m4__stats_add,
+   so that when they are off the only cost is a test of context->stats
+   per event.  The memory used by the token, input and argument stacks
+   is sampled after each macro call, which is when the stacks hold the
+   most; the report gives the highest sample of each.
+
+   The report is a series of lines, each holding the name of one
+   counter and its value separated by spaces, so that it is easy to
+   read both by people and by scripts.  The children forked by batch
+   and server modes restart the counters with m4__stats_forked, and
+   each appends its own report to the file before the parent does.  */
+
+/* Names of the token types, indexed by m4__token_type.  */
+static const char *const token_names[M4_TOKEN_ARGV + 1] =
+{
+  "eof", "none", "string", "comment", "space", "word", "open", "comma",
+  "close", "simple", "macdef", "argv"
+};
+
+static void     stats_write     (m4 *, m4__stats *);
+
+
+
+/* Start gathering statistics in CONTEXT, to be written to the file
+   NAME when m4_stats_finish is called, or to standard error if NAME
+   is NULL.  Return false with errno set if NAME cannot be opened.
+   Must not be called once macro expansion has started.  */
+bool
+m4_stats_set_output (m4 *context, const char *name)
+{
+  FILE *fp = stderr;
+
+  assert (context);
+  assert (!context->stats);
+
+  if (name)
+    {
+      /* Reports of children may be written to the file while it is
+         open, so let every write go to its end.  */
+      fp = fopen (name, "w");
+      if (fp == NULL)
+        return false;
+      fcntl (fileno (fp), F_SETFL, fcntl (fileno (fp), F_GETFL) | O_APPEND);
+      if (set_cloexec_flag (fileno (fp), true) != 0)
+        m4_warn (context, errno, NULL,
+                 _("cannot protect statistics file across forks"));
+    }
+  context->stats = (m4__stats *) xzalloc (sizeof *context->stats);
+  context->stats->file = fp;
+  return true;
+}
+
+/* Record a request for a compiled regular expression, which was
+   served by the cache of compiled expressions if HIT.  Modules
+   keeping such a cache call this, so that its hit rate is reported.  */
+void
+m4_stats_regex (m4 *context, bool hit)
+{
+  m4__stats_add (context, regex_lookups, 1);
+  if (hit)
+    m4__stats_add (context, regex_hits, 1);
+}
+
+/* Record the end of a macro call at expansion level LEVEL, and sample
+   the memory used by the stacks of the macro engine.  */
+void
+m4__stats_call (m4 *context, size_t level)
+{
+  m4__stats *stats = context->stats;
+  m4__macro_arg_stacks *stack = &context->arg_stacks[level];
+  size_t used;
+
+  stats->calls++;
+  if (stats->max_level < level + 1)
+    stats->max_level = level + 1;
+  used = (obstack_memory_used (stack->args)
+          + obstack_memory_used (stack->argv));
+  if (stats->arg_stack_max < used)
+    stats->arg_stack_max = used;
+  m4__input_stats (context, stats);
+}
+
+/* Record the start of loading a frozen state into CONTEXT.  */
+void
+m4__stats_load_begin (m4 *context)
+{
+  if (context->stats)
+    context->stats->load_start = gethrxtime ();
+}
+
+/* Record the end of loading a frozen state into CONTEXT.  */
+void
+m4__stats_load_end (m4 *context)
+{
+  if (context->stats)
+    context->stats->load_time += (gethrxtime ()
+                                  - context->stats->load_start);
+}
+
+/* Restart the counters of CONTEXT, in a child that was just forked to
+   carry on from its state, so that the report of the child covers only
+   its own work.  The counters of the include cache are restarted too,
+   but the size of the symbol table is reported as it stands.  */
+void
+m4__stats_forked (m4 *context)
+{
+  m4__stats *stats = context->stats;
+  m4_include_cache_stats *include = &m4__get_search_path (context)->stats;
+  FILE *fp;
+
+  if (!stats)
+    return;
+  fp = stats->file;
+  memset (stats, 0, sizeof *stats);
+  stats->file = fp;
+  include->hits = include->misses = include->evictions = 0;
+  include->peak_bytes = include->bytes;
+}
+
+/* Stop gathering statistics in CONTEXT, and write the report.  Does
+   nothing if statistics are not being gathered.  */
+void
+m4_stats_finish (m4 *context)
+{
+  m4__stats *stats;
+
+  assert (context);
+  stats = context->stats;
+  if (!stats)
+    return;
+  context->stats = NULL;
+
+  stats_write (context, stats);
+  if (stats->file != stderr && close_stream (stats->file) != 0)
+    m4_error (context, 0, errno, NULL, _("error writing statistics"));
+  free (stats);
+}
+
+/* Write the report of STATS, gathered by CONTEXT.  */
+static void
+stats_write (m4 *context, m4__stats *stats)
+{
+  FILE *fp = stats->file;
+  m4_hash *table = m4__symtab_hash (context->symtab);
+  m4_include_cache_stats include;
+  size_t symbols = m4_get_hash_length (table);
+  size_t buckets = m4_get_hash_size (table);
+  size_t tokens = 0;
+  int i;
+
+  for (i = 0; i <= M4_TOKEN_ARGV; i++)
+    tokens += stats->tokens[i];
+  xfprintf (fp, "# m4 statistics\n");
+  xfprintf (fp, "%-24s %zu\n", "tokens", tokens);
+  for (i = 0; i <= M4_TOKEN_ARGV; i++)
+    if (stats->tokens[i])
+      xfprintf (fp, "tokens.%-17s %zu\n", token_names[i], stats->tokens[i]);
+
+  xfprintf (fp, "%-24s %zu\n", "lookups", stats->lookups);
+  xfprintf (fp, "%-24s %zu\n", "lookups.hits", stats->hits);
+  xfprintf (fp, "%-24s %zu\n", "lookups.misses",
+            stats->lookups - stats->hits);
+  xfprintf (fp, "%-24s %zu\n", "hash.symbols", symbols);
+  xfprintf (fp, "%-24s %zu\n", "hash.buckets", buckets);
+  xfprintf (fp, "%-24s %.2f\n", "hash.load",
+            buckets ? (double) symbols / buckets : 0.0);
+  xfprintf (fp, "%-24s %zu\n", "hash.longest_chain",
+            m4_get_hash_longest_chain (table));
+
+  xfprintf (fp, "%-24s %zu\n", "calls", stats->calls);
+  xfprintf (fp, "%-24s %zu\n", "calls.max_level", stats->max_level);
+  xfprintf (fp, "%-24s %zu\n", "memory.token_stack",
+            stats->token_stack_max);
+  xfprintf (fp, "%-24s %zu\n", "memory.input_stack",
+            stats->input_stack_max);
+  xfprintf (fp, "%-24s %zu\n", "memory.arg_stack", stats->arg_stack_max);
+
+  xfprintf (fp, "%-24s %zu\n", "output.bytes", stats->output_bytes);
+  xfprintf (fp, "%-24s %zu\n", "output.diversions", stats->diversions);
+  xfprintf (fp, "%-24s %zu\n", "output.spilled_bytes",
+            stats->spilled_bytes);
+  xfprintf (fp, "%-24s %zu\n", "output.tmpfiles", stats->tmpfiles);
+
+  xfprintf (fp, "%-24s %zu\n", "regex.lookups", stats->regex_lookups);
+  xfprintf (fp, "%-24s %zu\n", "regex.hits", stats->regex_hits);
+  xfprintf (fp, "%-24s %.1f%%\n", "regex.hit_rate",
+            (stats->regex_lookups
+             ? 100.0 * stats->regex_hits / stats->regex_lookups : 0.0));
+
+  if (m4_get_include_cache_opt (context))
+    {
+      m4_get_include_cache_stats (context, &include);
+      xfprintf (fp, "%-24s %zu\n", "include.hits", include.hits);
+      xfprintf (fp, "%-24s %zu\n", "include.misses", include.misses);
+      xfprintf (fp, "%-24s %zu\n", "include.evictions", include.evictions);
+      xfprintf (fp, "%-24s %zu\n", "include.peak_bytes",
+                include.peak_bytes);
+    }
+
+  xfprintf (fp, "%-24s %.6f\n", "frozen.load_seconds",
+            stats->load_time / 1e9);
+}
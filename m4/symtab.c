@@ -43,14 +43,27 @@
    and the trace bit attached to the name was never lost.  There is a
    small amount of fluff in these functions to make sure that such
    symbols (with empty value stacks) are invisible to the users of
-   this module.  */
+   this module.
+
+   A symbol table can also defer the definition of symbols to a lazy
+   source, such as a frozen file, which is asked to define a name the
+   first time that name is missing from the table.  Anything that
+   needs to see every symbol first asks the source to define all of
+   its remaining names.  Every change to a symbol sets its changed
+   bit, which the source clears after defining it, so that only the
+   symbols modified since then need to be frozen again.  */
 
 #define M4_SYMTAB_DEFAULT_SIZE          2047
 
 struct m4_symbol_table {
   m4_hash *table;
+  m4_symtab_lazy_func *lazy;    /* Source of deferred symbols, or NULL.  */
+  void *lazy_data;              /* Opaque data for LAZY.  */
+  bool lazy_busy;               /* True while LAZY defines a symbol.  */
 };
 
+static m4_symbol **symtab_find          (m4_symbol_table *, m4_string *);
+static void       symtab_force          (m4_symbol_table *);
 static m4_symbol *symtab_fetch          (m4_symbol_table*, const char *,
                                          size_t);
 static void       symbol_popval         (m4_symbol *);
@@ -73,6 +86,9 @@ m4_symtab_create (size_t size)
 
   symtab->table = m4_hash_new (size ? size : M4_SYMTAB_DEFAULT_SIZE,
                                m4_hash_string_hash, m4_hash_string_cmp);
+  symtab->lazy = NULL;
+  symtab->lazy_data = NULL;
+  symtab->lazy_busy = false;
   return symtab;
 }
 
@@ -82,11 +98,21 @@ m4_symtab_delete (m4_symbol_table *symtab)
   assert (symtab);
   assert (symtab->table);
 
+  /* There is no point defining deferred symbols just to delete them.  */
+  symtab->lazy = NULL;
   m4_symtab_apply (symtab, true, symbol_destroy_CB, NULL);
   m4_hash_delete (symtab->table);
   free (symtab);
 }
 
+/* Return the hash table behind SYMTAB, for reporting its usage.  */
+m4_hash *
+m4__symtab_hash (m4_symbol_table *symtab)
+{
+  assert (symtab);
+  return symtab->table;
+}
+
 /* For every symbol in SYMTAB, execute the callback FUNC with the name
    and value of the symbol being visited, and the opaque parameter
    USERDATA.  Skip undefined symbols that are placeholders for
@@ -104,6 +130,7 @@ m4_symtab_apply (m4_symbol_table *symtab, bool include_trace,
   assert (symtab->table);
   assert (func);
 
+  symtab_force (symtab);
   while ((place = m4_get_hash_iterator_next (symtab->table, place)))
     {
       m4_symbol *symbol = m4_get_hash_iterator_value (place);
@@ -123,6 +150,65 @@ m4_symtab_apply (m4_symbol_table *symtab, bool include_trace,
   return result;
 }
 
+/* Install FUNC as the source of deferred symbols for SYMTAB, with the
+   opaque parameter USERDATA.  Whenever a name is missing from SYMTAB,
+   FUNC is called with that name, and may define it; once FUNC is
+   called with a NULL name, it must define all of its remaining
+   symbols, and is not called again.  FUNC must not define a name more
+   than once, since the name may have been undefined in the meantime.
+   A NULL FUNC removes the source, which FUNC itself may do once it has
+   nothing left to define.  */
+void
+m4_symtab_set_lazy (m4_symbol_table *symtab, m4_symtab_lazy_func *func,
+                    void *userdata)
+{
+  assert (symtab);
+
+  symtab->lazy = func;
+  symtab->lazy_data = userdata;
+}
+
+/* Return the source of deferred symbols of SYMTAB, or NULL.  */
+m4_symtab_lazy_func *
+m4__symtab_get_lazy (m4_symbol_table *symtab)
+{
+  assert (symtab);
+
+  return symtab->lazy;
+}
+
+/* Return the table entry for KEY in SYMTAB, or NULL if there is none
+   even after asking the lazy source to define it.  */
+static m4_symbol **
+symtab_find (m4_symbol_table *symtab, m4_string *key)
+{
+  m4_symbol **psymbol = (m4_symbol **) m4_hash_lookup (symtab->table, key);
+
+  if (!psymbol && symtab->lazy && !symtab->lazy_busy)
+    {
+      /* Defining the symbol looks it up again; don't recurse.  */
+      symtab->lazy_busy = true;
+      symtab->lazy (symtab, key->str, key->len, symtab->lazy_data);
+      symtab->lazy_busy = false;
+      psymbol = (m4_symbol **) m4_hash_lookup (symtab->table, key);
+    }
+  return psymbol;
+}
+
+/* Ask the lazy source of SYMTAB, if any, to define all remaining
+   symbols, since the caller needs to see all of them.  */
+static void
+symtab_force (m4_symbol_table *symtab)
+{
+  m4_symtab_lazy_func *lazy = symtab->lazy;
+
+  if (lazy)
+    {
+      symtab->lazy = NULL;
+      lazy (symtab, NULL, 0, symtab->lazy_data);
+    }
+}
+
 /* Ensure that NAME of length LEN exists in the table, creating an
    entry if needed.  */
 static m4_symbol *
@@ -139,7 +225,7 @@ symtab_fetch (m4_symbol_table *symtab, const char *name, size_t len)
      key.  */
   key.str = (char *) name;
   key.len = len;
-  psymbol = (m4_symbol **) m4_hash_lookup (symtab->table, &key);
+  psymbol = symtab_find (symtab, &key);
   if (psymbol)
     {
       symbol = *psymbol;
@@ -158,6 +244,26 @@ symtab_fetch (m4_symbol_table *symtab, const char *name, size_t len)
   return symbol;
 }
 
+/* Return the table entry for NAME of length LEN in SYMTAB, including
+   an undefined entry that is only traced, or NULL if there is none.
+   Unlike m4_symbol_lookup, this never consults the lazy source.  */
+m4_symbol *
+m4__symtab_peek (m4_symbol_table *symtab, const char *name, size_t len)
+{
+  m4_symbol **psymbol;
+  m4_string key;
+
+  assert (symtab);
+  assert (name);
+
+  /* Safe to cast away const, since m4_hash_lookup doesn't modify
+     key.  */
+  key.str = (char *) name;
+  key.len = len;
+  psymbol = (m4_symbol **) m4_hash_lookup (symtab->table, &key);
+  return psymbol ? *psymbol : NULL;
+}
+
 /* Remove every symbol that references the given module from
    the symbol table.  */
 void
@@ -168,6 +274,7 @@ m4__symtab_remove_module_references (m4_symbol_table *symtab,
 
   assert (module);
 
+  symtab_force (symtab);
    /* Traverse each symbol name in the hash table.  */
   while ((place = m4_get_hash_iterator_next (symtab->table, place)))
     {
@@ -185,6 +292,7 @@ m4__symtab_remove_module_references (m4_symbol_table *symtab,
               if (VALUE_MODULE (next) == module)
                 {
                   VALUE_NEXT (data) = VALUE_NEXT (next);
+                  symbol->changed = true;
 
                   assert (next->type != M4_SYMBOL_PLACEHOLDER);
                   m4_symbol_value_delete (next);
@@ -246,7 +354,7 @@ m4_symbol_lookup (m4_symbol_table *symtab, const char *name, size_t len)
      key.  */
   key.str = (char *) name;
   key.len = len;
-  psymbol = (m4_symbol **) m4_hash_lookup (symtab->table, &key);
+  psymbol = symtab_find (symtab, &key);
 
   /* If just searching, return status of search -- if only an empty
      struct is returned, that is treated as a failed lookup.  */
@@ -271,6 +379,8 @@ m4_symbol_pushdef (m4_symbol_table *symtab, const char *name, size_t len,
   symbol                = symtab_fetch (symtab, name, len);
   VALUE_NEXT (value)    = m4_get_symbol_value (symbol);
   symbol->value         = value;
+  symbol->changed       = true;
+  M4_PROBE3 (symbol__define, name, len, 1);
 
   assert (m4_get_symbol_value (symbol));
 
@@ -296,6 +406,8 @@ m4_symbol_define (m4_symbol_table *symtab, const char *name, size_t len,
 
   VALUE_NEXT (value) = m4_get_symbol_value (symbol);
   symbol->value      = value;
+  symbol->changed    = true;
+  M4_PROBE3 (symbol__define, name, len, 0);
 
   assert (m4_get_symbol_value (symbol));
 
@@ -315,12 +427,14 @@ m4_symbol_popdef (m4_symbol_table *symtab, const char *name, size_t len)
      key.  */
   key.str = (char *) name;
   key.len = len;
-  psymbol = (m4_symbol **) m4_hash_lookup (symtab->table, &key);
+  psymbol = symtab_find (symtab, &key);
 
   assert (psymbol);
   assert (*psymbol);
 
   symbol_popval (*psymbol);
+  (*psymbol)->changed = true;
+  M4_PROBE3 (symbol__undefine, name, len, !m4_get_symbol_value (*psymbol));
 
   /* Only remove the hash table entry if the last value in the
      symbol value stack was successfully removed.  */
@@ -378,7 +492,8 @@ m4_symbol_value_delete (m4_symbol_value *value)
       switch (value->type)
         {
         case M4_SYMBOL_TEXT:
-          DELETE (value->u.u_t.text);
+          if (!BIT_TEST (VALUE_FLAGS (value), VALUE_BORROWED_TEXT_BIT))
+            DELETE (value->u.u_t.text);
           break;
         case M4_SYMBOL_PLACEHOLDER:
           DELETE (value->u.u_t.text);
@@ -409,17 +524,24 @@ m4_symbol_rename (m4_symbol_table *symtab, const char *name, size_t len1,
   assert (name);
   assert (newname);
 
+  /* Bring in any deferred definitions of the new name first, since
+     that can grow the table.  */
+  key.str = (char *) newname;
+  key.len = len2;
+  symtab_find (symtab, &key);
+
   /* Safe to cast away const, since m4_hash_lookup doesn't modify
      key.  */
   key.str = (char *) name;
   key.len = len1;
   /* Use a low level hash fetch, so we can save the symbol value when
      removing the symbol name from the symbol table.  */
-  psymbol = (m4_symbol **) m4_hash_lookup (symtab->table, &key);
+  psymbol = symtab_find (symtab, &key);
 
   if (psymbol)
     {
       symbol = *psymbol;
+      symbol->changed = true;
 
       /* Remove the old name from the symbol table.  */
       pkey = (m4_string *) m4_hash_remove (symtab->table, &key);
@@ -469,7 +591,8 @@ m4_symbol_value_copy (m4 *context, m4_symbol_value *dest, m4_symbol_value *src)
   switch (dest->type)
     {
     case M4_SYMBOL_TEXT:
-      DELETE (dest->u.u_t.text);
+      if (!BIT_TEST (VALUE_FLAGS (dest), VALUE_BORROWED_TEXT_BIT))
+        DELETE (dest->u.u_t.text);
       break;
     case M4_SYMBOL_PLACEHOLDER:
       DELETE (dest->u.u_t.text);
@@ -493,6 +616,7 @@ m4_symbol_value_copy (m4 *context, m4_symbol_value *dest, m4_symbol_value *src)
   next = VALUE_NEXT (dest);
   memcpy (dest, src, sizeof (m4_symbol_value));
   VALUE_NEXT (dest) = next;
+  BIT_RESET (VALUE_FLAGS (dest), VALUE_BORROWED_TEXT_BIT);
 
   /* Caller is supposed to free text token strings, so we have to
      copy the string not just its address in that case.  */
@@ -597,7 +721,7 @@ m4_set_symbol_name_traced (m4_symbol_table *symtab, const char *name,
          key.  */
       key.str = (char *) name;
       key.len = len;
-      psymbol = (m4_symbol **) m4_hash_lookup (symtab->table, &key);
+      psymbol = symtab_find (symtab, &key);
       if (!psymbol)
         return false;
       symbol = *psymbol;
@@ -605,6 +729,7 @@ m4_set_symbol_name_traced (m4_symbol_table *symtab, const char *name,
 
   result = symbol->traced;
   symbol->traced = traced;
+  symbol->changed = true;
   if (!traced && !m4_get_symbol_value (symbol))
     {
       /* Free an undefined entry once it is no longer traced.  */
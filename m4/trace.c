@@ -0,0 +1,341 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include "m4private.h"
+#include "gethrxtime.h"
+
+/* This file writes trace and debug output in the binary format
+   described by m4_trace_record in m4module.h, which is selected by
+   m4_set_trace_binary_opt.  The text format spends most of its time
+   quoting, truncating and printing every traced call; the binary
+   format instead writes a few fixed-size records per call, and leaves
+   the formatting to a separate decoder.
+
+   Macro and file names are written once per debug file, as string
+   records, and are referred to by id afterwards.  Arguments are
+   written as raw text, truncated to the --debuglen limit, together
+   with their full length, which is all the decoder needs to reproduce
+   the truncation of the text format.  Since the debug file can change
+   at any time through debugfile, the string table starts over with a
+   new header whenever the file changes.  */
+
+struct m4__trace
+{
+  FILE *file;                   /* File that received the header.  */
+  m4_hash *strings;             /* Map of m4_string to string id.  */
+  m4_obstack keys;              /* Storage for keys of strings.  */
+  uint32_t next_id;             /* Next string id to assign.  */
+  char *quotes;                 /* Last quotes written, or NULL.  */
+  size_t quotes_len;            /* Length of quotes.  */
+  xtime_t start;                /* Time when tracing started.  */
+};
+
+static m4__trace *trace_file    (m4 *);
+static void     trace_reset     (m4__trace *);
+static uint32_t trace_string    (m4__trace *, const char *, size_t);
+static void     trace_quotes    (m4__trace *, const m4_string_pair *);
+static void     trace_record    (m4__trace *, m4_trace_record *,
+                                 const char *, size_t);
+static void     trace_init      (m4 *, m4__trace *, m4_trace_record *,
+                                 uint32_t, const m4_call_info *);
+
+
+
+/* Return the binary trace state of CONTEXT, ready to write records to
+   the current debug file, or NULL if debug output is discarded.  */
+static m4__trace *
+trace_file (m4 *context)
+{
+  m4__trace *trace = context->trace;
+  FILE *file = m4_get_debug_file (context);
+  m4_trace_record header;
+
+  if (file == NULL)
+    return NULL;
+  if (!trace)
+    {
+      trace = (m4__trace *) xzalloc (sizeof *trace);
+      trace->start = gethrxtime ();
+      context->trace = trace;
+    }
+  if (trace->file != file)
+    {
+      trace_reset (trace);
+      trace->file = file;
+      trace->strings = m4_hash_new (0, m4_hash_string_hash,
+                                    m4_hash_string_cmp);
+      obstack_init (&trace->keys);
+      memset (&header, 0, sizeof header);
+      header.type = M4_TRACE_HEADER;
+      header.index = M4_TRACE_VERSION;
+      header.length = sizeof header;
+      trace_record (trace, &header, NULL, 0);
+    }
+  return trace;
+}
+
+/* Forget the string table of TRACE, since the debug file changed.  */
+static void
+trace_reset (m4__trace *trace)
+{
+  if (trace->strings)
+    {
+      m4_hash_delete (trace->strings);
+      obstack_free (&trace->keys, NULL);
+      trace->strings = NULL;
+    }
+  free (trace->quotes);
+  trace->quotes = NULL;
+  trace->file = NULL;
+  trace->next_id = 0;
+}
+
+/* Return the id of the string STR of length LEN in TRACE, writing a
+   string record the first time it is seen.  */
+static uint32_t
+trace_string (m4__trace *trace, const char *str, size_t len)
+{
+  m4_string key;
+  m4_string *copy;
+  m4_trace_record record;
+  void **place;
+
+  key.str = (char *) str;
+  key.len = len;
+  place = m4_hash_lookup (trace->strings, &key);
+  if (place)
+    return (uint32_t) (uintptr_t) *place;
+
+  copy = (m4_string *) obstack_alloc (&trace->keys, sizeof *copy);
+  copy->str = (char *) obstack_copy0 (&trace->keys, str, len);
+  copy->len = len;
+  m4_hash_insert (trace->strings, copy, (void *) (uintptr_t) trace->next_id);
+
+  memset (&record, 0, sizeof record);
+  record.type = M4_TRACE_STRING;
+  record.name = trace->next_id;
+  trace_record (trace, &record, str, len);
+  return trace->next_id++;
+}
+
+/* Write a quotes record to TRACE if QUOTES differ from the ones that
+   were last written.  */
+static void
+trace_quotes (m4__trace *trace, const m4_string_pair *quotes)
+{
+  m4_trace_record record;
+  size_t len = quotes->len1 + quotes->len2;
+
+  if (trace->quotes && trace->quotes_len == len
+      && memcmp (trace->quotes, quotes->str1, quotes->len1) == 0
+      && memcmp (trace->quotes + quotes->len1, quotes->str2,
+                 quotes->len2) == 0)
+    return;
+  free (trace->quotes);
+  trace->quotes = (char *) xmalloc (len);
+  trace->quotes_len = len;
+  memcpy (trace->quotes, quotes->str1, quotes->len1);
+  memcpy (trace->quotes + quotes->len1, quotes->str2, quotes->len2);
+
+  memset (&record, 0, sizeof record);
+  record.type = M4_TRACE_QUOTES;
+  record.index = quotes->len1;
+  trace_record (trace, &record, trace->quotes, len);
+}
+
+/* Write RECORD to the debug file of TRACE, followed by the LEN bytes
+   of TEXT.  */
+static void
+trace_record (m4__trace *trace, m4_trace_record *record, const char *text,
+              size_t len)
+{
+  record->size = len;
+  fwrite (record, sizeof *record, 1, trace->file);
+  if (len)
+    fwrite (text, 1, len, trace->file);
+}
+
+/* Fill in RECORD of kind TYPE for the macro call described by INFO,
+   at the current expansion level and time.  */
+static void
+trace_init (m4 *context, m4__trace *trace, m4_trace_record *record,
+            uint32_t type, const m4_call_info *info)
+{
+  memset (record, 0, sizeof *record);
+  record->type = type;
+  record->flags = info->debug_level;
+  record->depth = context->expansion_level;
+  record->name = trace_string (trace, info->name, info->name_len);
+  record->file = trace_string (trace, info->file, strlen (info->file));
+  record->line = info->line;
+  record->call_id = info->call_id;
+  record->time = gethrxtime () - trace->start;
+}
+
+
+/* Write the binary equivalent of the `-dc' trace line for the macro
+   call described by INFO, about to collect arguments for VALUE.  */
+void
+m4__trace_prepare (m4 *context, const m4_call_info *info,
+                   m4_symbol_value *value)
+{
+  m4__trace *trace = trace_file (context);
+  m4_obstack *obs = &context->trace_messages;
+  size_t start = obstack_object_size (obs);
+  size_t arg_length = m4_get_max_debug_arg_length_opt (context);
+  const m4_string_pair *quotes = NULL;
+  m4_trace_record record;
+
+  if (!trace)
+    return;
+  if (info->debug_level & M4_DEBUG_TRACE_QUOTE)
+    quotes = m4_get_syntax_quotes (M4SYNTAX);
+  m4__symbol_value_print (context, value, obs, quotes, false, NULL,
+                          &arg_length,
+                          (info->debug_level & M4_DEBUG_TRACE_MODULE) != 0);
+  trace_init (context, trace, &record, M4_TRACE_PREPARE, info);
+  trace_record (trace, &record, (char *) obstack_base (obs) + start,
+                obstack_object_size (obs) - start);
+  obstack_blank (obs, start - obstack_object_size (obs));
+}
+
+/* Write the records for the start of the traced macro call ARGV:
+   a call record, then one record per argument if they are traced.
+   Like the text format, stop after the first argument that had to
+   be truncated.  */
+void
+m4__trace_call (m4 *context, m4_macro_args *argv)
+{
+  m4__trace *trace = trace_file (context);
+  const m4_call_info *info = m4_arg_info (argv);
+  size_t limit = m4_get_max_debug_arg_length_opt (context);
+  size_t argc = m4_arg_argc (argv);
+  m4_trace_record record;
+  size_t i;
+
+  if (!trace)
+    return;
+  if (info->debug_level & M4_DEBUG_TRACE_QUOTE)
+    trace_quotes (trace, m4_get_syntax_quotes (M4SYNTAX));
+  trace_init (context, trace, &record, M4_TRACE_CALL, info);
+  record.index = argc - 1;
+  record.length = limit;
+  trace_record (trace, &record, NULL, 0);
+  if (!(info->debug_level & M4_DEBUG_TRACE_ARGS))
+    return;
+
+  record.type = M4_TRACE_ARG;
+  for (i = 1; i < argc; i++)
+    {
+      record.index = i;
+      if (m4_is_arg_func (argv, i))
+        {
+          m4_obstack *obs = &context->trace_messages;
+          size_t start = obstack_object_size (obs);
+          const m4_string_pair *quotes = NULL;
+
+          if (info->debug_level & M4_DEBUG_TRACE_QUOTE)
+            quotes = m4_get_syntax_quotes (M4SYNTAX);
+          m4__builtin_print (obs, m4_arg_symbol (argv, i)->u.builtin, false,
+                             NULL, quotes,
+                             (info->debug_level & M4_DEBUG_TRACE_MODULE) != 0);
+          record.type = M4_TRACE_FUNC;
+          record.length = obstack_object_size (obs) - start;
+          trace_record (trace, &record, (char *) obstack_base (obs) + start,
+                        record.length);
+          obstack_blank (obs, start - obstack_object_size (obs));
+          record.type = M4_TRACE_ARG;
+        }
+      else
+        {
+          const char *text = m4_arg_text (context, argv, i, true);
+          size_t len = m4_arg_len (context, argv, i, true);
+
+          record.length = len;
+          trace_record (trace, &record, text, len < limit ? len : limit);
+          if (limit <= len)
+            break;
+        }
+    }
+}
+
+/* Write the record for the end of the traced macro call INFO,
+   including its expansion if requested.  */
+void
+m4__trace_result (m4 *context, const m4_call_info *info)
+{
+  m4__trace *trace = trace_file (context);
+  m4_obstack *obs = &context->trace_messages;
+  size_t start = obstack_object_size (obs);
+  m4_trace_record record;
+
+  if (!trace)
+    return;
+  if (info->debug_level & M4_DEBUG_TRACE_EXPANSION)
+    m4_input_print (context, obs, info->debug_level);
+  trace_init (context, trace, &record, M4_TRACE_RESULT, info);
+  trace_record (trace, &record, (char *) obstack_base (obs) + start,
+                obstack_object_size (obs) - start);
+  obstack_blank (obs, start - obstack_object_size (obs));
+}
+
+/* Write the debug message TEXT of length LEN, on behalf of
+   m4_debug_message.  */
+void
+m4__trace_message (m4 *context, const char *text, size_t len)
+{
+  m4__trace *trace = trace_file (context);
+  const char *file = m4_get_current_file (context);
+  m4_trace_record record;
+
+  if (!trace)
+    return;
+  memset (&record, 0, sizeof record);
+  record.type = M4_TRACE_MESSAGE;
+  record.flags = m4_get_debug_level_opt (context);
+  record.depth = context->expansion_level;
+  record.line = m4_get_current_line (context);
+  if (record.line)
+    record.file = trace_string (trace, file, strlen (file));
+  record.time = gethrxtime () - trace->start;
+  trace_record (trace, &record, text, len);
+}
+
+/* Start a new string table with the next record, because the debug
+   file of CONTEXT is about to change.  */
+void
+m4__trace_restart (m4 *context)
+{
+  if (context->trace)
+    trace_reset (context->trace);
+}
+
+/* Release the binary trace state of CONTEXT.  */
+void
+m4__trace_exit (m4 *context)
+{
+  if (context->trace)
+    {
+      trace_reset (context->trace);
+      free (context->trace);
+      context->trace = NULL;
+    }
+}
@@ -73,50 +73,57 @@ typedef enum eval_error
   }
 eval_error;
 
-static eval_error comma_term            (m4 *, eval_token, number *);
-static eval_error condition_term        (m4 *, eval_token, number *);
-static eval_error logical_or_term       (m4 *, eval_token, number *);
-static eval_error logical_and_term      (m4 *, eval_token, number *);
-static eval_error or_term               (m4 *, eval_token, number *);
-static eval_error xor_term              (m4 *, eval_token, number *);
-static eval_error and_term              (m4 *, eval_token, number *);
-static eval_error equality_term         (m4 *, eval_token, number *);
-static eval_error cmp_term              (m4 *, eval_token, number *);
-static eval_error shift_term            (m4 *, eval_token, number *);
-static eval_error add_term              (m4 *, eval_token, number *);
-static eval_error mult_term             (m4 *, eval_token, number *);
-static eval_error exp_term              (m4 *, eval_token, number *);
-static eval_error unary_term            (m4 *, eval_token, number *);
-static eval_error simple_term           (m4 *, eval_token, number *);
-static eval_error numb_pow              (number *, number *);
-
+/* The lexer state over one expression, kept on the stack of
+   m4_evaluate so that expressions can be evaluated in several
+   contexts at once.  */
+typedef struct eval_lexer
+  {
+    /* Pointer to next character of input text.  */
+    const char *text;
 
-
-/* --- LEXICAL FUNCTIONS --- */
+    /* Value of text, from before last call of eval_lex (lex, ).  This is
+       so we can back up, if we have read too much.  */
+    const char *last;
 
-/* Pointer to next character of input text.  */
-static const char *eval_text;
+    /* Detect when to end parsing.  */
+    const char *end;
+  }
+eval_lexer;
+
+static eval_error comma_term       (m4 *, eval_lexer *, eval_token, number *);
+static eval_error condition_term   (m4 *, eval_lexer *, eval_token, number *);
+static eval_error logical_or_term  (m4 *, eval_lexer *, eval_token, number *);
+static eval_error logical_and_term (m4 *, eval_lexer *, eval_token, number *);
+static eval_error or_term          (m4 *, eval_lexer *, eval_token, number *);
+static eval_error xor_term         (m4 *, eval_lexer *, eval_token, number *);
+static eval_error and_term         (m4 *, eval_lexer *, eval_token, number *);
+static eval_error equality_term    (m4 *, eval_lexer *, eval_token, number *);
+static eval_error cmp_term         (m4 *, eval_lexer *, eval_token, number *);
+static eval_error shift_term       (m4 *, eval_lexer *, eval_token, number *);
+static eval_error add_term         (m4 *, eval_lexer *, eval_token, number *);
+static eval_error mult_term        (m4 *, eval_lexer *, eval_token, number *);
+static eval_error exp_term         (m4 *, eval_lexer *, eval_token, number *);
+static eval_error unary_term       (m4 *, eval_lexer *, eval_token, number *);
+static eval_error simple_term      (m4 *, eval_lexer *, eval_token, number *);
+static eval_error numb_pow         (number *, number *);
 
-/* Value of eval_text, from before last call of eval_lex ().  This is so we
-   can back up, if we have read too much.  */
-static const char *last_text;
 
-/* Detect when to end parsing.  */
-static const char *end_text;
+
+/* --- LEXICAL FUNCTIONS --- */
 
-/* Prime the lexer at the start of TEXT, with length LEN.  */
+/* Prime the lexer LEX at the start of TEXT, with length LEN.  */
 static void
-eval_init_lex (const char *text, size_t len)
+eval_init_lex (eval_lexer *lex, const char *text, size_t len)
 {
-  eval_text = text;
-  end_text = text + len;
-  last_text = NULL;
+  lex->text = text;
+  lex->end = text + len;
+  lex->last = NULL;
 }
 
 static void
-eval_undo (void)
+eval_undo (eval_lexer *lex)
 {
-  eval_text = last_text;
+  lex->text = lex->last;
 }
 
 /* VAL is numerical value, if any.  Recognize C assignment operators,
@@ -124,46 +131,46 @@ eval_undo (void)
    messages.  */
 
 static eval_token
-eval_lex (number *val)
+eval_lex (eval_lexer *lex, number *val)
 {
-  while (eval_text != end_text && isspace (to_uchar (*eval_text)))
-    eval_text++;
+  while (lex->text != lex->end && isspace (to_uchar (*lex->text)))
+    lex->text++;
 
-  last_text = eval_text;
+  lex->last = lex->text;
 
-  if (eval_text == end_text)
+  if (lex->text == lex->end)
     return EOTEXT;
 
-  if (isdigit (to_uchar (*eval_text)))
+  if (isdigit (to_uchar (*lex->text)))
     {
       int base, digit;
 
-      if (*eval_text == '0')
+      if (*lex->text == '0')
         {
-          eval_text++;
-          switch (*eval_text)
+          lex->text++;
+          switch (*lex->text)
             {
             case 'x':
             case 'X':
               base = 16;
-              eval_text++;
+              lex->text++;
               break;
 
             case 'b':
             case 'B':
               base = 2;
-              eval_text++;
+              lex->text++;
               break;
 
             case 'r':
             case 'R':
               base = 0;
-              eval_text++;
-              while (isdigit (to_uchar (*eval_text)) && base <= 36)
-                base = 10 * base + *eval_text++ - '0';
-              if (base == 0 || base > 36 || *eval_text != ':')
+              lex->text++;
+              while (isdigit (to_uchar (*lex->text)) && base <= 36)
+                base = 10 * base + *lex->text++ - '0';
+              if (base == 0 || base > 36 || *lex->text != ':')
                 return ERROR;
-              eval_text++;
+              lex->text++;
               break;
 
             default:
@@ -174,14 +181,14 @@ eval_lex (number *val)
         base = 10;
 
       numb_set_si (val, 0);
-      for (; *eval_text; eval_text++)
+      for (; *lex->text; lex->text++)
         {
-          if (isdigit (to_uchar (*eval_text)))
-            digit = *eval_text - '0';
-          else if (islower (to_uchar (*eval_text)))
-            digit = *eval_text - 'a' + 10;
-          else if (isupper (to_uchar (*eval_text)))
-            digit = *eval_text - 'A' + 10;
+          if (isdigit (to_uchar (*lex->text)))
+            digit = *lex->text - '0';
+          else if (islower (to_uchar (*lex->text)))
+            digit = *lex->text - 'a' + 10;
+          else if (isupper (to_uchar (*lex->text)))
+            digit = *lex->text - 'A' + 10;
           else
             break;
 
@@ -216,63 +223,63 @@ eval_lex (number *val)
       return NUMBER;
     }
 
-  switch (*eval_text++)
+  switch (*lex->text++)
     {
     case '+':
-      if (*eval_text == '+' || *eval_text == '=')
+      if (*lex->text == '+' || *lex->text == '=')
         return BADOP;
       return PLUS;
     case '-':
-      if (*eval_text == '-' || *eval_text == '=')
+      if (*lex->text == '-' || *lex->text == '=')
         return BADOP;
       return MINUS;
     case '*':
-      if (*eval_text == '*')
+      if (*lex->text == '*')
         {
-          eval_text++;
+          lex->text++;
           return EXPONENT;
         }
-      else if (*eval_text == '=')
+      else if (*lex->text == '=')
         return BADOP;
       return TIMES;
     case '/':
-      if (*eval_text == '=')
+      if (*lex->text == '=')
         return BADOP;
       return DIVIDE;
     case '%':
-      if (*eval_text == '=')
+      if (*lex->text == '=')
         return BADOP;
       return MODULO;
     case '\\':
       return RATIO;
     case '=':
-      if (*eval_text == '=')
+      if (*lex->text == '=')
         {
-          eval_text++;
+          lex->text++;
           return EQ;
         }
       return BADOP;
     case '!':
-      if (*eval_text == '=')
+      if (*lex->text == '=')
         {
-          eval_text++;
+          lex->text++;
           return NOTEQ;
         }
       return LNOT;
     case '>':
-      if (*eval_text == '=')
+      if (*lex->text == '=')
         {
-          eval_text++;
+          lex->text++;
           return GTEQ;
         }
-      else if (*eval_text == '>')
+      else if (*lex->text == '>')
         {
-          eval_text++;
-          if (*eval_text == '=')
+          lex->text++;
+          if (*lex->text == '=')
             return BADOP;
-          else if (*eval_text == '>')
+          else if (*lex->text == '>')
             {
-              eval_text++;
+              lex->text++;
               return URSHIFT;
             }
           return RSHIFT;
@@ -280,41 +287,41 @@ eval_lex (number *val)
       else
         return GT;
     case '<':
-      if (*eval_text == '=')
+      if (*lex->text == '=')
         {
-          eval_text++;
+          lex->text++;
           return LSEQ;
         }
-      else if (*eval_text == '<')
+      else if (*lex->text == '<')
         {
-          if (*++eval_text == '=')
+          if (*++lex->text == '=')
             return BADOP;
           return LSHIFT;
         }
       else
         return LS;
     case '^':
-      if (*eval_text == '=')
+      if (*lex->text == '=')
         return BADOP;
       return XOR;
     case '~':
       return NOT;
     case '&':
-      if (*eval_text == '&')
+      if (*lex->text == '&')
         {
-          eval_text++;
+          lex->text++;
           return LAND;
         }
-      else if (*eval_text == '=')
+      else if (*lex->text == '=')
         return BADOP;
       return AND;
     case '|':
-      if (*eval_text == '|')
+      if (*lex->text == '|')
         {
-          eval_text++;
+          lex->text++;
           return LOR;
         }
-      else if (*eval_text == '=')
+      else if (*lex->text == '=')
         return BADOP;
       return OR;
     case '(':
@@ -334,22 +341,22 @@ eval_lex (number *val)
 
 /* Recursive descent parser.  */
 static eval_error
-comma_term (m4 *context, eval_token et, number *v1)
+comma_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   eval_error er;
 
-  if ((er = condition_term (context, et, v1)) != NO_ERROR)
+  if ((er = condition_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((et = eval_lex (&v2)) == COMMA)
+  while ((et = eval_lex (lex, &v2)) == COMMA)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = condition_term (context, et, &v2)) != NO_ERROR)
+      if ((er = condition_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
       numb_set (*v1, v2);
     }
@@ -357,45 +364,45 @@ comma_term (m4 *context, eval_token et, number *v1)
   if (et == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-condition_term (m4 *context, eval_token et, number *v1)
+condition_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   number v3;
   eval_error er;
 
-  if ((er = logical_or_term (context, et, v1)) != NO_ERROR)
+  if ((er = logical_or_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
   numb_init (v3);
-  if ((et = eval_lex (&v2)) == QUESTION)
+  if ((et = eval_lex (lex, &v2)) == QUESTION)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
       /* Implement short-circuiting of valid syntax.  */
-      er = comma_term (context, et, &v2);
+      er = comma_term (context, lex, et, &v2);
       if (er != NO_ERROR
           && !(numb_zerop (*v1) && er < SYNTAX_ERROR))
         return er;
 
-      et = eval_lex (&v3);
+      et = eval_lex (lex, &v3);
       if (et == ERROR)
         return UNKNOWN_INPUT;
       if (et != COLON)
         return MISSING_COLON;
 
-      et = eval_lex (&v3);
+      et = eval_lex (lex, &v3);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      er = condition_term (context, et, &v3);
+      er = condition_term (context, lex, et, &v3);
       if (er != NO_ERROR
           && !(! numb_zerop (*v1) && er < SYNTAX_ERROR))
         return er;
@@ -407,28 +414,28 @@ condition_term (m4 *context, eval_token et, number *v1)
   if (et == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-logical_or_term (m4 *context, eval_token et, number *v1)
+logical_or_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   eval_error er;
 
-  if ((er = logical_and_term (context, et, v1)) != NO_ERROR)
+  if ((er = logical_and_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((et = eval_lex (&v2)) == LOR)
+  while ((et = eval_lex (lex, &v2)) == LOR)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
       /* Implement short-circuiting of valid syntax.  */
-      er = logical_and_term (context, et, &v2);
+      er = logical_and_term (context, lex, et, &v2);
       if (er == NO_ERROR)
         numb_lior (*v1, v2);
       else if (! numb_zerop (*v1) && er < SYNTAX_ERROR)
@@ -440,28 +447,28 @@ logical_or_term (m4 *context, eval_token et, number *v1)
   if (et == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-logical_and_term (m4 *context, eval_token et, number *v1)
+logical_and_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   eval_error er;
 
-  if ((er = or_term (context, et, v1)) != NO_ERROR)
+  if ((er = or_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((et = eval_lex (&v2)) == LAND)
+  while ((et = eval_lex (lex, &v2)) == LAND)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
       /* Implement short-circuiting of valid syntax.  */
-      er = or_term (context, et, &v2);
+      er = or_term (context, lex, et, &v2);
       if (er == NO_ERROR)
         numb_land (*v1, v2);
       else if (numb_zerop (*v1) && er < SYNTAX_ERROR)
@@ -473,27 +480,27 @@ logical_and_term (m4 *context, eval_token et, number *v1)
   if (et == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-or_term (m4 *context, eval_token et, number *v1)
+or_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   eval_error er;
 
-  if ((er = xor_term (context, et, v1)) != NO_ERROR)
+  if ((er = xor_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((et = eval_lex (&v2)) == OR)
+  while ((et = eval_lex (lex, &v2)) == OR)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = xor_term (context, et, &v2)) != NO_ERROR)
+      if ((er = xor_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       numb_ior (context, v1, &v2);
@@ -502,27 +509,27 @@ or_term (m4 *context, eval_token et, number *v1)
   if (et == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-xor_term (m4 *context, eval_token et, number *v1)
+xor_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   eval_error er;
 
-  if ((er = and_term (context, et, v1)) != NO_ERROR)
+  if ((er = and_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((et = eval_lex (&v2)) == XOR)
+  while ((et = eval_lex (lex, &v2)) == XOR)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = and_term (context, et, &v2)) != NO_ERROR)
+      if ((er = and_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       numb_eor (context, v1, &v2);
@@ -531,27 +538,27 @@ xor_term (m4 *context, eval_token et, number *v1)
   if (et == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-and_term (m4 *context, eval_token et, number *v1)
+and_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   eval_error er;
 
-  if ((er = equality_term (context, et, v1)) != NO_ERROR)
+  if ((er = equality_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((et = eval_lex (&v2)) == AND)
+  while ((et = eval_lex (lex, &v2)) == AND)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = equality_term (context, et, &v2)) != NO_ERROR)
+      if ((er = equality_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       numb_and (context, v1, &v2);
@@ -560,28 +567,28 @@ and_term (m4 *context, eval_token et, number *v1)
   if (et == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-equality_term (m4 *context, eval_token et, number *v1)
+equality_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   eval_token op;
   number v2;
   eval_error er;
 
-  if ((er = cmp_term (context, et, v1)) != NO_ERROR)
+  if ((er = cmp_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((op = eval_lex (&v2)) == EQ || op == NOTEQ)
+  while ((op = eval_lex (lex, &v2)) == EQ || op == NOTEQ)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = cmp_term (context, et, &v2)) != NO_ERROR)
+      if ((er = cmp_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       if (op == EQ)
@@ -593,30 +600,30 @@ equality_term (m4 *context, eval_token et, number *v1)
   if (op == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-cmp_term (m4 *context, eval_token et, number *v1)
+cmp_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   eval_token op;
   number v2;
   eval_error er;
 
-  if ((er = shift_term (context, et, v1)) != NO_ERROR)
+  if ((er = shift_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((op = eval_lex (&v2)) == GT || op == GTEQ
+  while ((op = eval_lex (lex, &v2)) == GT || op == GTEQ
          || op == LS || op == LSEQ)
     {
 
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = shift_term (context, et, &v2)) != NO_ERROR)
+      if ((er = shift_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       switch (op)
@@ -646,29 +653,29 @@ cmp_term (m4 *context, eval_token et, number *v1)
   if (op == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-shift_term (m4 *context, eval_token et, number *v1)
+shift_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   eval_token op;
   number v2;
   eval_error er;
 
-  if ((er = add_term (context, et, v1)) != NO_ERROR)
+  if ((er = add_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((op = eval_lex (&v2)) == LSHIFT || op == RSHIFT || op == URSHIFT)
+  while ((op = eval_lex (lex, &v2)) == LSHIFT || op == RSHIFT || op == URSHIFT)
     {
 
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = add_term (context, et, &v2)) != NO_ERROR)
+      if ((er = add_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       switch (op)
@@ -694,28 +701,28 @@ shift_term (m4 *context, eval_token et, number *v1)
   if (op == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-add_term (m4 *context, eval_token et, number *v1)
+add_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   eval_token op;
   number v2;
   eval_error er;
 
-  if ((er = mult_term (context, et, v1)) != NO_ERROR)
+  if ((er = mult_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((op = eval_lex (&v2)) == PLUS || op == MINUS)
+  while ((op = eval_lex (lex, &v2)) == PLUS || op == MINUS)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = mult_term (context, et, &v2)) != NO_ERROR)
+      if ((er = mult_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       if (op == PLUS)
@@ -727,32 +734,32 @@ add_term (m4 *context, eval_token et, number *v1)
   if (op == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-mult_term (m4 *context, eval_token et, number *v1)
+mult_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   eval_token op;
   number v2;
   eval_error er;
 
-  if ((er = exp_term (context, et, v1)) != NO_ERROR)
+  if ((er = exp_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while (op = eval_lex (&v2),
+  while (op = eval_lex (lex, &v2),
          op == TIMES
          || op == DIVIDE
          || op == MODULO
          || op == RATIO)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = exp_term (context, et, &v2)) != NO_ERROR)
+      if ((er = exp_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       switch (op)
@@ -791,27 +798,27 @@ mult_term (m4 *context, eval_token et, number *v1)
   if (op == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-exp_term (m4 *context, eval_token et, number *v1)
+exp_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   eval_error er;
 
-  if ((er = unary_term (context, et, v1)) != NO_ERROR)
+  if ((er = unary_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   numb_init (v2);
-  while ((et = eval_lex (&v2)) == EXPONENT)
+  while ((et = eval_lex (lex, &v2)) == EXPONENT)
     {
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = exp_term (context, et, &v2)) != NO_ERROR)
+      if ((er = exp_term (context, lex, et, &v2)) != NO_ERROR)
         return er;
 
       if ((er = numb_pow (v1, &v2)) != NO_ERROR)
@@ -821,23 +828,23 @@ exp_term (m4 *context, eval_token et, number *v1)
   if (et == ERROR)
     return UNKNOWN_INPUT;
 
-  eval_undo ();
+  eval_undo (lex);
   return NO_ERROR;
 }
 
 static eval_error
-unary_term (m4 *context, eval_token et, number *v1)
+unary_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   eval_token et2 = et;
   eval_error er;
 
   if (et == PLUS || et == MINUS || et == NOT || et == LNOT)
     {
-      et2 = eval_lex (v1);
+      et2 = eval_lex (lex, v1);
       if (et2 == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = unary_term (context, et2, v1)) != NO_ERROR)
+      if ((er = unary_term (context, lex, et2, v1)) != NO_ERROR)
         return er;
 
       if (et == MINUS)
@@ -847,14 +854,14 @@ unary_term (m4 *context, eval_token et, number *v1)
       else if (et == LNOT)
         numb_lnot (*v1);
     }
-  else if ((er = simple_term (context, et, v1)) != NO_ERROR)
+  else if ((er = simple_term (context, lex, et, v1)) != NO_ERROR)
     return er;
 
   return NO_ERROR;
 }
 
 static eval_error
-simple_term (m4 *context, eval_token et, number *v1)
+simple_term (m4 *context, eval_lexer *lex, eval_token et, number *v1)
 {
   number v2;
   eval_error er;
@@ -862,14 +869,14 @@ simple_term (m4 *context, eval_token et, number *v1)
   switch (et)
     {
     case LEFTP:
-      et = eval_lex (v1);
+      et = eval_lex (lex, v1);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
-      if ((er = comma_term (context, et, v1)) != NO_ERROR)
+      if ((er = comma_term (context, lex, et, v1)) != NO_ERROR)
         return er;
 
-      et = eval_lex (&v2);
+      et = eval_lex (lex, &v2);
       if (et == ERROR)
         return UNKNOWN_INPUT;
 
@@ -899,6 +906,8 @@ m4_evaluate (m4 *context, m4_obstack *obs, size_t argc, m4_macro_args *argv)
   int           radix   = 10;
   int           min     = 1;
   number        val;
+  eval_lexer    lexer;
+  eval_lexer *  lex     = &lexer;
   eval_token    et;
   eval_error    err     = NO_ERROR;
 
@@ -923,21 +932,21 @@ m4_evaluate (m4 *context, m4_obstack *obs, size_t argc, m4_macro_args *argv)
     }
 
   numb_initialise ();
-  eval_init_lex (str, M4ARGLEN (1));
+  eval_init_lex (lex, str, M4ARGLEN (1));
 
   numb_init (val);
-  et = eval_lex (&val);
+  et = eval_lex (lex, &val);
   if (et == EOTEXT)
     {
       m4_warn (context, 0, me, _("empty string treated as 0"));
       numb_set (val, numb_ZERO);
     }
   else
-    err = comma_term (context, et, &val);
+    err = comma_term (context, lex, et, &val);
 
-  if (err == NO_ERROR && *eval_text != '\0')
+  if (err == NO_ERROR && *lex->text != '\0')
     {
-      if (eval_lex (&val) == BADOP)
+      if (eval_lex (lex, &val) == BADOP)
         err = INVALID_OPERATOR;
       else
         err = EXCESS_INPUT;
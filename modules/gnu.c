@@ -28,10 +28,23 @@
 #  include "m4private.h"
 #endif
 
+#include "m4/probes.h"
 #include "modules/m4.h"
-#include "pipe.h"
 #include "quotearg.h"
+#include "sha1.h"
 #include "wait-process.h"
+#include "xvasprintf.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#if HAVE_SPAWN_H && HAVE_POSIX_SPAWN && HAVE_POSIX_SPAWNP
+# include <poll.h>
+# define M4_USE_POLL 1
+#else
+# define M4_USE_POLL 0
+#endif
 
 /* Rename exported symbols for dlpreload()ing.  */
 #define m4_builtin_table        gnu_LTX_m4_builtin_table
@@ -47,12 +60,16 @@
   BUILTIN (__line__,    false,  false,  false,  0,      0  )    \
   BUILTIN (__program__, false,  false,  false,  0,      0  )    \
   BUILTIN (builtin,     true,   true,   false,  1,      -1 )    \
+  BUILTIN (case,        true,   true,   false,  1,      -1 )    \
   BUILTIN (changeresyntax,false,true,   false,  1,      1  )    \
   BUILTIN (changesyntax,false,  true,   false,  1,      -1 )    \
   BUILTIN (debugfile,   false,  false,  false,  0,      1  )    \
   BUILTIN (debuglen,    false,  true,   false,  1,      1  )    \
   BUILTIN (debugmode,   false,  false,  false,  0,      1  )    \
   BUILTIN (esyscmd,     false,  true,   true,   1,      1  )    \
+  BUILTIN (esyscmd_async,false, true,   true,   2,      2  )    \
+  BUILTIN (esyscmd_cached,false,true,   true,   1,      3  )    \
+  BUILTIN (esyscmd_wait,false,  true,   true,   1,      1  )    \
   BUILTIN (format,      false,  true,   false,  1,      -1 )    \
   BUILTIN (indir,       true,   true,   false,  1,      -1 )    \
   BUILTIN (mkdtemp,     false,  true,   false,  1,      1  )    \
@@ -125,8 +142,26 @@ typedef struct {
   struct re_registers regs;             /* match registers, reused */
 } m4_pattern_buffer;
 
-/* Storage for the cache of regular expressions.  */
-static m4_pattern_buffer regex_cache[REGEX_CACHE_SIZE];
+/* Key of the cache of regular expressions of a context, among the
+   data that modules keep for it.  */
+#define REGEX_CACHE_KEY "gnu regex_cache"
+
+/* Return the cache of regular expressions of CONTEXT, allocating it
+   0-initialized on first use.  */
+static m4_pattern_buffer *
+regex_cache_get (m4 *context)
+{
+  m4_pattern_buffer *regex_cache
+    = (m4_pattern_buffer *) m4_get_module_data (context, REGEX_CACHE_KEY);
+
+  if (!regex_cache)
+    {
+      regex_cache = (m4_pattern_buffer *) xcalloc (REGEX_CACHE_SIZE,
+                                                   sizeof *regex_cache);
+      m4_set_module_data (context, REGEX_CACHE_KEY, regex_cache, NULL);
+    }
+  return regex_cache;
+}
 
 /* Compile a REGEXP of length LEN using the RESYNTAX flavor, and
    return the buffer.  On error, report the problem on behalf of
@@ -140,12 +175,12 @@ regexp_compile (m4 *context, const m4_call_info *caller, const char *regexp,
      works in the algorithm below.
 
      FIXME - this method is not reentrant, since re_compile_pattern
-     mallocs memory, depends on the global variable re_syntax_options
-     for its syntax (but at least the compiled regex remembers its
-     syntax even if the global variable changes later), and since we
-     use a static variable.  To be reentrant, we would need a mutex in
-     this method, and move the storage for regex_cache into context.  */
+     depends on the global variable re_syntax_options for its syntax
+     (but at least the compiled regex remembers its syntax even if the
+     global variable changes later).  To be reentrant, we would need a
+     mutex around re_set_syntax and re_compile_pattern.  */
 
+  m4_pattern_buffer *regex_cache = regex_cache_get (context);
   const char *msg;              /* error message from re_compile_pattern */
   int i;                        /* iterator */
   m4_pattern_buffer *victim;    /* cache slot to replace */
@@ -159,8 +194,12 @@ regexp_compile (m4 *context, const m4_call_info *caller, const char *regexp,
         && regex_cache[i].str && memcmp (regexp, regex_cache[i].str, len) == 0)
       {
         regex_cache[i].count++;
+        m4_stats_regex (context, true);
+        M4_PROBE3 (regex__compile, regexp, len, 1);
         return &regex_cache[i];
       }
+  m4_stats_regex (context, false);
+  M4_PROBE3 (regex__compile, regexp, len, 0);
 
   /* Next, check if REGEXP can be compiled.  */
   pat = (struct re_pattern_buffer *) xzalloc (sizeof *pat);
@@ -352,23 +391,35 @@ regexp_substitute (m4 *context, m4_obstack *obs, const m4_call_info *caller,
   return subst;
 }
 
+static void esyscmd_jobs_free (m4 *);
 
-/* Reclaim memory used by this module.  */
+/* Key of the estimated size of the esyscmd_cached directory, among the
+   data that modules keep for a context.  */
+#define ESYSCMD_CACHE_KEY "gnu esyscmd_cache"
+
+/* Reclaim memory used by this module on behalf of CONTEXT.  */
 M4FINISH_HANDLER(gnu)
 {
+  m4_pattern_buffer *regex_cache
+    = (m4_pattern_buffer *) m4_get_module_data (context, REGEX_CACHE_KEY);
   int i;
-  for (i = 0; i < REGEX_CACHE_SIZE; i++)
-    if (regex_cache[i].str)
-      {
-        free (regex_cache[i].str);
-        regfree (regex_cache[i].pat);
-        free (regex_cache[i].pat);
-        free (regex_cache[i].regs.start);
-        free (regex_cache[i].regs.end);
-      }
-  /* If this module was preloaded, then we need to explicitly reset
-     the memory in case it gets reloaded.  */
-  memset (&regex_cache, 0, sizeof regex_cache);
+
+  if (regex_cache)
+    for (i = 0; i < REGEX_CACHE_SIZE; i++)
+      if (regex_cache[i].str)
+        {
+          free (regex_cache[i].str);
+          regfree (regex_cache[i].pat);
+          free (regex_cache[i].pat);
+          free (regex_cache[i].regs.start);
+          free (regex_cache[i].regs.end);
+        }
+  esyscmd_jobs_free (context);
+  /* Forget the caches, in case the module gets reloaded.  */
+  free (regex_cache);
+  free (m4_get_module_data (context, ESYSCMD_CACHE_KEY));
+  m4_set_module_data (context, REGEX_CACHE_KEY, NULL, NULL);
+  m4_set_module_data (context, ESYSCMD_CACHE_KEY, NULL, NULL);
 }
 
 
@@ -476,6 +527,30 @@ M4BUILTIN_HANDLER (builtin)
 }
 
 
+/* The builtin "case" selects among many alternatives for its first
+   argument, comparing it against each key in turn as a multibranch
+   ifelse would, without repeating it for every branch.  As with
+   ifelse, builtin tokens are handled transparently.  */
+
+/**
+ * case(STRING, [KEY-1, EXPANSION-1]..., [DEFAULT])
+ **/
+M4BUILTIN_HANDLER (case)
+{
+  size_t i;
+
+  for (i = 2; i + 1 < argc; i += 2)
+    if (m4_arg_equal (context, argv, 1, i))
+      {
+        m4_push_arg (context, obs, argv, i + 1);
+        return;
+      }
+
+  /* No key matched; a trailing unpaired argument is the default.  */
+  if (argc % 2)
+    m4_push_arg (context, obs, argv, argc - 1);
+}
+
 /* Change the current regexp syntax to SPEC of length LEN, or report
    failure on behalf of CALLER.  Currently this affects the builtins:
    `patsubst', `regexp' and `renamesyms'.  */
@@ -639,30 +714,46 @@ M4BUILTIN_HANDLER (debugmode)
 }
 
 
-/* Same as the sysymd builtin from m4.c module, but expand to the
-   output of SHELL-COMMAND. */
+/* Wait for the process CHILD running CMD on behalf of ME, and return
+   the value that sysval should take.  */
+static int
+esyscmd_reap (m4 *context, const m4_call_info *me, const char *cmd,
+              pid_t child)
+{
+  int status;
+  int sig_status;
 
-/**
- * esyscmd(SHELL-COMMAND)
- **/
+  errno = 0;
+  status = wait_subprocess (child, m4_info_name (me), false, true, true,
+                            false, &sig_status);
+  if (sig_status)
+    {
+      assert (status == 127);
+      return sig_status << 8;
+    }
+  if (status == 127 && errno)
+    m4_error (context, 0, errno, me, _("cannot run command %s"),
+              quotearg_style (locale_quoting_style, cmd));
+  return status;
+}
 
-M4BUILTIN_HANDLER (esyscmd)
+/* Run the command CMD of length LEN on behalf of ME, append its output
+   to OBS, and set sysval, as esyscmd does.  */
+static void
+esyscmd_run (m4 *context, m4_obstack *obs, const m4_call_info *me,
+             const char *cmd, size_t len)
 {
-  const m4_call_info *me = m4_arg_info (argv);
-  const char *cmd = M4ARG (1);
-  size_t len = M4ARGLEN (1);
   M4_MODULE_IMPORT (m4, m4_set_sysval);
   M4_MODULE_IMPORT (m4, m4_sysval_flush);
+  M4_MODULE_IMPORT (m4, m4_spawn_command);
+  M4_MODULE_IMPORT (m4, m4_shell_coprocess);
 
-  if (m4_set_sysval && m4_sysval_flush)
+  if (m4_set_sysval && m4_sysval_flush && m4_spawn_command
+      && m4_shell_coprocess)
     {
       pid_t child;
       int fd;
       FILE *pin;
-      int status;
-      int sig_status;
-      const char *prog_args[4] = { "sh", "-c" };
-      const char *caller;
 
       if (m4_get_safer_opt (context))
         {
@@ -676,28 +767,21 @@ M4BUILTIN_HANDLER (esyscmd)
       /* Optimize the empty command.  */
       if (!*cmd)
         {
-          m4_set_sysval (0);
+          m4_set_sysval (context, 0);
           return;
         }
 
       m4_sysval_flush (context, false);
-#if W32_NATIVE
-      if (strstr (M4_SYSCMD_SHELL, "cmd"))
-        {
-          prog_args[0] = "cmd";
-          prog_args[1] = "/c";
-        }
-#endif
-      prog_args[2] = cmd;
-      caller = m4_info_name (me);
-      errno = 0;
-      child = create_pipe_in (caller, M4_SYSCMD_SHELL, (char **) prog_args,
-                              NULL, false, true, false, &fd);
+      /* The command may create or remove files that include looks for.  */
+      m4_path_cache_flush (context);
+      if (m4_shell_coprocess (context, me, cmd, obs))
+        return;
+      child = m4_spawn_command (context, m4_info_name (me), cmd, &fd);
       if (child == -1)
         {
           m4_error (context, 0, errno, me, _("cannot run command %s"),
                     quotearg_style (locale_quoting_style, cmd));
-          m4_set_sysval (127);
+          m4_set_sysval (context, 127);
           return;
         }
       pin = fdopen (fd, "r");
@@ -705,7 +789,7 @@ M4BUILTIN_HANDLER (esyscmd)
         {
           m4_error (context, 0, errno, me, _("cannot run command %s"),
                     quotearg_style (locale_quoting_style, cmd));
-          m4_set_sysval (127);
+          m4_set_sysval (context, 127);
           close (fd);
           return;
         }
@@ -731,24 +815,609 @@ M4BUILTIN_HANDLER (esyscmd)
         m4_error (context, EXIT_FAILURE, errno, me,
                   _("cannot read pipe to command %s"),
                   quotearg_style (locale_quoting_style, cmd));
-      errno = 0;
-      status = wait_subprocess (child, caller, false, true, true, false,
-                                &sig_status);
-      if (sig_status)
+      m4_set_sysval (context, esyscmd_reap (context, me, cmd, child));
+    }
+  else
+    assert (!"Unable to import from m4 module");
+}
+
+/* Same as the sysymd builtin from m4.c module, but expand to the
+   output of SHELL-COMMAND. */
+
+/**
+ * esyscmd(SHELL-COMMAND)
+ **/
+
+M4BUILTIN_HANDLER (esyscmd)
+{
+  esyscmd_run (context, obs, m4_arg_info (argv), M4ARG (1), M4ARGLEN (1));
+}
+
+
+/* The builtins "esyscmd_async" and "esyscmd_wait" split esyscmd in
+   two, so that independent commands can run concurrently: the first
+   starts a command under a tag, and the second expands to its output.
+   While waiting for one command, the output of all others is read as
+   it arrives, so that none of them blocks on a full pipe.  */
+
+/* Maybe this is worth making runtime tunable.  Once this many commands
+   are running, esyscmd_async waits for one of them to finish before
+   starting another.  */
+#define ESYSCMD_JOBS_MAX 16
+
+/* A command started by esyscmd_async, until esyscmd_wait claims it.  */
+typedef struct {
+  char *tag;                            /* tag given to esyscmd_async */
+  size_t tag_len;                       /* length of tag */
+  char *cmd;                            /* command, for messages */
+  pid_t child;                          /* running process, or -1 */
+  int fd;                               /* pipe from child, or -1 */
+  int status;                           /* sysval, once child is -1 */
+  m4_obstack output;                    /* output read so far */
+} esyscmd_job;
+
+/* The commands of a context not yet claimed.  */
+typedef struct {
+  esyscmd_job **job;                    /* jobs, in the order started */
+  size_t count;                         /* number of jobs */
+  size_t alloc;                         /* allocated size of job */
+  size_t running;                       /* jobs that are still running */
+} esyscmd_job_list;
+
+/* Key of the command list of a context, among the data that modules
+   keep for it.  */
+#define ESYSCMD_JOBS_KEY "gnu esyscmd_jobs"
+
+static void esyscmd_jobs_forked (void *);
+
+/* Return the list of commands of CONTEXT, creating it on first
+   use.  */
+static esyscmd_job_list *
+esyscmd_jobs_get (m4 *context)
+{
+  esyscmd_job_list *jobs
+    = (esyscmd_job_list *) m4_get_module_data (context, ESYSCMD_JOBS_KEY);
+
+  if (!jobs)
+    {
+      jobs = (esyscmd_job_list *) xzalloc (sizeof *jobs);
+      m4_set_module_data (context, ESYSCMD_JOBS_KEY, jobs, NULL);
+      m4_set_module_fork_func (context, ESYSCMD_JOBS_KEY,
+                               esyscmd_jobs_forked);
+    }
+  return jobs;
+}
+
+/* Return the job with TAG of length LEN in JOBS, or NULL.  */
+static esyscmd_job *
+esyscmd_job_find (esyscmd_job_list *jobs, const char *tag, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < jobs->count; i++)
+    if (jobs->job[i]->tag_len == len
+        && memcmp (jobs->job[i]->tag, tag, len) == 0)
+      return jobs->job[i];
+  return NULL;
+}
+
+/* Read the output that JOB of JOBS has ready, on behalf of ME.  Once
+   its pipe reaches end of file, reap the process and return true.  */
+static bool
+esyscmd_job_read (m4 *context, const m4_call_info *me,
+                  esyscmd_job_list *jobs, esyscmd_job *job)
+{
+  char buf[BUFSIZ];
+  ssize_t len = read (job->fd, buf, sizeof buf);
+
+  if (0 < len)
+    {
+      obstack_grow (&job->output, buf, len);
+      return false;
+    }
+  if (len < 0 && errno == EINTR)
+    return false;
+  if (len < 0)
+    m4_error (context, EXIT_FAILURE, errno, me,
+              _("cannot read pipe to command %s"),
+              quotearg_style (locale_quoting_style, job->cmd));
+  close (job->fd);
+  job->fd = -1;
+  job->status = esyscmd_reap (context, me, job->cmd, job->child);
+  job->child = -1;
+  jobs->running--;
+  return true;
+}
+
+/* Collect the output of the running jobs of JOBS on behalf of ME,
+   until JOB has finished, or if JOB is NULL, until any one job has
+   finished.  */
+static void
+esyscmd_jobs_pump (m4 *context, const m4_call_info *me,
+                   esyscmd_job_list *jobs, esyscmd_job *job)
+{
+#if M4_USE_POLL
+  struct pollfd *fds = (struct pollfd *) xnmalloc (jobs->running,
+                                                   sizeof *fds);
+  esyscmd_job **polled = (esyscmd_job **) xnmalloc (jobs->running,
+                                                    sizeof *polled);
+  bool done = false;
+
+  while (job ? job->child != -1 : !done)
+    {
+      size_t count = 0;
+      size_t i;
+
+      for (i = 0; i < jobs->count; i++)
+        if (jobs->job[i]->child != -1)
+          {
+            fds[count].fd = jobs->job[i]->fd;
+            fds[count].events = POLLIN;
+            polled[count++] = jobs->job[i];
+          }
+      if (poll (fds, count, -1) < 0)
         {
-          assert (status == 127);
-          m4_set_sysval (sig_status << 8);
+          if (errno == EINTR)
+            continue;
+          m4_error (context, EXIT_FAILURE, errno, me,
+                    _("cannot read pipe to command %s"),
+                    quotearg_style (locale_quoting_style, polled[0]->cmd));
         }
-      else
+      for (i = 0; i < count; i++)
+        if (fds[i].revents
+            && esyscmd_job_read (context, me, jobs, polled[i]))
+          done = true;
+    }
+  free (polled);
+  free (fds);
+#else /* !M4_USE_POLL */
+  /* Without poll, read one pipe to its end, leaving the other commands
+     to block on their pipes until they are waited for.  */
+  size_t i;
+
+  for (i = 0; !job; i++)
+    if (jobs->job[i]->child != -1)
+      job = jobs->job[i];
+  while (!esyscmd_job_read (context, me, jobs, job))
+    ;
+#endif /* !M4_USE_POLL */
+}
+
+/* Release JOB, which has finished.  */
+static void
+esyscmd_job_free (esyscmd_job *job)
+{
+  obstack_free (&job->output, NULL);
+  free (job->tag);
+  free (job->cmd);
+  free (job);
+}
+
+/* Forget every unclaimed command of CONTEXT, waiting for those still
+   running.  */
+static void
+esyscmd_jobs_free (m4 *context)
+{
+  esyscmd_job_list *jobs
+    = (esyscmd_job_list *) m4_get_module_data (context, ESYSCMD_JOBS_KEY);
+  size_t i;
+
+  if (!jobs)
+    return;
+  for (i = 0; i < jobs->count; i++)
+    {
+      esyscmd_job *job = jobs->job[i];
+      if (job->child != -1)
         {
-          if (status == 127 && errno)
-            m4_error (context, 0, errno, me, _("cannot run command %s"),
-                      quotearg_style (locale_quoting_style, cmd));
-          m4_set_sysval (status);
+          close (job->fd);
+          wait_subprocess (job->child, "esyscmd_async", false, true, true,
+                           false, NULL);
         }
+      esyscmd_job_free (job);
     }
-  else
+  free (jobs->job);
+  free (jobs);
+  m4_set_module_data (context, ESYSCMD_JOBS_KEY, NULL, NULL);
+}
+
+/* Forget the commands of the list DATA that are still running, in a
+   forked child, since only the parent can wait for them.  Those that
+   finished can still be claimed by the child.  */
+static void
+esyscmd_jobs_forked (void *data)
+{
+  esyscmd_job_list *jobs = (esyscmd_job_list *) data;
+  size_t i = 0;
+
+  while (i < jobs->count)
+    if (jobs->job[i]->child != -1)
+      {
+        close (jobs->job[i]->fd);
+        esyscmd_job_free (jobs->job[i]);
+        memmove (&jobs->job[i], &jobs->job[i + 1],
+                 (--jobs->count - i) * sizeof *jobs->job);
+      }
+    else
+      i++;
+  jobs->running = 0;
+}
+
+/**
+ * esyscmd_async(TAG, SHELL-COMMAND)
+ **/
+M4BUILTIN_HANDLER (esyscmd_async)
+{
+  const m4_call_info *me = m4_arg_info (argv);
+  const char *tag = M4ARG (1);
+  size_t tag_len = M4ARGLEN (1);
+  const char *cmd = M4ARG (2);
+  esyscmd_job_list *jobs = esyscmd_jobs_get (context);
+  esyscmd_job *job;
+  M4_MODULE_IMPORT (m4, m4_sysval_flush);
+  M4_MODULE_IMPORT (m4, m4_spawn_command);
+
+  if (!m4_sysval_flush || !m4_spawn_command)
+    assert (!"Unable to import from m4 module");
+  if (m4_get_safer_opt (context))
+    {
+      m4_error (context, 0, 0, me, _("disabled by --safer"));
+      return;
+    }
+  if (esyscmd_job_find (jobs, tag, tag_len))
+    {
+      m4_error (context, 0, 0, me, _("command %s is already running"),
+                quotearg_style_mem (locale_quoting_style, tag, tag_len));
+      return;
+    }
+  if (strlen (cmd) != M4ARGLEN (2))
+    m4_warn (context, 0, me, _("argument %s truncated"),
+             quotearg_style_mem (locale_quoting_style, cmd, M4ARGLEN (2)));
+
+  job = (esyscmd_job *) xzalloc (sizeof *job);
+  job->tag = (char *) xmemdup (tag, tag_len);
+  job->tag_len = tag_len;
+  job->cmd = xstrdup (cmd);
+  job->child = -1;
+  job->fd = -1;
+  obstack_init (&job->output);
+  if (jobs->count == jobs->alloc)
+    jobs->job = (esyscmd_job **) x2nrealloc (jobs->job, &jobs->alloc,
+                                             sizeof *jobs->job);
+  jobs->job[jobs->count++] = job;
+
+  /* Optimize the empty command.  */
+  if (!*cmd)
+    return;
+
+  if (jobs->running == ESYSCMD_JOBS_MAX)
+    esyscmd_jobs_pump (context, me, jobs, NULL);
+  m4_sysval_flush (context, false);
+  m4_path_cache_flush (context);
+  job->child = m4_spawn_command (context, m4_info_name (me), cmd, &job->fd);
+  if (job->child == -1)
+    {
+      m4_error (context, 0, errno, me, _("cannot run command %s"),
+                quotearg_style (locale_quoting_style, cmd));
+      job->status = 127;
+      return;
+    }
+  jobs->running++;
+}
+
+/**
+ * esyscmd_wait(TAG)
+ **/
+M4BUILTIN_HANDLER (esyscmd_wait)
+{
+  const m4_call_info *me = m4_arg_info (argv);
+  esyscmd_job_list *jobs = esyscmd_jobs_get (context);
+  esyscmd_job *job = esyscmd_job_find (jobs, M4ARG (1), M4ARGLEN (1));
+  size_t i;
+  M4_MODULE_IMPORT (m4, m4_set_sysval);
+
+  if (!m4_set_sysval)
+    assert (!"Unable to import from m4 module");
+  if (!job)
+    {
+      m4_error (context, 0, 0, me, _("no command started as %s"),
+                quotearg_style_mem (locale_quoting_style, M4ARG (1),
+                                    M4ARGLEN (1)));
+      return;
+    }
+  if (job->child != -1)
+    esyscmd_jobs_pump (context, me, jobs, job);
+  /* The command may have created or removed files that include looks
+     for.  */
+  m4_path_cache_flush (context);
+
+  obstack_grow (obs, obstack_base (&job->output),
+                obstack_object_size (&job->output));
+  m4_set_sysval (context, job->status);
+  for (i = 0; jobs->job[i] != job; i++)
+    ;
+  memmove (&jobs->job[i], &jobs->job[i + 1],
+           (--jobs->count - i) * sizeof *jobs->job);
+  esyscmd_job_free (job);
+}
+
+
+/* The builtin "esyscmd_cached" is like esyscmd, but remembers the
+   output and exit status of commands in the directory given by the
+   esyscmd cache option, so that deterministic probes do not need to
+   start a process in every run.  Each entry is a file named after the
+   SHA-1 of the command, the key material and the shell, holding:
+
+     m4 esyscmd cache 1
+     STATUS CMD-LENGTH KEY-LENGTH OUTPUT-LENGTH
+     CMD KEY OUTPUT
+
+   where the command and key are kept to rule out collisions.  An entry
+   older than the time to live given to the builtin is ignored, and the
+   oldest entries are removed when the directory grows beyond the size
+   limit.  The directory is only scanned for its size by the first
+   write of a run; later writes add to that estimate, and scan again
+   once it exceeds the limit.  */
+
+#define ESYSCMD_CACHE_MAGIC "m4 esyscmd cache 1\n"
+#define ESYSCMD_CACHE_SUFFIX ".esc"
+
+/* Return the malloc'd name of the entry for CMD of length CMD_LEN and
+   KEY of length KEY_LEN in the cache directory DIR.  */
+static char *
+esyscmd_cache_file (const char *dir, const char *cmd, size_t cmd_len,
+                    const char *key, size_t key_len)
+{
+  struct sha1_ctx ctx;
+  unsigned char digest[20];
+  char *file = (char *) xmalloc (strlen (dir) + 1 + 2 * sizeof digest
+                                 + sizeof ESYSCMD_CACHE_SUFFIX);
+  char *p;
+  size_t i;
+
+  sha1_init_ctx (&ctx);
+  sha1_process_bytes (cmd, cmd_len + 1, &ctx);
+  sha1_process_bytes (key, key_len + 1, &ctx);
+  sha1_process_bytes (M4_SYSCMD_SHELL, sizeof M4_SYSCMD_SHELL, &ctx);
+  sha1_finish_ctx (&ctx, digest);
+  strcpy (file, dir);
+  p = file + strlen (dir);
+  *p++ = '/';
+  for (i = 0; i < sizeof digest; i++)
+    {
+      *p++ = "0123456789abcdef"[digest[i] >> 4];
+      *p++ = "0123456789abcdef"[digest[i] & 0xf];
+    }
+  strcpy (p, ESYSCMD_CACHE_SUFFIX);
+  return file;
+}
+
+/* Look up the entry FILE for CMD of length CMD_LEN and KEY of length
+   KEY_LEN.  If it exists and is younger than TTL seconds (or TTL is
+   0), append its output to OBS, store its exit status in *STATUS, and
+   return true.  */
+static bool
+esyscmd_cache_read (const char *file, const char *cmd, size_t cmd_len,
+                    const char *key, size_t key_len, int ttl,
+                    m4_obstack *obs, int *status)
+{
+  char magic[sizeof ESYSCMD_CACHE_MAGIC];
+  unsigned long int lengths[3];
+  struct stat st;
+  bool result = false;
+  char *text;
+  FILE *fp = fopen (file, "r");
+
+  if (!fp)
+    return false;
+  if (fstat (fileno (fp), &st) == 0
+      && (ttl <= 0 || time (NULL) - st.st_mtime < ttl)
+      && fgets (magic, sizeof magic, fp)
+      && strcmp (magic, ESYSCMD_CACHE_MAGIC) == 0
+      && fscanf (fp, "%d %lu %lu %lu", status, &lengths[0], &lengths[1],
+                 &lengths[2]) == 4
+      && getc (fp) == '\n'
+      && lengths[0] == cmd_len && lengths[1] == key_len
+      && lengths[2] <= (unsigned long int) st.st_size)
+    {
+      text = (char *) xmalloc (cmd_len + key_len + 1);
+      if (fread (text, 1, cmd_len + key_len, fp) == cmd_len + key_len
+          && memcmp (text, cmd, cmd_len) == 0
+          && memcmp (text + cmd_len, key, key_len) == 0)
+        {
+          obstack_blank (obs, lengths[2]);
+          if (fread ((char *) obstack_next_free (obs) - lengths[2], 1,
+                     lengths[2], fp) == lengths[2])
+            result = true;
+          else
+            obstack_blank (obs, -(int) lengths[2]);
+        }
+      free (text);
+    }
+  fclose (fp);
+  return result;
+}
+
+/* An entry of the cache directory, for esyscmd_cache_trim.  */
+typedef struct
+{
+  char *name;                   /* File name.  */
+  time_t mtime;                 /* Time the entry was written.  */
+  off_t size;                   /* Size of the entry.  */
+} esyscmd_cache_entry;
+
+/* Compare two cache entries by age, oldest first.  */
+static int
+esyscmd_cache_cmp (const void *a, const void *b)
+{
+  time_t ta = ((const esyscmd_cache_entry *) a)->mtime;
+  time_t tb = ((const esyscmd_cache_entry *) b)->mtime;
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* Remove the oldest entries of the cache directory DIR until it holds
+   no more than LIMIT bytes, and return the size of what remains.  */
+static size_t
+esyscmd_cache_trim (const char *dir, size_t limit)
+{
+  DIR *dirp = opendir (dir);
+  struct dirent *entry;
+  esyscmd_cache_entry *entries = NULL;
+  size_t count = 0;
+  size_t alloc = 0;
+  size_t total = 0;
+  size_t i;
+
+  if (!dirp)
+    return 0;
+  while ((entry = readdir (dirp)))
+    {
+      size_t len = strlen (entry->d_name);
+      char *name;
+      struct stat st;
+
+      if (len < sizeof ESYSCMD_CACHE_SUFFIX
+          || strcmp (entry->d_name + len - (sizeof ESYSCMD_CACHE_SUFFIX - 1),
+                     ESYSCMD_CACHE_SUFFIX) != 0)
+        continue;
+      name = xasprintf ("%s/%s", dir, entry->d_name);
+      if (stat (name, &st) != 0)
+        {
+          free (name);
+          continue;
+        }
+      if (count == alloc)
+        entries = (esyscmd_cache_entry *) x2nrealloc (entries, &alloc,
+                                                      sizeof *entries);
+      entries[count].name = name;
+      entries[count].mtime = st.st_mtime;
+      entries[count++].size = st.st_size;
+      total += st.st_size;
+    }
+  closedir (dirp);
+
+  if (total > limit)
+    {
+      qsort (entries, count, sizeof *entries, esyscmd_cache_cmp);
+      for (i = 0; i < count && total > limit; i++)
+        if (unlink (entries[i].name) == 0)
+          total -= entries[i].size;
+    }
+  for (i = 0; i < count; i++)
+    free (entries[i].name);
+  free (entries);
+  return total;
+}
+
+/* Store the entry FILE, for CMD of length CMD_LEN and KEY of length
+   KEY_LEN, with output OUTPUT of length OUT_LEN and exit status
+   STATUS, in the cache directory DIR.  Report failures on behalf of
+   CALLER.  */
+static void
+esyscmd_cache_write (m4 *context, const m4_call_info *caller,
+                     const char *dir, const char *file,
+                     const char *cmd, size_t cmd_len,
+                     const char *key, size_t key_len,
+                     const char *output, size_t out_len, int status)
+{
+  size_t limit = m4_get_esyscmd_cache_size_opt (context);
+  size_t *used = (size_t *) m4_get_module_data (context, ESYSCMD_CACHE_KEY);
+  char *tmp;
+  FILE *fp;
+  int fd;
+  off_t size;
+
+  /* An entry larger than the whole cache is not worth keeping.  */
+  if (cmd_len + key_len + out_len > limit)
+    return;
+  tmp = xasprintf ("%s/tmpXXXXXX", dir);
+  fd = mkstemp (tmp);
+  fp = fd < 0 ? NULL : fdopen (fd, "w");
+  if (!fp)
+    {
+      m4_warn (context, errno, caller, _("cannot write esyscmd cache %s"),
+               quotearg_style (locale_quoting_style, dir));
+      if (fd >= 0)
+        {
+          close (fd);
+          unlink (tmp);
+        }
+      free (tmp);
+      return;
+    }
+  fputs (ESYSCMD_CACHE_MAGIC, fp);
+  fprintf (fp, "%d %lu %lu %lu\n", status, (unsigned long int) cmd_len,
+           (unsigned long int) key_len, (unsigned long int) out_len);
+  fwrite (cmd, 1, cmd_len, fp);
+  fwrite (key, 1, key_len, fp);
+  fwrite (output, 1, out_len, fp);
+  size = ftello (fp);
+  if (ferror (fp) | (fclose (fp) != 0) || rename (tmp, file) != 0)
+    {
+      m4_warn (context, errno, caller, _("cannot write esyscmd cache %s"),
+               quotearg_style (locale_quoting_style, dir));
+      unlink (tmp);
+    }
+  else if (!used)
+    {
+      used = (size_t *) xmalloc (sizeof *used);
+      *used = esyscmd_cache_trim (dir, limit);
+      m4_set_module_data (context, ESYSCMD_CACHE_KEY, used, NULL);
+    }
+  else if ((*used += size) > limit)
+    *used = esyscmd_cache_trim (dir, limit);
+  free (tmp);
+}
+
+/**
+ * esyscmd_cached(SHELL-COMMAND, [KEY], [TTL])
+ **/
+M4BUILTIN_HANDLER (esyscmd_cached)
+{
+  const m4_call_info *me = m4_arg_info (argv);
+  const char *cmd = M4ARG (1);
+  size_t cmd_len = M4ARGLEN (1);
+  const char *key = argc > 2 ? M4ARG (2) : "";
+  size_t key_len = argc > 2 ? M4ARGLEN (2) : 0;
+  const char *dir = m4_get_esyscmd_cache_opt (context);
+  int ttl = 0;
+  int status;
+  size_t start;
+  char *file;
+  M4_MODULE_IMPORT (m4, m4_set_sysval);
+  M4_MODULE_IMPORT (m4, m4_get_sysval);
+
+  if (!m4_set_sysval || !m4_get_sysval)
     assert (!"Unable to import from m4 module");
+  if (m4_get_safer_opt (context))
+    {
+      m4_error (context, 0, 0, me, _("disabled by --safer"));
+      return;
+    }
+  if (argc > 3 && !m4_numeric_arg (context, me, M4ARG (3), M4ARGLEN (3),
+                                   &ttl))
+    return;
+  if (!dir || strlen (cmd) != cmd_len || !*cmd)
+    {
+      esyscmd_run (context, obs, me, cmd, cmd_len);
+      return;
+    }
+
+  file = esyscmd_cache_file (dir, cmd, cmd_len, key, key_len);
+  if (esyscmd_cache_read (file, cmd, cmd_len, key, key_len, ttl, obs,
+                          &status))
+    {
+      m4_set_sysval (context, status);
+      free (file);
+      return;
+    }
+
+  start = obstack_object_size (obs);
+  esyscmd_run (context, obs, me, cmd, cmd_len);
+  esyscmd_cache_write (context, me, dir, file, cmd, cmd_len, key, key_len,
+                       (char *) obstack_base (obs) + start,
+                       obstack_object_size (obs) - start,
+                       m4_get_sysval (context));
+  free (file);
 }
 
 
@@ -28,13 +28,33 @@
 #  include "m4private.h"
 #endif
 
+#include "cloexec.h"
 #include "execute.h"
 #include "memchr2.h"
 #include "memcmp2.h"
+#include "pipe.h"
 #include "quotearg.h"
 #include "stdlib--.h"
 #include "tempname.h"
 #include "unistd--.h"
+#include "wait-process.h"
+
+#if HAVE_SPAWN_H && HAVE_POSIX_SPAWN && HAVE_POSIX_SPAWNP
+# include <fcntl.h>
+# include <poll.h>
+# include <signal.h>
+# include <spawn.h>
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include "xvasprintf.h"
+# define M4_USE_SPAWN 1
+# ifndef NSIG
+#  define NSIG 65
+# endif
+extern char **environ;
+#else
+# define M4_USE_SPAWN 0
+#endif
 
 #include <modules/m4.h>
 
@@ -42,18 +62,25 @@
 #define m4_builtin_table        m4_LTX_m4_builtin_table
 
 #define m4_set_sysval           m4_LTX_m4_set_sysval
+#define m4_get_sysval           m4_LTX_m4_get_sysval
 #define m4_sysval_flush         m4_LTX_m4_sysval_flush
 #define m4_dump_symbols         m4_LTX_m4_dump_symbols
 #define m4_expand_ranges        m4_LTX_m4_expand_ranges
 #define m4_make_temp            m4_LTX_m4_make_temp
+#define m4_spawn_command        m4_LTX_m4_spawn_command
+#define m4_shell_coprocess      m4_LTX_m4_shell_coprocess
 
-extern void m4_set_sysval    (int);
+extern void m4_set_sysval    (m4 *, int);
+extern int  m4_get_sysval    (m4 *);
 extern void m4_sysval_flush  (m4 *, bool);
 extern void m4_dump_symbols  (m4 *, m4_dump_symbol_data *, size_t,
                               m4_macro_args *, bool);
 extern const char *m4_expand_ranges (const char *, size_t *, m4_obstack *);
 extern void m4_make_temp     (m4 *, m4_obstack *, const m4_call_info *,
                               const char *, size_t, bool);
+extern pid_t m4_spawn_command (m4 *, const char *, const char *, int *);
+extern bool m4_shell_coprocess (m4 *, const m4_call_info *, const char *,
+                                m4_obstack *);
 
 /* Maintain each of the builtins implemented in this modules along
    with their details in a single table for easy maintenance.
@@ -103,7 +130,7 @@ static void	include		(m4 *context, m4_obstack *obs, size_t argc,
 static int      dumpdef_cmp_CB  (const void *s1, const void *s2);
 static void *   dump_symbol_CB  (m4_symbol_table *, const char *, size_t,
                                  m4_symbol *symbol, void *userdata);
-static const char *ntoa         (number value, int radix);
+static const char *ntoa         (number value, int radix, char *str);
 static void     numb_obstack    (m4_obstack *obs, number value,
                                  int radix, int min);
 
@@ -139,6 +166,14 @@ M4INIT_HANDLER (m4)
               m4_get_module_name (module), err);
 }
 
+static int coprocess_stop (m4 *);
+
+/* Stop the shell started by --shell-coprocess, if any.  */
+M4FINISH_HANDLER (m4)
+{
+  coprocess_stop (context);
+}
+
 
 
 /* The rest of this file is code for builtins and expansion of user
@@ -408,16 +443,86 @@ M4BUILTIN_HANDLER (defn)
 /* This section contains macros to handle the builtins "syscmd"
    and "sysval".  */
 
-/* Exit code from last "syscmd" command.  */
-/* FIXME - we should preserve this value across freezing.  See
-   http://lists.gnu.org/archive/html/bug-m4/2006-06/msg00059.html
-   for ideas on how do to that.  */
-static int  m4_sysval = 0;
+/* The state of these builtins for one context, kept with the data
+   of its modules.  */
+typedef struct {
+  /* Exit code from last "syscmd" command.  */
+  /* FIXME - we should preserve this value across freezing.  See
+     http://lists.gnu.org/archive/html/bug-m4/2006-06/msg00059.html
+     for ideas on how do to that.  */
+  int sysval;
+
+#if M4_USE_SPAWN
+  /* The shell kept running with the shell coprocess option.  It reads
+     commands on its standard input, runs each in a subshell, with
+     standard input taken from a copy of the original standard input
+     of m4 on descriptor 5, and writes the exit status of each on
+     descriptor 3.  The output of commands run for esyscmd goes to
+     descriptor 4.  */
+  pid_t coprocess_pid;          /* Process id, or 0.  */
+  int coprocess_cmd;            /* Commands sent to the shell.  */
+  int coprocess_status;         /* Exit statuses from the shell.  */
+  int coprocess_output;         /* Output of esyscmd commands.  */
+#endif
+} m4_syscmd_state;
+
+/* Key of the state of a context, among the data that modules keep for
+   it.  */
+#define SYSCMD_STATE_KEY "m4 syscmd"
+
+/* Forget the shell coprocess of the parent in the state DATA of a
+   forked child, which starts its own when it needs one.  The parent
+   keeps stopping and waiting for the shell.  */
+static void
+syscmd_state_forked (void *data)
+{
+#if M4_USE_SPAWN
+  m4_syscmd_state *state = (m4_syscmd_state *) data;
+
+  if (!state->coprocess_pid)
+    return;
+  close (state->coprocess_cmd);
+  close (state->coprocess_status);
+  close (state->coprocess_output);
+  state->coprocess_cmd = state->coprocess_status = -1;
+  state->coprocess_output = -1;
+  state->coprocess_pid = 0;
+#endif
+}
+
+/* Return the state of the syscmd builtins of CONTEXT, creating it on
+   first use.  */
+static m4_syscmd_state *
+syscmd_state (m4 *context)
+{
+  m4_syscmd_state *state
+    = (m4_syscmd_state *) m4_get_module_data (context, SYSCMD_STATE_KEY);
+
+  if (!state)
+    {
+      state = (m4_syscmd_state *) xzalloc (sizeof *state);
+#if M4_USE_SPAWN
+      state->coprocess_cmd = -1;
+      state->coprocess_status = -1;
+      state->coprocess_output = -1;
+#endif
+      m4_set_module_data (context, SYSCMD_STATE_KEY, state, free);
+      m4_set_module_fork_func (context, SYSCMD_STATE_KEY,
+                               syscmd_state_forked);
+    }
+  return state;
+}
 
 void
-m4_set_sysval (int value)
+m4_set_sysval (m4 *context, int value)
 {
-  m4_sysval = value;
+  syscmd_state (context)->sysval = value;
+}
+
+int
+m4_get_sysval (m4 *context)
+{
+  return syscmd_state (context)->sysval;
 }
 
 /* Flush a given output STREAM.  If REPORT, also print an error
@@ -471,6 +576,418 @@ m4_sysval_flush (m4 *context, bool report)
     }
 }
 
+#if M4_USE_SPAWN
+/* Characters that need the shell to interpret a command.  */
+static const char shell_metachars[] = "|&;<>()$`\\\"'*?[]#~=%!{}\n";
+
+/* Return the malloc'd name of the executable regular file that the
+   shell would run for the command word NAME, searching PATH unless
+   NAME contains a slash, or NULL if there is none.  Resolving it here
+   rather than relying on posix_spawnp to fail means that a shell
+   builtin is never run as a missing program, whose failure some
+   systems only report as an exit status of 127.  */
+static char *
+find_program (const char *name)
+{
+  const char *path = getenv ("PATH");
+  struct stat st;
+
+  if (strchr (name, '/'))
+    return (stat (name, &st) == 0 && S_ISREG (st.st_mode)
+            && access (name, X_OK) == 0) ? xstrdup (name) : NULL;
+  if (!path)
+    path = "/bin:/usr/bin";
+  while (true)
+    {
+      const char *end = strchr (path, ':');
+      size_t len = end ? (size_t) (end - path) : strlen (path);
+      char *file = (len ? xasprintf ("%.*s/%s", (int) len, path, name)
+                    : xstrdup (name));
+
+      if (stat (file, &st) == 0 && S_ISREG (st.st_mode)
+          && access (file, X_OK) == 0)
+        return file;
+      free (file);
+      if (!end)
+        return NULL;
+      path = end + 1;
+    }
+}
+
+/* Start the shell command CMD on behalf of the builtin CALLER, and
+   return its process id, to be passed to wait_subprocess.  If FD is
+   not NULL, the standard output of the command goes to a pipe, whose
+   read end is stored in *FD.  On failure, return -1 with errno set.
+
+   The command is started with posix_spawn, so that m4 does not pay for
+   copying the page tables of a large heap with fork.  With the syscmd
+   direct option, a command that contains no shell metacharacters is
+   split at blanks and run without the shell, unless its first word is
+   not an executable found in PATH, such as for a shell builtin.  */
+pid_t
+m4_spawn_command (m4 *context, const char *caller M4_GNUC_UNUSED,
+                  const char *cmd, int *fd)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attrs;
+  const char *shell_args[4] = { "sh", "-c" };
+  char *program;
+  int pipe_fd[2];
+  pid_t child;
+  int err = -1;
+
+  if (fd && pipe (pipe_fd) != 0)
+    return -1;
+  posix_spawn_file_actions_init (&actions);
+  posix_spawnattr_init (&attrs);
+# ifdef POSIX_SPAWN_USEVFORK
+  /* Older glibc only avoids fork when asked to.  */
+  posix_spawnattr_setflags (&attrs, POSIX_SPAWN_USEVFORK);
+# endif
+  if (fd)
+    {
+      set_cloexec_flag (pipe_fd[0], true);
+      posix_spawn_file_actions_addclose (&actions, pipe_fd[0]);
+      if (pipe_fd[1] != STDOUT_FILENO)
+        {
+          posix_spawn_file_actions_adddup2 (&actions, pipe_fd[1],
+                                            STDOUT_FILENO);
+          posix_spawn_file_actions_addclose (&actions, pipe_fd[1]);
+        }
+    }
+
+  if (m4_get_syscmd_direct_opt (context) && !strpbrk (cmd, shell_metachars))
+    {
+      char *copy = xstrdup (cmd);
+      char **words = (char **) xnmalloc (strlen (cmd) / 2 + 2,
+                                         sizeof *words);
+      size_t count = 0;
+      char *p = copy;
+
+      while (*p)
+        {
+          if (*p == ' ' || *p == '\t')
+            {
+              *p++ = '\0';
+              continue;
+            }
+          words[count++] = p;
+          while (*p && *p != ' ' && *p != '\t')
+            p++;
+        }
+      words[count] = NULL;
+      program = count ? find_program (words[0]) : NULL;
+      if (program)
+        err = posix_spawn (&child, program, &actions, &attrs, words,
+                           environ);
+      free (program);
+      free (words);
+      free (copy);
+    }
+  if (err == -1)
+    {
+      shell_args[2] = cmd;
+      err = posix_spawn (&child, M4_SYSCMD_SHELL, &actions, &attrs,
+                         (char **) shell_args, environ);
+    }
+
+  posix_spawnattr_destroy (&attrs);
+  posix_spawn_file_actions_destroy (&actions);
+  if (fd)
+    {
+      close (pipe_fd[1]);
+      if (err)
+        close (pipe_fd[0]);
+      else
+        *fd = pipe_fd[0];
+    }
+  if (err)
+    {
+      errno = err;
+      return -1;
+    }
+  register_slave_subprocess (child);
+  return child;
+}
+
+/* Move FD out of the way of the low descriptors that the coprocess
+   uses, and keep it from leaking into other children.  Return the new
+   descriptor, or -1 on failure.  Either way, FD is closed.  */
+static int
+coprocess_fd (int fd)
+{
+  int high = fcntl (fd, F_DUPFD, 10);
+  int saved_errno = errno;
+
+  close (fd);
+  if (high >= 0)
+    set_cloexec_flag (high, true);
+  errno = saved_errno;
+  return high;
+}
+
+/* Start the shell coprocess of CONTEXT, and return true on success.  */
+static bool
+coprocess_start (m4 *context)
+{
+  m4_syscmd_state *state = syscmd_state (context);
+  posix_spawn_file_actions_t actions;
+  const char *shell_args[2] = { "sh" };
+  int cmd[2] = { -1, -1 };
+  int status[2] = { -1, -1 };
+  int output[2] = { -1, -1 };
+  int i;
+  int err = EMFILE;
+
+  /* Commands go through a socket rather than a pipe, so that writing
+     them after the shell died fails without raising SIGPIPE.  */
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, cmd) == 0
+      && pipe (status) == 0 && pipe (output) == 0)
+    for (err = i = 0; i < 2; i++)
+      {
+        cmd[i] = coprocess_fd (cmd[i]);
+        status[i] = coprocess_fd (status[i]);
+        output[i] = coprocess_fd (output[i]);
+        if (cmd[i] < 0 || status[i] < 0 || output[i] < 0)
+          err = errno;
+      }
+#ifdef SO_NOSIGPIPE
+  if (!err)
+    {
+      int on = 1;
+      setsockopt (cmd[1], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+    }
+#endif
+  if (!err)
+    {
+      posix_spawn_file_actions_init (&actions);
+      posix_spawn_file_actions_adddup2 (&actions, STDIN_FILENO, 5);
+      posix_spawn_file_actions_adddup2 (&actions, cmd[0], STDIN_FILENO);
+      posix_spawn_file_actions_adddup2 (&actions, status[1], 3);
+      posix_spawn_file_actions_adddup2 (&actions, output[1], 4);
+      err = posix_spawn (&state->coprocess_pid, M4_SYSCMD_SHELL, &actions,
+                         NULL, (char **) shell_args, environ);
+      posix_spawn_file_actions_destroy (&actions);
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      if (cmd[i] >= 0 && (err || i == 0))
+        close (cmd[i]);
+      if (status[i] >= 0 && (err || i == 1))
+        close (status[i]);
+      if (output[i] >= 0 && (err || i == 1))
+        close (output[i]);
+    }
+  if (err)
+    {
+      state->coprocess_pid = 0;
+      return false;
+    }
+  register_slave_subprocess (state->coprocess_pid);
+  state->coprocess_cmd = cmd[1];
+  state->coprocess_status = status[0];
+  state->coprocess_output = output[0];
+  return true;
+}
+
+/* Stop the shell coprocess of CONTEXT, and return its wait status as
+   for sysval, or 0 if it was not running.  */
+static int
+coprocess_stop (m4 *context)
+{
+  m4_syscmd_state *state = syscmd_state (context);
+  int status;
+  int sig_status;
+
+  if (!state->coprocess_pid)
+    return 0;
+  /* The shell exits at the end of its input.  */
+  close (state->coprocess_cmd);
+  close (state->coprocess_status);
+  close (state->coprocess_output);
+  state->coprocess_cmd = state->coprocess_status = -1;
+  state->coprocess_output = -1;
+  status = wait_subprocess (state->coprocess_pid, M4_SYSCMD_SHELL, true,
+                            true, true, false, &sig_status);
+  state->coprocess_pid = 0;
+  return sig_status ? sig_status << 8 : status;
+}
+
+/* Write the LEN bytes at BUF to the shell coprocess of CONTEXT, and
+   return true on success.  A shell that died must not kill m4 with
+   SIGPIPE, which MSG_NOSIGNAL, or SO_NOSIGPIPE on the socket, prevents
+   without touching the signal dispositions of the process.  */
+static bool
+coprocess_write (m4 *context, const char *buf, size_t len)
+{
+  int fd = syscmd_state (context)->coprocess_cmd;
+  ssize_t n = 0;
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+  while (len && ((n = send (fd, buf, len, MSG_NOSIGNAL)) > 0
+                 || errno == EINTR))
+    if (n > 0)
+      {
+        buf += n;
+        len -= n;
+      }
+  return !len;
+}
+
+/* Run CMD on behalf of CALLER in the shell coprocess, if the shell
+   coprocess option of CONTEXT is set, and set sysval to its exit
+   status.  If OBS is not NULL, collect the output of CMD on it, as for
+   esyscmd; otherwise CMD writes to the standard output of m4.  Return
+   false if the command should be started as usual instead, because
+   the option is not set, the shell could not be started, or the exit
+   status is ambiguous.
+
+   A shell reports a command killed by a signal as 128 plus the signal
+   number, just as a command that exits with that status, so sysval
+   cannot be set as it would be for a command run as its own process.
+   Such a command is run again as usual, after its output through the
+   coprocess is discarded.  The Korn shell reports signals as 256 plus
+   the signal number instead, which is mapped to the signal number
+   times 256.  */
+bool
+m4_shell_coprocess (m4 *context, const m4_call_info *caller, const char *cmd,
+                    m4_obstack *obs)
+{
+  m4_syscmd_state *state = syscmd_state (context);
+  m4_obstack script;
+  struct pollfd fds[2];
+  char status[32];
+  size_t status_len = 0;
+  char buf[BUFSIZ];
+  ssize_t n;
+  const char *p;
+  int value;
+  size_t start = obs ? obstack_object_size (obs) : 0;
+
+  if (!m4_get_shell_coprocess_opt (context))
+    return false;
+  if (!state->coprocess_pid && !coprocess_start (context))
+    return false;
+
+  /* Quote CMD for eval, and redirect the descriptors of the protocol
+     away from it.  */
+  obstack_init (&script);
+  obstack_grow (&script, "(eval '", 7);
+  for (p = cmd; *p; p++)
+    if (*p == '\'')
+      obstack_grow (&script, "'\\''", 4);
+    else
+      obstack_1grow (&script, *p);
+  obstack_grow (&script, "') <&5 5<&-", 11);
+  if (obs)
+    obstack_grow (&script, " >&4", 4);
+  obstack_grow (&script, " 3>&- 4>&-; echo $? >&3\n", 24);
+  n = obstack_object_size (&script);
+  if (!coprocess_write (context, (char *) obstack_finish (&script), n))
+    {
+      obstack_free (&script, NULL);
+      coprocess_stop (context);
+      return false;
+    }
+  obstack_free (&script, NULL);
+
+  /* Collect output until the exit status arrives.  */
+  fds[0].fd = state->coprocess_status;
+  fds[0].events = POLLIN;
+  fds[1].fd = state->coprocess_output;
+  fds[1].events = POLLIN;
+  while (!status_len || status[status_len - 1] != '\n')
+    {
+      if (poll (fds, obs ? 2 : 1, -1) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+      if (obs && fds[1].revents
+          && (n = read (state->coprocess_output, buf, sizeof buf)) > 0)
+        obstack_grow (obs, buf, n);
+      if (fds[0].revents)
+        {
+          n = read (state->coprocess_status, status + status_len,
+                    sizeof status - 1 - status_len);
+          if (n <= 0)
+            break;
+          status_len += n;
+        }
+    }
+
+  if (!status_len || status[status_len - 1] != '\n')
+    {
+      /* The shell died, for example because CMD killed it.  */
+      m4_warn (context, 0, caller, _("shell coprocess exited"));
+      m4_set_sysval (context, coprocess_stop (context));
+      return true;
+    }
+  /* Everything CMD wrote to the pipe is there by now.  */
+  while (obs && poll (&fds[1], 1, 0) > 0
+         && (n = read (state->coprocess_output, buf, sizeof buf)) > 0)
+    obstack_grow (obs, buf, n);
+
+  status[status_len] = '\0';
+  value = atoi (status);
+  if (128 < value && value - 128 < NSIG)
+    {
+      if (obs)
+        obstack_blank (obs, -(int) (obstack_object_size (obs) - start));
+      return false;
+    }
+  if (256 < value && value - 256 < NSIG)
+    value = (value - 256) << 8;
+  m4_set_sysval (context, value);
+  return true;
+}
+#else /* !M4_USE_SPAWN */
+/* Without posix_spawn, there is no shell coprocess, and commands are
+   always started as usual.  */
+bool
+m4_shell_coprocess (m4 *context M4_GNUC_UNUSED,
+                    const m4_call_info *caller M4_GNUC_UNUSED,
+                    const char *cmd M4_GNUC_UNUSED,
+                    m4_obstack *obs M4_GNUC_UNUSED)
+{
+  return false;
+}
+
+static int
+coprocess_stop (m4 *context M4_GNUC_UNUSED)
+{
+  return 0;
+}
+
+/* Start the shell command CMD on behalf of the builtin CALLER, with its
+   standard output going to a pipe whose read end is stored in *FD, and
+   return its process id, or -1 with errno set.  Without posix_spawn,
+   FD must not be NULL.  */
+pid_t
+m4_spawn_command (m4 *context M4_GNUC_UNUSED, const char *caller,
+                  const char *cmd, int *fd)
+{
+  const char *prog_args[4] = { "sh", "-c" };
+
+  assert (fd);
+# if W32_NATIVE
+  if (strstr (M4_SYSCMD_SHELL, "cmd"))
+    {
+      prog_args[0] = "cmd";
+      prog_args[1] = "/c";
+    }
+# endif
+  prog_args[2] = cmd;
+  errno = 0;
+  return create_pipe_in (caller, M4_SYSCMD_SHELL, (char **) prog_args,
+                         NULL, false, true, false, fd);
+}
+#endif /* !M4_USE_SPAWN */
+
 M4BUILTIN_HANDLER (syscmd)
 {
   const m4_call_info *me = m4_arg_info (argv);
@@ -478,7 +995,11 @@ M4BUILTIN_HANDLER (syscmd)
   size_t len = M4ARGLEN (1);
   int status;
   int sig_status;
+#if M4_USE_SPAWN
+  pid_t child;
+#else
   const char *prog_args[4] = { "sh", "-c" };
+#endif
 
   if (m4_get_safer_opt (context))
     {
@@ -492,39 +1013,57 @@ M4BUILTIN_HANDLER (syscmd)
   /* Optimize the empty command.  */
   if (!*cmd)
     {
-      m4_set_sysval (0);
+      m4_set_sysval (context, 0);
       return;
     }
   m4_sysval_flush (context, false);
-#if W32_NATIVE
+  /* The command may create or remove files that include looks for.  */
+  m4_path_cache_flush (context);
+  if (m4_shell_coprocess (context, me, cmd, NULL))
+    return;
+#if M4_USE_SPAWN
+  child = m4_spawn_command (context, m4_info_name (me), cmd, NULL);
+  if (child == -1)
+    {
+      m4_error (context, 0, errno, me, _("cannot run command %s"),
+                quotearg_style (locale_quoting_style, cmd));
+      m4_set_sysval (context, 127);
+      return;
+    }
+  errno = 0;
+  status = wait_subprocess (child, m4_info_name (me), false, false, true,
+                            false, &sig_status);
+#else /* !M4_USE_SPAWN */
+# if W32_NATIVE
   if (strstr (M4_SYSCMD_SHELL, "cmd"))
     {
       prog_args[0] = "cmd";
       prog_args[1] = "/c";
     }
-#endif
+# endif
   prog_args[2] = cmd;
   errno = 0;
   status = execute (m4_info_name (me), M4_SYSCMD_SHELL, (char **) prog_args,
                     false, false, false, false, true, false, &sig_status);
+#endif /* !M4_USE_SPAWN */
   if (sig_status)
     {
       assert (status == 127);
-      m4_sysval = sig_status << 8;
+      m4_set_sysval (context, sig_status << 8);
     }
   else
     {
       if (status == 127 && errno)
         m4_warn (context, errno, me, _("cannot run command %s"),
                  quotearg_style (locale_quoting_style, cmd));
-      m4_sysval = status;
+      m4_set_sysval (context, status);
     }
 }
 
 
 M4BUILTIN_HANDLER (sysval)
 {
-  m4_shipout_int (obs, m4_sysval);
+  m4_shipout_int (obs, m4_get_sysval (context));
 }
 
 
@@ -746,6 +1285,7 @@ m4_make_temp (m4 *context, m4_obstack *obs, const m4_call_info *caller,
     {
       if (!dir)
         close (fd);
+      m4_path_cache_flush (context);
       /* Remove NUL, then finish quote.  */
       obstack_blank (obs, -1);
       obstack_grow (obs, quotes->str2, quotes->len2);
@@ -840,6 +1380,9 @@ M4BUILTIN_HANDLER (m4exit)
   if (exit_code != EXIT_SUCCESS)
     m4_set_exit_failure (exit_code);
 
+  /* Report statistics while the modules are still loaded.  */
+  m4_stats_finish (context);
+
   /* Ensure any module exit callbacks are executed.  */
   m4__module_exit (context);
 
@@ -847,6 +1390,7 @@ M4BUILTIN_HANDLER (m4exit)
      stream and detect any errors.  */
   m4_debug_set_output (context, me, NULL);
   m4_sysval_flush (context, true);
+  m4_profile_finish (context);
 
   /* Check for saved error.  */
   if (exit_code == 0 && m4_get_exit_status (context) != 0)
@@ -1245,19 +1789,22 @@ M4BUILTIN_HANDLER (translit)
   (*(x) = (number) ((unumber) *(x) >> (*(y) & shift_mask)))
 
 
+/* Size of the buffer that ntoa () needs: sized for radix 2, plus sign
+   and trailing NUL.  */
+#define NTOA_BUFSIZE (sizeof (number) * CHAR_BIT + 2)
+
 /* The function ntoa () converts VALUE to a signed ASCII representation in
-   radix RADIX.  Radix must be between 2 and 36, inclusive.  */
+   radix RADIX, at the end of the buffer STR of NTOA_BUFSIZE bytes.
+   Radix must be between 2 and 36, inclusive.  */
 static const char *
-ntoa (number value, int radix)
+ntoa (number value, int radix, char *str)
 {
   /* Digits for number to ASCII conversions.  */
   static char const ntoa_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
 
   bool negative;
   unumber uvalue;
-  /* Sized for radix 2, plus sign and trailing NUL.  */
-  static char str[sizeof value * CHAR_BIT + 2];
-  char *s = &str[sizeof str];
+  char *s = &str[NTOA_BUFSIZE];
 
   *--s = '\0';
 
@@ -1287,6 +1834,7 @@ ntoa (number value, int radix)
 static void
 numb_obstack (m4_obstack *obs, number value, int radix, int min)
 {
+  char buf[NTOA_BUFSIZE];
   const char *s;
   size_t len;
   unumber uvalue;
@@ -1311,7 +1859,7 @@ numb_obstack (m4_obstack *obs, number value, int radix, int min)
       return;
     }
 
-  s = ntoa (value, radix);
+  s = ntoa (value, radix, buf);
 
   if (*s == '-')
     {
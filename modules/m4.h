@@ -22,6 +22,7 @@
 #define MODULES_M4_H 1
 
 #include <m4/m4module.h>
+#include <sys/types.h>
 
 BEGIN_C_DECLS
 
@@ -38,7 +39,8 @@ typedef struct
 /* Types used to cast imported symbols to, so we get type checking
    across the interface boundary.  */
 typedef void m4_sysval_flush_func (m4 *context, bool report);
-typedef void m4_set_sysval_func (int value);
+typedef void m4_set_sysval_func (m4 *context, int value);
+typedef int m4_get_sysval_func (m4 *context);
 typedef void m4_dump_symbols_func (m4 *context, m4_dump_symbol_data *data,
                                    size_t argc, m4_macro_args *argv,
                                    bool complain);
@@ -47,6 +49,10 @@ typedef const char *m4_expand_ranges_func (const char *s, size_t *len,
 typedef void m4_make_temp_func (m4 *context, m4_obstack *obs,
                                 const m4_call_info *macro, const char *name,
                                 size_t len, bool dir);
+typedef pid_t m4_spawn_command_func (m4 *context, const char *caller,
+                                     const char *cmd, int *fd);
+typedef bool m4_shell_coprocess_func (m4 *context, const m4_call_info *caller,
+                                      const char *cmd, m4_obstack *obs);
 
 END_C_DECLS
 
@@ -0,0 +1,239 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* This module implements --batch-map, which runs many independent
+   input files after a single startup.  Each line of the map names an
+   input file and the file that receives its output, separated by a
+   tab, or by a space if the line has no tab.  Every pair is processed
+   by a child forked once the command line has been handled, so that
+   it starts from a copy-on-write image of the state reached so far,
+   such as reloaded frozen files and command line definitions, and
+   cannot disturb the other pairs.  At most JOBS children run at
+   once.  */
+
+#include <config.h>
+
+#include "m4.h"
+
+#include "quotearg.h"
+
+#if HAVE_WORKING_FORK
+
+# include <sys/wait.h>
+
+/* Children still running, by process id.  */
+typedef struct
+{
+  pid_t *pid;                   /* Process ids, or 0 for free slots.  */
+  size_t jobs;                  /* Number of slots.  */
+  size_t running;               /* Number of slots in use.  */
+  int status;                   /* First failing exit status, or 0.  */
+} batch_jobs;
+
+/* Process INPUT in the child, with its output going to OUTPUT, then
+   exit with the resulting status.  This mirrors the end of main.  */
+static void
+batch_child (m4 *context, const char *input, const char *output)
+{
+  m4__module_forked (context);
+  m4__stats_forked (context);
+  if (!freopen (output, "w", stdout))
+    m4_error (context, EXIT_FAILURE, errno, NULL, _("cannot open %s"),
+              quotearg_style (locale_quoting_style, output));
+  if (m4_load_filename (context, NULL, input, NULL, false))
+    m4_macro_expand_input (context);
+  while (m4_pop_wrapup (context))
+    m4_macro_expand_input (context);
+  m4_make_diversion (context, 0);
+  m4_undivert_all (context);
+
+  m4_stats_finish (context);
+  m4__module_exit (context);
+  m4_output_exit (context);
+  m4_input_exit (context);
+  m4_debug_set_output (context, NULL, NULL);
+  exit (m4_get_exit_status (context));
+}
+
+/* Wait for one of the children of JOBS to exit, and record its
+   status.  */
+static void
+batch_wait (m4 *context, batch_jobs *jobs)
+{
+  int wstatus;
+  pid_t pid;
+  size_t i;
+
+  while (true)
+    {
+      pid = waitpid (-1, &wstatus, 0);
+      if (pid < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          m4_error (context, 0, errno, NULL, _("cannot wait for batch job"));
+          jobs->running = 0;
+          if (!jobs->status)
+            jobs->status = EXIT_FAILURE;
+          return;
+        }
+      /* Ignore other children, such as commands of esyscmd_async
+         left running by the leading input files.  */
+      for (i = 0; i < jobs->jobs; i++)
+        if (jobs->pid[i] == pid)
+          break;
+      if (i < jobs->jobs)
+        break;
+    }
+  jobs->pid[i] = 0;
+  jobs->running--;
+  if (jobs->status)
+    return;
+  if (WIFEXITED (wstatus))
+    jobs->status = WEXITSTATUS (wstatus);
+  else
+    jobs->status = EXIT_FAILURE;
+}
+
+/* Start a child of JOBS that processes INPUT into OUTPUT, and return
+   true on success.  */
+static bool
+batch_start (m4 *context, batch_jobs *jobs, const char *input,
+             const char *output)
+{
+  pid_t pid;
+  size_t i;
+
+  if (jobs->running == jobs->jobs)
+    batch_wait (context, jobs);
+  for (i = 0; i < jobs->jobs; i++)
+    if (!jobs->pid[i])
+      break;
+  assert (i < jobs->jobs);
+
+  /* The child must not write again what is buffered so far.  */
+  fflush (NULL);
+  pid = fork ();
+  if (pid < 0)
+    {
+      m4_error (context, 0, errno, NULL, _("cannot start batch job"));
+      return false;
+    }
+  if (pid == 0)
+    batch_child (context, input, output);
+  jobs->pid[i] = pid;
+  jobs->running++;
+  return true;
+}
+
+/* Process each pair of files listed in the file MAP, or standard input
+   if MAP is `-', with up to JOBS children at once.  Return the first
+   failing exit status of a child, or EXIT_SUCCESS.  */
+int
+batch_run (m4 *context, const char *map, size_t jobs)
+{
+  batch_jobs batch;
+  FILE *fp;
+  m4_obstack line;
+  unsigned long int lineno = 0;
+  int ch = 0;
+
+  if (m4__output_has_temp_dir (context))
+    {
+      m4_error (context, 0, 0, NULL,
+                _("diversions too large for batch mode"));
+      return EXIT_FAILURE;
+    }
+  fp = STREQ (map, "-") ? stdin : fopen (map, "r");
+  if (!fp)
+    {
+      m4_error (context, 0, errno, NULL, _("cannot open %s"),
+                quotearg_style (locale_quoting_style, map));
+      return EXIT_FAILURE;
+    }
+
+  batch.jobs = jobs;
+  batch.pid = (pid_t *) xcalloc (jobs, sizeof *batch.pid);
+  batch.running = 0;
+  batch.status = EXIT_SUCCESS;
+  obstack_init (&line);
+  while (ch != EOF)
+    {
+      char *input;
+      char *output;
+
+      while ((ch = getc (fp)) != EOF && ch != '\n')
+        obstack_1grow (&line, ch);
+      obstack_1grow (&line, '\0');
+      input = (char *) obstack_finish (&line);
+      lineno++;
+      if (!*input)
+        {
+          obstack_free (&line, input);
+          continue;
+        }
+      output = strchr (input, '\t');
+      if (!output)
+        output = strchr (input, ' ');
+      if (!output || output == input || !output[1])
+        {
+          m4_error (context, 0, 0, NULL, _("%s:%lu: bad batch map line"),
+                    map, lineno);
+          batch.status = EXIT_FAILURE;
+        }
+      else
+        {
+          *output++ = '\0';
+          if (!batch_start (context, &batch, input, output))
+            {
+              batch.status = EXIT_FAILURE;
+              obstack_free (&line, input);
+              break;
+            }
+        }
+      obstack_free (&line, input);
+    }
+  if (ferror (fp))
+    {
+      m4_error (context, 0, errno, NULL, _("error reading %s"),
+                quotearg_style (locale_quoting_style, map));
+      batch.status = EXIT_FAILURE;
+    }
+  if (fp != stdin)
+    fclose (fp);
+  while (batch.running)
+    batch_wait (context, &batch);
+
+  obstack_free (&line, NULL);
+  free (batch.pid);
+  return batch.status;
+}
+
+#else /* !HAVE_WORKING_FORK */
+
+int
+batch_run (m4 *context, const char *map, size_t jobs M4_GNUC_UNUSED)
+{
+  m4_error (context, 0, 0, NULL,
+            _("batch mode is not supported on this platform: %s"),
+            quotearg_style (locale_quoting_style, map));
+  return EXIT_FAILURE;
+}
+
+#endif /* !HAVE_WORKING_FORK */
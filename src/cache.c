@@ -0,0 +1,449 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* This module implements --state-cache, which saves the frozen state
+   reached after the leading input files of a run, so that a later
+   run with the same leading files can reload it instead.
+
+   An entry is named after the SHA-1 of everything that can affect
+   that state and that is known up front: the version of m4, the
+   command line other than the last input file, a few environment
+   variables, and the contents of the leading files.  It consists of
+   KEY.m4f, a version 3 frozen file, and KEY.sum, which lists the
+   SHA-1 of KEY.m4f and of every file that was read while the leading
+   files were processed, such as included files, and the names that
+   include searches tried and did not find, followed by the output of
+   the leading files.  An entry is only used once all of those files
+   hash the same as when it was written, and none of the missing
+   files has appeared, so that neither changes to the files nor new
+   files that would shadow them or satisfy a failed include can go
+   unnoticed.  */
+
+#include <config.h>
+
+#include "m4.h"
+
+#include "filenamecat.h"
+#include "quotearg.h"
+#include "sha1.h"
+#include "xvasprintf.h"
+
+#define CACHE_MAGIC     "m4 state cache 2\n"
+#define CACHE_HEX_SIZE  (2 * SHA1_DIGEST_SIZE)
+
+/* Marks the names of missing files, in place of their hash.  */
+#define CACHE_MISSING   '-'
+
+struct state_cache
+{
+  m4 *context;                  /* Context whose state is cached.  */
+  char *dir;                    /* Cache directory.  */
+  struct sha1_ctx key;          /* Hash of the key so far.  */
+  char *frozen;                 /* Name of KEY.m4f.  */
+  char *sum;                    /* Name of KEY.sum.  */
+  bool recording;               /* True while the leading files run.  */
+  FILE *output;                 /* Their output, while recording.  */
+  int stdout_fd;                /* Where that output belongs, or -1.  */
+  m4_obstack files;             /* Files read or missed while recording,
+                                   each after a `+' or CACHE_MISSING.  */
+};
+
+static void cache_open_CB       (m4 *, const char *, bool, void *);
+static void cache_record_end    (state_cache *);
+static void cache_replay        (state_cache *);
+static void cache_replay_exit   (void);
+static bool cache_hash_file     (const char *, char *);
+static bool cache_validate      (state_cache *, char *, size_t);
+static void cache_store         (state_cache *);
+
+/* The cache whose output must be replayed if m4 exits early.  */
+static state_cache *recording_cache;
+
+
+/* Write the lowercase hex form of DIGEST to HEX, NUL-terminated.  */
+static void
+cache_hex (const unsigned char *digest, char *hex)
+{
+  int i;
+
+  for (i = 0; i < SHA1_DIGEST_SIZE; i++)
+    sprintf (hex + 2 * i, "%02x", digest[i]);
+}
+
+/* Store the hex SHA-1 of the contents of file NAME in HEX, which has
+   room for CACHE_HEX_SIZE + 1 bytes.  Return false if it cannot be
+   read.  */
+static bool
+cache_hash_file (const char *name, char *hex)
+{
+  unsigned char digest[SHA1_DIGEST_SIZE];
+  FILE *file = fopen (name, "rb");
+  int result;
+
+  if (!file)
+    return false;
+  result = sha1_stream (file, digest);
+  if (fclose (file) != 0 || result != 0)
+    return false;
+  cache_hex (digest, hex);
+  return true;
+}
+
+/* Start a lookup of the state of CONTEXT in directory DIR.  The key is
+   then completed with state_cache_key and state_cache_key_file.  */
+state_cache *
+state_cache_create (m4 *context, const char *dir)
+{
+  state_cache *cache = (state_cache *) xzalloc (sizeof *cache);
+
+  cache->context = context;
+  cache->dir = xstrdup (dir);
+  cache->stdout_fd = -1;
+  sha1_init_ctx (&cache->key);
+  state_cache_key (cache, CACHE_MAGIC, strlen (CACHE_MAGIC));
+  state_cache_key (cache, PACKAGE_STRING, strlen (PACKAGE_STRING) + 1);
+  return cache;
+}
+
+/* Add the LEN bytes of STR to the key of CACHE.  Separate strings
+   should include their NUL, so that they cannot run together.  */
+void
+state_cache_key (state_cache *cache, const char *str, size_t len)
+{
+  sha1_process_bytes (str, len, &cache->key);
+}
+
+/* Add the contents of the input file NAME to the key of CACHE,
+   looking it up like a command line file.  Return false if that is
+   not possible, such as for standard input, in which case the state
+   cannot be cached.  */
+bool
+state_cache_key_file (state_cache *cache, const char *name)
+{
+  m4 *context = cache->context;
+  char hex[CACHE_HEX_SIZE + 1];
+  char *path = NULL;
+  bool result;
+
+  if (STREQ (name, "-"))
+    return false;
+  if (m4_get_posixly_correct_opt (context))
+    {
+      if (access (name, R_OK) == 0)
+        path = xstrdup (name);
+    }
+  else
+    path = m4_path_search (context, name, NULL);
+  result = path && cache_hash_file (path, hex);
+  if (result)
+    state_cache_key (cache, hex, sizeof hex);
+  free (path);
+  return result;
+}
+
+/* Check that the contents SUM of length LEN of a KEY.sum file
+   describe files that have not changed.  On success, strip SUM down
+   to the output it holds, and return true.  */
+static bool
+cache_validate (state_cache *cache, char *sum, size_t len)
+{
+  char *end = sum + len;
+  char *p = sum + strlen (CACHE_MAGIC);
+  char hex[CACHE_HEX_SIZE + 1];
+  char *line;
+  char *eol;
+
+  if (len < strlen (CACHE_MAGIC)
+      || memcmp (sum, CACHE_MAGIC, strlen (CACHE_MAGIC)) != 0)
+    return false;
+
+  /* The first line is the frozen file, then one line per file that
+     was read or missed, up to an empty line.  */
+  for (line = p; line < end && *line != '\n'; line = eol + 1)
+    {
+      const char *name = line + CACHE_HEX_SIZE + 1;
+
+      eol = (char *) memchr (line, '\n', end - line);
+      if (!eol || eol - line <= CACHE_HEX_SIZE
+          || line[CACHE_HEX_SIZE] != ' ')
+        return false;
+      *eol = '\0';
+      if (line == p)
+        name = cache->frozen;
+      else if (*line == CACHE_MISSING)
+        {
+          if (access (name, R_OK) == 0)
+            return false;
+          continue;
+        }
+      if (!cache_hash_file (name, hex)
+          || memcmp (hex, line, CACHE_HEX_SIZE) != 0)
+        return false;
+    }
+  if (line == p || line == end)
+    return false;
+  line++;
+  memmove (sum, line, end - line);
+  return true;
+}
+
+/* Look up the state in CACHE, now that its key is complete.  On a hit,
+   reload the state and print the output of the leading files, and
+   return true.  Otherwise, return false and start recording what the
+   leading files read and output, until state_cache_finish.  */
+bool
+state_cache_reload (state_cache *cache)
+{
+  m4 *context = cache->context;
+  unsigned char digest[SHA1_DIGEST_SIZE];
+  char hex[CACHE_HEX_SIZE + 6];
+  FILE *file;
+  m4_obstack obs;
+  size_t len;
+  char *sum;
+
+  sha1_finish_ctx (&cache->key, digest);
+  cache_hex (digest, hex);
+  strcpy (hex + CACHE_HEX_SIZE, ".m4f");
+  cache->frozen = file_name_concat (cache->dir, hex, NULL);
+  strcpy (hex + CACHE_HEX_SIZE, ".sum");
+  cache->sum = file_name_concat (cache->dir, hex, NULL);
+
+  file = fopen (cache->sum, "rb");
+  if (file)
+    {
+      char buf[BUFSIZ];
+
+      obstack_init (&obs);
+      while ((len = fread (buf, 1, sizeof buf, file)) != 0)
+        obstack_grow (&obs, buf, len);
+      len = obstack_object_size (&obs);
+      obstack_1grow (&obs, '\0');
+      sum = (char *) obstack_finish (&obs);
+      if (!ferror (file) && fclose (file) == 0
+          && cache_validate (cache, sum, len))
+        {
+          m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                            _("reusing state cache %s"),
+                            quotearg_style (locale_quoting_style,
+                                            cache->frozen));
+          reload_frozen_state (context, cache->frozen);
+          fwrite (sum, 1, strlen (sum), stdout);
+          obstack_free (&obs, NULL);
+          return true;
+        }
+      obstack_free (&obs, NULL);
+    }
+
+  /* Point standard output itself at the recording, rather than just
+     diversion 0, so that the output of commands run by syscmd is
+     recorded in order with the rest.  */
+  cache->output = tmpfile ();
+  if (!cache->output)
+    return false;
+  fflush (stdout);
+  cache->stdout_fd = dup (STDOUT_FILENO);
+  if (cache->stdout_fd < 0
+      || set_cloexec_flag (cache->stdout_fd, true) != 0
+      || dup2 (fileno (cache->output), STDOUT_FILENO) < 0)
+    {
+      if (cache->stdout_fd >= 0)
+        close (cache->stdout_fd);
+      fclose (cache->output);
+      cache->output = NULL;
+      return false;
+    }
+  cache->recording = true;
+  obstack_init (&cache->files);
+  m4_set_open_hook (context, cache_open_CB, cache);
+  if (!recording_cache)
+    atexit (cache_replay_exit);
+  recording_cache = cache;
+  return false;
+}
+
+/* Remember the name FILE of a file opened by CONTEXT while the leading
+   files of the cache in USERDATA are processed, or if not FOUND, of a
+   file that was looked for in vain.  */
+static void
+cache_open_CB (m4 *context M4_GNUC_UNUSED, const char *file, bool found,
+               void *userdata)
+{
+  state_cache *cache = (state_cache *) userdata;
+
+  obstack_1grow (&cache->files, found ? '+' : CACHE_MISSING);
+  obstack_grow0 (&cache->files, file, strlen (file));
+}
+
+/* Stop recording for CACHE, and give standard output back.  */
+static void
+cache_record_end (state_cache *cache)
+{
+  if (!cache->recording)
+    return;
+  m4_set_open_hook (cache->context, NULL, NULL);
+  fflush (stdout);
+  dup2 (cache->stdout_fd, STDOUT_FILENO);
+  close (cache->stdout_fd);
+  cache->stdout_fd = -1;
+  recording_cache = NULL;
+  cache->recording = false;
+}
+
+/* Stop recording for CACHE, and pass on the output that the leading
+   files produced so far.  */
+static void
+cache_replay (state_cache *cache)
+{
+  char buf[BUFSIZ];
+  size_t len;
+
+  cache_record_end (cache);
+  rewind (cache->output);
+  while ((len = fread (buf, 1, sizeof buf, cache->output)) != 0)
+    fwrite (buf, 1, len, stdout);
+}
+
+/* If m4 exits while the leading files are still being processed, such
+   as through m4exit, their output must not be lost.  */
+static void
+cache_replay_exit (void)
+{
+  if (recording_cache)
+    cache_replay (recording_cache);
+}
+
+/* Write the entry for CACHE, now that the leading files have been
+   processed.  */
+static void
+cache_store (state_cache *cache)
+{
+  m4 *context = cache->context;
+  char hex[CACHE_HEX_SIZE + 1];
+  char *frozen_tmp = xasprintf ("%s.XXXXXX", cache->frozen);
+  char *sum_tmp = xasprintf ("%s.XXXXXX", cache->sum);
+  char *files = (char *) obstack_base (&cache->files);
+  char *end = files + obstack_object_size (&cache->files);
+  char buf[BUFSIZ];
+  FILE *file = NULL;
+  size_t len;
+  int saved_errno;
+  int fd;
+
+  /* A file that appeared after it was looked for in vain may or may
+     not have affected the state, so that state cannot be trusted.  */
+  for (; files < end; files += strlen (files) + 1)
+    if (*files == CACHE_MISSING && access (files + 1, R_OK) == 0)
+      {
+        free (frozen_tmp);
+        free (sum_tmp);
+        return;
+      }
+  files = (char *) obstack_base (&cache->files);
+
+  if (mkdir (cache->dir, 0777) != 0 && errno != EEXIST)
+    goto fail;
+  fd = mkstemp (frozen_tmp);
+  if (fd < 0)
+    goto fail;
+  close (fd);
+  fd = mkstemp (sum_tmp);
+  if (fd < 0)
+    {
+      unlink (frozen_tmp);
+      goto fail;
+    }
+
+  /* Freeze first, so that the state is not disturbed by the files
+     being hashed.  */
+  produce_frozen_state (context, frozen_tmp, FREEZE_BINARY | FREEZE_KEEP);
+  file = fdopen (fd, "wb");
+  if (file)
+    fd = -1;
+  if (!file || !cache_hash_file (frozen_tmp, hex))
+    goto fail_unlink;
+  fputs (CACHE_MAGIC, file);
+  fprintf (file, "%s frozen\n", hex);
+  for (; files < end; files += strlen (files) + 1)
+    {
+      if (strchr (files, '\n'))
+        goto fail_unlink;
+      if (*files == CACHE_MISSING)
+        memset (hex, CACHE_MISSING, CACHE_HEX_SIZE);
+      else if (!cache_hash_file (files + 1, hex))
+        goto fail_unlink;
+      fprintf (file, "%s %s\n", hex, files + 1);
+    }
+  putc ('\n', file);
+  rewind (cache->output);
+  while ((len = fread (buf, 1, sizeof buf, cache->output)) != 0)
+    fwrite (buf, 1, len, file);
+  if (ferror (cache->output) || fclose (file) != 0)
+    {
+      file = NULL;
+      goto fail_unlink;
+    }
+  file = NULL;
+  if (rename (frozen_tmp, cache->frozen) != 0
+      || rename (sum_tmp, cache->sum) != 0)
+    goto fail_unlink;
+  free (frozen_tmp);
+  free (sum_tmp);
+  return;
+
+ fail_unlink:
+  saved_errno = errno;
+  if (file)
+    fclose (file);
+  else if (fd >= 0)
+    close (fd);
+  unlink (frozen_tmp);
+  unlink (sum_tmp);
+  errno = saved_errno;
+ fail:
+  m4_warn (context, errno, NULL, _("cannot write state cache %s"),
+           quotearg_style (locale_quoting_style, cache->dir));
+  free (frozen_tmp);
+  free (sum_tmp);
+}
+
+/* Finish with CACHE once the leading files have been processed.  If
+   they were processed after a miss, and left nothing behind that a
+   frozen file cannot hold, write the cache entry, then pass on their
+   output.  */
+void
+state_cache_finish (state_cache *cache)
+{
+  if (cache->recording)
+    {
+      bool store = (m4_get_exit_status (cache->context) == EXIT_SUCCESS
+                    && !m4__wrapup_pending (cache->context));
+
+      cache_record_end (cache);
+      if (store)
+        cache_store (cache);
+      cache_replay (cache);
+      fclose (cache->output);
+      obstack_free (&cache->files, NULL);
+    }
+  free (cache->dir);
+  free (cache->frozen);
+  free (cache->sum);
+  free (cache);
+}
@@ -29,17 +29,144 @@
 #include "quotearg.h"
 #include "verify.h"
 #include "xmemdup0.h"
+#include "xvasprintf.h"
+
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
+
+/* Version 3 frozen files start with the same comment and version
+   directive as version 2, so that older versions of m4 can diagnose
+   the mismatch, followed by NUL padding to an 8-byte boundary.  The
+   rest of the file is binary, in the byte order of the machine that
+   wrote it: a header, an array of records that mirror the version 2
+   directives, a hash table of symbol names, a string table, and
+   finally the diversions.  Every string in the table is followed by a
+   NUL, so that once the file is mapped into memory, macro definitions
+   can point directly into the string table rather than being copied.
+
+   The records of each symbol are contiguous, and come after all other
+   records.  The hash table maps each symbol name to its records, so
+   that reloading only has to act on the other records up front, and
+   defines each symbol when it is first looked up.
+
+   A delta file has the same layout, but only describes what changed
+   since the frozen files that were reloaded before it was written:
+   the records of each symbol start with a `P' record that discards
+   whatever those files defined for the name, followed by the records
+   of its current definitions, if any.  Several files can be reloaded
+   in turn, each applying to a name on top of the files before it.  */
+
+#define FROZEN_MAGIC            0x4d344633      /* "M4F3" */
+#define FROZEN_MAGIC_SWAPPED    0x3346344d
+#define FROZEN_ALIGN(N)         (((N) + 7) & ~(uint64_t) 7)
+
+typedef struct
+{
+  uint64_t offset;              /* Offset into the string table.  */
+  uint64_t len;                 /* Length, not counting the NUL.  */
+} frozen_string;
+
+typedef struct
+{
+  uint32_t magic;               /* FROZEN_MAGIC.  */
+  uint32_t count;               /* Number of records.  */
+  uint32_t symbols;             /* Index of the first symbol record.  */
+  uint32_t buckets;             /* Size of the hash table, a power of 2.  */
+  uint64_t strings;             /* Size of the string table.  */
+} frozen_header;
+
+typedef struct
+{
+  uint32_t hash;                /* frozen_hash of the symbol name.  */
+  uint32_t first;               /* Index of the first record.  */
+  uint32_t count;               /* Number of records, or 0 if unused.  */
+} frozen_bucket;
+
+typedef struct
+{
+  uint32_t type;                /* Directive letter, as in version 2.  */
+  int32_t code;                 /* Syntax category of `S'.  */
+  frozen_string str[3];         /* Arguments, with len 0 if absent.  */
+} frozen_record;
+
+typedef struct
+{
+  FILE *file;                   /* File being written.  */
+  bool binary;                  /* True to write version 3.  */
+  bool delta;                   /* True to only write changes.  */
+  uint32_t count;               /* Number of records written.  */
+  uint32_t symbols;             /* Index of the first symbol record.  */
+  m4_obstack records;           /* Version 3 records.  */
+  m4_obstack strings;           /* Version 3 string table.  */
+  m4_obstack index;             /* One frozen_bucket per symbol.  */
+} frozen_writer;
+
+/* A reloaded version 3 frozen file, whose symbols are defined on
+   demand.  */
+typedef struct frozen_lazy frozen_lazy;
+struct frozen_lazy
+{
+  m4 *context;                  /* Context to define symbols in.  */
+  const frozen_header *header;  /* Header of the mapped file.  */
+  const frozen_record *records; /* First record.  */
+  const frozen_bucket *buckets; /* Symbol hash table.  */
+  const char *strings;          /* String table.  */
+  char *done;                   /* Flag per bucket, once defined.  */
+  frozen_lazy *next;            /* File reloaded after this one.  */
+};
 
 static  void  produce_mem_dump          (FILE *, const char *, size_t);
-static  void  produce_resyntax_dump     (m4 *, FILE *);
-static  void  produce_syntax_dump       (FILE *, m4_syntax_table *, char);
-static  void  produce_module_dump       (FILE *, m4_module *);
-static  void  produce_symbol_dump       (m4 *, FILE *, m4_symbol_table *);
+static  void  produce_directive         (frozen_writer *, int, int,
+                                         const char *, size_t,
+                                         const char *, size_t,
+                                         const char *, size_t);
+static  void  produce_resyntax_dump     (m4 *, frozen_writer *);
+static  void  produce_syntax_dump       (frozen_writer *, m4_syntax_table *,
+                                         char);
+static  void  produce_module_dump       (frozen_writer *, m4_module *);
+static  void  produce_symbol_dump       (m4 *, frozen_writer *,
+                                         m4_symbol_table *);
+static  void  produce_removed_dump      (frozen_writer *, m4_symbol_table *);
 static  void *dump_symbol_CB            (m4_symbol_table *, const char *,
                                          size_t, m4_symbol *, void *);
 static  void  issue_expect_message      (m4 *, int);
 static  int   decode_char               (m4 *, FILE *, bool *);
+static  void  reload_binary_state       (m4 *, FILE *);
+static  void  reload_diversions         (m4 *, const char *, const char *);
+static  void  reload_force              (m4 *);
+static  void  reload_lazy               (m4_symbol_table *, const char *,
+                                         size_t, void *);
+
+/* The version 3 files reloaded so far, in order.  Mapped files must
+   not be truncated while symbols still point into them, and a delta
+   needs to know which names they defined.  */
+static frozen_lazy *reloaded_layers;
+
+/* True while reload_lazy is the lazy source of the symbol table.  */
+static bool reloaded_pending;
+
+/* True once a version 1 or 2 file was reloaded, since a delta cannot
+   describe what changed since then.  */
+static bool reloaded_text;
+
+
+/* Return the hash of the LEN bytes of STR used in the symbol index of
+   a version 3 frozen file.  This is 32-bit FNV-1a, which unlike
+   m4_hash_string_hash is fixed by the file format.  */
+static uint32_t
+frozen_hash (const char *str, size_t len)
+{
+  uint32_t hash = 2166136261U;
 
+  while (len--)
+    {
+      hash ^= to_uchar (*str++);
+      hash *= 16777619U;
+    }
+  return hash;
+}
 
 /* Dump an ASCII-encoded representation of LEN bytes at MEM to FILE.
    MEM may contain embedded NUL characters.  */
@@ -51,6 +178,67 @@ produce_mem_dump (FILE *file, const char *mem, size_t len)
   fwrite (quoted, strlen (quoted), 1, file);
 }
 
+/* Append the LEN bytes of STR to the string table of WRITER, and
+   describe where they went in RESULT.  */
+static void
+produce_string (frozen_writer *writer, frozen_string *result,
+                const char *str, size_t len)
+{
+  result->offset = obstack_object_size (&writer->strings);
+  result->len = len;
+  obstack_grow0 (&writer->strings, str, len);
+}
+
+/* Produce the directive TYPE, with the syntax category CODE if it is
+   not 0, and up to three strings.  STR2 and STR3 may be NULL when the
+   directive takes fewer arguments.  */
+static void
+produce_directive (frozen_writer *writer, int type, int code,
+                   const char *str1, size_t len1, const char *str2,
+                   size_t len2, const char *str3, size_t len3)
+{
+  FILE *file = writer->file;
+
+  if (writer->binary)
+    {
+      frozen_record record;
+
+      memset (&record, 0, sizeof record);
+      record.type = type;
+      record.code = code;
+      produce_string (writer, &record.str[0], str1, len1);
+      if (str2)
+        produce_string (writer, &record.str[1], str2, len2);
+      if (str3)
+        produce_string (writer, &record.str[2], str3, len3);
+      obstack_grow (&writer->records, &record, sizeof record);
+      writer->count++;
+      return;
+    }
+
+  if (code)
+    xfprintf (file, "%c%c%zu", type, code, len1);
+  else
+    xfprintf (file, "%c%zu", type, len1);
+  if (str2)
+    xfprintf (file, ",%zu", len2);
+  if (str3)
+    xfprintf (file, ",%zu", len3);
+  fputc ('\n', file);
+  produce_mem_dump (file, str1, len1);
+  fputc ('\n', file);
+  if (str2)
+    {
+      produce_mem_dump (file, str2, len2);
+      fputc ('\n', file);
+    }
+  if (str3)
+    {
+      produce_mem_dump (file, str3, len3);
+      fputc ('\n', file);
+    }
+}
+
 
 /* Produce the 'R14\nPOSIX_EXTENDED\n' frozen file dump of the current
    default regular expression syntax.  Note that it would be a little
@@ -60,12 +248,13 @@ produce_mem_dump (FILE *file, const char *mem, size_t len)
    unencoded representation here.  */
 
 static void
-produce_resyntax_dump (m4 *context, FILE *file)
+produce_resyntax_dump (m4 *context, frozen_writer *writer)
 {
   int code = m4_get_regexp_syntax_opt (context);
 
-  /* Don't dump default syntax code (`0' for GNU_EMACS).  */
-  if (code)
+  /* Don't dump default syntax code (`0' for GNU_EMACS), unless a
+     reloaded file may have changed it.  */
+  if (code || writer->delta)
     {
       const char *resyntax = m4_regexp_syntax_decode (code);
 
@@ -73,42 +262,40 @@ produce_resyntax_dump (m4 *context, FILE *file)
         m4_error (context, EXIT_FAILURE, 0, NULL,
                   _("invalid regexp syntax code `%d'"), code);
 
-      /* No need to use produce_mem_dump, since we know all resyntax
-         names are already ASCII-encoded.  */
-      xfprintf (file, "R%zu\n%s\n", strlen (resyntax), resyntax);
+      produce_directive (writer, 'R', 0, resyntax, strlen (resyntax),
+                         NULL, 0, NULL, 0);
     }
 }
 
 static void
-produce_syntax_dump (FILE *file, m4_syntax_table *syntax, char ch)
+produce_syntax_dump (frozen_writer *writer, m4_syntax_table *syntax, char ch)
 {
   char buf[UCHAR_MAX + 1];
   int code = m4_syntax_code (ch);
   int count = 0;
   int i;
 
+  /* A delta lists every character of the category, since a reloaded
+     file may have moved characters out of their original one.  */
   for (i = 0; i < UCHAR_MAX + 1; ++i)
-    if (m4_has_syntax (syntax, i, code) && code != syntax->orig[i])
+    if (m4_has_syntax (syntax, i, code)
+        && (writer->delta || code != syntax->orig[i]))
       buf[count++] = i;
 
   /* If code falls in M4_SYNTAX_MASKS, then we must treat it
      specially, since it will not be found in syntax->orig.  */
-  if (count == 1
+  if (count == 1 && !writer->delta
       && ((code == M4_SYNTAX_RQUOTE && *buf == *DEF_RQUOTE)
           || (code == M4_SYNTAX_ECOMM && *buf == *DEF_ECOMM)))
     return;
 
   if (count || (code & M4_SYNTAX_MASKS))
-    {
-      xfprintf (file, "S%c%d\n", ch, count);
-      produce_mem_dump (file, buf, count);
-      fputc ('\n', file);
-    }
+    produce_directive (writer, 'S', ch, buf, count, NULL, 0, NULL, 0);
 }
 
 /* Store the debug mode in textual format.  */
 static void
-produce_debugmode_state (FILE *file, int flags)
+produce_debugmode_state (frozen_writer *writer, int flags)
 {
   /* This code tracks the number of bits in M4_DEBUG_TRACE_VERBOSE.  */
   char str[15];
@@ -144,34 +331,50 @@ produce_debugmode_state (FILE *file, int flags)
     str[offset++] = 'o';
   str[offset] = '\0';
   if (offset)
-    xfprintf (file, "d%d\n%s\n", offset, str);
+    produce_directive (writer, 'd', 0, str, offset, NULL, 0, NULL, 0);
+  else if (writer->delta)
+    produce_directive (writer, 'd', 0, "-V", 2, NULL, 0, NULL, 0);
 }
 
 /* The modules must be dumped in the order in which they will be
    reloaded from the frozen file.  libltdl stores handles in a push
    down stack, so we need to dump them in the reverse order to that.  */
 static void
-produce_module_dump (FILE *file, m4_module *module)
+produce_module_dump (frozen_writer *writer, m4_module *module)
 {
   const char *name = m4_get_module_name (module);
-  size_t len = strlen (name);
 
   module = m4__module_next (module);
   if (module)
-    produce_module_dump (file, module);
+    produce_module_dump (writer, module);
 
-  xfprintf (file, "M%zu\n", len);
-  produce_mem_dump (file, name, len);
-  fputc ('\n', file);
+  produce_directive (writer, 'M', 0, name, strlen (name), NULL, 0, NULL, 0);
+}
+
+/* Add NAME of length LEN to the symbol index of WRITER, if records
+   were written for it since the record FIRST.  */
+static void
+produce_bucket (frozen_writer *writer, const char *name, size_t len,
+                uint32_t first)
+{
+  frozen_bucket bucket;
+
+  if (!writer->binary || writer->count == first)
+    return;
+  bucket.hash = frozen_hash (name, len);
+  bucket.first = first;
+  bucket.count = writer->count - first;
+  obstack_grow (&writer->index, &bucket, sizeof bucket);
 }
 
 /* Process all entries in one bucket, from the last to the first.
    This order ensures that, at reload time, pushdef's will be
    executed with the oldest definitions first.  */
 static void
-produce_symbol_dump (m4 *context, FILE *file, m4_symbol_table *symtab)
+produce_symbol_dump (m4 *context, frozen_writer *writer,
+                     m4_symbol_table *symtab)
 {
-  if (m4_symtab_apply (symtab, true, dump_symbol_CB, file))
+  if (m4_symtab_apply (symtab, true, dump_symbol_CB, writer))
     assert (false);
 }
 
@@ -197,15 +400,24 @@ reverse_symbol_value_stack (m4_symbol_value *value)
 
 /* Dump the stack of values for SYMBOL, with name SYMBOL_NAME and
    length LEN, located in SYMTAB.  USERDATA is interpreted as the
-   FILE* to dump to.  */
+   frozen_writer to dump to.  */
 static void *
 dump_symbol_CB (m4_symbol_table *symtab, const char *symbol_name, size_t len,
                 m4_symbol *symbol, void *userdata)
 {
-  FILE *file = (FILE *) userdata;
+  frozen_writer *writer = (frozen_writer *) userdata;
+  uint32_t first = writer->count;
   m4_symbol_value *value;
   m4_symbol_value *last;
 
+  /* A delta only repeats the symbols changed since they were
+     reloaded, after discarding what the reloaded files said.  */
+  if (writer->delta)
+    {
+      if (!symbol->changed)
+        return NULL;
+      produce_directive (writer, 'P', 0, symbol_name, len, NULL, 0, NULL, 0);
+    }
   last = value = reverse_symbol_value_stack (m4_get_symbol_value (symbol));
   while (value)
     {
@@ -214,46 +426,17 @@ dump_symbol_CB (m4_symbol_table *symtab, const char *symbol_name, size_t len,
       size_t module_len = module_name ? strlen (module_name) : 0;
 
       if (m4_is_symbol_value_text (value))
-        {
-          const char *text = m4_get_symbol_value_text (value);
-          size_t text_len = m4_get_symbol_value_len (value);
-          xfprintf (file, "T%zu,%zu", len, text_len);
-          if (module)
-            xfprintf (file, ",%zu", module_len);
-          fputc ('\n', file);
-
-          produce_mem_dump (file, symbol_name, len);
-          fputc ('\n', file);
-          produce_mem_dump (file, text, text_len);
-          fputc ('\n', file);
-          if (module)
-            {
-              produce_mem_dump (file, module_name, module_len);
-              fputc ('\n', file);
-            }
-        }
+        produce_directive (writer, 'T', 0, symbol_name, len,
+                           m4_get_symbol_value_text (value),
+                           m4_get_symbol_value_len (value),
+                           module_name, module_len);
       else if (m4_is_symbol_value_func (value))
         {
           const m4_builtin *bp = m4_get_symbol_value_builtin (value);
-          size_t bp_len;
           if (bp == NULL)
             assert (!"INTERNAL ERROR: builtin not found in builtin table!");
-          bp_len = strlen (bp->name);
-
-          xfprintf (file, "F%zu,%zu", len, bp_len);
-          if (module)
-            xfprintf (file, ",%zu", module_len);
-          fputc ('\n', file);
-
-          produce_mem_dump (file, symbol_name, len);
-          fputc ('\n', file);
-          produce_mem_dump (file, bp->name, bp_len);
-          fputc ('\n', file);
-          if (module)
-            {
-              produce_mem_dump (file, module_name, module_len);
-              fputc ('\n', file);
-            }
+          produce_directive (writer, 'F', 0, symbol_name, len, bp->name,
+                             strlen (bp->name), module_name, module_len);
         }
       else if (m4_is_symbol_value_placeholder (value))
         ; /* Nothing to do for a builtin we couldn't reload earlier.  */
@@ -263,80 +446,279 @@ dump_symbol_CB (m4_symbol_table *symtab, const char *symbol_name, size_t len,
     }
   reverse_symbol_value_stack (last);
   if (m4_get_symbol_traced (symbol))
-    xfprintf (file, "t%zu\n%s\n", len, symbol_name);
+    produce_directive (writer, 't', 0, symbol_name, len, NULL, 0, NULL, 0);
+  produce_bucket (writer, symbol_name, len, first);
   return NULL;
 }
 
-/* Produce a frozen state to the given file NAME. */
+/* Write a `P' record to WRITER for each name that a reloaded file
+   defined, but which is no longer in SYMTAB.  Only names that were
+   looked up can have been removed.  */
+static void
+produce_removed_dump (frozen_writer *writer, m4_symbol_table *symtab)
+{
+  m4_hash *seen = m4_hash_new (0, m4_hash_string_hash, m4_hash_string_cmp);
+  m4_obstack keys;
+  frozen_lazy *lazy;
+  uint32_t slot;
+
+  obstack_init (&keys);
+  for (lazy = reloaded_layers; lazy; lazy = lazy->next)
+    for (slot = 0; slot < lazy->header->buckets; slot++)
+      if (lazy->done[slot])
+        {
+          const frozen_record *record
+            = &lazy->records[lazy->buckets[slot].first];
+          uint32_t first = writer->count;
+          m4_string key;
+
+          key.str = (char *) lazy->strings + record->str[0].offset;
+          key.len = record->str[0].len;
+          if (m4__symtab_peek (symtab, key.str, key.len)
+              || m4_hash_lookup (seen, &key))
+            continue;
+          m4_hash_insert (seen, obstack_copy (&keys, &key, sizeof key),
+                          NULL);
+          produce_directive (writer, 'P', 0, key.str, key.len,
+                             NULL, 0, NULL, 0);
+          produce_bucket (writer, key.str, key.len, first);
+        }
+  m4_hash_delete (seen);
+  obstack_free (&keys, NULL);
+}
+
+/* Write the header, records, symbol index and string table gathered
+   in WRITER, which the diversions will follow.  */
+static void
+produce_binary_tables (frozen_writer *writer)
+{
+  FILE *file = writer->file;
+  frozen_header header;
+  frozen_bucket *symbols = (frozen_bucket *) obstack_base (&writer->index);
+  size_t count = obstack_object_size (&writer->index) / sizeof *symbols;
+  frozen_bucket *buckets = NULL;
+  uint32_t size_buckets = 0;
+  size_t size;
+  size_t i;
+  off_t offset = ftello (file);
+
+  /* Keep the hash table at most half full, so that probe sequences
+     stay short.  */
+  if (count)
+    {
+      size_buckets = 2;
+      while (size_buckets < 2 * count)
+        size_buckets *= 2;
+      buckets = (frozen_bucket *) xcalloc (size_buckets, sizeof *buckets);
+      for (i = 0; i < count; i++)
+        {
+          uint32_t slot = symbols[i].hash & (size_buckets - 1);
+          while (buckets[slot].count)
+            slot = (slot + 1) & (size_buckets - 1);
+          buckets[slot] = symbols[i];
+        }
+    }
+
+  while (offset >= 0 && offset++ % 8)
+    fputc ('\0', file);
+  size = obstack_object_size (&writer->strings);
+  while (size % 8)
+    {
+      obstack_1grow (&writer->strings, '\0');
+      size++;
+    }
+
+  memset (&header, 0, sizeof header);
+  header.magic = FROZEN_MAGIC;
+  header.count = writer->count;
+  header.symbols = writer->symbols;
+  header.buckets = size_buckets;
+  header.strings = size;
+  fwrite (&header, sizeof header, 1, file);
+  fwrite (obstack_base (&writer->records), 1,
+          obstack_object_size (&writer->records), file);
+  if (size_buckets)
+    fwrite (buckets, sizeof *buckets, size_buckets, file);
+  fwrite (obstack_base (&writer->strings), 1, size, file);
+  free (buckets);
+}
+
+/* Produce a frozen state to the given file NAME, in version 3 if
+   FLAGS has FREEZE_BINARY, otherwise in version 2.  With
+   FREEZE_DELTA, the version 3 file only describes what changed since
+   the frozen files that were reloaded, and must be reloaded after
+   them.  Writing the diversions empties them, which is fine at the
+   end of a run; with FREEZE_KEEP, they are read back from the version
+   3 file afterwards, so that the run can go on.  */
 void
-produce_frozen_state (m4 *context, const char *name)
+produce_frozen_state (m4 *context, const char *name, int flags)
 {
-  FILE *file = fopen (name, O_BINARY ? "wb" : "w");
+  bool binary = (flags & FREEZE_BINARY) != 0;
+  bool delta = (flags & FREEZE_DELTA) != 0;
+  frozen_writer writer;
+  FILE *file;
+  struct stat st;
   const char *str;
   const m4_string_pair *pair;
+  off_t diversions;
+  char *tmp = NULL;
+  mode_t mask;
+  int fd;
+
+  if (delta && reloaded_text)
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+cannot freeze a delta against a frozen file of version 1 or 2"));
+
+  /* Any process may have the file mapped from an earlier -R, this one
+     included, and truncating it in place would pull the rug out from
+     under the definitions that still point into it.  So write a new
+     file beside it, and rename it over the old one once complete.
+     Only files that are not regular, such as /dev/null, are written
+     in place.  */
+  if (stat (name, &st) != 0 || S_ISREG (st.st_mode))
+    {
+      tmp = xasprintf ("%s.XXXXXX", name);
+      fd = mkstemp (tmp);
+      file = NULL;
+      if (fd >= 0)
+        {
+          mask = umask (0);
+          umask (mask);
+          fchmod (fd, 0666 & ~mask);
+          SET_BINARY (fd);
+          file = fdopen (fd, O_BINARY ? "wb" : "w");
+          if (!file)
+            {
+              int saved_errno = errno;
 
+              close (fd);
+              unlink (tmp);
+              errno = saved_errno;
+            }
+        }
+    }
+  else
+    file = fopen (name, O_BINARY ? "wb" : "w");
   if (!file)
     {
       m4_error (context, 0, errno, NULL, _("cannot open %s"),
                 quotearg_style (locale_quoting_style, name));
+      free (tmp);
       return;
     }
 
+  memset (&writer, 0, sizeof writer);
+  writer.file = file;
+  writer.binary = binary || delta;
+  writer.delta = delta;
+  if (binary)
+    {
+      obstack_init (&writer.records);
+      obstack_init (&writer.strings);
+      obstack_init (&writer.index);
+      /* Offset 0 is the empty string, for absent arguments.  */
+      obstack_1grow (&writer.strings, '\0');
+    }
+
   /* Write a recognizable header.  */
 
   xfprintf (file, "# This is a frozen state file generated by GNU %s %s\n",
             PACKAGE, VERSION);
-  fputs ("V2\n", file);
+  xfprintf (file, "V%d\n", writer.binary ? 3 : 2);
 
   /* Dump quote delimiters.  */
   pair = m4_get_syntax_quotes (M4SYNTAX);
-  if (strcmp (pair->str1, DEF_LQUOTE) || strcmp (pair->str2, DEF_RQUOTE))
-    {
-      xfprintf (file, "Q%zu,%zu\n", pair->len1, pair->len2);
-      produce_mem_dump (file, pair->str1, pair->len1);
-      fputc ('\n', file);
-      produce_mem_dump (file, pair->str2, pair->len2);
-      fputc ('\n', file);
-    }
+  if (delta || strcmp (pair->str1, DEF_LQUOTE)
+      || strcmp (pair->str2, DEF_RQUOTE))
+    produce_directive (&writer, 'Q', 0, pair->str1, pair->len1,
+                       pair->str2, pair->len2, NULL, 0);
 
   /* Dump comment delimiters.  */
   pair = m4_get_syntax_comments (M4SYNTAX);
-  if (strcmp (pair->str1, DEF_BCOMM) || strcmp (pair->str2, DEF_ECOMM))
-    {
-      xfprintf (file, "C%zu,%zu\n", pair->len1, pair->len2);
-      produce_mem_dump (file, pair->str1, pair->len1);
-      fputc ('\n', file);
-      produce_mem_dump (file, pair->str2, pair->len2);
-      fputc ('\n', file);
-    }
+  if (delta || strcmp (pair->str1, DEF_BCOMM)
+      || strcmp (pair->str2, DEF_ECOMM))
+    produce_directive (&writer, 'C', 0, pair->str1, pair->len1,
+                       pair->str2, pair->len2, NULL, 0);
 
   /* Dump regular expression syntax.  */
-  produce_resyntax_dump (context, file);
+  produce_resyntax_dump (context, &writer);
 
   /* Dump syntax table.  */
   str = "I@WLBOD${}SA(),RE";
   while (*str)
-    produce_syntax_dump (file, M4SYNTAX, *str++);
+    produce_syntax_dump (&writer, M4SYNTAX, *str++);
 
   /* Dump debugmode state.  */
-  produce_debugmode_state (file, m4_get_debug_level_opt (context));
+  produce_debugmode_state (&writer, m4_get_debug_level_opt (context));
 
   /* Dump all loaded modules.  */
-  produce_module_dump (file, m4__module_next (NULL));
+  produce_module_dump (&writer, m4__module_next (NULL));
 
-  /* Dump all symbols.  */
-  produce_symbol_dump (context, file, M4SYMTAB);
+  /* Dump all symbols.  A delta leaves the symbols that were never
+     looked up in the reloaded files, since they cannot have
+     changed.  */
+  writer.symbols = writer.count;
+  if (delta)
+    {
+      if (reloaded_pending)
+        m4_symtab_set_lazy (M4SYMTAB, NULL, NULL);
+      produce_symbol_dump (context, &writer, M4SYMTAB);
+      produce_removed_dump (&writer, M4SYMTAB);
+      if (reloaded_pending)
+        m4_symtab_set_lazy (M4SYMTAB, reload_lazy, reloaded_layers);
+    }
+  else
+    produce_symbol_dump (context, &writer, M4SYMTAB);
+
+  if (writer.binary)
+    {
+      produce_binary_tables (&writer);
+      obstack_free (&writer.records, NULL);
+      obstack_free (&writer.strings, NULL);
+      obstack_free (&writer.index, NULL);
+    }
 
   /* Let diversions be issued from output.c module, its cleaner to have this
      piece of code there.  */
-  m4_freeze_diversions (context, file);
+  diversions = ftello (file);
+  m4_freeze_diversions (context, file, !writer.binary);
 
   /* All done.  */
 
-  fputs ("# End of frozen state file\n", file);
-  if (close_stream (file) != 0)
-    m4_error (context, EXIT_FAILURE, errno, NULL,
-              _("unable to create frozen state"));
+  if (!writer.binary)
+    fputs ("# End of frozen state file\n", file);
+  if (close_stream (file) != 0 || (tmp && rename (tmp, name) != 0))
+    {
+      int saved_errno = errno;
+
+      if (tmp)
+        unlink (tmp);
+      m4_error (context, EXIT_FAILURE, saved_errno, NULL,
+                _("unable to create frozen state"));
+    }
+  free (tmp);
+
+  if (flags & FREEZE_KEEP)
+    {
+      char *buf;
+      size_t len;
+
+      assert (writer.binary);
+      file = fopen (name, "rb");
+      if (!file || fstat (fileno (file), &st) < 0 || diversions < 0
+          || st.st_size < diversions
+          || fseeko (file, diversions, SEEK_SET) != 0)
+        m4_error (context, EXIT_FAILURE, errno, NULL,
+                  _("cannot read frozen state back"));
+      len = st.st_size - diversions;
+      buf = xcharalloc (len);
+      if (fread (buf, 1, len, file) != len)
+        m4_error (context, EXIT_FAILURE, errno, NULL,
+                  _("cannot read frozen state back"));
+      fclose (file);
+      reload_diversions (context, buf, buf + len);
+      free (buf);
+    }
 }
 
 /* Issue a message saying that some character is an EXPECTED character. */
@@ -443,6 +825,460 @@ decode_char (m4 *context, FILE *in, bool *advance_line)
 }
 
 
+/* The following functions act on a directive of a frozen file, once
+   its strings have been decoded.  Each string is followed by a NUL,
+   which is not counted in its length.  */
+
+/* Set the debug flags from the LEN bytes of STR.  */
+static void
+reload_debugmode (m4 *context, const char *str, size_t len)
+{
+  if (m4_debug_decode (context, str, len) < 0)
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("unknown debug mode %s"),
+              quotearg_style_mem (locale_quoting_style, str, len));
+}
+
+/* Return the module named by the LEN bytes of NAME, or NULL if LEN is
+   0.  */
+static m4_module *
+reload_module_find (m4 *context, const char *name, size_t len)
+{
+  if (!len)
+    return NULL;
+  if (strlen (name) < len)
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+ill-formed frozen file, invalid module %s encountered"),
+              quotearg_style_mem (locale_quoting_style, name, len));
+  return m4__module_find (name);
+}
+
+/* Load the module named by the LEN bytes of NAME, but *without*
+   perturbing the symbol table.  Note that any expansion from loading
+   the module which would have been seen when loading it originally is
+   discarded when loading it from a frozen file.  */
+static void
+reload_module (m4 *context, const char *name, size_t len)
+{
+  if (strlen (name) < len)
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+ill-formed frozen file, invalid module %s encountered"),
+              quotearg_style_mem (locale_quoting_style, name, len));
+  m4__module_open (context, name, NULL);
+}
+
+/* Set the regexp syntax named by the LEN bytes of STR.  */
+static void
+reload_resyntax (m4 *context, const char *str, size_t len)
+{
+  m4_set_regexp_syntax_opt (context, m4_regexp_syntax_encode (str));
+  if (m4_get_regexp_syntax_opt (context) < 0 || strlen (str) < len)
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("bad syntax-spec %s"),
+              quotearg_style_mem (locale_quoting_style, str, len));
+}
+
+/* Add the LEN bytes of STR to the syntax category SYNTAX.  */
+static void
+reload_syntax (m4 *context, char syntax, const char *str, size_t len)
+{
+  /* Syntax under M4_SYNTAX_MASKS is handled specially; all other
+     characters are additive.  */
+  if ((m4_set_syntax (M4SYNTAX, syntax,
+                      (m4_syntax_code (syntax) & M4_SYNTAX_MASKS
+                       ? '=' : '+'), str, len) < 0)
+      && (syntax != '\0'))
+    m4_error (context, 0, 0, NULL, _("undefined syntax code %c"), syntax);
+}
+
+/* Enter a macro NAME of length LEN, having as a definition the
+   builtin function named by the BUILTIN_LEN bytes of BUILTIN from
+   MODULE.  */
+static void
+reload_builtin (m4 *context, const char *name, size_t len,
+                const char *builtin, size_t builtin_len, m4_module *module)
+{
+  m4_symbol_value *token;
+
+  /* Builtins cannot contain a NUL byte.  */
+  if (strlen (builtin) < builtin_len)
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+ill-formed frozen file, invalid builtin %s encountered"),
+              quotearg_style_mem (locale_quoting_style, builtin,
+                                  builtin_len));
+  token = m4_builtin_find_by_name (module, builtin);
+
+  if (token == NULL)
+    {
+      token = (m4_symbol_value *) xzalloc (sizeof *token);
+      m4_set_symbol_value_placeholder (token, xstrdup (builtin));
+      VALUE_MODULE (token) = module;
+      VALUE_MIN_ARGS (token) = 0;
+      VALUE_MAX_ARGS (token) = -1;
+    }
+  m4_symbol_pushdef (M4SYMTAB, name, len, token);
+}
+
+/* Enter a macro NAME of length LEN, having the TEXT_LEN bytes of TEXT
+   as a definition, from MODULE.  If BORROWED, TEXT outlives the
+   symbol table and is used in place rather than copied.  */
+static void
+reload_text (m4 *context, const char *name, size_t len, const char *text,
+             size_t text_len, m4_module *module, bool borrowed)
+{
+  m4_symbol_value *token = (m4_symbol_value *) xzalloc (sizeof *token);
+
+  if (borrowed)
+    BIT_SET (VALUE_FLAGS (token), VALUE_BORROWED_TEXT_BIT);
+  else
+    text = xmemdup0 (text, text_len);
+  m4_set_symbol_value_text (token, text, text_len, 0);
+  VALUE_MODULE (token) = module;
+  VALUE_MAX_ARGS (token) = -1;
+
+  m4_symbol_pushdef (M4SYMTAB, name, len, token);
+}
+
+
+/* Return the string described by STR within the string table of the
+   version 3 frozen file with HEADER and STRINGS.  */
+static const char *
+binary_string (m4 *context, const frozen_header *header, const char *strings,
+               const frozen_string *str)
+{
+  if (header->strings <= str->offset
+      || header->strings - str->offset <= str->len
+      || strings[str->offset + str->len] != '\0')
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("ill-formed frozen file, bad string reference"));
+  return strings + str->offset;
+}
+
+/* Parse a decimal number no larger than MAX from *P, which must not
+   pass END, then check that it is followed by DELIM.  Advance *P past
+   DELIM.  */
+static uint64_t
+binary_number (m4 *context, const char **p, const char *end, uint64_t max,
+               char delim)
+{
+  uint64_t n = 0;
+
+  while (*p < end && isdigit (to_uchar (**p)))
+    {
+      if ((max - (**p - '0')) / 10 < n)
+        m4_error (context, EXIT_FAILURE, 0, NULL,
+                  _("integer overflow in frozen file"));
+      n = 10 * n + *(*p)++ - '0';
+    }
+  if (*p == end || **p != delim)
+    issue_expect_message (context, delim);
+  (*p)++;
+  return n;
+}
+
+/* Act on RECORD of the version 3 frozen file with HEADER and
+   STRINGS.  */
+static void
+reload_record (m4 *context, const frozen_header *header, const char *strings,
+               const frozen_record *record)
+{
+  const char *str[3];
+
+  str[0] = binary_string (context, header, strings, &record->str[0]);
+  str[1] = binary_string (context, header, strings, &record->str[1]);
+  str[2] = binary_string (context, header, strings, &record->str[2]);
+  switch (record->type)
+    {
+    default:
+      m4_error (context, EXIT_FAILURE, 0, NULL,
+                _("ill-formed frozen file, unknown directive %c"),
+                (int) record->type);
+
+    case 'C':
+      m4_set_comment (M4SYNTAX, str[0], record->str[0].len, str[1],
+                      record->str[1].len);
+      break;
+
+    case 'd':
+      reload_debugmode (context, str[0], record->str[0].len);
+      break;
+
+    case 'F':
+      reload_builtin (context, str[0], record->str[0].len, str[1],
+                      record->str[1].len,
+                      reload_module_find (context, str[2],
+                                          record->str[2].len));
+      break;
+
+    case 'M':
+      reload_module (context, str[0], record->str[0].len);
+      break;
+
+    case 'P':
+      m4_symbol_delete (M4SYMTAB, str[0], record->str[0].len);
+      m4_set_symbol_name_traced (M4SYMTAB, str[0], record->str[0].len,
+                                 false);
+      break;
+
+    case 'Q':
+      m4_set_quotes (M4SYNTAX, str[0], record->str[0].len, str[1],
+                     record->str[1].len);
+      break;
+
+    case 'R':
+      reload_resyntax (context, str[0], record->str[0].len);
+      break;
+
+    case 'S':
+      reload_syntax (context, record->code, str[0], record->str[0].len);
+      break;
+
+    case 't':
+      m4_set_symbol_name_traced (M4SYMTAB, str[0], record->str[0].len,
+                                 true);
+      break;
+
+    case 'T':
+      reload_text (context, str[0], record->str[0].len, str[1],
+                   record->str[1].len,
+                   reload_module_find (context, str[2], record->str[2].len),
+                   true);
+      break;
+    }
+}
+
+/* Return bucket SLOT of LAZY, once it is known to describe a range of
+   symbol records.  */
+static const frozen_bucket *
+lazy_bucket (frozen_lazy *lazy, uint32_t slot)
+{
+  const frozen_header *header = lazy->header;
+  const frozen_bucket *bucket = &lazy->buckets[slot];
+
+  if (bucket->first < header->symbols || header->count < bucket->count
+      || header->count - bucket->count < bucket->first)
+    m4_error (lazy->context, EXIT_FAILURE, 0, NULL,
+              _("ill-formed frozen file, bad symbol index"));
+  return bucket;
+}
+
+/* Define the symbol described by bucket SLOT of LAZY, on top of what
+   the files reloaded before LAZY defined for it.  The symbol then
+   matches the reloaded files, until it is changed again.  */
+static void
+reload_symbol (frozen_lazy *lazy, uint32_t slot)
+{
+  const frozen_bucket *bucket = lazy_bucket (lazy, slot);
+  const frozen_string *str = &lazy->records[bucket->first].str[0];
+  m4_symbol *symbol;
+  uint32_t i;
+
+  lazy->done[slot] = true;
+  for (i = 0; i < bucket->count; i++)
+    reload_record (lazy->context, lazy->header, lazy->strings,
+                   &lazy->records[bucket->first + i]);
+  symbol = m4__symtab_peek (m4_get_symbol_table (lazy->context),
+                            lazy->strings + str->offset, str->len);
+  if (symbol)
+    symbol->changed = false;
+}
+
+/* Called by the symbol table when NAME of length LEN is missing, to
+   define it from each reloaded file in turn, starting with the one
+   described by USERDATA.  A NULL NAME defines all symbols that
+   remain.  */
+static void
+reload_lazy (m4_symbol_table *symtab M4_GNUC_UNUSED, const char *name,
+             size_t len, void *userdata)
+{
+  frozen_lazy *lazy;
+  uint32_t hash;
+  uint32_t slot;
+
+  /* Since a name is defined from every file at once, defining the
+     remaining names one file at a time keeps each name in order.  */
+  if (!name)
+    {
+      reloaded_pending = false;
+      for (lazy = (frozen_lazy *) userdata; lazy; lazy = lazy->next)
+        for (slot = 0; slot < lazy->header->buckets; slot++)
+          if (lazy->buckets[slot].count && !lazy->done[slot])
+            reload_symbol (lazy, slot);
+      return;
+    }
+
+  hash = frozen_hash (name, len);
+  for (lazy = (frozen_lazy *) userdata; lazy; lazy = lazy->next)
+    {
+      uint32_t mask = lazy->header->buckets - 1;
+
+      if (!lazy->header->buckets)
+        continue;
+      for (slot = hash & mask; lazy->buckets[slot].count;
+           slot = (slot + 1) & mask)
+        {
+          const frozen_bucket *bucket = &lazy->buckets[slot];
+          const frozen_string *str;
+
+          if (bucket->hash != hash)
+            continue;
+          str = &lazy->records[lazy_bucket (lazy, slot)->first].str[0];
+          if (str->len == len
+              && memcmp (binary_string (lazy->context, lazy->header,
+                                        lazy->strings, str), name, len) == 0)
+            {
+              if (!lazy->done[slot])
+                reload_symbol (lazy, slot);
+              break;
+            }
+        }
+    }
+}
+
+/* Define all symbols that the reloaded files still owe, before
+   reloading a file that defines its symbols right away.  */
+static void
+reload_force (m4 *context)
+{
+  if (reloaded_pending)
+    {
+      m4_symtab_set_lazy (M4SYMTAB, NULL, NULL);
+      reload_lazy (M4SYMTAB, NULL, 0, reloaded_layers);
+    }
+}
+
+/* Reload the binary part of a version 3 frozen FILE, which starts at
+   the current position.  The file is mapped into memory when
+   possible, and stays there for the rest of the run, since the
+   definitions of text macros point into its string table.  Symbols
+   are only defined once they are looked up.  */
+static void
+reload_binary_state (m4 *context, FILE *file)
+{
+  off_t start = ftello (file);
+  struct stat st;
+  char *base = NULL;
+  size_t size;
+  const frozen_header *header;
+  const frozen_record *records;
+  const frozen_bucket *buckets;
+  const char *strings;
+  const char *p;
+  const char *end;
+  frozen_lazy *lazy;
+  frozen_lazy **tail;
+  uint32_t i;
+
+  if (start < 0 || fstat (fileno (file), &st) < 0)
+    m4_error (context, EXIT_FAILURE, errno, NULL,
+              _("unable to read frozen state"));
+  size = st.st_size;
+  if (size != st.st_size)
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("frozen file too large"));
+
+  lazy = (frozen_lazy *) xzalloc (sizeof *lazy);
+#if USE_MMAP
+  base = (char *) mmap (NULL, size, PROT_READ, MAP_PRIVATE, fileno (file), 0);
+  if (base == MAP_FAILED)
+    base = NULL;
+#endif
+  if (!base)
+    {
+      /* The copy is never freed, either.  */
+      base = xcharalloc (size);
+      if (fseeko (file, 0, SEEK_SET) != 0
+          || fread (base, 1, size, file) != size)
+        m4_error (context, EXIT_FAILURE, 0, NULL,
+                  _("premature end of frozen file"));
+    }
+
+  start = FROZEN_ALIGN (start);
+  if (size < start + sizeof *header)
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("premature end of frozen file"));
+  header = (const frozen_header *) (base + start);
+  if (header->magic == FROZEN_MAGIC_SWAPPED)
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+frozen file was produced on a machine with a different byte order"));
+  if (header->magic != FROZEN_MAGIC || header->count < header->symbols
+      || (header->buckets & (header->buckets - 1)))
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("ill-formed frozen file, bad binary header"));
+  records = (const frozen_record *) (header + 1);
+  p = (const char *) records;
+  end = base + size;
+  if ((end - p) / sizeof *records < header->count)
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("premature end of frozen file"));
+  buckets = (const frozen_bucket *) (records + header->count);
+  p = (const char *) buckets;
+  if ((end - p) / sizeof *buckets < header->buckets)
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("premature end of frozen file"));
+  strings = (const char *) (buckets + header->buckets);
+  if ((size_t) (end - strings) < header->strings)
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("premature end of frozen file"));
+  /* Act on everything but the symbols now.  Without an index, the
+     symbols must be defined now as well, after those still owed by
+     earlier files.  */
+  if (!header->buckets && header->symbols < header->count)
+    reload_force (context);
+  for (i = 0; i < (header->buckets ? header->symbols : header->count); i++)
+    reload_record (context, header, strings, &records[i]);
+
+  lazy->context = context;
+  lazy->header = header;
+  lazy->records = records;
+  lazy->buckets = buckets;
+  lazy->strings = strings;
+  lazy->done = (char *) xzalloc (header->buckets);
+  for (tail = &reloaded_layers; *tail; tail = &(*tail)->next)
+    ;
+  *tail = lazy;
+  if (header->buckets)
+    {
+      m4_symtab_set_lazy (M4SYMTAB, reload_lazy, reloaded_layers);
+      reloaded_pending = true;
+    }
+
+  reload_diversions (context, strings + header->strings, end);
+}
+
+/* Reload the diversions between P and END of a version 3 frozen file,
+   which are version 2 `D' directives whose contents are not
+   escaped.  */
+static void
+reload_diversions (m4 *context, const char *p, const char *end)
+{
+  while (p < end)
+    {
+      bool negative = false;
+      int divnum;
+      size_t len;
+
+      if (*p++ != 'D')
+        issue_expect_message (context, 'D');
+      if (p < end && *p == '-')
+        {
+          negative = true;
+          p++;
+        }
+      divnum = binary_number (context, &p, end, INT_MAX, ',');
+      if (negative)
+        divnum = -divnum;
+      len = binary_number (context, &p, end, SIZE_MAX, '\n');
+      if ((size_t) (end - p) <= len)
+        m4_error (context, EXIT_FAILURE, 0, NULL,
+                  _("premature end of frozen file"));
+      m4_make_diversion (context, divnum);
+      if (len)
+        m4_output_text (context, p, len);
+      p += len;
+      if (*p++ != '\n')
+        issue_expect_message (context, '\n');
+    }
+}
+
+
 /*  Reload state from the given file NAME.  We are seeking speed,
     here.  */
 
@@ -567,7 +1403,7 @@ reload_frozen_state (m4 *context, const char *name)
   while (character == '\n')
 
   filepath = m4_path_search (context, name, NULL);
-  file = m4_fopen (context, filepath, "r");
+  file = m4_fopen (context, filepath, O_BINARY ? "rb" : "r");
   if (file == NULL)
     m4_error (context, EXIT_FAILURE, errno, NULL, _("cannot open %s"),
               quotearg_style (locale_quoting_style, name));
@@ -580,14 +1416,15 @@ reload_frozen_state (m4 *context, const char *name)
   allocated[2] = 100;
   string[2] = xcharalloc (allocated[2]);
 
-  /* Validate format version.  Accept both `1' (m4 1.3 and 1.4.x) and
-     `2' (m4 2.0).  */
+  /* Validate format version.  Accept `1' (m4 1.3 and 1.4.x), and `2'
+     and `3' (m4 2.0).  */
   GET_DIRECTIVE;
   VALIDATE ('V');
   GET_CHARACTER;
   GET_NUMBER (version, false);
   switch (version)
     {
+    case 3:
     case 2:
       break;
     case 1:
@@ -601,9 +1438,9 @@ reload_frozen_state (m4 *context, const char *name)
       m4_set_syntax (M4SYNTAX, 'O', '+', "{}", 2);
       break;
     default:
-      if (version > 2)
+      if (version > 3)
         m4_error (context, EXIT_MISMATCH, 0, NULL,
-                  _("frozen file version %d greater than max supported of 2"),
+                  _("frozen file version %d greater than max supported of 3"),
                   version);
       else
         m4_error (context, EXIT_FAILURE, 0, NULL,
@@ -611,7 +1448,29 @@ reload_frozen_state (m4 *context, const char *name)
     }
   VALIDATE ('\n');
 
-  GET_DIRECTIVE;
+  /* The diversions of each file replace those of the files reloaded
+     before it.  */
+  if (reloaded_layers || reloaded_text)
+    {
+      m4_make_diversion (context, -1);
+      m4_undivert_all (context);
+      m4_make_diversion (context, 0);
+    }
+
+  if (version == 3)
+    {
+      /* The rest of the file is binary.  */
+      reload_binary_state (context, file);
+      character = EOF;
+    }
+  else
+    {
+      /* Symbols are defined right away, after those still owed by
+         earlier files.  */
+      reload_force (context);
+      reloaded_text = true;
+      GET_DIRECTIVE;
+    }
   while (character != EOF)
     {
       switch (character)
@@ -636,11 +1495,7 @@ ill-formed frozen file, version 2 directive `%c' encountered"), 'd');
           GET_STRING (file, string[0], allocated[0], number[0], false);
           VALIDATE ('\n');
 
-          if (m4_debug_decode (context, string[0], number[0]) < 0)
-            m4_error (context, EXIT_FAILURE, 0, NULL,
-                      _("unknown debug mode %s"),
-                      quotearg_style_mem (locale_quoting_style, string[0],
-                                          number[0]));
+          reload_debugmode (context, string[0], number[0]);
           break;
 
         case 'F':
@@ -694,45 +1549,14 @@ ill-formed frozen file, version 2 directive `%c' encountered"), 'F');
           VALIDATE ('\n');
 
           /* Enter a macro having a builtin function as a definition.  */
-          {
-            m4_module *module = NULL;
-            m4_symbol_value *token;
-
-            // Builtins cannot contain a NUL byte.
-            if (strlen (string[1]) < number[1])
-              m4_error (context, EXIT_FAILURE, 0, NULL, _("\
-ill-formed frozen file, invalid builtin %s encountered"),
-                        quotearg_style_mem (locale_quoting_style, string[1],
-                                            number[1]));
-            if (number[2] > 0)
-              {
-                if (strlen (string[2]) < number[2])
-                  m4_error (context, EXIT_FAILURE, 0, NULL, _("\
-ill-formed frozen file, invalid module %s encountered"),
-                            quotearg_style_mem (locale_quoting_style,
-                                                string[2], number[2]));
-                module = m4__module_find (string[2]);
-              }
-            token = m4_builtin_find_by_name (module, string[1]);
-
-            if (token == NULL)
-              {
-                token = (m4_symbol_value *) xzalloc (sizeof *token);
-                m4_set_symbol_value_placeholder (token, xstrdup (string[1]));
-                VALUE_MODULE (token) = module;
-                VALUE_MIN_ARGS (token) = 0;
-                VALUE_MAX_ARGS (token) = -1;
-              }
-            m4_symbol_pushdef (M4SYMTAB, string[0], number[0], token);
-          }
+          reload_builtin (context, string[0], number[0], string[1],
+                          number[1], reload_module_find (context, string[2],
+                                                         number[2]));
           break;
 
         case 'M':
 
-          /* Load a module, but *without* perturbing the symbol table.
-             Note that any expansion from loading the module which would
-             have been seen when loading it originally is discarded
-             when loading it from a frozen file. */
+          /* Load a module.  */
 
           if (version < 2)
             {
@@ -747,12 +1571,7 @@ ill-formed frozen file, version 2 directive `%c' encountered"), 'M');
           GET_STRING (file, string[0], allocated[0], number[0], false);
           VALIDATE ('\n');
 
-          if (strlen (string[0]) < number[0])
-            m4_error (context, EXIT_FAILURE, 0, NULL, _("\
-ill-formed frozen file, invalid module %s encountered"),
-                      quotearg_style_mem (locale_quoting_style,
-                                          string[0], number[0]));
-          m4__module_open (context, string[0], NULL);
+          reload_module (context, string[0], number[0]);
 
           break;
 
@@ -771,16 +1590,7 @@ ill-formed frozen file, version 2 directive `%c' encountered"), 'R');
           GET_STRING (file, string[0], allocated[0], number[0], false);
           VALIDATE ('\n');
 
-          m4_set_regexp_syntax_opt (context,
-                                    m4_regexp_syntax_encode (string[0]));
-          if (m4_get_regexp_syntax_opt (context) < 0
-              || strlen (string[0]) < number[0])
-            {
-              m4_error (context, EXIT_FAILURE, 0, NULL,
-                        _("bad syntax-spec %s"),
-                        quotearg_style_mem (locale_quoting_style, string[0],
-                                            number[0]));
-            }
+          reload_resyntax (context, string[0], number[0]);
 
           break;
 
@@ -800,16 +1610,7 @@ ill-formed frozen file, version 2 directive `%c' encountered"), 'S');
           VALIDATE ('\n');
           GET_STRING (file, string[0], allocated[0], number[0], false);
 
-          /* Syntax under M4_SYNTAX_MASKS is handled specially; all
-             other characters are additive.  */
-          if ((m4_set_syntax (M4SYNTAX, syntax,
-                              (m4_syntax_code (syntax) & M4_SYNTAX_MASKS
-                               ? '=' : '+'), string[0], number[0]) < 0)
-              && (syntax != '\0'))
-            {
-              m4_error (context, 0, 0, NULL,
-                        _("undefined syntax code %c"), syntax);
-            }
+          reload_syntax (context, syntax, string[0], number[0]);
           break;
 
         case 't':
@@ -954,28 +1755,9 @@ ill-formed frozen file, version 2 directive `%c' encountered"), 'T');
           VALIDATE ('\n');
 
           /* Enter a macro having an expansion text as a definition.  */
-          {
-            m4_symbol_value *token;
-            m4_module *module = NULL;
-
-            token = (m4_symbol_value *) xzalloc (sizeof *token);
-            if (number[2] > 0)
-              {
-                if (strlen (string[2]) < number[2])
-                  m4_error (context, EXIT_FAILURE, 0, NULL, _("\
-ill-formed frozen file, invalid module %s encountered"),
-                            quotearg_style_mem (locale_quoting_style,
-                                                string[2], number[2]));
-                module = m4__module_find (string[2]);
-              }
-
-            m4_set_symbol_value_text (token, xmemdup0 (string[1], number[1]),
-                                      number[1], 0);
-            VALUE_MODULE (token) = module;
-            VALUE_MAX_ARGS (token) = -1;
-
-            m4_symbol_pushdef (M4SYMTAB, string[0], number[0], token);
-          }
+          reload_text (context, string[0], number[0], string[1], number[1],
+                       reload_module_find (context, string[2], number[2]),
+                       false);
           break;
 
         }
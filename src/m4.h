@@ -35,9 +35,34 @@ void stackovf_exit (void);
 #endif
 
 
+/* File: cache.c --- state cache.  */
+
+typedef struct state_cache state_cache;
+
+state_cache *state_cache_create   (m4 *context, const char *);
+void         state_cache_key      (state_cache *, const char *, size_t);
+bool         state_cache_key_file (state_cache *, const char *);
+bool         state_cache_reload   (state_cache *);
+void         state_cache_finish   (state_cache *);
+
+
 /* File: freeze.c --- frozen state files.  */
 
-void produce_frozen_state (m4 *context, const char *);
+/* Flags for produce_frozen_state.  */
+#define FREEZE_BINARY   (1 << 0) /* Write version 3 rather than 2.  */
+#define FREEZE_DELTA    (1 << 1) /* Only write changes since reloading.  */
+#define FREEZE_KEEP     (1 << 2) /* Keep the diversions for later use.  */
+
+void produce_frozen_state (m4 *context, const char *, int);
 void reload_frozen_state  (m4 *context, const char *);
 
+
+
+int batch_run (m4 *context, const char *, size_t);
+
+
+
+int server_run (m4 *context, const char *);
+int client_run (m4 *context, const char *, const char *, size_t);
+
 #endif /* M4_H */
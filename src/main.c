@@ -92,6 +92,12 @@ Operation modes:\n\
 "), stdout);
       fputs (_("\
   -b, --batch                  buffer output, process interrupts\n\
+      --batch-jobs=N           run up to N files of --batch-map at once [1]\n\
+      --batch-map=LIST         after the command line, process each line\n\
+                                 `INPUT OUTPUT' of LIST in its own copy\n\
+                                 of the state reached\n\
+      --client=SOCKET          have the server on SOCKET process the\n\
+                                 FILEs, -D and -U of this command line\n\
   -c, --discard-comments       do not copy comments to the output\n\
   -E, --fatal-warnings         once: warnings become errors, twice: stop\n\
                                  execution at first error\n\
@@ -100,6 +106,13 @@ Operation modes:\n\
   -Q, --quiet, --silent        suppress some warnings for builtins\n\
   -r, --regexp-syntax[=SPEC]   set default regexp syntax to SPEC [GNU_M4]\n\
       --safer                  disable potentially unsafe builtins\n\
+      --server=SOCKET          after the command line, process requests\n\
+                                 of --client on SOCKET, each in its own\n\
+                                 copy of the state reached\n\
+      --shell-coprocess        run syscmd and esyscmd commands in one\n\
+                                 long-lived shell\n\
+      --syscmd-direct          run simple commands of syscmd and esyscmd\n\
+                                 without the shell\n\
   -W, --warnings               enable all warnings\n\
 "), stdout);
       puts ("");
@@ -113,8 +126,13 @@ SPEC is any one of:\n\
 Preprocessor features:\n\
   -B, --prepend-include=DIR    add DIR to include path before `.'\n\
   -D, --define=NAME[=VALUE]    define NAME as having VALUE, or empty\n\
+      --esyscmd-cache=DIR      keep results of esyscmd_cached in DIR\n\
+      --esyscmd-cache-size=SIZE  limit the size of DIR to SIZE bytes [16M]\n\
       --import-environment     import all environment variables as macros\n\
   -I, --include=DIR            add DIR to include path after `.'\n\
+      --include-cache[=SIZE]   keep up to SIZE bytes of included files in\n\
+                                 memory [16M]\n\
+      --include-snapshot       list each include directory only once\n\
 "), stdout);
       fputs (_("\
       --popdef=NAME            popdef NAME\n\
@@ -135,7 +153,12 @@ Limits control:\n\
       fputs (_("\
 Frozen state files:\n\
   -F, --freeze-state=FILE      produce a frozen state on FILE at end\n\
-  -R, --reload-state=FILE      reload a frozen state from FILE at start\n\
+      --freeze-format=FORMAT   write FILE as FORMAT, `text' (default),\n\
+                               `binary' or `delta'\n\
+  -R, --reload-state=FILE      reload a frozen state from FILE at start;\n\
+                               may be given several times\n\
+      --state-cache=DIR        reuse the state after all but the last FILE\n\
+                               from DIR, or save it there\n\
 "), stdout);
       puts ("");
       fputs (_("\
@@ -148,6 +171,15 @@ Debugging:\n\
   -t, --trace=NAME, --traceon=NAME\n\
                                trace NAME when it is defined\n\
       --traceoff=NAME          no longer trace NAME\n\
+      --trace-format=FORMAT    write trace and debug output as FORMAT, one of\n\
+                                 `text' (default) or `binary'\n\
+"), stdout);
+      fputs (_("\
+      --profile=FILE           write per-macro call counts and times to FILE\n\
+      --profile-stacks=FILE    write time per macro call stack to FILE, in\n\
+                                 collapsed format for flame graphs\n\
+      --stats[=FILE]           write counters about the run to FILE at exit\n\
+                                 (default stderr)\n\
 "), stdout);
       puts ("");
       fputs (_("\
@@ -192,14 +224,30 @@ mismatch, or whatever value was passed to the m4exit macro.\n\
 enum
 {
   ARGLENGTH_OPTION = CHAR_MAX + 1,      /* not quite -l, because of message */
+  BATCH_JOBS_OPTION,                    /* no short opt */
+  BATCH_MAP_OPTION,                     /* no short opt */
+  CLIENT_OPTION,                        /* no short opt */
   DEBUGFILE_OPTION,                     /* no short opt */
   ERROR_OUTPUT_OPTION,                  /* not quite -o, because of message */
+  ESYSCMD_CACHE_OPTION,                 /* no short opt */
+  ESYSCMD_CACHE_SIZE_OPTION,            /* no short opt */
+  FREEZE_FORMAT_OPTION,                 /* no short opt */
   HASHSIZE_OPTION,                      /* not quite -H, because of message */
   IMPORT_ENVIRONMENT_OPTION,            /* no short opt */
+  INCLUDE_CACHE_OPTION,                 /* no short opt */
+  INCLUDE_SNAPSHOT_OPTION,              /* no short opt */
   POPDEF_OPTION,                        /* no short opt */
   PREPEND_INCLUDE_OPTION,               /* not quite -B, because of message */
+  PROFILE_OPTION,                       /* no short opt */
+  PROFILE_STACKS_OPTION,                /* no short opt */
   SAFER_OPTION,                         /* -S still has old no-op semantics */
+  SERVER_OPTION,                        /* no short opt */
+  SHELL_COPROCESS_OPTION,               /* no short opt */
+  STATE_CACHE_OPTION,                   /* no short opt */
+  STATS_OPTION,                         /* no short opt */
   SYNCOUTPUT_OPTION,                    /* not quite -s, because of opt arg */
+  SYSCMD_DIRECT_OPTION,                 /* no short opt */
+  TRACE_FORMAT_OPTION,                  /* no short opt */
   TRACEOFF_OPTION,                      /* no short opt */
   WORD_REGEXP_OPTION,                   /* deprecated, used to be -W */
 
@@ -237,14 +285,30 @@ static const struct option long_options[] =
   {"warnings", no_argument, NULL, 'W'},
 
   {"arglength", required_argument, NULL, ARGLENGTH_OPTION},
+  {"batch-jobs", required_argument, NULL, BATCH_JOBS_OPTION},
+  {"batch-map", required_argument, NULL, BATCH_MAP_OPTION},
+  {"client", required_argument, NULL, CLIENT_OPTION},
   {"debugfile", optional_argument, NULL, DEBUGFILE_OPTION},
   {"hashsize", required_argument, NULL, HASHSIZE_OPTION},
   {"error-output", required_argument, NULL, ERROR_OUTPUT_OPTION},
+  {"esyscmd-cache", required_argument, NULL, ESYSCMD_CACHE_OPTION},
+  {"esyscmd-cache-size", required_argument, NULL, ESYSCMD_CACHE_SIZE_OPTION},
+  {"freeze-format", required_argument, NULL, FREEZE_FORMAT_OPTION},
   {"import-environment", no_argument, NULL, IMPORT_ENVIRONMENT_OPTION},
+  {"include-cache", optional_argument, NULL, INCLUDE_CACHE_OPTION},
+  {"include-snapshot", no_argument, NULL, INCLUDE_SNAPSHOT_OPTION},
   {"popdef", required_argument, NULL, POPDEF_OPTION},
   {"prepend-include", required_argument, NULL, PREPEND_INCLUDE_OPTION},
+  {"profile", required_argument, NULL, PROFILE_OPTION},
+  {"profile-stacks", required_argument, NULL, PROFILE_STACKS_OPTION},
   {"safer", no_argument, NULL, SAFER_OPTION},
+  {"server", required_argument, NULL, SERVER_OPTION},
+  {"shell-coprocess", no_argument, NULL, SHELL_COPROCESS_OPTION},
+  {"state-cache", required_argument, NULL, STATE_CACHE_OPTION},
+  {"stats", optional_argument, NULL, STATS_OPTION},
   {"syncoutput", optional_argument, NULL, SYNCOUTPUT_OPTION},
+  {"syscmd-direct", no_argument, NULL, SYSCMD_DIRECT_OPTION},
+  {"trace-format", required_argument, NULL, TRACE_FORMAT_OPTION},
   {"traceoff", required_argument, NULL, TRACEOFF_OPTION},
   {"word-regexp", required_argument, NULL, WORD_REGEXP_OPTION},
 
@@ -302,6 +366,99 @@ process_file (m4 *context, const char *name)
   return new_input;
 }
 
+/* Start looking up the state reached before the command line file
+   LAST_FILE, at index LAST_FILE_INDEX of ARGV, in the state cache DIR.
+   HEAD lists the deferred arguments, which include the earlier files.
+   Return NULL if that state cannot be cached.  */
+static state_cache *
+cache_lookup (m4 *context, const char *dir, int argc, char *const *argv,
+              char *const *envp, bool import_environment, deferred *head,
+              deferred *last_file, int last_file_index)
+{
+  static const char *const variables[] = { "M4PATH", "POSIXLY_CORRECT" };
+  state_cache *cache;
+  deferred *defn;
+  size_t i;
+  int n;
+
+  /* Only worth it if at least one file comes before the last.  */
+  for (defn = head; defn != last_file; defn = defn->next)
+    if (defn->code == '\1')
+      break;
+  if (defn == last_file)
+    return NULL;
+
+  cache = state_cache_create (context, dir);
+  for (n = 1; n < argc; n++)
+    if (n != last_file_index)
+      state_cache_key (cache, argv[n], strlen (argv[n]) + 1);
+  for (i = 0; i < sizeof variables / sizeof *variables; i++)
+    {
+      const char *value = getenv (variables[i]);
+      if (value)
+        state_cache_key (cache, value, strlen (value) + 1);
+      else
+        state_cache_key (cache, "", 0);
+    }
+  if (import_environment)
+    for (; *envp != NULL; envp++)
+      state_cache_key (cache, *envp, strlen (*envp) + 1);
+  for (defn = head; defn != last_file; defn = defn->next)
+    if (defn->code == '\1' && !state_cache_key_file (cache, defn->value))
+      {
+        state_cache_finish (cache);
+        return NULL;
+      }
+  return cache;
+}
+
+/* Send the input files and definitions of the command line to the
+   server on the socket NAME, and return the exit status of the
+   request.  HEAD lists the deferred arguments, and the ARGC elements
+   of ARGV are the remaining file names.  */
+static int
+client_request (m4 *context, const char *name, deferred *head, int argc,
+                char *const *argv)
+{
+  m4_obstack words;
+  bool seen_file = argc > 0;
+  int status;
+
+  obstack_init (&words);
+  for (; head; head = head->next)
+    switch (head->code)
+      {
+      case 'D':
+      case 'U':
+        obstack_1grow (&words, head->code);
+        obstack_grow0 (&words, head->value, strlen (head->value));
+        break;
+
+      case '\1':
+        obstack_1grow (&words, 'F');
+        obstack_grow0 (&words, head->value, strlen (head->value));
+        seen_file = true;
+        break;
+
+      default:
+        m4_error (context, EXIT_FAILURE, 0, NULL,
+                  _("--client only passes files, -D and -U"));
+      }
+  for (; argc; argc--, argv++)
+    {
+      obstack_1grow (&words, 'F');
+      obstack_grow0 (&words, *argv, strlen (*argv));
+    }
+  if (!seen_file)
+    obstack_grow0 (&words, "F-", 2);
+  obstack_1grow (&words, '\0');
+
+  status = client_run (context, name, (char *) obstack_base (&words),
+                       obstack_object_size (&words));
+  obstack_free (&words, NULL);
+  return status;
+}
+
 
 /* Main entry point.  Parse arguments, load modules, then parse input.  */
 int
@@ -315,8 +472,26 @@ main (int argc, char *const *argv, char *const *envp)
   bool import_environment = false; /* true to import environment */
   bool seen_file = false;
   const char *debugfile = NULL;
-  const char *frozen_file_to_read = NULL;
+  const char **frozen_files_to_read = NULL;
+  size_t frozen_files_count = 0;
   const char *frozen_file_to_write = NULL;
+  int freeze_flags = 0;
+  const char *profile_file = NULL;
+  const char *profile_stacks_file = NULL;
+  const char *stats_file = NULL;
+  bool stats = false;
+  const char *state_cache_dir = NULL;
+  const char *batch_map = NULL;
+  size_t batch_jobs = 1;
+  const char *server_socket = NULL;
+  const char *client_socket = NULL;
+  bool client_only = true;      /* true if --client can pass everything */
+  bool later_input = false;     /* true if input comes after startup */
+  int later_status = EXIT_SUCCESS;
+  state_cache *cache = NULL;
+  bool cache_hit = false;
+  deferred *last_file = NULL;
+  int last_file_index = 0;
   enum interactive_choice interactive = INTERACTIVE_UNKNOWN;
 
   m4 *context;
@@ -360,6 +535,9 @@ main (int argc, char *const *argv, char *const *envp)
                                  long_options, &oi);
       if (optchar == -1)
         break;
+      if (optchar != 'D' && optchar != 'U' && optchar != '\1'
+          && optchar != CLIENT_OPTION)
+        client_only = false;
 
       switch (optchar)
         {
@@ -417,6 +595,7 @@ main (int argc, char *const *argv, char *const *envp)
 
         case '\1':
           seen_file = true;
+          last_file_index = optind - 1;
           goto defer;
 
         case 'B':
@@ -473,7 +652,10 @@ main (int argc, char *const *argv, char *const *envp)
           break;
 
         case 'R':
-          frozen_file_to_read = optarg;
+          frozen_files_to_read = xnrealloc (frozen_files_to_read,
+                                            frozen_files_count + 1,
+                                            sizeof *frozen_files_to_read);
+          frozen_files_to_read[frozen_files_count++] = optarg;
           break;
 
         case 'W':
@@ -495,7 +677,7 @@ main (int argc, char *const *argv, char *const *envp)
           /* Staggered handling of 'd', since -dm is useful prior to
              first file and prior to reloading, but other -d must also
              have effect between files.  */
-          if (seen_file || frozen_file_to_read)
+          if (seen_file || frozen_files_count)
             goto defer;
           if (m4_debug_decode (context, optarg, SIZE_MAX) < 0)
             error (0, 0, _("bad debug flags: %s"),
@@ -529,7 +711,7 @@ main (int argc, char *const *argv, char *const *envp)
           /* Staggered handling of '--debugfile', since it is useful
              prior to first file and prior to reloading, but other
              uses must also have effect between files.  */
-          if (seen_file || frozen_file_to_read)
+          if (seen_file || frozen_files_count)
             goto defer;
           debugfile = optarg;
           break;
@@ -547,14 +729,102 @@ main (int argc, char *const *argv, char *const *envp)
           debugfile = optarg;
           break;
 
+        case FREEZE_FORMAT_OPTION:
+          if (STREQ (optarg, "binary"))
+            freeze_flags = FREEZE_BINARY;
+          else if (STREQ (optarg, "delta"))
+            freeze_flags = FREEZE_BINARY | FREEZE_DELTA;
+          else if (STREQ (optarg, "text"))
+            freeze_flags = 0;
+          else
+            m4_error (context, EXIT_FAILURE, 0, NULL,
+                      _("bad freeze format: %s"),
+                      quotearg_style (locale_quoting_style, optarg));
+          break;
+
+        case BATCH_JOBS_OPTION:
+          batch_jobs = size_opt (optarg, oi, optchar);
+          if (!batch_jobs)
+            m4_error (context, EXIT_FAILURE, 0, NULL,
+                      _("bad batch jobs: %s"),
+                      quotearg_style (locale_quoting_style, optarg));
+          break;
+
+        case BATCH_MAP_OPTION:
+          batch_map = optarg;
+          break;
+
+        case CLIENT_OPTION:
+          client_socket = optarg;
+          break;
+
         case IMPORT_ENVIRONMENT_OPTION:
           import_environment = true;
           break;
 
+        case ESYSCMD_CACHE_OPTION:
+          m4_set_esyscmd_cache_opt (context, optarg);
+          break;
+
+        case ESYSCMD_CACHE_SIZE_OPTION:
+          m4_set_esyscmd_cache_size_opt (context,
+                                         size_opt (optarg, oi, optchar));
+          break;
+
+        case INCLUDE_CACHE_OPTION:
+          m4_set_include_cache_opt (context, (optarg
+                                              ? size_opt (optarg, oi, optchar)
+                                              : 16 * 1024 * 1024));
+          break;
+
+        case INCLUDE_SNAPSHOT_OPTION:
+          m4_set_include_snapshot_opt (context, true);
+          break;
+
+        case PROFILE_OPTION:
+          profile_file = optarg;
+          break;
+
+        case PROFILE_STACKS_OPTION:
+          profile_stacks_file = optarg;
+          break;
+
         case SAFER_OPTION:
           m4_set_safer_opt (context, true);
           break;
 
+        case SERVER_OPTION:
+          server_socket = optarg;
+          break;
+
+        case SHELL_COPROCESS_OPTION:
+          m4_set_shell_coprocess_opt (context, true);
+          break;
+
+        case SYSCMD_DIRECT_OPTION:
+          m4_set_syscmd_direct_opt (context, true);
+          break;
+
+        case STATE_CACHE_OPTION:
+          state_cache_dir = optarg;
+          break;
+
+        case STATS_OPTION:
+          stats = true;
+          stats_file = optarg;
+          break;
+
+        case TRACE_FORMAT_OPTION:
+          if (STREQ (optarg, "binary"))
+            m4_set_trace_binary_opt (context, true);
+          else if (STREQ (optarg, "text"))
+            m4_set_trace_binary_opt (context, false);
+          else
+            m4_error (context, EXIT_FAILURE, 0, NULL,
+                      _("bad trace format: %s"),
+                      quotearg_style (locale_quoting_style, optarg));
+          break;
+
         case VERSION_OPTION:
           version_etc (stdout, PACKAGE, PACKAGE_NAME, VERSION, AUTHORS, NULL);
           exit (EXIT_SUCCESS);
@@ -566,15 +836,75 @@ main (int argc, char *const *argv, char *const *envp)
         }
     }
 
+  /* A client only forwards its input files and definitions, and any
+     other option would be silently lost.  */
+  if (client_socket && !client_only)
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("--client only passes files, -D and -U"));
+  if (client_socket)
+    exit (client_request (context, client_socket, head, argc - optind,
+                          argv + optind));
+
+  if (batch_map && server_socket)
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("--batch-map cannot be used with --server"));
+  later_input = batch_map || server_socket;
+  if (later_input && frozen_file_to_write)
+    m4_error (context, EXIT_FAILURE, 0, NULL,
+              _("%s cannot be used with --freeze-state"),
+              batch_map ? "--batch-map" : "--server");
+
   /* Do the basic initializations.  */
   if (debugfile && !m4_debug_set_output (context, NULL, debugfile))
     m4_error (context, 0, errno, NULL, _("cannot set debug file %s"),
               quotearg_style (locale_quoting_style, debugfile));
+  if (profile_file && !m4_profile_set_output (context, profile_file))
+    m4_error (context, EXIT_FAILURE, errno, NULL,
+              _("cannot open profile file %s"),
+              quotearg_style (locale_quoting_style, profile_file));
+  if (profile_stacks_file
+      && !m4_profile_set_stacks_output (context, profile_stacks_file))
+    m4_error (context, EXIT_FAILURE, errno, NULL,
+              _("cannot open profile file %s"),
+              quotearg_style (locale_quoting_style, profile_stacks_file));
+  if (stats && !m4_stats_set_output (context, stats_file))
+    m4_error (context, EXIT_FAILURE, errno, NULL,
+              _("cannot open statistics file %s"),
+              quotearg_style (locale_quoting_style, stats_file));
   m4_input_init (context);
   m4_output_init (context);
 
-  if (frozen_file_to_read)
-    reload_frozen_state (context, frozen_file_to_read);
+  /* The state reached before the last input file can come from the
+     state cache, instead of from the steps below.  */
+  if (state_cache_dir && !later_input)
+    {
+      for (defn = head; defn != NULL; defn = defn->next)
+        if (defn->code == '\1')
+          last_file = defn;
+      if (optind == argc && interactive != INTERACTIVE_YES
+          && !(frozen_file_to_write && (freeze_flags & FREEZE_DELTA)))
+        cache = cache_lookup (context, state_cache_dir, argc, argv, envp,
+                              import_environment, head, last_file,
+                              last_file_index);
+      if (cache)
+        {
+          m4__stats_load_begin (context);
+          cache_hit = state_cache_reload (cache);
+          m4__stats_load_end (context);
+        }
+    }
+
+  if (cache_hit)
+    free (frozen_files_to_read);
+  else if (frozen_files_count)
+    {
+      size_t i;
+      m4__stats_load_begin (context);
+      for (i = 0; i < frozen_files_count; i++)
+        reload_frozen_state (context, frozen_files_to_read[i]);
+      m4__stats_load_end (context);
+      free (frozen_files_to_read);
+    }
   else
     {
       m4_module_load (context, "m4", NULL);
@@ -610,6 +940,16 @@ main (int argc, char *const *argv, char *const *envp)
       deferred *next;
       const char *arg = defn->value;
 
+      if (defn == last_file && cache)
+        {
+          state_cache_finish (cache);
+          cache = NULL;
+          cache_hit = false;
+        }
+      if (cache_hit && defn->code != DEBUGFILE_OPTION
+          && defn->code != SYNCOUTPUT_OPTION)
+        goto skip;
+
       switch (defn->code)
         {
         case 'D':
@@ -693,6 +1033,7 @@ main (int argc, char *const *argv, char *const *envp)
           abort ();
         }
 
+    skip:
       next = defn->next;
       free (defn);
       defn = next;
@@ -706,6 +1047,7 @@ main (int argc, char *const *argv, char *const *envp)
   m4_set_interactive_opt (context, (interactive == INTERACTIVE_YES
 				    || (interactive == INTERACTIVE_UNKNOWN
 					&& optind == argc && !seen_file
+					&& !later_input
 					&& isatty (STDIN_FILENO)
 					&& isatty (STDERR_FILENO))));
   if (m4_get_interactive_opt (context))
@@ -718,25 +1060,34 @@ main (int argc, char *const *argv, char *const *envp)
 
 
   /* Handle remaining input files.  Each file is pushed on the input,
-     and the input read.  */
+     and the input read.  In batch or server mode, they only lead the
+     input that comes later.  */
 
-  if (optind == argc && !seen_file)
+  if (optind == argc && !seen_file && !later_input)
     process_file (context, "-");
   else
     for (; optind < argc; optind++)
       process_file (context, argv[optind]);
 
-  /* Now handle wrapup text.
+  /* Now handle wrapup text.  In batch or server mode, wrapup text and
+     diversions belong to the output of each later input.
      FIXME - when -F is in effect, should wrapped text be frozen?  */
-  while (m4_pop_wrapup (context))
-    m4_macro_expand_input (context);
-
-  if (frozen_file_to_write)
-    produce_frozen_state (context, frozen_file_to_write);
+  if (batch_map)
+    later_status = batch_run (context, batch_map, batch_jobs);
+  else if (server_socket)
+    later_status = server_run (context, server_socket);
   else
     {
-      m4_make_diversion (context, 0);
-      m4_undivert_all (context);
+      while (m4_pop_wrapup (context))
+        m4_macro_expand_input (context);
+
+      if (frozen_file_to_write)
+        produce_frozen_state (context, frozen_file_to_write, freeze_flags);
+      else
+        {
+          m4_make_diversion (context, 0);
+          m4_undivert_all (context);
+        }
     }
 
   /* The remaining cleanup functions systematically free all of the
@@ -745,9 +1096,11 @@ main (int argc, char *const *argv, char *const *envp)
      Strictly, we don't need to do this, but it makes leak detection
      a whole lot easier!  */
 
+  m4_profile_finish (context);
+  m4_stats_finish (context);
   m4__module_exit (context);
-  m4_output_exit ();
-  m4_input_exit ();
+  m4_output_exit (context);
+  m4_input_exit (context);
 
   /* Change debug stream back to stderr, to force flushing the debug
      stream and detect any errors it might have encountered.  The
@@ -755,9 +1108,10 @@ main (int argc, char *const *argv, char *const *envp)
   m4_debug_set_output (context, NULL, NULL);
 
   exit_status = m4_get_exit_status (context);
+  if (exit_status == EXIT_SUCCESS)
+    exit_status = later_status;
   m4_delete (context);
 
-  m4_hash_exit ();
   quotearg_free ();
 
 #ifdef USE_STACKOVF
@@ -0,0 +1,386 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* This module implements --server and --client.  A server handles
+   its command line as usual, including frozen files and leading input
+   files, then listens on a Unix socket.  For each connection, it forks
+   a child that starts from a copy-on-write image of that state, and
+   processes a request from a client:
+
+   The client first sends a single byte, along with its standard
+   input, output and error, and its working directory, as four
+   descriptors.  It then sends a list of NUL-terminated words, ended
+   by an empty word: `DNAME=VALUE' defines NAME, `UNAME' undefines it,
+   and `FFILE' processes FILE, or standard input if FILE is `-', in the
+   order given.  The child runs in the directory of the client, with
+   its descriptors, so that file names, output and error messages work
+   as if the client had run m4 itself.  Once done, including wrapup
+   text and diversions, the exit status is sent back as a single
+   byte.  */
+
+#include <config.h>
+
+#include "m4.h"
+
+#include "quotearg.h"
+
+#if HAVE_WORKING_FORK && HAVE_SYS_UN_H
+# include <fcntl.h>
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/un.h>
+# include <sys/wait.h>
+# define M4_USE_SERVER 1
+#else
+# define M4_USE_SERVER 0
+#endif
+
+#if M4_USE_SERVER
+
+/* Number of descriptors passed by a client.  */
+#define SERVER_FDS 4
+
+/* Fill ADDR with the address of the socket NAME, and return false if
+   NAME is too long.  */
+static bool
+server_address (struct sockaddr_un *addr, const char *name)
+{
+  memset (addr, 0, sizeof *addr);
+  addr->sun_family = AF_UNIX;
+  if (strlen (name) >= sizeof addr->sun_path)
+    return false;
+  strcpy (addr->sun_path, name);
+  return true;
+}
+
+/* Write the LEN bytes at BUF to FD, and return true on success.  */
+static bool
+server_write (int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len)
+    {
+      n = write (fd, buf, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      buf += n;
+      len -= n;
+    }
+  return true;
+}
+
+/* Receive the descriptors of a client on SOCK, and install them as
+   the standard descriptors and the working directory of this
+   process.  Return true on success.  */
+static bool
+server_receive_fds (int sock)
+{
+  char byte;
+  struct iovec iov;
+  struct msghdr msg;
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (SERVER_FDS * sizeof (int))];
+  } control;
+  struct cmsghdr *cmsg;
+  int fds[SERVER_FDS];
+  int i;
+
+  memset (&msg, 0, sizeof msg);
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  if (recvmsg (sock, &msg, 0) != 1)
+    return false;
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+      || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN (sizeof fds))
+    return false;
+  memcpy (fds, CMSG_DATA (cmsg), sizeof fds);
+
+  for (i = 0; i < SERVER_FDS - 1; i++)
+    if (dup2 (fds[i], i) < 0)
+      return false;
+  if (fchdir (fds[SERVER_FDS - 1]) < 0)
+    return false;
+  for (i = 0; i < SERVER_FDS; i++)
+    if (fds[i] > STDERR_FILENO)
+      close (fds[i]);
+  return true;
+}
+
+/* Read the words of a request on SOCK into OBS, and return them as a
+   list ended by an empty word, or NULL on error.  */
+static char *
+server_read_request (int sock, m4_obstack *obs)
+{
+  char buf[BUFSIZ];
+  ssize_t n;
+  size_t len;
+
+  while (true)
+    {
+      n = read (sock, buf, sizeof buf);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return NULL;
+      obstack_grow (obs, buf, n);
+      len = obstack_object_size (obs);
+      /* A request ends with an empty word, so two NULs in a row, or
+         a single NUL when there are no other words.  */
+      if (((char *) obstack_base (obs))[len - 1] == '\0'
+          && (len == 1 || ((char *) obstack_base (obs))[len - 2] == '\0'))
+        return (char *) obstack_finish (obs);
+    }
+}
+
+/* Process the request of the client connected on SOCK, then exit
+   with the resulting status, which the parent passes on to the client.
+   This mirrors the end of main.  */
+static void
+server_child (m4 *context, int sock)
+{
+  m4_obstack obs;
+  char *word;
+
+  m4__module_forked (context);
+  m4__stats_forked (context);
+  obstack_init (&obs);
+  if (!server_receive_fds (sock))
+    exit (EXIT_FAILURE);
+  word = server_read_request (sock, &obs);
+  if (!word)
+    exit (EXIT_FAILURE);
+
+  for (; *word; word += strlen (word) + 1)
+    switch (*word++)
+      {
+      case 'D':
+        {
+          m4_symbol_value *value = m4_symbol_value_create ();
+          const char *str = strchr (word, '=');
+          size_t len = str ? str - word : strlen (word);
+
+          m4_set_symbol_value_text (value, xstrdup (str ? str + 1 : ""),
+                                    str ? strlen (str + 1) : 0, 0);
+          m4_symbol_define (M4SYMTAB, word, len, value);
+        }
+        break;
+
+      case 'U':
+        m4_symbol_delete (M4SYMTAB, word, strlen (word));
+        break;
+
+      case 'F':
+        if (STREQ (word, "-"))
+          m4_push_file (context, stdin, _("stdin"), false);
+        else if (!m4_load_filename (context, NULL, word, NULL, false))
+          break;
+        m4_macro_expand_input (context);
+        break;
+
+      default:
+        m4_error (context, EXIT_FAILURE, 0, NULL, _("bad server request"));
+      }
+  while (m4_pop_wrapup (context))
+    m4_macro_expand_input (context);
+  m4_make_diversion (context, 0);
+  m4_undivert_all (context);
+  obstack_free (&obs, NULL);
+
+  m4_stats_finish (context);
+  m4__module_exit (context);
+  m4_output_exit (context);
+  m4_input_exit (context);
+  m4_debug_set_output (context, NULL, NULL);
+  exit (m4_get_exit_status (context));
+}
+
+/* Serve requests on the Unix socket NAME until killed.  Return
+   EXIT_FAILURE if the socket cannot be set up.  */
+int
+server_run (m4 *context, const char *name)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  int sock;
+
+  if (m4__output_has_temp_dir (context))
+    {
+      m4_error (context, 0, 0, NULL,
+                _("diversions too large for server mode"));
+      return EXIT_FAILURE;
+    }
+  if (!server_address (&addr, name))
+    {
+      m4_error (context, 0, 0, NULL, _("socket name too long: %s"),
+                quotearg_style (locale_quoting_style, name));
+      return EXIT_FAILURE;
+    }
+  /* Replace the socket of an earlier server, but nothing else.  */
+  if (lstat (name, &st) == 0 && S_ISSOCK (st.st_mode))
+    unlink (name);
+  sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0
+      || bind (sock, (struct sockaddr *) &addr, sizeof addr) < 0
+      || listen (sock, SOMAXCONN) < 0)
+    {
+      m4_error (context, 0, errno, NULL, _("cannot listen on %s"),
+                quotearg_style (locale_quoting_style, name));
+      return EXIT_FAILURE;
+    }
+
+  /* Each connection gets a child, which forks the worker that serves
+     it and reports its exit status, even if the worker exits early,
+     such as through m4exit or a fatal error.  The server only has to
+     reap the children.  */
+  fflush (NULL);
+  while (true)
+    {
+      int conn = accept (sock, NULL, NULL);
+      pid_t pid;
+
+      while (waitpid (-1, NULL, WNOHANG) > 0)
+        continue;
+      if (conn < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          m4_error (context, 0, errno, NULL, _("cannot accept on %s"),
+                    quotearg_style (locale_quoting_style, name));
+          return EXIT_FAILURE;
+        }
+      pid = fork ();
+      if (pid < 0)
+        m4_error (context, 0, errno, NULL, _("cannot start server job"));
+      else if (pid == 0)
+        {
+          int status;
+          char byte;
+
+          close (sock);
+          pid = fork ();
+          if (pid == 0)
+            server_child (context, conn);
+          if (pid < 0 || waitpid (pid, &status, 0) != pid)
+            _exit (EXIT_FAILURE);
+          byte = WIFEXITED (status) ? WEXITSTATUS (status) : EXIT_FAILURE;
+          _exit (server_write (conn, &byte, 1) ? EXIT_SUCCESS
+                 : EXIT_FAILURE);
+        }
+      close (conn);
+    }
+}
+
+/* Send WORDS, a list of NUL-terminated words of length LEN ended by
+   an empty word, to the server listening on the Unix socket NAME,
+   along with the standard descriptors and working directory of this
+   process, and return the exit status sent back.  */
+int
+client_run (m4 *context, const char *name, const char *words, size_t len)
+{
+  struct sockaddr_un addr;
+  int fds[SERVER_FDS];
+  char byte = 0;
+  struct iovec iov;
+  struct msghdr msg;
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (SERVER_FDS * sizeof (int))];
+  } control;
+  struct cmsghdr *cmsg;
+  int sock;
+  ssize_t n;
+
+  if (!server_address (&addr, name))
+    m4_error (context, EXIT_FAILURE, 0, NULL, _("socket name too long: %s"),
+              quotearg_style (locale_quoting_style, name));
+  fds[0] = STDIN_FILENO;
+  fds[1] = STDOUT_FILENO;
+  fds[2] = STDERR_FILENO;
+  fds[3] = open (".", O_RDONLY);
+  if (fds[3] < 0)
+    m4_error (context, EXIT_FAILURE, errno, NULL,
+              _("cannot open current directory"));
+  sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0 || connect (sock, (struct sockaddr *) &addr, sizeof addr) < 0)
+    m4_error (context, EXIT_FAILURE, errno, NULL, _("cannot connect to %s"),
+              quotearg_style (locale_quoting_style, name));
+
+  memset (&msg, 0, sizeof msg);
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof fds);
+  memcpy (CMSG_DATA (cmsg), fds, sizeof fds);
+  if (sendmsg (sock, &msg, 0) != 1 || !server_write (sock, words, len))
+    m4_error (context, EXIT_FAILURE, errno, NULL, _("cannot send to %s"),
+              quotearg_style (locale_quoting_style, name));
+  close (fds[3]);
+
+  while ((n = read (sock, &byte, 1)) < 0 && errno == EINTR)
+    continue;
+  close (sock);
+  if (n != 1)
+    {
+      m4_error (context, 0, 0, NULL, _("no status from %s"),
+                quotearg_style (locale_quoting_style, name));
+      return EXIT_FAILURE;
+    }
+  return (unsigned char) byte;
+}
+
+#else /* !M4_USE_SERVER */
+
+int
+server_run (m4 *context, const char *name)
+{
+  m4_error (context, 0, 0, NULL,
+            _("server mode is not supported on this platform: %s"),
+            quotearg_style (locale_quoting_style, name));
+  return EXIT_FAILURE;
+}
+
+int
+client_run (m4 *context, const char *name,
+            const char *words M4_GNUC_UNUSED, size_t len M4_GNUC_UNUSED)
+{
+  m4_error (context, 0, 0, NULL,
+            _("server mode is not supported on this platform: %s"),
+            quotearg_style (locale_quoting_style, name));
+  return EXIT_FAILURE;
+}
+
+#endif /* !M4_USE_SERVER */
@@ -0,0 +1,400 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Render the binary trace output of m4 --trace-format=binary as the
+   text that m4 would have written to the debug file without it.  */
+
+#include <config.h>
+
+#include <locale.h>
+
+#include "m4.h"
+
+#include "closein.h"
+#include "getopt.h"
+#include "propername.h"
+#include "quotearg.h"
+#include "version-etc.h"
+
+#define AUTHORS proper_name ("Eric Blake")
+
+/* A string from a string record.  */
+typedef struct
+{
+  char *str;
+  size_t len;
+} string;
+
+/* A traced call whose result has not been seen yet.  */
+typedef struct
+{
+  uint64_t call_id;             /* Id of the call.  */
+  m4_obstack line;              /* Trace line collected so far.  */
+  size_t limit;                 /* The --debuglen limit of the call.  */
+  bool args;                    /* True if an argument list is open.  */
+  bool first;                   /* True before the first argument.  */
+  bool done;                    /* True once an argument was truncated.  */
+} pending;
+
+/* State of the decoder for one input stream.  */
+typedef struct
+{
+  const char *name;             /* Name of the input, for messages.  */
+  string *strings;              /* Strings, indexed by id.  */
+  size_t strings_len;           /* Number of strings.  */
+  size_t strings_max;           /* Allocated size of strings.  */
+  string quotes[2];             /* Quote delimiters in effect.  */
+  pending *calls;               /* Stack of traced calls.  */
+  size_t calls_len;             /* Number of pending calls.  */
+  size_t calls_max;             /* Allocated size of calls.  */
+} decoder;
+
+static void usage (int);
+static const string *lookup (decoder *, uint32_t);
+static void header (decoder *, m4_obstack *, const m4_trace_record *);
+static void decode_record (decoder *, const m4_trace_record *, char *);
+static bool decode_file (const char *);
+
+/* Print a usage message and exit with STATUS.  */
+static void
+usage (int status)
+{
+  if (status != EXIT_SUCCESS)
+    {
+      fprintf (stderr, _("Try `%s --help' for more information."),
+               m4_get_program_name ());
+      fputs ("\n", stderr);
+    }
+  else
+    {
+      printf (_("Usage: %s [OPTION]... [FILE]...\n"),
+              m4_get_program_name ());
+      fputs (_("\
+Render binary trace output of `m4 --trace-format=binary' as text.\n\
+With no FILE, or when FILE is -, read standard input.\n\
+"), stdout);
+      puts ("");
+      fputs (_("\
+      --help                   display this help and exit\n\
+      --version                output version information and exit\n\
+"), stdout);
+      emit_bug_reporting_address ();
+    }
+  exit (status);
+}
+
+/* Return the string with ID in DECODER.  */
+static const string *
+lookup (decoder *decoder, uint32_t id)
+{
+  if (decoder->strings_len <= id)
+    error (EXIT_FAILURE, 0, _("%s: undefined string %lu"),
+           quotearg_style (locale_quoting_style, decoder->name),
+           (unsigned long int) id);
+  return &decoder->strings[id];
+}
+
+/* Append to OBS the header of the trace line for RECORD.  */
+static void
+header (decoder *decoder, m4_obstack *obs, const m4_trace_record *record)
+{
+  const string *name = lookup (decoder, record->name);
+
+  obstack_grow (obs, "m4trace:", 8);
+  if (record->flags & M4_DEBUG_TRACE_FILE)
+    {
+      const string *file = lookup (decoder, record->file);
+      obstack_grow (obs, file->str, file->len);
+      obstack_1grow (obs, ':');
+    }
+  if (record->flags & M4_DEBUG_TRACE_LINE)
+    obstack_printf (obs, "%d:", (int) record->line);
+  obstack_printf (obs, " -%lu- ", (unsigned long int) record->depth);
+  if (record->flags & M4_DEBUG_TRACE_CALLID)
+    obstack_printf (obs, "id %llu: ", (unsigned long long int) record->call_id);
+  obstack_grow (obs, name->str, name->len);
+}
+
+/* Act on RECORD, which is followed by TEXT.  */
+static void
+decode_record (decoder *decoder, const m4_trace_record *record, char *text)
+{
+  m4_obstack obs;
+  pending *call;
+  size_t i;
+
+  switch (record->type)
+    {
+    case M4_TRACE_STRING:
+      if (record->name != decoder->strings_len)
+        error (EXIT_FAILURE, 0, _("%s: string %lu out of sequence"),
+               quotearg_style (locale_quoting_style, decoder->name),
+               (unsigned long int) record->name);
+      if (decoder->strings_len == decoder->strings_max)
+        decoder->strings = (string *) x2nrealloc (decoder->strings,
+                                                  &decoder->strings_max,
+                                                  sizeof *decoder->strings);
+      decoder->strings[decoder->strings_len].str = text;
+      decoder->strings[decoder->strings_len++].len = record->size;
+      return;
+
+    case M4_TRACE_QUOTES:
+      free (decoder->quotes[0].str);
+      decoder->quotes[0].str = text;
+      decoder->quotes[0].len = record->index;
+      decoder->quotes[1].str = text + record->index;
+      decoder->quotes[1].len = record->size - record->index;
+      return;
+
+    case M4_TRACE_PREPARE:
+      obstack_init (&obs);
+      header (decoder, &obs, record);
+      obstack_grow (&obs, " ... = ", 7);
+      obstack_grow (&obs, text, record->size);
+      fwrite (obstack_base (&obs), 1, obstack_object_size (&obs), stdout);
+      putchar ('\n');
+      obstack_free (&obs, NULL);
+      break;
+
+    case M4_TRACE_CALL:
+      if (decoder->calls_len == decoder->calls_max)
+        decoder->calls = (pending *) x2nrealloc (decoder->calls,
+                                                 &decoder->calls_max,
+                                                 sizeof *decoder->calls);
+      call = &decoder->calls[decoder->calls_len++];
+      call->call_id = record->call_id;
+      call->limit = record->length;
+      call->args = record->index && (record->flags & M4_DEBUG_TRACE_ARGS);
+      call->first = true;
+      call->done = false;
+      obstack_init (&call->line);
+      header (decoder, &call->line, record);
+      if (call->args)
+        obstack_1grow (&call->line, '(');
+      break;
+
+    case M4_TRACE_ARG:
+    case M4_TRACE_FUNC:
+      if (!decoder->calls_len)
+        error (EXIT_FAILURE, 0, _("%s: argument outside of a call"),
+               quotearg_style (locale_quoting_style, decoder->name));
+      call = &decoder->calls[decoder->calls_len - 1];
+      if (call->done)
+        break;
+      if (!call->first)
+        obstack_grow (&call->line, ", ", 2);
+      call->first = false;
+      if (record->type == M4_TRACE_FUNC)
+        obstack_grow (&call->line, text, record->size);
+      else
+        {
+          /* Mirror m4_shipout_string_trunc, which adds an ellipsis
+             when the limit is reached, even on an exact fit.  */
+          bool quote = (record->flags & M4_DEBUG_TRACE_QUOTE) != 0;
+          if (quote)
+            obstack_grow (&call->line, decoder->quotes[0].str,
+                          decoder->quotes[0].len);
+          obstack_grow (&call->line, text, record->size);
+          if (call->limit <= record->length)
+            {
+              obstack_grow (&call->line, "...", 3);
+              call->done = true;
+            }
+          if (quote)
+            obstack_grow (&call->line, decoder->quotes[1].str,
+                          decoder->quotes[1].len);
+        }
+      break;
+
+    case M4_TRACE_RESULT:
+      for (i = decoder->calls_len; i--; )
+        if (decoder->calls[i].call_id == record->call_id)
+          break;
+      if (i == (size_t) -1)
+        error (EXIT_FAILURE, 0, _("%s: result of unknown call %llu"),
+               quotearg_style (locale_quoting_style, decoder->name),
+               (unsigned long long int) record->call_id);
+      call = &decoder->calls[i];
+      if (call->args)
+        obstack_1grow (&call->line, ')');
+      if (record->flags & M4_DEBUG_TRACE_EXPANSION)
+        {
+          obstack_grow (&call->line, " -> ", 4);
+          obstack_grow (&call->line, text, record->size);
+        }
+      fwrite (obstack_base (&call->line), 1,
+              obstack_object_size (&call->line), stdout);
+      putchar ('\n');
+      obstack_free (&call->line, NULL);
+      memmove (call, call + 1,
+               (--decoder->calls_len - i) * sizeof *decoder->calls);
+      break;
+
+    case M4_TRACE_MESSAGE:
+      fputs ("m4debug:", stdout);
+      if (record->line)
+        {
+          if (record->flags & M4_DEBUG_TRACE_FILE)
+            {
+              const string *file = lookup (decoder, record->file);
+              fwrite (file->str, 1, file->len, stdout);
+              putchar (':');
+            }
+          if (record->flags & M4_DEBUG_TRACE_LINE)
+            printf ("%d:", (int) record->line);
+        }
+      putchar (' ');
+      fwrite (text, 1, record->size, stdout);
+      putchar ('\n');
+      break;
+
+    default:
+      error (EXIT_FAILURE, 0, _("%s: unknown record type %lu"),
+             quotearg_style (locale_quoting_style, decoder->name),
+             (unsigned long int) record->type);
+    }
+  free (text);
+}
+
+/* Decode the binary trace in file NAME, or standard input if NAME is
+   "-".  Return false if the file could not be read.  */
+static bool
+decode_file (const char *name)
+{
+  FILE *fp = stdin;
+  decoder decoder;
+  m4_trace_record record;
+  bool result = true;
+  bool seen_header = false;
+  size_t i;
+
+  if (!STREQ (name, "-"))
+    {
+      fp = fopen (name, "rb");
+      if (fp == NULL)
+        {
+          error (0, errno, "%s", quotearg_style (locale_quoting_style, name));
+          return false;
+        }
+    }
+  memset (&decoder, 0, sizeof decoder);
+  decoder.name = name;
+
+  while (fread (&record, sizeof record, 1, fp) == 1)
+    {
+      char *text = (char *) xmalloc (record.size + 1);
+
+      if (record.size && fread (text, 1, record.size, fp) != record.size)
+        {
+          free (text);
+          break;
+        }
+      text[record.size] = '\0';
+      if (record.type == M4_TRACE_HEADER)
+        {
+          free (text);
+          if (record.index != M4_TRACE_VERSION
+              || record.length != sizeof record)
+            error (EXIT_FAILURE, 0, _("%s: unsupported trace version %lu"),
+                   quotearg_style (locale_quoting_style, name),
+                   (unsigned long int) record.index);
+          /* The debug file changed, so strings start over.  */
+          for (i = 0; i < decoder.strings_len; i++)
+            free (decoder.strings[i].str);
+          decoder.strings_len = 0;
+          seen_header = true;
+          continue;
+        }
+      if (!seen_header)
+        error (EXIT_FAILURE, 0, _("%s: not a binary m4 trace"),
+               quotearg_style (locale_quoting_style, name));
+      decode_record (&decoder, &record, text);
+    }
+  if (ferror (fp))
+    {
+      error (0, errno, _("%s: read error"),
+             quotearg_style (locale_quoting_style, name));
+      result = false;
+    }
+  else if (!feof (fp) || fgetc (fp) != EOF)
+    {
+      error (0, 0, _("%s: truncated trace"),
+             quotearg_style (locale_quoting_style, name));
+      result = false;
+    }
+
+  for (i = 0; i < decoder.strings_len; i++)
+    free (decoder.strings[i].str);
+  free (decoder.strings);
+  free (decoder.quotes[0].str);
+  for (i = 0; i < decoder.calls_len; i++)
+    obstack_free (&decoder.calls[i].line, NULL);
+  free (decoder.calls);
+  if (fp != stdin)
+    fclose (fp);
+  return result;
+}
+
+int
+main (int argc, char *const *argv)
+{
+  static const struct option long_options[] =
+    {
+      {"help", no_argument, NULL, 'h'},
+      {"version", no_argument, NULL, 'V'},
+      {NULL, 0, NULL, 0},
+    };
+  int exit_status = EXIT_SUCCESS;
+  int optchar;
+
+  m4_set_program_name (argv[0]);
+  atexit (close_stdin);
+  setlocale (LC_ALL, "");
+#ifdef ENABLE_NLS
+  textdomain (PACKAGE);
+#endif
+
+  while ((optchar = getopt_long (argc, argv, "", long_options, NULL)) != -1)
+    switch (optchar)
+      {
+      case 'h':
+        usage (EXIT_SUCCESS);
+        break;
+
+      case 'V':
+        version_etc (stdout, "m4-trace-decode", PACKAGE_NAME, VERSION,
+                     AUTHORS, NULL);
+        exit (EXIT_SUCCESS);
+
+      default:
+        usage (EXIT_FAILURE);
+      }
+
+  if (optind == argc)
+    {
+      if (!decode_file ("-"))
+        exit_status = EXIT_FAILURE;
+    }
+  else
+    for (; optind < argc; optind++)
+      if (!decode_file (argv[optind]))
+        exit_status = EXIT_FAILURE;
+
+  return exit_status;
+}